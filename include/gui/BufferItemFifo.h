@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_BUFFERITEMFIFO_H
+#define ANDROID_GUI_BUFFERITEMFIFO_H
+
+#include <stddef.h>
+
+#include <gui/BufferItem.h>
+
+namespace android {
+
+// BufferItemFifo is the queue of the buffers queued to a BufferQueue. It's a
+// ring of BufferItems that grows by doubling when full, so that removing the
+// oldest item doesn't shift the others, and the storage is reused from one
+// frame to the next. An item leaving the queue drops its references to the
+// GraphicBuffer and the Fence right away.
+//
+// The queue is *NOT* thread-safe, BufferQueueCore::mMutex protects it.
+class BufferItemFifo {
+public:
+    BufferItemFifo();
+    ~BufferItemFifo();
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    // operator[] returns the item at the given position from the oldest one,
+    // which must be less than size().
+    BufferItem& operator[](size_t index) {
+        return mItems[(mHead + index) & (mCapacity - 1)];
+    }
+    const BufferItem& operator[](size_t index) const {
+        return mItems[(mHead + index) & (mCapacity - 1)];
+    }
+
+    // front returns the oldest item, the queue must not be empty.
+    BufferItem& front() { return (*this)[0]; }
+    const BufferItem& front() const { return (*this)[0]; }
+
+    // push_back appends an item after the newest one.
+    void push_back(const BufferItem& item);
+
+    // pop_front removes the oldest item, the queue must not be empty.
+    void pop_front();
+
+    // clear removes all the items.
+    void clear();
+
+private:
+    // Not copyable
+    BufferItemFifo(const BufferItemFifo&);
+    BufferItemFifo& operator=(const BufferItemFifo&);
+
+    // grow doubles the capacity, keeping the items in order.
+    void grow();
+
+    // mItems is the ring, mCapacity is a power of two. The items are at
+    // [mHead, mHead + mSize) modulo mCapacity, the other ones hold no
+    // references.
+    BufferItem* mItems;
+    size_t mCapacity;
+    size_t mHead;
+    size_t mSize;
+};
+
+} // namespace android
+
+#endif // ANDROID_GUI_BUFFERITEMFIFO_H
@@ -17,9 +17,11 @@
 #ifndef ANDROID_GUI_BUFFERQUEUECORE_H
 #define ANDROID_GUI_BUFFERQUEUECORE_H
 
+#include <gui/BufferItemFifo.h>
 #include <gui/BufferQueueDefs.h>
 #include <gui/BufferSlot.h>
 
+#include <utils/BitSet.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
 #include <utils/NativeHandle.h>
@@ -67,7 +69,10 @@ public:
     // The default API number used to indicate that no producer is connected
     enum { NO_CONNECTED_API = 0 };
 
-    typedef Vector<BufferItem> Fifo;
+    // The number of values of BufferSlot::BufferState
+    enum { NUM_BUFFER_STATES = BufferSlot::ACQUIRED + 1 };
+
+    typedef BufferItemFifo Fifo;
 
     // BufferQueueCore manages a pool of gralloc memory slots to be used by
     // producers and consumers. allocator is used to allocate all the needed
@@ -123,6 +128,31 @@ private:
     // waitWhileAllocatingLocked blocks until mIsAllocating is false.
     void waitWhileAllocatingLocked() const;
 
+    // setBufferStateLocked changes the state of a slot. All the changes of
+    // BufferSlot::mBufferState must go through it, so that mSlotStates stays
+    // in sync with mSlots.
+    void setBufferStateLocked(int slot, BufferSlot::BufferState state);
+
+    // setGraphicBufferLocked puts a buffer, or NULL, in a slot and updates
+    // mSlotsWithBuffers accordingly. freeBufferLocked also updates it.
+    void setGraphicBufferLocked(int slot, const sp<GraphicBuffer>& buffer);
+
+    // getSlotsLocked returns the slots below maxBufferCount that are in the
+    // given state, getSlotCountLocked the number of them.
+    BitSet64 getSlotsLocked(BufferSlot::BufferState state,
+            int maxBufferCount) const;
+    int getSlotCountLocked(BufferSlot::BufferState state,
+            int maxBufferCount) const;
+
+    // getOldestFreeSlotLocked returns the FREE slot among the given ones with
+    // the lowest frame number, the lowest index winning ties, or
+    // INVALID_BUFFER_SLOT if there is none. Since only the FREE slots are
+    // looked at, this doesn't depend on the number of slots in use.
+    int getOldestFreeSlotLocked(BitSet64 slots) const;
+
+    // firstSlots returns the set of the slots below count.
+    static BitSet64 firstSlots(int count);
+
     // mAllocator is the connection to SurfaceFlinger that is used to allocate
     // new GraphicBuffer objects.
     sp<IGraphicBufferAlloc> mAllocator;
@@ -174,6 +204,15 @@ private:
     // allocated for a slot when requestBuffer is called with that slot's index.
     BufferQueueDefs::SlotsType mSlots;
 
+    // mSlotStates holds, for each BufferSlot::BufferState, the set of the
+    // slots in that state, so that dequeueBuffer and friends can count and
+    // find slots without scanning mSlots. Initially all the slots are FREE.
+    BitSet64 mSlotStates[NUM_BUFFER_STATES];
+
+    // mSlotsWithBuffers is the set of the slots whose mGraphicBuffer isn't
+    // NULL. It's maintained by setGraphicBufferLocked and freeBufferLocked.
+    BitSet64 mSlotsWithBuffers;
+
     // mQueue is a FIFO of queued buffers used in synchronous mode.
     Fifo mQueue;
 
@@ -124,6 +124,13 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output);
 
+    // See IGraphicBufferProducer::queueAndDequeueBuffer
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            bool async, uint32_t width, uint32_t height, uint32_t format,
+            uint32_t usage, int* outSlot, sp<Fence>* outFence,
+            sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult);
+
     // cancelBuffer returns a dequeued buffer to the BufferQueue, but doesn't
     // queue it for use by the consumer.
     //
@@ -189,9 +196,16 @@ private:
     // block if there are no available slots and we are not in non-blocking
     // mode (producer and consumer controlled by the application). If it blocks,
     // it will release mCore->mMutex while blocked so that other operations on
-    // the BufferQueue may succeed.
+    // the BufferQueue may succeed. If canBlock is false, it returns
+    // WOULD_BLOCK instead of blocking.
     status_t waitForFreeSlotThenRelock(const char* caller, bool async,
-            int* found, status_t* returnFlags) const;
+            bool canBlock, int* found, status_t* returnFlags) const;
+
+    // doDequeueBuffer implements dequeueBuffer. If canBlock is false, it
+    // returns WOULD_BLOCK rather than wait for a free slot.
+    status_t doDequeueBuffer(int *outSlot, sp<Fence>* outFence, bool async,
+            uint32_t width, uint32_t height, uint32_t format, uint32_t usage,
+            bool canBlock);
 
     sp<BufferQueueCore> mCore;
 
@@ -68,6 +68,17 @@ class CpuConsumer : public ConsumerBase
         uint32_t    chromaStep;
     };
 
+    // An RGBA_8888 copy of a YCbCr buffer, see lockNextConvertedBuffer.
+    struct ConvertedBuffer {
+        uint8_t    *data;
+        uint32_t    width;
+        uint32_t    height;
+        // in pixels
+        uint32_t    stride;
+        int64_t     timestamp;
+        uint64_t    frameNumber;
+    };
+
     // Create a new CPU consumer. The maxLockedBuffers parameter specifies
     // how many buffers can be locked for user access at the same time.
     CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
@@ -108,6 +119,24 @@ class CpuConsumer : public ConsumerBase
     // lockNextBuffer.
     status_t unlockBuffer(const LockedBuffer &nativeBuffer);
 
+    // Gets the next graphics buffer like lockNextBuffer, and converts its
+    // crop rectangle to RGBA_8888, downscaled by 'scale' (1, 2 or 4). The
+    // left and top edges of the crop are rounded down to even coordinates,
+    // so that they fall on a chroma sample. The conversion is split
+    // between the calling thread and a worker thread, and the graphics
+    // buffer is returned to the queue as soon as it is done. The converted
+    // image is written to a buffer from a pool owned by the CpuConsumer.
+    //
+    // Returns BAD_VALUE if no new buffer is available or 'scale' is invalid,
+    // NOT_ENOUGH_DATA if maxLockedBuffers converted buffers are already
+    // locked, and INVALID_OPERATION if the buffer isn't YCbCr 4:2:0, in
+    // which case it is dropped.
+    status_t lockNextConvertedBuffer(ConvertedBuffer *convertedBuffer,
+            uint32_t scale);
+
+    // Returns a converted buffer to the pool.
+    status_t unlockConvertedBuffer(const ConvertedBuffer &convertedBuffer);
+
   private:
     // Maximum number of buffers that can be locked at a time
     uint32_t mMaxLockedBuffers;
@@ -135,6 +164,27 @@ class CpuConsumer : public ConsumerBase
     // Count of currently locked buffers
     uint32_t mCurrentLockedBuffers;
 
+    // Destination buffers of lockNextConvertedBuffer, reused across frames
+    struct ConversionBuffer {
+        uint8_t *mData;
+        size_t mSize;
+        bool mLocked;
+
+        ConversionBuffer() : mData(NULL), mSize(0), mLocked(false) {}
+    };
+    Vector<ConversionBuffer> mConversionBuffers;
+
+    // Count of currently locked converted buffers
+    uint32_t mCurrentConvertedBuffers;
+
+    // Converts part of each frame in lockNextConvertedBuffer, created on
+    // first use
+    class ConversionThread;
+    sp<ConversionThread> mConversionThread;
+
+    // Serializes the use of mConversionThread
+    Mutex mConversionMutex;
+
 };
 
 } // namespace android
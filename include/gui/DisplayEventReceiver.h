@@ -33,6 +33,7 @@ namespace android {
 // ----------------------------------------------------------------------------
 
 class BitTube;
+class EventRing;
 class IDisplayEventConnection;
 
 // ----------------------------------------------------------------------------
@@ -73,6 +74,8 @@ public:
      * SurfaceFlinger. VSync events are disabled by default. Call setVSyncRate
      * or requestNextVsync to receive them.
      * Other events start being delivered immediately.
+     * The events come through a shared memory EventRing when SurfaceFlinger
+     * supports it, and through a BitTube otherwise.
      */
     DisplayEventReceiver();
 
@@ -104,6 +107,8 @@ public:
     ssize_t getEvents(Event* events, size_t count);
     static ssize_t getEvents(const sp<BitTube>& dataChannel,
             Event* events, size_t count);
+    static ssize_t getEvents(const sp<EventRing>& eventRing,
+            Event* events, size_t count);
 
     /*
      * sendEvents write events to the queue and returns how many events were
@@ -111,6 +116,8 @@ public:
      */
     static ssize_t sendEvents(const sp<BitTube>& dataChannel,
             Event const* events, size_t count);
+    static ssize_t sendEvents(const sp<EventRing>& eventRing,
+            Event const* events, size_t count);
 
     /*
      * setVsyncRate() sets the Event::VSync delivery rate. A value of
@@ -126,9 +133,18 @@ public:
      */
     status_t requestNextVsync();
 
+    /*
+     * setVsyncPhaseOffset() moves the Event::VSync of this receiver by
+     * 'offset' nanoseconds relative to the default ones, e.g. so that a
+     * client with a short deadline gets them closer to it. The offset is
+     * rounded, and ignored if it's larger than a refresh period.
+     */
+    status_t setVsyncPhaseOffset(nsecs_t offset);
+
 private:
     sp<IDisplayEventConnection> mEventConnection;
     sp<BitTube> mDataChannel;
+    sp<EventRing> mEventRing;
 };
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_EVENT_RING_H
+#define ANDROID_GUI_EVENT_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <cutils/log.h>
+
+
+namespace android {
+// ----------------------------------------------------------------------------
+class BitTube;
+class Parcel;
+
+/*
+ * EventRing is a single-producer, single-consumer queue of fixed-size
+ * objects in shared memory, with a BitTube to wake up the consumer. It's a
+ * drop-in replacement for a BitTube that saves the copies through the
+ * kernel, and most of the syscalls: the producer only sends a wakeup
+ * through the BitTube when the queue goes from empty to non-empty, and the
+ * consumer only drains the wakeups when it empties the queue.
+ *
+ * The fd to poll is the BitTube's, so the consumer still sees a hangup
+ * when the producer goes away. The shared memory isn't kept open once it's
+ * mapped, an EventRing costs the consumer a single fd like a BitTube does.
+ *
+ * The process that creates the EventRing is the producer, the one that
+ * unparcels it is the consumer. The consumer can corrupt the shared state,
+ * the producer never trusts it: it then fails with -EPIPE.
+ */
+class EventRing : public RefBase
+{
+public:
+
+    // creates an EventRing holding up to 'capacity' objects of 'objSize'
+    // bytes, 'capacity' is rounded up to a power of two. The consumer is
+    // woken up through 'wakeupChannel', which mustn't carry anything else.
+    EventRing(size_t objSize, size_t capacity,
+            const sp<BitTube>& wakeupChannel);
+
+    explicit EventRing(const Parcel& data);
+    virtual ~EventRing();
+
+    // check state after construction
+    status_t initCheck() const;
+
+    // get the file-descriptor to poll for incoming objects
+    int getFd() const;
+
+    // send objects. All objects are queued or the call fails with -EAGAIN if
+    // there isn't enough room.
+    template <typename T>
+    static ssize_t sendObjects(const sp<EventRing>& ring,
+            T const* events, size_t count) {
+        return sendObjects(ring, events, count, sizeof(T));
+    }
+
+    // receive up to 'count' objects, returns 0 if there are none.
+    template <typename T>
+    static ssize_t recvObjects(const sp<EventRing>& ring,
+            T* events, size_t count) {
+        return recvObjects(ring, events, count, sizeof(T));
+    }
+
+    // parcels this EventRing. Like a BitTube, it can only be parceled once.
+    status_t writeToParcel(Parcel* reply) const;
+
+private:
+    struct Header;
+
+    status_t map(int memFd, bool producer);
+
+    void wakeUp();
+    void drainWakeUps();
+
+    ssize_t write(void const* vaddr, size_t count, size_t objSize);
+    ssize_t read(void* vaddr, size_t count, size_t objSize);
+
+    static ssize_t sendObjects(const sp<EventRing>& ring,
+            void const* events, size_t count, size_t objSize);
+
+    static ssize_t recvObjects(const sp<EventRing>& ring,
+            void* events, size_t count, size_t objSize);
+
+    // producer only, the consumer closes it once it's mapped
+    int mMemFd;
+    sp<BitTube> mWakeupChannel;
+    size_t mObjSize;
+    size_t mCapacity;
+    size_t mMapSize;
+    Header* mHeader;
+    uint8_t* mData;
+
+    // the producer's copy of the head, and the consumer's copy of the tail
+    uint32_t mHead;
+    uint32_t mTail;
+
+    // consumer only, true if wakeups may be pending
+    bool mMaybeSignaled;
+
+    status_t mStatus;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_EVENT_RING_H
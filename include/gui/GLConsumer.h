@@ -112,6 +112,17 @@ public:
     // union fence.
     void setReleaseFence(const sp<Fence>& fence);
 
+    // prepareImage creates the EGLImage for the frame frameNumber, queued in
+    // slot but not acquired yet, so that updateTexImage() doesn't have to
+    // when it acquires it. The EGLImage is created without holding the
+    // GLConsumer lock, and doesn't require an OpenGL ES context. This does
+    // nothing before the first call to updateTexImage(), or if the frame
+    // was acquired in the meantime.
+    //
+    // This call may be made from any thread.
+    status_t prepareImage(int slot, const sp<GraphicBuffer>& buffer,
+            const Rect& crop, uint64_t frameNumber);
+
     // setDefaultMaxBufferCount sets the default limit on the maximum number
     // of buffers that will be allocated at one time. The image producer may
     // override the limit.
@@ -312,6 +323,11 @@ private:
         EGLImageKHR createImage(EGLDisplay dpy,
                 const sp<GraphicBuffer>& graphicBuffer, const Rect& crop);
 
+        // releaseImage gives mEglImage back to the EglImageCache, or
+        // destroys it if it isn't shared. With 'discard', a shared image is
+        // destroyed once its last user releases it.
+        void releaseImage(bool discard);
+
         // Disallow copying
         EglImage(const EglImage& rhs);
         void operator = (const EglImage& rhs);
@@ -328,6 +344,9 @@ private:
         // mCropRect is the crop rectangle passed to EGL when mEglImage
         // was created.
         Rect mCropRect;
+
+        // mCached is true if mEglImage is shared through the EglImageCache.
+        bool mCached;
     };
 
     // freeBufferLocked frees up the given buffer slot. If the slot has been
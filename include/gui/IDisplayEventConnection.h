@@ -22,6 +22,7 @@
 
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
+#include <utils/Timers.h>
 
 #include <binder/IInterface.h>
 
@@ -29,6 +30,7 @@ namespace android {
 // ----------------------------------------------------------------------------
 
 class BitTube;
+class EventRing;
 
 class IDisplayEventConnection : public IInterface
 {
@@ -41,6 +43,13 @@ public:
      */
     virtual sp<BitTube> getDataChannel() const = 0;
 
+    /*
+     * getEventRing() returns an EventRing where to receive the events from,
+     * instead of the data channel, or NULL if the connection doesn't
+     * support it. It must be called at most once.
+     */
+    virtual sp<EventRing> getEventRing() const = 0;
+
     /*
      * setVsyncRate() sets the vsync event delivery rate. A value of
      * 1 returns every vsync events. A value of 2 returns every other events,
@@ -54,6 +63,14 @@ public:
      * if the vsync rate is > 0.
      */
     virtual void requestNextVsync() = 0;    // asynchronous
+
+    /*
+     * setVsyncPhaseOffset() moves the vsync events of this connection by
+     * 'offset' nanoseconds relative to the default vsync events, e.g. a
+     * negative offset gets them earlier. The offset is rounded, and
+     * ignored if it's larger than a refresh period.
+     */
+    virtual void setVsyncPhaseOffset(nsecs_t offset) = 0;
 };
 
 // ----------------------------------------------------------------------------
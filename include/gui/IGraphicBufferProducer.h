@@ -375,6 +375,30 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output) = 0;
 
+    // queueAndDequeueBuffer queues the buffer in the given slot exactly like
+    // queueBuffer, and then dequeues the next buffer like dequeueBuffer with
+    // the given async, w, h, format and usage. For a remote producer this
+    // takes one round trip per frame instead of two, or three when the
+    // dequeued buffer needs reallocation.
+    //
+    // The return value is the one of queueBuffer. The dequeue is only
+    // attempted if the queue succeeded, and it never blocks. Its result goes
+    // to *outDequeueResult, and is one of:
+    // * the value dequeueBuffer would return - *outSlot and *outFence are
+    //   set as by dequeueBuffer. If BUFFER_NEEDS_REALLOCATION is set,
+    //   *outBuffer is the new buffer, as returned by requestBuffer, which
+    //   doesn't need to be called.
+    // * WOULD_BLOCK - no buffer was free right away. The client must call
+    //   dequeueBuffer.
+    // * INVALID_OPERATION - the implementation doesn't dequeue along with
+    //   queueBuffer. The client must call dequeueBuffer.
+    // * any other error dequeueBuffer may return.
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            bool async, uint32_t w, uint32_t h, uint32_t format,
+            uint32_t usage, int* outSlot, sp<Fence>* outFence,
+            sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult) = 0;
+
     // cancelBuffer indicates that the client does not wish to fill in the
     // buffer associated with slot and transfers ownership of the slot back to
     // the server.
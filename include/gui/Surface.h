@@ -29,6 +29,27 @@
 
 struct ANativeWindow_Buffer;
 
+/*
+ * ANativeWindow perform() operation of Surface that isn't in
+ * system/window.h yet, for code that only holds the ANativeWindow. Its
+ * value is kept clear of the system/window.h ones.
+ */
+enum {
+    NATIVE_WINDOW_SET_QUEUE_AND_DEQUEUE = 0x10000,  /* private */
+};
+
+/*
+ * native_window_set_queue_and_dequeue(..., enabled)
+ * Enables or disables Surface::setQueueAndDequeue. Other ANativeWindows
+ * return NAME_NOT_FOUND.
+ */
+static inline int native_window_set_queue_and_dequeue(
+        struct ANativeWindow* window, int enabled)
+{
+    return window->perform(window, NATIVE_WINDOW_SET_QUEUE_AND_DEQUEUE,
+            enabled);
+}
+
 namespace android {
 
 /*
@@ -105,6 +126,20 @@ public:
      * Surface */
     status_t setDirtyRect(const Rect* dirtyRect);
 
+    /* Enables or disables dequeueing along with queueing.
+     *
+     * When enabled, queueBuffer also dequeues the next buffer with the
+     * current dimensions, format and usage, in the same call to the
+     * IGraphicBufferProducer, and the next dequeueBuffer returns it. This
+     * halves the binder transactions of producers that queue many frames
+     * per second, like cameras and video decoders, at the cost of keeping a
+     * buffer dequeued between frames. If the dimensions, format or usage
+     * change in the meantime, the buffer is cancelled and a new one is
+     * dequeued. It's disabled by default. Holders of the ANativeWindow
+     * can use native_window_set_queue_and_dequeue instead.
+     */
+    void setQueueAndDequeue(bool enabled);
+
 protected:
     virtual ~Surface();
 
@@ -151,6 +186,7 @@ private:
     int dispatchLock(va_list args);
     int dispatchUnlockAndPost(va_list args);
     int dispatchSetSidebandStream(va_list args);
+    int dispatchSetQueueAndDequeue(va_list args);
 
 protected:
     virtual int dequeueBuffer(ANativeWindowBuffer** buffer, int* fenceFd);
@@ -188,11 +224,33 @@ private:
     void freeAllBuffers();
     int getSlotFromBufferLocked(android_native_buffer_t* buffer) const;
 
+    // cancelPrefetchedBufferLocked gives the buffer dequeued by the last
+    // queueBuffer, if any, back to the IGraphicBufferProducer.
+    void cancelPrefetchedBufferLocked();
+
     struct BufferSlot {
         sp<GraphicBuffer> buffer;
         Region dirtyRegion;
     };
 
+    // PrefetchedBuffer is a buffer dequeued by queueBuffer for the next
+    // dequeueBuffer: what IGraphicBufferProducer::queueAndDequeueBuffer
+    // returned for it, and the parameters it was dequeued with.
+    struct PrefetchedBuffer {
+        PrefetchedBuffer() : slot(-1), result(NO_ERROR), async(false),
+                width(0), height(0), format(0), usage(0), size(0) {}
+        int slot;
+        sp<Fence> fence;
+        sp<GraphicBuffer> buffer;
+        status_t result;
+        bool async;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t usage;
+        uint32_t size;
+    };
+
     // mSurfaceTexture is the interface to the surface texture server. All
     // operations on the surface texture client ultimately translate into
     // interactions with the server using this interface.
@@ -288,6 +346,14 @@ private:
     // one buffer behind the producer.
     mutable bool mConsumerRunningBehind;
 
+    // mQueueAndDequeue is set if queueBuffer dequeues the next buffer, see
+    // setQueueAndDequeue.
+    bool mQueueAndDequeue;
+
+    // mPrefetched is the buffer dequeued by the last queueBuffer, its slot is
+    // -1 if there is none.
+    PrefetchedBuffer mPrefetched;
+
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables of Surface objects. It must be locked whenever the
     // member variables are accessed.
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_YUV_CONVERTER_H
+#define ANDROID_GUI_YUV_CONVERTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * YuvConverter converts 4:2:0 YCbCr images to RGBA_8888, optionally
+ * downscaling them by 2 or 4 with a box filter. The source is described
+ * like a flexible YCbCr buffer (android_ycbcr), so NV12, NV21 and YV12 all
+ * go through the same code: they only differ in the chroma pointers and
+ * step.
+ *
+ * The conversion is BT.601 limited range, in 16-bit fixed point. The NEON
+ * and SSE2 kernels give the same results as the scalar ones.
+ */
+class YuvConverter {
+public:
+    struct Planes {
+        const uint8_t* y;
+        const uint8_t* cb;
+        const uint8_t* cr;
+        uint32_t width;
+        uint32_t height;
+        uint32_t yStride;
+        uint32_t chromaStride;
+        // distance in bytes between two chroma samples of a row: 1 for
+        // planar, 2 for semi-planar
+        uint32_t chromaStep;
+    };
+
+    // getScaledSize returns the size of the converted image, the source
+    // size divided by 'scale' and rounded down.
+    static uint32_t getScaledSize(uint32_t size, uint32_t scale) {
+        return size / scale;
+    }
+
+    // toRgba converts the rows [firstRow, firstRow + numRows) of the
+    // converted image, of the given scale (1, 2 or 4). 'dst' points to the
+    // first converted row, its stride is in pixels. If allowSimd is false,
+    // the scalar kernels are used even if SIMD ones are available.
+    static status_t toRgba(const Planes& src, uint32_t scale,
+            uint32_t firstRow, uint32_t numRows,
+            uint8_t* dst, uint32_t dstStride, bool allowSimd = true);
+
+    // hasSimd returns true if NEON or SSE2 kernels were built in.
+    static bool hasSimd();
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_YUV_CONVERTER_H
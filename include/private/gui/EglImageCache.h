@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_EGL_IMAGE_CACHE_H
+#define ANDROID_GUI_EGL_IMAGE_CACHE_H
+
+#include <stdint.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <ui/GraphicBuffer.h>
+#include <ui/Rect.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Singleton.h>
+#include <utils/String8.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * EglImageCache shares the EGLImages created by the GLConsumers of a
+ * process. Images are keyed by the id of their GraphicBuffer, the EGLDisplay
+ * and the crop rectangle, and are reference counted: an image is kept as
+ * long as it is in use, and the least recently used of the unused ones are
+ * destroyed once the buffers they hold on to add up to more than
+ * MAX_UNUSED_BYTES.
+ *
+ * An EGLImage keeps its buffer alive, so the images of a buffer are
+ * discarded when a GLConsumer frees the buffer's slot. A GraphicBuffer that
+ * goes back and forth between two crop rectangles, or that is shared by
+ * several GLConsumers, then gets its EGLImage back instead of a new one.
+ */
+class EglImageCache : public Singleton<EglImageCache> {
+public:
+    enum { MAX_UNUSED_BYTES = 16 * 1024 * 1024 };
+
+    // acquire returns a new reference to the cached image for the given key,
+    // or EGL_NO_IMAGE_KHR if there is none. 'crop' must be the crop that is
+    // actually set on the image, or an invalid Rect if there isn't one.
+    EGLImageKHR acquire(EGLDisplay dpy, const sp<GraphicBuffer>& buffer,
+            const Rect& crop);
+
+    // add hands an image that was just created over to the cache, and
+    // returns a reference to the image to use. That's a different one if
+    // another thread added an image for the same key meanwhile, 'image' is
+    // then destroyed.
+    EGLImageKHR add(EGLDisplay dpy, const sp<GraphicBuffer>& buffer,
+            const Rect& crop, EGLImageKHR image);
+
+    // release drops a reference returned by acquire or add. If 'discard' is
+    // true, the image is destroyed as soon as it isn't used anymore instead
+    // of being kept for later.
+    void release(EGLDisplay dpy, const sp<GraphicBuffer>& buffer,
+            const Rect& crop, bool discard);
+
+    // discardBuffer destroys the unused images of 'buffer', and makes the
+    // ones still in use be destroyed when they are released.
+    void discardBuffer(const sp<GraphicBuffer>& buffer);
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    friend class Singleton<EglImageCache>;
+    EglImageCache();
+
+    struct Key {
+        Key() : mBufferId(0), mDisplay(EGL_NO_DISPLAY) {}
+        Key(EGLDisplay dpy, const sp<GraphicBuffer>& buffer, const Rect& crop);
+        bool operator < (const Key& rhs) const;
+
+        uint64_t mBufferId;
+        EGLDisplay mDisplay;
+        Rect mCrop;
+    };
+
+    struct Entry {
+        Entry() : mImage(EGL_NO_IMAGE_KHR), mRefs(0), mLastUse(0),
+            mBytes(0), mDiscard(false) {}
+        Entry(EGLImageKHR image, uint64_t lastUse, size_t bytes) :
+            mImage(image), mRefs(1), mLastUse(lastUse), mBytes(bytes),
+            mDiscard(false) {}
+
+        EGLImageKHR mImage;
+        uint32_t mRefs;
+        // mLastUse orders the unused images from least to most recently
+        // released.
+        uint64_t mLastUse;
+        // mBytes is the size of the buffer the image holds on to
+        size_t mBytes;
+        // mDiscard is set if the image must not be reused once released
+        bool mDiscard;
+    };
+
+    static size_t getBufferSize(const sp<GraphicBuffer>& buffer);
+
+    void removeLocked(size_t index);
+    void trimLocked();
+
+    mutable Mutex mMutex;
+    KeyedVector<Key, Entry> mEntries;
+    size_t mNumUnused;
+    size_t mUnusedBytes;
+    uint64_t mUseCounter;
+
+    uint64_t mHits;
+    uint64_t mMisses;
+    uint64_t mEvictions;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_EGL_IMAGE_CACHE_H
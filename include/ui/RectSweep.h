@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_RECT_SWEEP_H
+#define ANDROID_UI_RECT_SWEEP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+
+#include <ui/Rect.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+class Region;
+
+/*
+ * RectSweep answers questions about a set of rectangles with a sweep-line
+ * over x and a segment tree over the (compressed) y coordinates, in
+ * O(n log n) rather than the O(n^2) it takes to build up a Region.
+ *
+ * The storage only grows: once a RectSweep has seen its largest set, clear()
+ * and the queries below don't allocate anymore, so it is meant to be kept
+ * around and reused, e.g. once per composition.
+ *
+ * Edges are exclusive like everywhere else in libui: rectangles that only
+ * share an edge do not overlap. Empty rectangles are ignored.
+ *
+ * RectSweep is *NOT* thread-safe.
+ */
+class RectSweep
+{
+public:
+                RectSweep();
+                ~RectSweep();
+
+    // clear removes all the rectangles but keeps the storage
+    void        clear();
+
+    // reserve makes room for 'count' rectangles
+    status_t    reserve(size_t count);
+
+    status_t    add(const Rect& rect);
+    // adds all the rectangles of 'region', which never overlap each other
+    status_t    add(const Region& region);
+
+    size_t      size() const { return mCount; }
+    bool        isEmpty() const { return mCount == 0; }
+
+    // returns true if the interiors of any two rectangles intersect
+    bool        hasOverlap();
+
+    // returns the area covered by the union of the rectangles
+    int64_t     unionArea();
+
+    // returns the sum of the areas of the rectangles clipped to 'clip',
+    // the area where rectangles overlap is counted once per rectangle.
+    int64_t     clippedAreaSum(const Rect& clip) const;
+
+    // returns the bounds of all the rectangles
+    Rect        getBounds() const;
+
+private:
+                RectSweep(const RectSweep&);
+    RectSweep&  operator = (const RectSweep&);
+
+    struct Event {
+        int32_t x;
+        // -1 when the rectangle ends at x, +1 when it starts
+        int32_t delta;
+        // the rectangle's y extent, as indices into mCoords
+        int32_t top;
+        int32_t bottom;
+    };
+
+    struct Node {
+        // number of events covering the whole node and not pushed down
+        int32_t count;
+        // hasOverlap: the highest coverage below this node
+        // unionArea: the covered length below this node
+        int64_t value;
+    };
+
+    // prepare sorts the events and compresses the y coordinates, returns
+    // the number of elementary y intervals.
+    size_t      prepare();
+
+    int64_t     queryMax(size_t node, size_t lo, size_t hi,
+                        size_t top, size_t bottom) const;
+    void        addMax(size_t node, size_t lo, size_t hi,
+                        size_t top, size_t bottom, int32_t delta);
+    void        addLength(size_t node, size_t lo, size_t hi,
+                        size_t top, size_t bottom, int32_t delta);
+
+    static int  compareEvents(const void* lhs, const void* rhs);
+    static int  compareCoords(const void* lhs, const void* rhs);
+
+    Rect*       mRects;
+    size_t      mCount;
+    size_t      mCapacity;
+    Event*      mEvents;
+    int32_t*    mCoords;
+    Node*       mNodes;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_UI_RECT_SWEEP_H
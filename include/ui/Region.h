@@ -45,9 +45,11 @@ public:
         Region& operator = (const Region& rhs);
 
     inline  bool        isEmpty() const     { return getBounds().isEmpty(); }
-    inline  bool        isRect() const      { return mStorage.size() == 1; }
+    inline  bool        isRect() const      { return mStorage.size() <= 1; }
 
-    inline  Rect        getBounds() const   { return mStorage[mStorage.size() - 1]; }
+    inline  Rect        getBounds() const   {
+        return mStorage.isEmpty() ? mInlineRect : mStorage[mStorage.size() - 1];
+    }
     inline  Rect        bounds() const      { return getBounds(); }
 
             bool        contains(const Point& point) const;
@@ -111,7 +113,8 @@ public:
     inline  Region&     operator += (const Point& pt);
 
     
-    // returns true if the regions share the same underlying storage
+    // returns true if the regions share the same underlying storage, or
+    // are both the same single Rect
     bool isTriviallyEqual(const Region& region) const;
 
 
@@ -167,6 +170,11 @@ private:
     static void boolean_operation(int op, Region& dst,
             const Region& lhs, const Rect& rhs);
 
+    static bool boolean_operation_trivial(int op, Region& dst,
+            const Region& lhs, const Region& rhs, int dx, int dy);
+    static void boolean_operation_banded(int op, Region& dst,
+            const Region& lhs, const Region& rhs, int dx, int dy);
+
     static void translate(Region& reg, int dx, int dy);
     static void translate(Region& dst, const Region& reg, int dx, int dy);
 
@@ -176,8 +184,11 @@ private:
     // mStorage is a (manually) sorted array of Rects describing the region
     // with an extra Rect as the last element which is set to the
     // bounds of the region. However, if the region is
-    // a simple Rect then mStorage contains only that rect.
+    // a simple Rect then mStorage is empty and that rect is stored in
+    // mInlineRect, which saves a heap allocation for the most common
+    // regions.
     Vector<Rect> mStorage;
+    Rect mInlineRect;
 };
 
 
@@ -6,6 +6,7 @@ LOCAL_SRC_FILES:= \
 	IConsumerListener.cpp \
 	BitTube.cpp \
 	BufferItem.cpp \
+	BufferItemFifo.cpp \
 	BufferItemConsumer.cpp \
 	BufferQueue.cpp \
 	BufferQueueConsumer.cpp \
@@ -15,6 +16,8 @@ LOCAL_SRC_FILES:= \
 	ConsumerBase.cpp \
 	CpuConsumer.cpp \
 	DisplayEventReceiver.cpp \
+	EglImageCache.cpp \
+	EventRing.cpp \
 	GLConsumer.cpp \
 	GraphicBufferAlloc.cpp \
 	GuiConfig.cpp \
@@ -35,6 +38,7 @@ LOCAL_SRC_FILES:= \
 	SurfaceControl.cpp \
 	SurfaceComposerClient.cpp \
 	SyncFeatures.cpp \
+	YuvConverter.cpp \
 
 LOCAL_SHARED_LIBRARIES := \
 	libbinder \
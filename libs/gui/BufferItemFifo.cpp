@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gui/BufferItemFifo.h>
+
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+
+#include <utils/Log.h>
+
+namespace android {
+
+// Enough for the usual triple buffering plus an acquired buffer. The ring
+// only grows if the producer runs far ahead of the consumer.
+static const size_t INITIAL_CAPACITY = 4;
+
+BufferItemFifo::BufferItemFifo()
+    : mItems(new BufferItem[INITIAL_CAPACITY]),
+      mCapacity(INITIAL_CAPACITY), mHead(0), mSize(0) {
+}
+
+BufferItemFifo::~BufferItemFifo() {
+    delete [] mItems;
+}
+
+void BufferItemFifo::push_back(const BufferItem& item) {
+    if (mSize == mCapacity) {
+        grow();
+    }
+    mItems[(mHead + mSize) & (mCapacity - 1)] = item;
+    mSize++;
+}
+
+void BufferItemFifo::pop_front() {
+    LOG_ALWAYS_FATAL_IF(mSize == 0, "BufferItemFifo: pop_front on empty queue");
+    BufferItem& item(mItems[mHead]);
+    item.mGraphicBuffer.clear();
+    item.mFence.clear();
+    mHead = (mHead + 1) & (mCapacity - 1);
+    mSize--;
+}
+
+void BufferItemFifo::clear() {
+    while (mSize > 0) {
+        pop_front();
+    }
+    mHead = 0;
+}
+
+void BufferItemFifo::grow() {
+    const size_t capacity = mCapacity * 2;
+    BufferItem* items = new BufferItem[capacity];
+    for (size_t i = 0; i < mSize; i++) {
+        items[i] = (*this)[i];
+    }
+    delete [] mItems;
+    mItems = items;
+    mCapacity = capacity;
+    mHead = 0;
+}
+
+} // namespace android
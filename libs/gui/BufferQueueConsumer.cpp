@@ -45,12 +45,8 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
     // buffers acquired. We allow the max buffer count to be exceeded by one
     // buffer so that the consumer can successfully set up the newly acquired
     // buffer before releasing the old one.
-    int numAcquiredBuffers = 0;
-    for (int s = 0; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
-        if (mSlots[s].mBufferState == BufferSlot::ACQUIRED) {
-            ++numAcquiredBuffers;
-        }
-    }
+    const int numAcquiredBuffers =
+            int(mCore->mSlotStates[BufferSlot::ACQUIRED].count());
     if (numAcquiredBuffers >= mCore->mMaxAcquiredBufferCount + 1) {
         BQ_LOGE("acquireBuffer: max acquired buffer count reached: %d (max %d)",
                 numAcquiredBuffers, mCore->mMaxAcquiredBufferCount);
@@ -64,7 +60,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         return NO_BUFFER_AVAILABLE;
     }
 
-    BufferQueueCore::Fifo::iterator front(mCore->mQueue.begin());
+    BufferItem* front = &mCore->mQueue.front();
 
     // If expectedPresent is specified, we may not want to return a buffer yet.
     // If it's specified and there's more than one buffer queued, we may want
@@ -131,10 +127,10 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
                     desiredPresent, expectedPresent, mCore->mQueue.size());
             if (mCore->stillTracking(front)) {
                 // Front buffer is still in mSlots, so mark the slot as free
-                mSlots[front->mSlot].mBufferState = BufferSlot::FREE;
+                mCore->setBufferStateLocked(front->mSlot, BufferSlot::FREE);
             }
-            mCore->mQueue.erase(front);
-            front = mCore->mQueue.begin();
+            mCore->mQueue.pop_front();
+            front = &mCore->mQueue.front();
         }
 
         // See if the front buffer is due
@@ -165,7 +161,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
     if (mCore->stillTracking(front)) {
         mSlots[slot].mAcquireCalled = true;
         mSlots[slot].mNeedsCleanupOnRelease = false;
-        mSlots[slot].mBufferState = BufferSlot::ACQUIRED;
+        mCore->setBufferStateLocked(slot, BufferSlot::ACQUIRED);
         mSlots[slot].mFence = Fence::NO_FENCE;
     }
 
@@ -176,7 +172,7 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         outBuffer->mGraphicBuffer = NULL;
     }
 
-    mCore->mQueue.erase(front);
+    mCore->mQueue.pop_front();
 
     // We might have freed a slot while dropping old buffers, or the producer
     // may be blocked waiting for the number of buffers in the queue to
@@ -231,18 +227,10 @@ status_t BufferQueueConsumer::attachBuffer(int* outSlot,
 
     // Make sure we don't have too many acquired buffers and find a free slot
     // to put the buffer into (the oldest if there are multiple).
-    int numAcquiredBuffers = 0;
-    int found = BufferQueueCore::INVALID_BUFFER_SLOT;
-    for (int s = 0; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
-        if (mSlots[s].mBufferState == BufferSlot::ACQUIRED) {
-            ++numAcquiredBuffers;
-        } else if (mSlots[s].mBufferState == BufferSlot::FREE) {
-            if (found == BufferQueueCore::INVALID_BUFFER_SLOT ||
-                    mSlots[s].mFrameNumber < mSlots[found].mFrameNumber) {
-                found = s;
-            }
-        }
-    }
+    const int numAcquiredBuffers =
+            int(mCore->mSlotStates[BufferSlot::ACQUIRED].count());
+    const int found = mCore->getOldestFreeSlotLocked(
+            BufferQueueCore::firstSlots(BufferQueueDefs::NUM_BUFFER_SLOTS));
 
     if (numAcquiredBuffers >= mCore->mMaxAcquiredBufferCount + 1) {
         BQ_LOGE("attachBuffer(P): max acquired buffer count reached: %d "
@@ -259,8 +247,8 @@ status_t BufferQueueConsumer::attachBuffer(int* outSlot,
     ATRACE_BUFFER_INDEX(*outSlot);
     BQ_LOGV("attachBuffer(C): returning slot %d", *outSlot);
 
-    mSlots[*outSlot].mGraphicBuffer = buffer;
-    mSlots[*outSlot].mBufferState = BufferSlot::ACQUIRED;
+    mCore->setGraphicBufferLocked(*outSlot, buffer);
+    mCore->setBufferStateLocked(*outSlot, BufferSlot::ACQUIRED);
     mSlots[*outSlot].mAttachedByConsumer = true;
     mSlots[*outSlot].mNeedsCleanupOnRelease = false;
     mSlots[*outSlot].mFence = Fence::NO_FENCE;
@@ -308,21 +296,19 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         }
 
         // Make sure this buffer hasn't been queued while acquired by the consumer
-        BufferQueueCore::Fifo::iterator current(mCore->mQueue.begin());
-        while (current != mCore->mQueue.end()) {
-            if (current->mSlot == slot) {
+        for (size_t i = 0; i < mCore->mQueue.size(); ++i) {
+            if (mCore->mQueue[i].mSlot == slot) {
                 BQ_LOGE("releaseBuffer: buffer slot %d pending release is "
                         "currently queued", slot);
                 return BAD_VALUE;
             }
-            ++current;
         }
 
         if (mSlots[slot].mBufferState == BufferSlot::ACQUIRED) {
             mSlots[slot].mEglDisplay = eglDisplay;
             mSlots[slot].mEglFence = eglFence;
             mSlots[slot].mFence = releaseFence;
-            mSlots[slot].mBufferState = BufferSlot::FREE;
+            mCore->setBufferStateLocked(slot, BufferSlot::FREE);
             listener = mCore->mConnectedProducerListener;
             BQ_LOGV("releaseBuffer: releasing slot %d", slot);
         } else if (mSlots[slot].mNeedsCleanupOnRelease) {
@@ -417,12 +403,11 @@ status_t BufferQueueConsumer::getReleasedBuffers(uint64_t *outSlotMask) {
     // Remove from the mask queued buffers for which acquire has been called,
     // since the consumer will not receive their buffer addresses and so must
     // retain their cached information
-    BufferQueueCore::Fifo::iterator current(mCore->mQueue.begin());
-    while (current != mCore->mQueue.end()) {
-        if (current->mAcquireCalled) {
-            mask &= ~(1ULL << current->mSlot);
+    for (size_t i = 0; i < mCore->mQueue.size(); ++i) {
+        const BufferItem& item(mCore->mQueue[i]);
+        if (item.mAcquireCalled) {
+            mask &= ~(1ULL << item.mSlot);
         }
-        ++current;
     }
 
     BQ_LOGV("getReleasedBuffers: returning mask %#" PRIx64, mask);
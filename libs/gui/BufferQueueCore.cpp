@@ -52,6 +52,7 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     mConnectedApi(NO_CONNECTED_API),
     mConnectedProducerListener(),
     mSlots(),
+    mSlotsWithBuffers(),
     mQueue(),
     mOverrideMaxBufferCount(0),
     mDequeueCondition(),
@@ -75,6 +76,8 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
             BQ_LOGE("createGraphicBufferAlloc failed");
         }
     }
+    mSlotStates[BufferSlot::FREE] =
+            firstSlots(BufferQueueDefs::NUM_BUFFER_SLOTS);
 }
 
 BufferQueueCore::~BufferQueueCore() {}
@@ -83,15 +86,14 @@ void BufferQueueCore::dump(String8& result, const char* prefix) const {
     Mutex::Autolock lock(mMutex);
 
     String8 fifo;
-    Fifo::const_iterator current(mQueue.begin());
-    while (current != mQueue.end()) {
+    for (size_t i = 0; i < mQueue.size(); ++i) {
+        const BufferItem& item(mQueue[i]);
         fifo.appendFormat("%02d:%p crop=[%d,%d,%d,%d], "
                 "xform=0x%02x, time=%#" PRIx64 ", scale=%s\n",
-                current->mSlot, current->mGraphicBuffer.get(),
-                current->mCrop.left, current->mCrop.top, current->mCrop.right,
-                current->mCrop.bottom, current->mTransform, current->mTimestamp,
-                BufferItem::scalingModeName(current->mScalingMode));
-        ++current;
+                item.mSlot, item.mGraphicBuffer.get(),
+                item.mCrop.left, item.mCrop.top, item.mCrop.right,
+                item.mCrop.bottom, item.mTransform, item.mTimestamp,
+                BufferItem::scalingModeName(item.mScalingMode));
     }
 
     result.appendFormat("%s-BufferQueue mMaxAcquiredBufferCount=%d, "
@@ -161,11 +163,11 @@ int BufferQueueCore::getMaxBufferCountLocked(bool async) const {
     // waiting to be consumed need to have their slots preserved. Such buffers
     // will temporarily keep the max buffer count up until the slots no longer
     // need to be preserved.
-    for (int s = maxBufferCount; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
-        BufferSlot::BufferState state = mSlots[s].mBufferState;
-        if (state == BufferSlot::QUEUED || state == BufferSlot::DEQUEUED) {
-            maxBufferCount = s + 1;
-        }
+    BitSet64 preserved(mSlotStates[BufferSlot::QUEUED].value |
+            mSlotStates[BufferSlot::DEQUEUED].value);
+    if (!preserved.isEmpty()) {
+        maxBufferCount = max(maxBufferCount,
+                int(preserved.lastMarkedBit()) + 1);
     }
 
     return maxBufferCount;
@@ -190,10 +192,11 @@ status_t BufferQueueCore::setDefaultMaxBufferCountLocked(int count) {
 void BufferQueueCore::freeBufferLocked(int slot) {
     BQ_LOGV("freeBufferLocked: slot %d", slot);
     mSlots[slot].mGraphicBuffer.clear();
+    mSlotsWithBuffers.clearBit(slot);
     if (mSlots[slot].mBufferState == BufferSlot::ACQUIRED) {
         mSlots[slot].mNeedsCleanupOnRelease = true;
     }
-    mSlots[slot].mBufferState = BufferSlot::FREE;
+    setBufferStateLocked(slot, BufferSlot::FREE);
     mSlots[slot].mFrameNumber = UINT32_MAX;
     mSlots[slot].mAcquireCalled = false;
 
@@ -235,4 +238,56 @@ void BufferQueueCore::waitWhileAllocatingLocked() const {
     }
 }
 
+void BufferQueueCore::setBufferStateLocked(int slot,
+        BufferSlot::BufferState state) {
+    BufferSlot::BufferState& current(mSlots[slot].mBufferState);
+    mSlotStates[current].clearBit(slot);
+    mSlotStates[state].markBit(slot);
+    current = state;
+}
+
+void BufferQueueCore::setGraphicBufferLocked(int slot,
+        const sp<GraphicBuffer>& buffer) {
+    mSlots[slot].mGraphicBuffer = buffer;
+    if (buffer != NULL) {
+        mSlotsWithBuffers.markBit(slot);
+    } else {
+        mSlotsWithBuffers.clearBit(slot);
+    }
+}
+
+BitSet64 BufferQueueCore::getSlotsLocked(BufferSlot::BufferState state,
+        int maxBufferCount) const {
+    return BitSet64(mSlotStates[state].value & firstSlots(maxBufferCount).value);
+}
+
+int BufferQueueCore::getSlotCountLocked(BufferSlot::BufferState state,
+        int maxBufferCount) const {
+    return int(getSlotsLocked(state, maxBufferCount).count());
+}
+
+int BufferQueueCore::getOldestFreeSlotLocked(BitSet64 slots) const {
+    // Usually only a couple of slots are FREE, visit just those
+    BitSet64 candidates(slots.value & mSlotStates[BufferSlot::FREE].value);
+    int found = INVALID_BUFFER_SLOT;
+    while (!candidates.isEmpty()) {
+        int s = int(candidates.clearFirstMarkedBit());
+        if (found == INVALID_BUFFER_SLOT ||
+                mSlots[s].mFrameNumber < mSlots[found].mFrameNumber) {
+            found = s;
+        }
+    }
+    return found;
+}
+
+BitSet64 BufferQueueCore::firstSlots(int count) {
+    // BitSet64 stores slot 0 in the most significant bit
+    if (count <= 0) {
+        return BitSet64();
+    } else if (count >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
+        return BitSet64(~0ULL);
+    }
+    return BitSet64(~(~0ULL >> count));
+}
+
 } // namespace android
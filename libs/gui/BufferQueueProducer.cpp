@@ -93,11 +93,9 @@ status_t BufferQueueProducer::setBufferCount(int bufferCount) {
         }
 
         // There must be no dequeued buffers when changing the buffer count.
-        for (int s = 0; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
-            if (mSlots[s].mBufferState == BufferSlot::DEQUEUED) {
-                BQ_LOGE("setBufferCount: buffer owned by producer");
-                return BAD_VALUE;
-            }
+        if (!mCore->mSlotStates[BufferSlot::DEQUEUED].isEmpty()) {
+            BQ_LOGE("setBufferCount: buffer owned by producer");
+            return BAD_VALUE;
         }
 
         if (bufferCount == 0) {
@@ -132,7 +130,7 @@ status_t BufferQueueProducer::setBufferCount(int bufferCount) {
 }
 
 status_t BufferQueueProducer::waitForFreeSlotThenRelock(const char* caller,
-        bool async, int* found, status_t* returnFlags) const {
+        bool async, bool canBlock, int* found, status_t* returnFlags) const {
     bool tryAgain = true;
     while (tryAgain) {
         if (mCore->mIsAbandoned) {
@@ -153,39 +151,24 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(const char* caller,
         }
 
         // Free up any buffers that are in slots beyond the max buffer count
-        for (int s = maxBufferCount; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
+        const BitSet64 slots(BufferQueueCore::firstSlots(maxBufferCount));
+        BitSet64 beyondMax(mCore->mSlotsWithBuffers.value & ~slots.value);
+        while (!beyondMax.isEmpty()) {
+            int s = int(beyondMax.clearFirstMarkedBit());
             assert(mSlots[s].mBufferState == BufferSlot::FREE);
-            if (mSlots[s].mGraphicBuffer != NULL) {
-                mCore->freeBufferLocked(s);
-                *returnFlags |= RELEASE_ALL_BUFFERS;
-            }
+            mCore->freeBufferLocked(s);
+            *returnFlags |= RELEASE_ALL_BUFFERS;
         }
 
-        // Look for a free buffer to give to the client
-        *found = BufferQueueCore::INVALID_BUFFER_SLOT;
-        int dequeuedCount = 0;
-        int acquiredCount = 0;
-        for (int s = 0; s < maxBufferCount; ++s) {
-            switch (mSlots[s].mBufferState) {
-                case BufferSlot::DEQUEUED:
-                    ++dequeuedCount;
-                    break;
-                case BufferSlot::ACQUIRED:
-                    ++acquiredCount;
-                    break;
-                case BufferSlot::FREE:
-                    // We return the oldest of the free buffers to avoid
-                    // stalling the producer if possible, since the consumer
-                    // may still have pending reads of in-flight buffers
-                    if (*found == BufferQueueCore::INVALID_BUFFER_SLOT ||
-                            mSlots[s].mFrameNumber < mSlots[*found].mFrameNumber) {
-                        *found = s;
-                    }
-                    break;
-                default:
-                    break;
-            }
-        }
+        // Look for a free buffer to give to the client. We return the oldest
+        // of the free buffers to avoid stalling the producer if possible,
+        // since the consumer may still have pending reads of in-flight
+        // buffers
+        *found = mCore->getOldestFreeSlotLocked(slots);
+        const int dequeuedCount = mCore->getSlotCountLocked(
+                BufferSlot::DEQUEUED, maxBufferCount);
+        const int acquiredCount = mCore->getSlotCountLocked(
+                BufferSlot::ACQUIRED, maxBufferCount);
 
         // Producers are not allowed to dequeue more than one buffer if they
         // did not set a buffer count
@@ -237,8 +220,8 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(const char* caller,
             // buffer (which could cause us to have to wait here), which is
             // okay, since it is only used to implement an atomic acquire +
             // release (e.g., in GLConsumer::updateTexImage())
-            if (mCore->mDequeueBufferCannotBlock &&
-                    (acquiredCount <= mCore->mMaxAcquiredBufferCount)) {
+            if (!canBlock || (mCore->mDequeueBufferCannotBlock &&
+                    (acquiredCount <= mCore->mMaxAcquiredBufferCount))) {
                 return WOULD_BLOCK;
             }
             mCore->mDequeueCondition.wait(mCore->mMutex);
@@ -252,6 +235,14 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         sp<android::Fence> *outFence, bool async,
         uint32_t width, uint32_t height, uint32_t format, uint32_t usage) {
     ATRACE_CALL();
+    return doDequeueBuffer(outSlot, outFence, async, width, height, format,
+            usage, true);
+}
+
+status_t BufferQueueProducer::doDequeueBuffer(int *outSlot,
+        sp<android::Fence> *outFence, bool async,
+        uint32_t width, uint32_t height, uint32_t format, uint32_t usage,
+        bool canBlock) {
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mConsumerName = mCore->mConsumerName;
@@ -283,7 +274,7 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
 
         int found;
         status_t status = waitForFreeSlotThenRelock("dequeueBuffer", async,
-                &found, &returnFlags);
+                canBlock, &found, &returnFlags);
         if (status != NO_ERROR) {
             return status;
         }
@@ -305,7 +296,7 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
             height = mCore->mDefaultHeight;
         }
 
-        mSlots[found].mBufferState = BufferSlot::DEQUEUED;
+        mCore->setBufferStateLocked(found, BufferSlot::DEQUEUED);
 
         const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
         if ((buffer == NULL) ||
@@ -315,7 +306,7 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
                 ((static_cast<uint32_t>(buffer->usage) & usage) != usage))
         {
             mSlots[found].mAcquireCalled = false;
-            mSlots[found].mGraphicBuffer = NULL;
+            mCore->setGraphicBufferLocked(found, NULL);
             mSlots[found].mRequestBufferCalled = false;
             mSlots[found].mEglDisplay = EGL_NO_DISPLAY;
             mSlots[found].mEglFence = EGL_NO_SYNC_KHR;
@@ -356,7 +347,7 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
             }
 
             mSlots[*outSlot].mFrameNumber = UINT32_MAX;
-            mSlots[*outSlot].mGraphicBuffer = graphicBuffer;
+            mCore->setGraphicBufferLocked(*outSlot, graphicBuffer);
         } // Autolock scope
     }
 
@@ -439,16 +430,7 @@ status_t BufferQueueProducer::detachNextBuffer(sp<GraphicBuffer>* outBuffer,
     }
 
     // Find the oldest valid slot
-    int found = BufferQueueCore::INVALID_BUFFER_SLOT;
-    for (int s = 0; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
-        if (mSlots[s].mBufferState == BufferSlot::FREE &&
-                mSlots[s].mGraphicBuffer != NULL) {
-            if (found == BufferQueueCore::INVALID_BUFFER_SLOT ||
-                    mSlots[s].mFrameNumber < mSlots[found].mFrameNumber) {
-                found = s;
-            }
-        }
-    }
+    int found = mCore->getOldestFreeSlotLocked(mCore->mSlotsWithBuffers);
 
     if (found == BufferQueueCore::INVALID_BUFFER_SLOT) {
         return NO_MEMORY;
@@ -484,7 +466,7 @@ status_t BufferQueueProducer::attachBuffer(int* outSlot,
     // unlikely that buffers which we are attaching to a BufferQueue will
     // be asynchronous (droppable), but it may not be impossible.
     status_t status = waitForFreeSlotThenRelock("attachBuffer(P)", false,
-            &found, &returnFlags);
+            true, &found, &returnFlags);
     if (status != NO_ERROR) {
         return status;
     }
@@ -500,8 +482,8 @@ status_t BufferQueueProducer::attachBuffer(int* outSlot,
     BQ_LOGV("attachBuffer(P): returning slot %d flags=%#x",
             *outSlot, returnFlags);
 
-    mSlots[*outSlot].mGraphicBuffer = buffer;
-    mSlots[*outSlot].mBufferState = BufferSlot::DEQUEUED;
+    mCore->setGraphicBufferLocked(*outSlot, buffer);
+    mCore->setBufferStateLocked(*outSlot, BufferSlot::DEQUEUED);
     mSlots[*outSlot].mEglFence = EGL_NO_SYNC_KHR;
     mSlots[*outSlot].mFence = Fence::NO_FENCE;
     mSlots[*outSlot].mRequestBufferCalled = true;
@@ -598,7 +580,7 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         }
 
         mSlots[slot].mFence = fence;
-        mSlots[slot].mBufferState = BufferSlot::QUEUED;
+        mCore->setBufferStateLocked(slot, BufferSlot::QUEUED);
         ++mCore->mFrameCounter;
         mSlots[slot].mFrameNumber = mCore->mFrameCounter;
 
@@ -627,12 +609,13 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         } else {
             // When the queue is not empty, we need to look at the front buffer
             // state to see if we need to replace it
-            BufferQueueCore::Fifo::iterator front(mCore->mQueue.begin());
+            BufferItem* front = &mCore->mQueue.front();
             if (front->mIsDroppable) {
                 // If the front queued buffer is still being tracked, we first
                 // mark it as freed
                 if (mCore->stillTracking(front)) {
-                    mSlots[front->mSlot].mBufferState = BufferSlot::FREE;
+                    mCore->setBufferStateLocked(front->mSlot,
+                            BufferSlot::FREE);
                     // Reset the frame number of the freed buffer so that it is
                     // the first in line to be dequeued again
                     mSlots[front->mSlot].mFrameNumber = 0;
@@ -693,6 +676,31 @@ status_t BufferQueueProducer::queueBuffer(int slot,
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        bool async, uint32_t width, uint32_t height, uint32_t format,
+        uint32_t usage, int* outSlot, sp<Fence>* outFence,
+        sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult) {
+    ATRACE_CALL();
+    *outDequeueResult = INVALID_OPERATION;
+    status_t result = queueBuffer(slot, input, output);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    status_t dequeueResult = doDequeueBuffer(outSlot, outFence, async,
+            width, height, format, usage, false);
+    if (dequeueResult >= 0 &&
+            (dequeueResult & BUFFER_NEEDS_REALLOCATION)) {
+        // Save the client the requestBuffer round trip
+        if (requestBuffer(*outSlot, outBuffer) != NO_ERROR) {
+            outBuffer->clear();
+        }
+    }
+    *outDequeueResult = dequeueResult;
+    return result;
+}
+
 void BufferQueueProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     ATRACE_CALL();
     BQ_LOGV("cancelBuffer: slot %d", slot);
@@ -716,7 +724,7 @@ void BufferQueueProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
         return;
     }
 
-    mSlots[slot].mBufferState = BufferSlot::FREE;
+    mCore->setBufferStateLocked(slot, BufferSlot::FREE);
     mSlots[slot].mFrameNumber = 0;
     mSlots[slot].mFence = fence;
     mCore->mDequeueCondition.broadcast();
@@ -927,19 +935,18 @@ void BufferQueueProducer::allocateBuffers(bool async, uint32_t width,
             Mutex::Autolock lock(mCore->mMutex);
             mCore->waitWhileAllocatingLocked();
 
-            int currentBufferCount = 0;
-            for (int slot = 0; slot < BufferQueueDefs::NUM_BUFFER_SLOTS; ++slot) {
-                if (mSlots[slot].mGraphicBuffer != NULL) {
-                    ++currentBufferCount;
-                } else {
-                    if (mSlots[slot].mBufferState != BufferSlot::FREE) {
-                        BQ_LOGE("allocateBuffers: slot %d without buffer is not FREE",
-                                slot);
-                        continue;
-                    }
-
-                    freeSlots.push_back(slot);
+            const int currentBufferCount =
+                    int(mCore->mSlotsWithBuffers.count());
+            BitSet64 emptySlots(~mCore->mSlotsWithBuffers.value);
+            while (!emptySlots.isEmpty()) {
+                int slot = int(emptySlots.clearFirstMarkedBit());
+                if (mSlots[slot].mBufferState != BufferSlot::FREE) {
+                    BQ_LOGE("allocateBuffers: slot %d without buffer is not FREE",
+                            slot);
+                    continue;
                 }
+
+                freeSlots.push_back(slot);
             }
 
             int maxBufferCount = mCore->getMaxBufferCountLocked(async);
@@ -1001,7 +1008,7 @@ void BufferQueueProducer::allocateBuffers(bool async, uint32_t width,
                     continue;
                 }
                 mCore->freeBufferLocked(slot); // Clean up the slot first
-                mSlots[slot].mGraphicBuffer = buffers[i];
+                mCore->setGraphicBufferLocked(slot, buffers[i]);
                 mSlots[slot].mFrameNumber = 0;
                 mSlots[slot].mFence = Fence::NO_FENCE;
                 BQ_LOGV("allocateBuffers: allocated a new buffer in slot %d", slot);
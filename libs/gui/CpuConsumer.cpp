@@ -18,9 +18,13 @@
 #define LOG_TAG "CpuConsumer"
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <string.h>
+
 #include <cutils/compiler.h>
 #include <utils/Log.h>
 #include <gui/CpuConsumer.h>
+#include <gui/YuvConverter.h>
+#include <utils/Trace.h>
 
 #define CC_LOGV(x, ...) ALOGV("[%s] "x, mName.string(), ##__VA_ARGS__)
 #define CC_LOGD(x, ...) ALOGD("[%s] "x, mName.string(), ##__VA_ARGS__)
@@ -30,11 +34,84 @@
 
 namespace android {
 
+// Frames with fewer converted rows than this are converted by the calling
+// thread alone.
+static const uint32_t MIN_ROWS_TO_SPLIT = 64;
+
+// Runs one YuvConverter::toRgba call at a time for lockNextConvertedBuffer.
+class CpuConsumer::ConversionThread : public Thread {
+public:
+    ConversionThread() : Thread(false), mPending(false), mResult(NO_ERROR),
+            mScale(1), mFirstRow(0), mNumRows(0), mDst(NULL), mDstStride(0) {
+        memset(&mSrc, 0, sizeof(mSrc));
+    }
+
+    void post(const YuvConverter::Planes& src, uint32_t scale,
+            uint32_t firstRow, uint32_t numRows, uint8_t* dst,
+            uint32_t dstStride) {
+        Mutex::Autolock _l(mMutex);
+        mSrc = src;
+        mScale = scale;
+        mFirstRow = firstRow;
+        mNumRows = numRows;
+        mDst = dst;
+        mDstStride = dstStride;
+        mPending = true;
+        mCondition.broadcast();
+    }
+
+    status_t wait() {
+        Mutex::Autolock _l(mMutex);
+        while (mPending) {
+            mCondition.wait(mMutex);
+        }
+        return mResult;
+    }
+
+    virtual void requestExit() {
+        Thread::requestExit();
+        Mutex::Autolock _l(mMutex);
+        mCondition.broadcast();
+    }
+
+private:
+    virtual bool threadLoop() {
+        Mutex::Autolock _l(mMutex);
+        while (!mPending) {
+            if (exitPending()) {
+                return false;
+            }
+            mCondition.wait(mMutex);
+        }
+        // The job doesn't change until we clear mPending.
+        mMutex.unlock();
+        status_t result = YuvConverter::toRgba(mSrc, mScale, mFirstRow,
+                mNumRows, mDst, mDstStride);
+        mMutex.lock();
+        mResult = result;
+        mPending = false;
+        mCondition.broadcast();
+        return true;
+    }
+
+    Mutex mMutex;
+    Condition mCondition;
+    bool mPending;
+    status_t mResult;
+    YuvConverter::Planes mSrc;
+    uint32_t mScale;
+    uint32_t mFirstRow;
+    uint32_t mNumRows;
+    uint8_t* mDst;
+    uint32_t mDstStride;
+};
+
 CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
         uint32_t maxLockedBuffers, bool controlledByApp) :
     ConsumerBase(bq, controlledByApp),
     mMaxLockedBuffers(maxLockedBuffers),
-    mCurrentLockedBuffers(0)
+    mCurrentLockedBuffers(0),
+    mCurrentConvertedBuffers(0)
 {
     // Create tracking entries for locked buffers
     mAcquiredBuffers.insertAt(0, maxLockedBuffers);
@@ -44,7 +121,14 @@ CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
 }
 
 CpuConsumer::~CpuConsumer() {
-    // ConsumerBase destructor does all the work.
+    // ConsumerBase destructor does all the work, but for the conversion.
+    if (mConversionThread != NULL) {
+        mConversionThread->requestExit();
+        mConversionThread->join();
+    }
+    for (size_t i = 0; i < mConversionBuffers.size(); i++) {
+        delete[] mConversionBuffers[i].mData;
+    }
 }
 
 
@@ -229,6 +313,136 @@ status_t CpuConsumer::unlockBuffer(const LockedBuffer &nativeBuffer) {
     return releaseAcquiredBufferLocked(lockedIdx);
 }
 
+status_t CpuConsumer::lockNextConvertedBuffer(ConvertedBuffer *convertedBuffer,
+        uint32_t scale) {
+    ATRACE_CALL();
+    if (!convertedBuffer || (scale != 1 && scale != 2 && scale != 4)) {
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock _c(mConversionMutex);
+    {
+        Mutex::Autolock _l(mMutex);
+        if (mCurrentConvertedBuffers == mMaxLockedBuffers) {
+            CC_LOGW("Max converted buffers have been locked (%d), cannot "
+                    "lock anymore.", mMaxLockedBuffers);
+            return NOT_ENOUGH_DATA;
+        }
+    }
+
+    LockedBuffer src;
+    status_t err = lockNextBuffer(&src);
+    if (err != OK) {
+        return err;
+    }
+    if (src.flexFormat != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+        CC_LOGE("Can't convert buffers of format %#x", src.format);
+        unlockBuffer(src);
+        return INVALID_OPERATION;
+    }
+
+    // Only convert the crop rectangle, decoders often align the buffer
+    // size beyond the picture
+    Rect crop(src.width, src.height);
+    Rect cropped;
+    if (src.crop.intersect(crop, &cropped)) {
+        crop = cropped;
+    }
+    crop.left &= ~1;
+    crop.top &= ~1;
+
+    const uint32_t width = YuvConverter::getScaledSize(crop.width(), scale);
+    const uint32_t height = YuvConverter::getScaledSize(crop.height(), scale);
+    const size_t size = size_t(width) * height * 4;
+
+    // Find a free destination buffer, preferably one that is big enough
+    ConversionBuffer* dst = NULL;
+    {
+        Mutex::Autolock _l(mMutex);
+        for (size_t i = 0; i < mConversionBuffers.size(); i++) {
+            ConversionBuffer& cb = mConversionBuffers.editItemAt(i);
+            if (!cb.mLocked && (dst == NULL || cb.mSize >= size)) {
+                dst = &cb;
+            }
+        }
+        if (dst == NULL) {
+            mConversionBuffers.push(ConversionBuffer());
+            dst = &mConversionBuffers.editTop();
+        }
+        if (dst->mSize < size) {
+            delete[] dst->mData;
+            dst->mData = new uint8_t[size];
+            dst->mSize = size;
+        }
+        dst->mLocked = true;
+        mCurrentConvertedBuffers++;
+    }
+    uint8_t* data = dst->mData;
+
+    const size_t chromaOffset = size_t(crop.top / 2) * src.chromaStride +
+            size_t(crop.left / 2) * src.chromaStep;
+    YuvConverter::Planes planes;
+    planes.y = src.data + size_t(crop.top) * src.stride + crop.left;
+    planes.cb = src.dataCb + chromaOffset;
+    planes.cr = src.dataCr + chromaOffset;
+    planes.width = crop.width();
+    planes.height = crop.height();
+    planes.yStride = src.stride;
+    planes.chromaStride = src.chromaStride;
+    planes.chromaStep = src.chromaStep;
+
+    // The worker thread converts the bottom half while we do the top one.
+    uint32_t numRows = height;
+    if (height >= MIN_ROWS_TO_SPLIT) {
+        if (mConversionThread == NULL) {
+            mConversionThread = new ConversionThread();
+            mConversionThread->run("CpuConsumerConversion");
+        }
+        numRows = height / 2;
+        mConversionThread->post(planes, scale, numRows, height - numRows,
+                data + size_t(numRows) * width * 4, width);
+    }
+    err = YuvConverter::toRgba(planes, scale, 0, numRows, data, width);
+    if (numRows != height) {
+        status_t workerErr = mConversionThread->wait();
+        if (err == NO_ERROR) {
+            err = workerErr;
+        }
+    }
+    unlockBuffer(src);
+
+    if (err != NO_ERROR) {
+        CC_LOGE("Unable to convert buffer: %s (%d)", strerror(-err), err);
+        Mutex::Autolock _l(mMutex);
+        dst->mLocked = false;
+        mCurrentConvertedBuffers--;
+        return err;
+    }
+
+    convertedBuffer->data        = data;
+    convertedBuffer->width       = width;
+    convertedBuffer->height      = height;
+    convertedBuffer->stride      = width;
+    convertedBuffer->timestamp   = src.timestamp;
+    convertedBuffer->frameNumber = src.frameNumber;
+    return OK;
+}
+
+status_t CpuConsumer::unlockConvertedBuffer(
+        const ConvertedBuffer &convertedBuffer) {
+    Mutex::Autolock _l(mMutex);
+    for (size_t i = 0; i < mConversionBuffers.size(); i++) {
+        ConversionBuffer& cb = mConversionBuffers.editItemAt(i);
+        if (cb.mLocked && cb.mData == convertedBuffer.data) {
+            cb.mLocked = false;
+            mCurrentConvertedBuffers--;
+            return OK;
+        }
+    }
+    CC_LOGE("%s: Can't find buffer to free", __FUNCTION__);
+    return BAD_VALUE;
+}
+
 status_t CpuConsumer::releaseAcquiredBufferLocked(int lockedIdx) {
     status_t err;
     int fd = -1;
@@ -20,6 +20,7 @@
 
 #include <gui/BitTube.h>
 #include <gui/DisplayEventReceiver.h>
+#include <gui/EventRing.h>
 #include <gui/IDisplayEventConnection.h>
 #include <gui/ISurfaceComposer.h>
 
@@ -36,7 +37,13 @@ DisplayEventReceiver::DisplayEventReceiver() {
     if (sf != NULL) {
         mEventConnection = sf->createDisplayEventConnection();
         if (mEventConnection != NULL) {
-            mDataChannel = mEventConnection->getDataChannel();
+            mEventRing = mEventConnection->getEventRing();
+            if (mEventRing != NULL && mEventRing->initCheck() != NO_ERROR) {
+                mEventRing.clear();
+            }
+            if (mEventRing == NULL) {
+                mDataChannel = mEventConnection->getDataChannel();
+            }
         }
     }
 }
@@ -45,12 +52,15 @@ DisplayEventReceiver::~DisplayEventReceiver() {
 }
 
 status_t DisplayEventReceiver::initCheck() const {
-    if (mDataChannel != NULL)
+    if (mDataChannel != NULL || mEventRing != NULL)
         return NO_ERROR;
     return NO_INIT;
 }
 
 int DisplayEventReceiver::getFd() const {
+    if (mEventRing != NULL)
+        return mEventRing->getFd();
+
     if (mDataChannel == NULL)
         return NO_INIT;
 
@@ -76,9 +86,20 @@ status_t DisplayEventReceiver::requestNextVsync() {
     return NO_INIT;
 }
 
+status_t DisplayEventReceiver::setVsyncPhaseOffset(nsecs_t offset) {
+    if (mEventConnection != NULL) {
+        mEventConnection->setVsyncPhaseOffset(offset);
+        return NO_ERROR;
+    }
+    return NO_INIT;
+}
+
 
 ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
         size_t count) {
+    if (mEventRing != NULL) {
+        return DisplayEventReceiver::getEvents(mEventRing, events, count);
+    }
     return DisplayEventReceiver::getEvents(mDataChannel, events, count);
 }
 
@@ -88,12 +109,24 @@ ssize_t DisplayEventReceiver::getEvents(const sp<BitTube>& dataChannel,
     return BitTube::recvObjects(dataChannel, events, count);
 }
 
+ssize_t DisplayEventReceiver::getEvents(const sp<EventRing>& eventRing,
+        Event* events, size_t count)
+{
+    return EventRing::recvObjects(eventRing, events, count);
+}
+
 ssize_t DisplayEventReceiver::sendEvents(const sp<BitTube>& dataChannel,
         Event const* events, size_t count)
 {
     return BitTube::sendObjects(dataChannel, events, count);
 }
 
+ssize_t DisplayEventReceiver::sendEvents(const sp<EventRing>& eventRing,
+        Event const* events, size_t count)
+{
+    return EventRing::sendObjects(eventRing, events, count);
+}
+
 // ---------------------------------------------------------------------------
 
 }; // namespace android
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "GLConsumer"
+
+#define EGL_EGLEXT_PROTOTYPES
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <ui/PixelFormat.h>
+
+#include <utils/Log.h>
+#include <utils/Singleton.h>
+#include <utils/String8.h>
+
+#include <private/gui/EglImageCache.h>
+
+namespace android {
+
+ANDROID_SINGLETON_STATIC_INSTANCE(EglImageCache);
+
+// Images are created with a matching eglInitialize, see
+// GLConsumer::EglImage::createImage.
+static void destroyImage(EGLDisplay dpy, EGLImageKHR image) {
+    if (!eglDestroyImageKHR(dpy, image)) {
+        ALOGE("EglImageCache: eglDestroyImageKHR failed");
+    }
+    eglTerminate(dpy);
+}
+
+EglImageCache::Key::Key(EGLDisplay dpy, const sp<GraphicBuffer>& buffer,
+        const Rect& crop) :
+    mBufferId(buffer->getId()),
+    mDisplay(dpy),
+    mCrop(crop) {
+}
+
+bool EglImageCache::Key::operator < (const Key& rhs) const {
+    if (mBufferId != rhs.mBufferId) {
+        return mBufferId < rhs.mBufferId;
+    }
+    if (mDisplay != rhs.mDisplay) {
+        return uintptr_t(mDisplay) < uintptr_t(rhs.mDisplay);
+    }
+    if (mCrop.left != rhs.mCrop.left) {
+        return mCrop.left < rhs.mCrop.left;
+    }
+    if (mCrop.top != rhs.mCrop.top) {
+        return mCrop.top < rhs.mCrop.top;
+    }
+    if (mCrop.right != rhs.mCrop.right) {
+        return mCrop.right < rhs.mCrop.right;
+    }
+    return mCrop.bottom < rhs.mCrop.bottom;
+}
+
+EglImageCache::EglImageCache() : Singleton<EglImageCache>(),
+    mNumUnused(0),
+    mUnusedBytes(0),
+    mUseCounter(0),
+    mHits(0),
+    mMisses(0),
+    mEvictions(0) {
+}
+
+size_t EglImageCache::getBufferSize(const sp<GraphicBuffer>& buffer) {
+    // YUV formats are unknown to bytesPerPixel, count them as 32 bits per
+    // pixel, which is more than they take.
+    ssize_t bpp = bytesPerPixel(buffer->getPixelFormat());
+    if (bpp <= 0) {
+        bpp = 4;
+    }
+    return size_t(buffer->getStride()) * buffer->getHeight() * bpp;
+}
+
+EGLImageKHR EglImageCache::acquire(EGLDisplay dpy,
+        const sp<GraphicBuffer>& buffer, const Rect& crop) {
+    Mutex::Autolock lock(mMutex);
+    ssize_t index = mEntries.indexOfKey(Key(dpy, buffer, crop));
+    if (index < 0) {
+        mMisses++;
+        return EGL_NO_IMAGE_KHR;
+    }
+    mHits++;
+    Entry& entry(mEntries.editValueAt(index));
+    if (entry.mRefs++ == 0) {
+        mNumUnused--;
+        mUnusedBytes -= entry.mBytes;
+    }
+    return entry.mImage;
+}
+
+EGLImageKHR EglImageCache::add(EGLDisplay dpy,
+        const sp<GraphicBuffer>& buffer, const Rect& crop, EGLImageKHR image) {
+    Mutex::Autolock lock(mMutex);
+    const Key key(dpy, buffer, crop);
+    ssize_t index = mEntries.indexOfKey(key);
+    if (index >= 0) {
+        // Someone else created the same image meanwhile, use theirs.
+        destroyImage(dpy, image);
+        Entry& entry(mEntries.editValueAt(index));
+        if (entry.mRefs++ == 0) {
+            mNumUnused--;
+            mUnusedBytes -= entry.mBytes;
+        }
+        return entry.mImage;
+    }
+    mEntries.add(key, Entry(image, mUseCounter++, getBufferSize(buffer)));
+    return image;
+}
+
+void EglImageCache::release(EGLDisplay dpy, const sp<GraphicBuffer>& buffer,
+        const Rect& crop, bool discard) {
+    Mutex::Autolock lock(mMutex);
+    ssize_t index = mEntries.indexOfKey(Key(dpy, buffer, crop));
+    if (index < 0) {
+        ALOGE("EglImageCache: releasing an image that isn't cached");
+        return;
+    }
+    Entry& entry(mEntries.editValueAt(index));
+    if (--entry.mRefs > 0) {
+        return;
+    }
+    if (discard || entry.mDiscard) {
+        removeLocked(index);
+        return;
+    }
+    entry.mLastUse = mUseCounter++;
+    mNumUnused++;
+    mUnusedBytes += entry.mBytes;
+    trimLocked();
+}
+
+void EglImageCache::discardBuffer(const sp<GraphicBuffer>& buffer) {
+    Mutex::Autolock lock(mMutex);
+    const uint64_t id = buffer->getId();
+    for (size_t i = mEntries.size(); i > 0; i--) {
+        if (mEntries.keyAt(i - 1).mBufferId != id) {
+            continue;
+        }
+        Entry& entry(mEntries.editValueAt(i - 1));
+        if (entry.mRefs > 0) {
+            entry.mDiscard = true;
+        } else {
+            mNumUnused--;
+            mUnusedBytes -= entry.mBytes;
+            removeLocked(i - 1);
+        }
+    }
+}
+
+void EglImageCache::removeLocked(size_t index) {
+    const Key& key(mEntries.keyAt(index));
+    destroyImage(key.mDisplay, mEntries.valueAt(index).mImage);
+    mEntries.removeItemsAt(index);
+}
+
+void EglImageCache::trimLocked() {
+    while (mUnusedBytes > MAX_UNUSED_BYTES) {
+        ssize_t oldest = -1;
+        for (size_t i = 0; i < mEntries.size(); i++) {
+            const Entry& entry(mEntries.valueAt(i));
+            if (entry.mRefs == 0 && (oldest < 0 ||
+                    entry.mLastUse < mEntries.valueAt(oldest).mLastUse)) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0) {
+            break;
+        }
+        mNumUnused--;
+        mUnusedBytes -= mEntries.valueAt(oldest).mBytes;
+        removeLocked(oldest);
+        mEvictions++;
+    }
+}
+
+void EglImageCache::dump(String8& result, const char* prefix) const {
+    Mutex::Autolock lock(mMutex);
+    const uint64_t lookups = mHits + mMisses;
+    result.appendFormat("%sEGLImage cache: %zu images (%zu unused, "
+            "%.1f MB), %llu hits, %llu misses (%.1f%% hit rate), "
+            "%llu evictions\n",
+            prefix, mEntries.size(), mNumUnused,
+            mUnusedBytes / (1024.0 * 1024.0),
+            (unsigned long long)mHits, (unsigned long long)mMisses,
+            lookups ? 100.0 * mHits / lookups : 0.0,
+            (unsigned long long)mEvictions);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
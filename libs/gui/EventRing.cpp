@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+
+#include <utils/Errors.h>
+
+#include <binder/Parcel.h>
+
+#include <gui/BitTube.h>
+#include <gui/EventRing.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Bounds on what we accept from a parcel, the default socket buffer of a
+// BitTube is 4KB.
+static const size_t MAX_OBJECT_SIZE = 4 * 1024;
+static const size_t MAX_CAPACITY = 1024;
+
+// head and tail are on separate cache lines, the producer and consumer each
+// write one of them.
+struct EventRing::Header {
+    // number of objects written, only written by the producer
+    volatile int32_t head;
+    uint8_t reserved0[60];
+    // number of objects read, only written by the consumer
+    volatile int32_t tail;
+    uint8_t reserved1[60];
+};
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+EventRing::EventRing(size_t objSize, size_t capacity,
+        const sp<BitTube>& wakeupChannel)
+    : mMemFd(-1), mWakeupChannel(wakeupChannel), mObjSize(objSize),
+      mCapacity(roundUpToPowerOfTwo(capacity)), mMapSize(0),
+      mHeader(NULL), mData(NULL), mHead(0), mTail(0),
+      mMaybeSignaled(true), mStatus(NO_INIT)
+{
+    if (objSize == 0 || objSize > MAX_OBJECT_SIZE ||
+            mCapacity > MAX_CAPACITY || mWakeupChannel == NULL) {
+        mStatus = BAD_VALUE;
+        return;
+    }
+    if (mWakeupChannel->initCheck() != NO_ERROR) {
+        mStatus = mWakeupChannel->initCheck();
+        return;
+    }
+    const size_t size = sizeof(Header) + mObjSize * mCapacity;
+    mMapSize = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+
+    mMemFd = ashmem_create_region("EventRing", mMapSize);
+    if (mMemFd < 0) {
+        mStatus = -errno;
+        ALOGE("EventRing: can't create a %zu bytes region (%s)", mMapSize,
+                strerror(-mStatus));
+        return;
+    }
+    mStatus = map(mMemFd, true);
+}
+
+EventRing::EventRing(const Parcel& data)
+    : mMemFd(-1), mObjSize(0), mCapacity(0), mMapSize(0),
+      mHeader(NULL), mData(NULL), mHead(0), mTail(0),
+      mMaybeSignaled(true), mStatus(NO_INIT)
+{
+    mMemFd = dup(data.readFileDescriptor());
+    mObjSize = data.readInt32();
+    mCapacity = data.readInt32();
+    mWakeupChannel = new BitTube(data);
+    if (mMemFd < 0) {
+        mStatus = -errno;
+        ALOGE("EventRing(Parcel): can't dup filedescriptor (%s)",
+                strerror(-mStatus));
+        return;
+    }
+    if (mWakeupChannel->initCheck() != NO_ERROR) {
+        mStatus = mWakeupChannel->initCheck();
+        return;
+    }
+    if (mObjSize == 0 || mObjSize > MAX_OBJECT_SIZE || mCapacity == 0 ||
+            mCapacity > MAX_CAPACITY || (mCapacity & (mCapacity - 1))) {
+        ALOGE("EventRing(Parcel): invalid geometry (%zu objects of %zu "
+                "bytes)", mCapacity, mObjSize);
+        mStatus = BAD_VALUE;
+        return;
+    }
+    const size_t size = sizeof(Header) + mObjSize * mCapacity;
+    mMapSize = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+    int regionSize = ashmem_get_size_region(mMemFd);
+    if (regionSize < 0 || size_t(regionSize) < mMapSize) {
+        ALOGE("EventRing(Parcel): region too small (%d bytes)", regionSize);
+        mStatus = BAD_VALUE;
+        return;
+    }
+    mStatus = map(mMemFd, false);
+    // the mapping keeps the region alive
+    close(mMemFd);
+    mMemFd = -1;
+}
+
+EventRing::~EventRing()
+{
+    if (mHeader != NULL)
+        munmap(mHeader, mMapSize);
+
+    if (mMemFd >= 0)
+        close(mMemFd);
+}
+
+status_t EventRing::map(int memFd, bool producer)
+{
+    void* base = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+            memFd, 0);
+    if (base == MAP_FAILED) {
+        status_t err = -errno;
+        ALOGE("EventRing: can't map the region (%s)", strerror(-err));
+        return err;
+    }
+    mHeader = static_cast<Header*>(base);
+    mData = static_cast<uint8_t*>(base) + sizeof(Header);
+    if (producer) {
+        mHeader->head = 0;
+        mHeader->tail = 0;
+    } else {
+        // the producer may already have queued objects
+        mTail = uint32_t(android_atomic_acquire_load(&mHeader->tail));
+    }
+    return NO_ERROR;
+}
+
+status_t EventRing::initCheck() const
+{
+    return mStatus;
+}
+
+int EventRing::getFd() const
+{
+    return mWakeupChannel != NULL ? mWakeupChannel->getFd() : -1;
+}
+
+void EventRing::wakeUp()
+{
+    // if the channel is full, the consumer has wakeups pending already
+    const uint8_t wakeup = 1;
+    BitTube::sendObjects(mWakeupChannel, &wakeup, 1);
+}
+
+void EventRing::drainWakeUps()
+{
+    uint8_t wakeup;
+    while (BitTube::recvObjects(mWakeupChannel, &wakeup, 1) > 0) {
+    }
+}
+
+ssize_t EventRing::write(void const* vaddr, size_t count, size_t objSize)
+{
+    if (mStatus != NO_ERROR) {
+        return mStatus;
+    }
+    if (objSize != mObjSize) {
+        return -EINVAL;
+    }
+
+    const uint32_t head = mHead;
+    const uint32_t tail = uint32_t(android_atomic_acquire_load(&mHeader->tail));
+    const uint32_t used = head - tail;
+    if (used > mCapacity) {
+        // the consumer has corrupted the ring
+        return -EPIPE;
+    }
+    if (count > mCapacity - used) {
+        return -EAGAIN;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(vaddr);
+    for (size_t i = 0; i < count; i++) {
+        const size_t index = (head + i) & (mCapacity - 1);
+        memcpy(mData + index * mObjSize, src + i * mObjSize, mObjSize);
+    }
+    mHead = head + count;
+    android_atomic_release_store(int32_t(mHead), &mHeader->head);
+
+    // Wake up the consumer if it had emptied the ring: it only drains the
+    // wakeups when it sees it empty, and checks the head again afterwards.
+    // With the barriers on both sides, either we see its tail or it sees
+    // our head.
+    android_memory_barrier();
+    if (uint32_t(android_atomic_acquire_load(&mHeader->tail)) == head) {
+        wakeUp();
+    }
+    return count;
+}
+
+ssize_t EventRing::read(void* vaddr, size_t count, size_t objSize)
+{
+    if (mStatus != NO_ERROR) {
+        return mStatus;
+    }
+    if (objSize != mObjSize) {
+        return -EINVAL;
+    }
+
+    uint8_t* dst = static_cast<uint8_t*>(vaddr);
+    size_t n = 0;
+    for (;;) {
+        const uint32_t head =
+                uint32_t(android_atomic_acquire_load(&mHeader->head));
+        const uint32_t available = head - mTail;
+        if (available > mCapacity) {
+            return -EPIPE;
+        }
+        const size_t m = (count - n) < available ? (count - n) : available;
+        for (size_t i = 0; i < m; i++) {
+            const size_t index = (mTail + i) & (mCapacity - 1);
+            memcpy(dst + (n + i) * mObjSize, mData + index * mObjSize,
+                    mObjSize);
+        }
+        mTail += m;
+        n += m;
+        android_atomic_release_store(int32_t(mTail), &mHeader->tail);
+        if (m) {
+            // the producer sends a wakeup when the ring goes non-empty
+            mMaybeSignaled = true;
+        }
+
+        // Drain the wakeups once the ring is empty, so that the consumer
+        // doesn't wake up again. If objects were queued meanwhile, their
+        // wakeup may have been drained: read them too, or leave the
+        // wakeups alone if there's no room for them.
+        if (mTail != head || n == count || !mMaybeSignaled) {
+            break;
+        }
+        android_memory_barrier();
+        if (uint32_t(android_atomic_acquire_load(&mHeader->head)) != mTail) {
+            continue;
+        }
+        drainWakeUps();
+        mMaybeSignaled = false;
+        android_memory_barrier();
+        if (uint32_t(android_atomic_acquire_load(&mHeader->head)) == mTail) {
+            break;
+        }
+    }
+    return n;
+}
+
+status_t EventRing::writeToParcel(Parcel* reply) const
+{
+    if (mStatus != NO_ERROR)
+        return mStatus;
+
+    status_t result = reply->writeDupFileDescriptor(mMemFd);
+    if (result == NO_ERROR) {
+        result = reply->writeInt32(int32_t(mObjSize));
+    }
+    if (result == NO_ERROR) {
+        result = reply->writeInt32(int32_t(mCapacity));
+    }
+    if (result == NO_ERROR) {
+        result = mWakeupChannel->writeToParcel(reply);
+    }
+    return result;
+}
+
+ssize_t EventRing::sendObjects(const sp<EventRing>& ring,
+        void const* events, size_t count, size_t objSize)
+{
+    return ring->write(events, count, objSize);
+}
+
+ssize_t EventRing::recvObjects(const sp<EventRing>& ring,
+        void* events, size_t count, size_t objSize)
+{
+    return ring->read(events, count, objSize);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
@@ -35,6 +35,7 @@
 #include <gui/SurfaceComposerClient.h>
 
 #include <private/gui/ComposerService.h>
+#include <private/gui/EglImageCache.h>
 #include <private/gui/SyncFeatures.h>
 
 #include <utils/Log.h>
@@ -116,6 +117,17 @@ static bool isEglImageCroppable(const Rect& crop) {
     return hasEglAndroidImageCrop() && (crop.left == 0 && crop.top == 0);
 }
 
+// Returns the crop that createImage actually sets on the EGLImage, images
+// are cached under that one.
+static Rect eglImageCrop(const Rect& crop) {
+    if (crop.isValid() && isEglImageCroppable(crop)) {
+        return crop;
+    }
+    Rect invalid;
+    invalid.makeInvalid();
+    return invalid;
+}
+
 GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t tex,
         uint32_t texTarget, bool useFenceSync, bool isControlledByApp) :
     ConsumerBase(bq, isControlledByApp),
@@ -341,15 +353,59 @@ status_t GLConsumer::acquireBufferLocked(BufferQueue::BufferItem *item,
 
     // If item->mGraphicBuffer is not null, this buffer has not been acquired
     // before, so any prior EglImage created is using a stale buffer. This
-    // replaces any old EglImage with a new one (using the new buffer).
+    // replaces any old EglImage with a new one (using the new buffer), unless
+    // prepareImage() already created one for it.
     if (item->mGraphicBuffer != NULL) {
         int slot = item->mBuf;
-        mEglSlots[slot].mEglImage = new EglImage(item->mGraphicBuffer);
+        const sp<EglImage>& image(mEglSlots[slot].mEglImage);
+        if (image == NULL || image->graphicBuffer() != item->mGraphicBuffer) {
+            mEglSlots[slot].mEglImage = new EglImage(item->mGraphicBuffer);
+        }
     }
 
     return NO_ERROR;
 }
 
+status_t GLConsumer::prepareImage(int slot, const sp<GraphicBuffer>& buffer,
+        const Rect& crop, uint64_t frameNumber) {
+    ATRACE_CALL();
+    if (slot < 0 || slot >= BufferQueue::NUM_BUFFER_SLOTS || buffer == NULL) {
+        return BAD_VALUE;
+    }
+
+    EGLDisplay dpy;
+    {
+        Mutex::Autolock lock(mMutex);
+        if (mAbandoned || !mAttached || mEglDisplay == EGL_NO_DISPLAY) {
+            return NO_INIT;
+        }
+        const sp<EglImage>& image(mEglSlots[slot].mEglImage);
+        if (frameNumber <= mSlots[slot].mFrameNumber ||
+                (image != NULL && image->graphicBuffer() == buffer)) {
+            // already acquired, already prepared, or acquired before
+            return NO_ERROR;
+        }
+        dpy = mEglDisplay;
+    }
+
+    sp<EglImage> image(new EglImage(buffer));
+    status_t err = image->createIfNeeded(dpy, crop);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    // As long as the frame isn't acquired, the slot is not in use by this
+    // GLConsumer and only holds a stale EglImage, if any. acquireBufferLocked
+    // checks that the image is for the right buffer.
+    if (mAbandoned || mEglDisplay != dpy ||
+            frameNumber <= mSlots[slot].mFrameNumber) {
+        return NO_ERROR;
+    }
+    mEglSlots[slot].mEglImage = image;
+    return NO_ERROR;
+}
+
 status_t GLConsumer::releaseBufferLocked(int buf,
         sp<GraphicBuffer> graphicBuffer,
         EGLDisplay display, EGLSyncKHR eglFence) {
@@ -996,6 +1052,12 @@ void GLConsumer::freeBufferLocked(int slotIndex) {
         mCurrentTexture = BufferQueue::INVALID_BUFFER_SLOT;
     }
     mEglSlots[slotIndex].mEglImage.clear();
+    // the EGLImages of the buffer would keep it alive once it's gone from
+    // the BufferQueue
+    if (mSlots[slotIndex].mGraphicBuffer != NULL) {
+        EglImageCache::getInstance().discardBuffer(
+                mSlots[slotIndex].mGraphicBuffer);
+    }
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
@@ -1036,6 +1098,8 @@ void GLConsumer::dumpLocked(String8& result, const char* prefix) const
        mCurrentCrop.top, mCurrentCrop.right, mCurrentCrop.bottom,
        mCurrentTransform);
 
+    EglImageCache::getInstance().dump(result, prefix);
+
     ConsumerBase::dumpLocked(result, prefix);
 }
 
@@ -1064,45 +1128,53 @@ static void mtxMul(float out[16], const float a[16], const float b[16]) {
 GLConsumer::EglImage::EglImage(sp<GraphicBuffer> graphicBuffer) :
     mGraphicBuffer(graphicBuffer),
     mEglImage(EGL_NO_IMAGE_KHR),
-    mEglDisplay(EGL_NO_DISPLAY) {
+    mEglDisplay(EGL_NO_DISPLAY),
+    mCached(false) {
 }
 
 GLConsumer::EglImage::~EglImage() {
     if (mEglImage != EGL_NO_IMAGE_KHR) {
-        if (!eglDestroyImageKHR(mEglDisplay, mEglImage)) {
-           ALOGE("~EglImage: eglDestroyImageKHR failed");
-        }
-        eglTerminate(mEglDisplay);
+        releaseImage(false);
     }
 }
 
 status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
                                               const Rect& cropRect,
                                               bool forceCreation) {
-    // If there's an image and it's no longer valid, destroy it.
+    // If there's an image and it's no longer valid, release it.
     bool haveImage = mEglImage != EGL_NO_IMAGE_KHR;
     bool displayInvalid = mEglDisplay != eglDisplay;
     bool cropInvalid = hasEglAndroidImageCrop() && mCropRect != cropRect;
     if (haveImage && (displayInvalid || cropInvalid || forceCreation)) {
-        if (!eglDestroyImageKHR(mEglDisplay, mEglImage)) {
-           ALOGE("createIfNeeded: eglDestroyImageKHR failed");
-        }
-        eglTerminate(mEglDisplay);
-        mEglImage = EGL_NO_IMAGE_KHR;
-        mEglDisplay = EGL_NO_DISPLAY;
+        releaseImage(forceCreation);
     }
 
-    // If there's no image, create one.
+    // If there's no image, look for one in the cache, or create one. A
+    // forced creation means the image we had failed, don't share the new
+    // one with the users of the old one.
     if (mEglImage == EGL_NO_IMAGE_KHR) {
         mEglDisplay = eglDisplay;
         mCropRect = cropRect;
-        mEglImage = createImage(mEglDisplay, mGraphicBuffer, mCropRect);
+        const Rect crop(eglImageCrop(mCropRect));
+        EglImageCache& cache(EglImageCache::getInstance());
+        if (!forceCreation) {
+            mEglImage = cache.acquire(mEglDisplay, mGraphicBuffer, crop);
+        }
+        if (mEglImage == EGL_NO_IMAGE_KHR) {
+            mEglImage = createImage(mEglDisplay, mGraphicBuffer, mCropRect);
+            if (mEglImage != EGL_NO_IMAGE_KHR && !forceCreation) {
+                mEglImage = cache.add(mEglDisplay, mGraphicBuffer, crop,
+                        mEglImage);
+            }
+        }
+        mCached = !forceCreation;
     }
 
     // Fail if we can't create a valid image.
     if (mEglImage == EGL_NO_IMAGE_KHR) {
         mEglDisplay = EGL_NO_DISPLAY;
         mCropRect.makeInvalid();
+        mCached = false;
         const sp<GraphicBuffer>& buffer = mGraphicBuffer;
         ALOGE("Failed to create image. size=%ux%u st=%u usage=0x%x fmt=%d",
             buffer->getWidth(), buffer->getHeight(), buffer->getStride(),
@@ -1113,6 +1185,21 @@ status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
     return OK;
 }
 
+void GLConsumer::EglImage::releaseImage(bool discard) {
+    if (mCached) {
+        EglImageCache::getInstance().release(mEglDisplay, mGraphicBuffer,
+                eglImageCrop(mCropRect), discard);
+    } else {
+        if (!eglDestroyImageKHR(mEglDisplay, mEglImage)) {
+           ALOGE("releaseImage: eglDestroyImageKHR failed");
+        }
+        eglTerminate(mEglDisplay);
+    }
+    mEglImage = EGL_NO_IMAGE_KHR;
+    mEglDisplay = EGL_NO_DISPLAY;
+    mCached = false;
+}
+
 void GLConsumer::EglImage::bindToTextureTarget(uint32_t texTarget) {
     glEGLImageTargetTexture2DOES(texTarget, (GLeglImageOES)mEglImage);
 }
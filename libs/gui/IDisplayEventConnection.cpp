@@ -26,6 +26,7 @@
 
 #include <gui/IDisplayEventConnection.h>
 #include <gui/BitTube.h>
+#include <gui/EventRing.h>
 
 namespace android {
 // ----------------------------------------------------------------------------
@@ -33,7 +34,9 @@ namespace android {
 enum {
     GET_DATA_CHANNEL = IBinder::FIRST_CALL_TRANSACTION,
     SET_VSYNC_RATE,
-    REQUEST_NEXT_VSYNC
+    REQUEST_NEXT_VSYNC,
+    SET_VSYNC_PHASE_OFFSET,
+    GET_EVENT_RING
 };
 
 class BpDisplayEventConnection : public BpInterface<IDisplayEventConnection>
@@ -52,6 +55,17 @@ public:
         return new BitTube(reply);
     }
 
+    virtual sp<EventRing> getEventRing() const
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
+        status_t err = remote()->transact(GET_EVENT_RING, data, &reply);
+        if (err != NO_ERROR || reply.readInt32() == 0) {
+            return NULL;
+        }
+        return new EventRing(reply);
+    }
+
     virtual void setVsyncRate(uint32_t count) {
         Parcel data, reply;
         data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
@@ -64,6 +78,13 @@ public:
         data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
         remote()->transact(REQUEST_NEXT_VSYNC, data, &reply, IBinder::FLAG_ONEWAY);
     }
+
+    virtual void setVsyncPhaseOffset(nsecs_t offset) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IDisplayEventConnection::getInterfaceDescriptor());
+        data.writeInt64(offset);
+        remote()->transact(SET_VSYNC_PHASE_OFFSET, data, &reply);
+    }
 };
 
 IMPLEMENT_META_INTERFACE(DisplayEventConnection, "android.gui.DisplayEventConnection");
@@ -80,6 +101,15 @@ status_t BnDisplayEventConnection::onTransact(
             channel->writeToParcel(reply);
             return NO_ERROR;
         } break;
+        case GET_EVENT_RING: {
+            CHECK_INTERFACE(IDisplayEventConnection, data, reply);
+            sp<EventRing> ring(getEventRing());
+            reply->writeInt32(ring != NULL);
+            if (ring != NULL) {
+                ring->writeToParcel(reply);
+            }
+            return NO_ERROR;
+        } break;
         case SET_VSYNC_RATE: {
             CHECK_INTERFACE(IDisplayEventConnection, data, reply);
             setVsyncRate(data.readInt32());
@@ -90,6 +120,11 @@ status_t BnDisplayEventConnection::onTransact(
             requestNextVsync();
             return NO_ERROR;
         } break;
+        case SET_VSYNC_PHASE_OFFSET: {
+            CHECK_INTERFACE(IDisplayEventConnection, data, reply);
+            setVsyncPhaseOffset(data.readInt64());
+            return NO_ERROR;
+        } break;
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
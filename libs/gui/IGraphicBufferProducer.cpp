@@ -47,6 +47,7 @@ enum {
     DISCONNECT,
     SET_SIDEBAND_STREAM,
     ALLOCATE_BUFFERS,
+    QUEUE_AND_DEQUEUE_BUFFER,
 };
 
 class BpGraphicBufferProducer : public BpInterface<IGraphicBufferProducer>
@@ -185,6 +186,53 @@ public:
         return result;
     }
 
+    virtual status_t queueAndDequeueBuffer(int buf,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            bool async, uint32_t w, uint32_t h, uint32_t format,
+            uint32_t usage, int* outSlot, sp<Fence>* outFence,
+            sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        data.writeInt32(buf);
+        data.write(input);
+        data.writeInt32(async);
+        data.writeInt32(w);
+        data.writeInt32(h);
+        data.writeInt32(format);
+        data.writeInt32(usage);
+        *outDequeueResult = INVALID_OPERATION;
+        status_t result = remote()->transact(QUEUE_AND_DEQUEUE_BUFFER, data,
+                &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        memcpy(output, reply.readInplace(sizeof(*output)), sizeof(*output));
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        status_t dequeueResult = reply.readInt32();
+        if (dequeueResult >= 0) {
+            *outSlot = reply.readInt32();
+            bool nonNull = reply.readInt32();
+            if (nonNull) {
+                *outFence = new Fence();
+                reply.read(**outFence);
+            }
+            nonNull = reply.readInt32();
+            if (nonNull) {
+                *outBuffer = new GraphicBuffer();
+                if (reply.read(**outBuffer) != NO_ERROR) {
+                    // The slot is still dequeued, the client requests its
+                    // buffer as usual
+                    (*outBuffer).clear();
+                }
+            }
+        }
+        *outDequeueResult = dequeueResult;
+        return result;
+    }
+
     virtual void cancelBuffer(int buf, const sp<Fence>& fence) {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
@@ -374,6 +422,42 @@ status_t BnGraphicBufferProducer::onTransact(
             reply->writeInt32(result);
             return NO_ERROR;
         } break;
+        case QUEUE_AND_DEQUEUE_BUFFER: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+            int buf = data.readInt32();
+            QueueBufferInput input(data);
+            bool async      = data.readInt32();
+            uint32_t w      = data.readInt32();
+            uint32_t h      = data.readInt32();
+            uint32_t format = data.readInt32();
+            uint32_t usage  = data.readInt32();
+            QueueBufferOutput* const output =
+                    reinterpret_cast<QueueBufferOutput *>(
+                            reply->writeInplace(sizeof(QueueBufferOutput)));
+            int slot = -1;
+            sp<Fence> fence;
+            sp<GraphicBuffer> buffer;
+            status_t dequeueResult = INVALID_OPERATION;
+            status_t result = queueAndDequeueBuffer(buf, input, output, async,
+                    w, h, format, usage, &slot, &fence, &buffer,
+                    &dequeueResult);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeInt32(dequeueResult);
+                if (dequeueResult >= 0) {
+                    reply->writeInt32(slot);
+                    reply->writeInt32(fence != NULL);
+                    if (fence != NULL) {
+                        reply->write(*fence);
+                    }
+                    reply->writeInt32(buffer != NULL);
+                    if (buffer != NULL) {
+                        reply->write(*buffer);
+                    }
+                }
+            }
+            return NO_ERROR;
+        } break;
         case CANCEL_BUFFER: {
             CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
             int buf = data.readInt32();
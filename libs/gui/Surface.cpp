@@ -80,6 +80,7 @@ Surface::Surface(
     mUserHeight = 0;
     mTransformHint = 0;
     mConsumerRunningBehind = false;
+    mQueueAndDequeue = false;
     mConnectedToCpu = false;
     mProducerControlledByApp = controlledByApp;
     mSwapIntervalZero = false;
@@ -89,6 +90,8 @@ Surface::~Surface() {
     if (mConnectedToCpu) {
         Surface::disconnect(NATIVE_WINDOW_API_CPU);
     }
+    Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 }
 
 sp<IGraphicBufferProducer> Surface::getIGraphicBufferProducer() const {
@@ -187,6 +190,14 @@ status_t Surface::setDirtyRect(const Rect* dirtyRect) {
     return NO_ERROR;
 }
 
+void Surface::setQueueAndDequeue(bool enabled) {
+    Mutex::Autolock lock(mMutex);
+    mQueueAndDequeue = enabled;
+    if (!enabled) {
+        cancelPrefetchedBufferLocked();
+    }
+}
+
 int Surface::setSwapInterval(int interval) {
     ATRACE_CALL();
     // EGL specification states:
@@ -214,6 +225,12 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     uint32_t reqFormat;
     uint32_t reqUsage;
 
+    int buf = -1;
+    sp<Fence> fence;
+    sp<GraphicBuffer> prefetchedBuffer;
+    status_t result = NO_ERROR;
+    bool prefetched = false;
+
     {
         Mutex::Autolock lock(mMutex);
 
@@ -223,12 +240,30 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
         swapIntervalZero = mSwapIntervalZero;
         reqFormat = mReqFormat;
         reqUsage = mReqUsage;
+
+        if (mPrefetched.slot >= 0) {
+            if (mPrefetched.async == swapIntervalZero &&
+                    mPrefetched.width == uint32_t(reqW) &&
+                    mPrefetched.height == uint32_t(reqH) &&
+                    mPrefetched.format == reqFormat &&
+                    mPrefetched.usage == reqUsage &&
+                    mPrefetched.size == mReqSize) {
+                buf = mPrefetched.slot;
+                fence = mPrefetched.fence;
+                prefetchedBuffer = mPrefetched.buffer;
+                result = mPrefetched.result;
+                mPrefetched = PrefetchedBuffer();
+                prefetched = true;
+            } else {
+                cancelPrefetchedBufferLocked();
+            }
+        }
     } // Drop the lock so that we can still touch the Surface while blocking in IGBP::dequeueBuffer
 
-    int buf = -1;
-    sp<Fence> fence;
-    status_t result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence, swapIntervalZero,
-            reqW, reqH, reqFormat, reqUsage);
+    if (!prefetched) {
+        result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence,
+                swapIntervalZero, reqW, reqH, reqFormat, reqUsage);
+    }
 
     if (result < 0) {
         ALOGV("dequeueBuffer: IGraphicBufferProducer::dequeueBuffer(%d, %d, %d, %d, %d)"
@@ -248,7 +283,11 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
         freeAllBuffers();
     }
 
-    if ((result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) || gbuf == 0) {
+    if ((result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) &&
+            prefetchedBuffer != NULL) {
+        // queueAndDequeueBuffer already requested the new buffer
+        gbuf = prefetchedBuffer;
+    } else if ((result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) || gbuf == 0) {
         result = mGraphicBufferProducer->requestBuffer(buf, &gbuf);
         if (result != NO_ERROR) {
             ALOGE("dequeueBuffer: IGraphicBufferProducer::requestBuffer failed: %d", result);
@@ -287,6 +326,21 @@ int Surface::cancelBuffer(android_native_buffer_t* buffer,
     return OK;
 }
 
+void Surface::cancelPrefetchedBufferLocked() {
+    if (mPrefetched.slot < 0) {
+        return;
+    }
+    // Keep the slot mirror up to date, as if the buffer had been dequeued
+    if (mPrefetched.result & IGraphicBufferProducer::RELEASE_ALL_BUFFERS) {
+        freeAllBuffers();
+    }
+    if (mPrefetched.buffer != NULL) {
+        mSlots[mPrefetched.slot].buffer = mPrefetched.buffer;
+    }
+    mGraphicBufferProducer->cancelBuffer(mPrefetched.slot, mPrefetched.fence);
+    mPrefetched = PrefetchedBuffer();
+}
+
 int Surface::getSlotFromBufferLocked(
         android_native_buffer_t* buffer) const {
     bool dumpedState = false;
@@ -342,7 +396,28 @@ int Surface::queueBuffer(android_native_buffer_t* buffer, int fenceFd) {
     IGraphicBufferProducer::QueueBufferInput input(timestamp, isAutoTimestamp,
             crop, dirtyRect, mScalingMode, mTransform ^ mStickyTransform, mSwapIntervalZero,
             fence, mStickyTransform);
-    status_t err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    status_t err;
+    if (mQueueAndDequeue && mPrefetched.slot < 0) {
+        PrefetchedBuffer next;
+        next.async = mSwapIntervalZero;
+        next.width = mReqWidth ? mReqWidth : mUserWidth;
+        next.height = mReqHeight ? mReqHeight : mUserHeight;
+        next.format = mReqFormat;
+        next.usage = mReqUsage;
+        next.size = mReqSize;
+        status_t dequeueResult = INVALID_OPERATION;
+        err = mGraphicBufferProducer->queueAndDequeueBuffer(i, input, &output,
+                next.async, next.width, next.height, next.format, next.usage,
+                &next.slot, &next.fence, &next.buffer, &dequeueResult);
+        if (err == OK && dequeueResult >= 0) {
+            next.result = dequeueResult;
+            mPrefetched = next;
+        } else {
+            ALOGV("queueBuffer: no buffer dequeued along (%d)", dequeueResult);
+        }
+    } else {
+        err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    }
     if (err != OK)  {
         ALOGE("queueBuffer: error queuing buffer to SurfaceTexture, %d", err);
     }
@@ -483,6 +558,9 @@ int Surface::perform(int operation, va_list args)
     case NATIVE_WINDOW_SET_SIDEBAND_STREAM:
         res = dispatchSetSidebandStream(args);
         break;
+    case NATIVE_WINDOW_SET_QUEUE_AND_DEQUEUE:
+        res = dispatchSetQueueAndDequeue(args);
+        break;
     default:
         res = NAME_NOT_FOUND;
         break;
@@ -585,6 +663,12 @@ int Surface::dispatchSetSidebandStream(va_list args) {
     return OK;
 }
 
+int Surface::dispatchSetQueueAndDequeue(va_list args) {
+    int enabled = va_arg(args, int);
+    setQueueAndDequeue(enabled != 0);
+    return NO_ERROR;
+}
+
 int Surface::connect(int api) {
     ATRACE_CALL();
     ALOGV("Surface::connect");
@@ -616,6 +700,7 @@ int Surface::disconnect(int api) {
     ATRACE_CALL();
     ALOGV("Surface::disconnect");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
     freeAllBuffers();
     int err = mGraphicBufferProducer->disconnect(api);
     if (!err) {
@@ -668,6 +753,7 @@ int Surface::setBufferCount(int bufferCount)
     ATRACE_CALL();
     ALOGV("Surface::setBufferCount");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
 
     status_t err = mGraphicBufferProducer->setBufferCount(bufferCount);
     ALOGE_IF(err, "IGraphicBufferProducer::setBufferCount(%d) returned %s",
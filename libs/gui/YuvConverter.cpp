@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <gui/YuvConverter.h>
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#define YUV_CONVERTER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_CONVERTER_SSE2 1
+#endif
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// BT.601 limited range, scaled by 64 so that all the intermediate values but
+// the blue one fit in 16 bits. Blue can only overflow when it's clamped to
+// 255 anyway, the SIMD kernels use a saturating add for it.
+enum {
+    COEF_Y = 74,
+    COEF_R_CR = 102,
+    COEF_G_CB = -25,
+    COEF_G_CR = -52,
+    COEF_B_CB = 129,
+};
+
+static inline uint8_t clampShift(int32_t v) {
+    v >>= 6;
+    return uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static inline void yuvToRgba(uint8_t y, uint8_t cb, uint8_t cr,
+        uint8_t* dst) {
+    const int32_t c = COEF_Y * (int32_t(y) - 16) + 32;
+    const int32_t d = int32_t(cb) - 128;
+    const int32_t e = int32_t(cr) - 128;
+    dst[0] = clampShift(c + COEF_R_CR * e);
+    dst[1] = clampShift(c + COEF_G_CB * d + COEF_G_CR * e);
+    dst[2] = clampShift(c + COEF_B_CB * d);
+    dst[3] = 0xff;
+}
+
+// Converts n pixels. With chromaShift, cb and cr are at half the horizontal
+// resolution of y.
+static void rgbaRowScalar(const uint8_t* y, const uint8_t* cb,
+        const uint8_t* cr, uint32_t chromaShift, uint32_t x, uint32_t n,
+        uint8_t* dst) {
+    for (; x < n; x++) {
+        const uint32_t cx = x >> chromaShift;
+        yuvToRgba(y[x], cb[cx], cr[cx], dst + 4 * x);
+    }
+}
+
+// Averages scale x scale blocks of a plane into n samples. 'step' is the
+// distance between two samples of a row.
+static void boxRowScalar(const uint8_t* src, uint32_t stride, uint32_t step,
+        uint32_t scale, uint32_t x, uint32_t n, uint8_t* dst) {
+    const uint32_t area = scale * scale;
+    for (; x < n; x++) {
+        const uint8_t* block = src + x * scale * step;
+        uint32_t sum = 0;
+        for (uint32_t j = 0; j < scale; j++) {
+            for (uint32_t i = 0; i < scale; i++) {
+                sum += block[j * stride + i * step];
+            }
+        }
+        dst[x] = uint8_t((sum + area / 2) / area);
+    }
+}
+
+#if defined(YUV_CONVERTER_NEON)
+
+static uint32_t rgbaRowSimd(const uint8_t* y, const uint8_t* cb,
+        const uint8_t* cr, uint32_t chromaShift, uint32_t n, uint8_t* dst) {
+    const int16x8_t bias = vdupq_n_s16(32);
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint8x8_t u, v;
+        if (chromaShift) {
+            uint32_t u4, v4;
+            memcpy(&u4, cb + x / 2, 4);
+            memcpy(&v4, cr + x / 2, 4);
+            u = vreinterpret_u8_u32(vdup_n_u32(u4));
+            v = vreinterpret_u8_u32(vdup_n_u32(v4));
+            u = vzip_u8(u, u).val[0];
+            v = vzip_u8(v, v).val[0];
+        } else {
+            u = vld1_u8(cb + x);
+            v = vld1_u8(cr + x);
+        }
+        const int16x8_t c = vaddq_s16(vmulq_n_s16(vreinterpretq_s16_u16(
+                vsubl_u8(vld1_u8(y + x), vdup_n_u8(16))), COEF_Y), bias);
+        const int16x8_t d = vreinterpretq_s16_u16(
+                vsubl_u8(u, vdup_n_u8(128)));
+        const int16x8_t e = vreinterpretq_s16_u16(
+                vsubl_u8(v, vdup_n_u8(128)));
+
+        uint8x8x4_t rgba;
+        rgba.val[0] = vqshrun_n_s16(vaddq_s16(c, vmulq_n_s16(e, COEF_R_CR)), 6);
+        rgba.val[1] = vqshrun_n_s16(vaddq_s16(c, vmlaq_n_s16(
+                vmulq_n_s16(d, COEF_G_CB), e, COEF_G_CR)), 6);
+        rgba.val[2] = vqshrun_n_s16(vqaddq_s16(c, vmulq_n_s16(d, COEF_B_CB)), 6);
+        rgba.val[3] = vdup_n_u8(0xff);
+        vst4_u8(dst + 4 * x, rgba);
+    }
+    return x;
+}
+
+static uint32_t boxRow2Simd(const uint8_t* src, uint32_t stride, uint32_t n,
+        uint8_t* dst) {
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(src + 2 * x)),
+                vpaddlq_u8(vld1q_u8(src + stride + 2 * x)));
+        vst1_u8(dst + x, vrshrn_n_u16(sum, 2));
+    }
+    return x;
+}
+
+static uint32_t boxRow4Simd(const uint8_t* src, uint32_t stride, uint32_t n,
+        uint8_t* dst) {
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint16x8_t lo = vdupq_n_u16(0);
+        uint16x8_t hi = vdupq_n_u16(0);
+        for (uint32_t j = 0; j < 4; j++) {
+            const uint8_t* row = src + j * stride + 4 * x;
+            lo = vaddq_u16(lo, vpaddlq_u8(vld1q_u8(row)));
+            hi = vaddq_u16(hi, vpaddlq_u8(vld1q_u8(row + 16)));
+        }
+        const uint16x8_t sum = vcombine_u16(
+                vrshrn_n_u32(vpaddlq_u16(lo), 4),
+                vrshrn_n_u32(vpaddlq_u16(hi), 4));
+        vst1_u8(dst + x, vmovn_u16(sum));
+    }
+    return x;
+}
+
+#elif defined(YUV_CONVERTER_SSE2)
+
+static inline __m128i load4(const uint8_t* p) {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return _mm_cvtsi32_si128(v);
+}
+
+static uint32_t rgbaRowSimd(const uint8_t* y, const uint8_t* cb,
+        const uint8_t* cr, uint32_t chromaShift, uint32_t n, uint8_t* dst) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(char(0xff));
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i u, v;
+        if (chromaShift) {
+            u = load4(cb + x / 2);
+            v = load4(cr + x / 2);
+            u = _mm_unpacklo_epi8(u, u);
+            v = _mm_unpacklo_epi8(v, v);
+        } else {
+            u = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(cb + x));
+            v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(cr + x));
+        }
+        const __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64(
+                reinterpret_cast<const __m128i*>(y + x)), zero);
+        const __m128i c = _mm_add_epi16(_mm_mullo_epi16(
+                _mm_sub_epi16(yy, _mm_set1_epi16(16)),
+                _mm_set1_epi16(COEF_Y)), _mm_set1_epi16(32));
+        const __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(u, zero),
+                _mm_set1_epi16(128));
+        const __m128i e = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero),
+                _mm_set1_epi16(128));
+
+        __m128i r = _mm_add_epi16(c,
+                _mm_mullo_epi16(e, _mm_set1_epi16(COEF_R_CR)));
+        __m128i g = _mm_add_epi16(c, _mm_add_epi16(
+                _mm_mullo_epi16(d, _mm_set1_epi16(COEF_G_CB)),
+                _mm_mullo_epi16(e, _mm_set1_epi16(COEF_G_CR))));
+        __m128i b = _mm_adds_epi16(c,
+                _mm_mullo_epi16(d, _mm_set1_epi16(COEF_B_CB)));
+        r = _mm_packus_epi16(_mm_srai_epi16(r, 6), zero);
+        g = _mm_packus_epi16(_mm_srai_epi16(g, 6), zero);
+        b = _mm_packus_epi16(_mm_srai_epi16(b, 6), zero);
+
+        const __m128i rg = _mm_unpacklo_epi8(r, g);
+        const __m128i ba = _mm_unpacklo_epi8(b, alpha);
+        __m128i* out = reinterpret_cast<__m128i*>(dst + 4 * x);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg, ba));
+    }
+    return x;
+}
+
+// Sums the pairs of bytes of 16 bytes into 8 16-bit lanes.
+static inline __m128i pairSums(const uint8_t* p) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm_add_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)),
+            _mm_srli_epi16(v, 8));
+}
+
+static uint32_t boxRow2Simd(const uint8_t* src, uint32_t stride, uint32_t n,
+        uint8_t* dst) {
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i sum = _mm_add_epi16(pairSums(src + 2 * x),
+                pairSums(src + stride + 2 * x));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x),
+                _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+static uint32_t boxRow4Simd(const uint8_t* src, uint32_t stride, uint32_t n,
+        uint8_t* dst) {
+    const __m128i ones = _mm_set1_epi16(1);
+    uint32_t x = 0;
+    for (; x + 8 <= n; x += 8) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        for (uint32_t j = 0; j < 4; j++) {
+            const uint8_t* row = src + j * stride + 4 * x;
+            lo = _mm_add_epi16(lo, pairSums(row));
+            hi = _mm_add_epi16(hi, pairSums(row + 16));
+        }
+        const __m128i round = _mm_set1_epi32(8);
+        lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(lo, ones), round), 4);
+        hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(hi, ones), round), 4);
+        const __m128i sum = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x),
+                _mm_packus_epi16(sum, sum));
+    }
+    return x;
+}
+
+#endif
+
+#if defined(YUV_CONVERTER_NEON) || defined(YUV_CONVERTER_SSE2)
+#define YUV_CONVERTER_SIMD 1
+#endif
+
+static void rgbaRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+        uint32_t chromaShift, uint32_t n, uint8_t* dst, bool simd) {
+    uint32_t x = 0;
+#ifdef YUV_CONVERTER_SIMD
+    if (simd) {
+        x = rgbaRowSimd(y, cb, cr, chromaShift, n, dst);
+    }
+#endif
+    rgbaRowScalar(y, cb, cr, chromaShift, x, n, dst);
+}
+
+static void boxRow(const uint8_t* src, uint32_t stride, uint32_t step,
+        uint32_t scale, uint32_t n, uint8_t* dst, bool simd) {
+    uint32_t x = 0;
+#ifdef YUV_CONVERTER_SIMD
+    if (simd && step == 1) {
+        if (scale == 2) {
+            x = boxRow2Simd(src, stride, n, dst);
+        } else if (scale == 4) {
+            x = boxRow4Simd(src, stride, n, dst);
+        }
+    }
+#endif
+    boxRowScalar(src, stride, step, scale, x, n, dst);
+}
+
+bool YuvConverter::hasSimd() {
+#ifdef YUV_CONVERTER_SIMD
+    return true;
+#else
+    return false;
+#endif
+}
+
+status_t YuvConverter::toRgba(const Planes& src, uint32_t scale,
+        uint32_t firstRow, uint32_t numRows, uint8_t* dst, uint32_t dstStride,
+        bool allowSimd) {
+    if (scale != 1 && scale != 2 && scale != 4) {
+        return BAD_VALUE;
+    }
+    const uint32_t width = getScaledSize(src.width, scale);
+    const uint32_t height = getScaledSize(src.height, scale);
+    if (src.y == NULL || src.cb == NULL || src.cr == NULL ||
+            src.chromaStep == 0 || dst == NULL || dstStride < width ||
+            firstRow > height || numRows > height - firstRow) {
+        return BAD_VALUE;
+    }
+
+    // At scale 1, a chroma sample covers two pixels of a row. Above, there
+    // is one chroma sample per pixel, averaged over (scale/2)^2 samples.
+    const uint32_t chromaShift = scale == 1 ? 1 : 0;
+    const uint32_t chromaScale = scale == 1 ? 1 : scale / 2;
+    const uint32_t chromaWidth = (width + chromaShift) >> chromaShift;
+    const bool copyY = scale != 1;
+    const bool copyChroma = chromaScale != 1 || src.chromaStep != 1;
+
+    uint8_t* scratch = NULL;
+    if (copyY || copyChroma) {
+        scratch = new uint8_t[width + 2 * chromaWidth];
+    }
+    uint8_t* yRow = scratch;
+    uint8_t* cbRow = scratch + width;
+    uint8_t* crRow = cbRow + chromaWidth;
+
+    for (uint32_t row = firstRow; row < firstRow + numRows; row++) {
+        const uint8_t* y = src.y + size_t(row) * scale * src.yStride;
+        if (copyY) {
+            boxRow(y, src.yStride, 1, scale, width, yRow, allowSimd);
+            y = yRow;
+        }
+
+        const size_t chromaRow = scale == 1 ? row / 2 : row * chromaScale;
+        const uint8_t* cb = src.cb + chromaRow * src.chromaStride;
+        const uint8_t* cr = src.cr + chromaRow * src.chromaStride;
+        if (copyChroma) {
+            boxRow(cb, src.chromaStride, src.chromaStep, chromaScale,
+                    chromaWidth, cbRow, allowSimd);
+            boxRow(cr, src.chromaStride, src.chromaStep, chromaScale,
+                    chromaWidth, crRow, allowSimd);
+            cb = cbRow;
+            cr = crRow;
+        }
+
+        rgbaRow(y, cb, cr, chromaShift, width,
+                dst + size_t(row - firstRow) * dstStride * 4, allowSimd);
+    }
+
+    delete[] scratch;
+    return NO_ERROR;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
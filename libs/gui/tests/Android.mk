@@ -9,6 +9,7 @@ LOCAL_MODULE_TAGS := tests
 LOCAL_SRC_FILES := \
     BufferQueue_test.cpp \
     CpuConsumer_test.cpp \
+    EventRing_test.cpp \
     FillBuffer.cpp \
     GLTest.cpp \
     IGraphicBufferProducer_test.cpp \
@@ -136,6 +136,46 @@ TEST_F(BufferQueueTest, BufferQueueInAnotherProcess) {
             reinterpret_cast<void**>(&dataOut)));
     ASSERT_EQ(*dataOut, 0x12345678);
     ASSERT_EQ(OK, item.mGraphicBuffer->unlock());
+    ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+
+    // queueAndDequeueBuffer through the binder proxy: the reply carries
+    // both the queue output and the next buffer.
+    status_t result = mProducer->dequeueBuffer(&slot, &fence, false, 0, 0, 0,
+            GRALLOC_USAGE_SW_WRITE_OFTEN);
+    ASSERT_LE(0, result);
+    if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+        ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+    }
+    ASSERT_EQ(OK, buffer->lock(GraphicBuffer::USAGE_SW_WRITE_OFTEN,
+            reinterpret_cast<void**>(&dataIn)));
+    *dataIn = 0x87654321;
+    ASSERT_EQ(OK, buffer->unlock());
+
+    int nextSlot;
+    sp<GraphicBuffer> nextBuffer;
+    status_t dequeueResult;
+    output = IGraphicBufferProducer::QueueBufferOutput();
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(slot, input, &output,
+            false, 0, 0, 0, GRALLOC_USAGE_SW_WRITE_OFTEN, &nextSlot, &fence,
+            &nextBuffer, &dequeueResult));
+    ASSERT_LE(0, dequeueResult);
+    ASSERT_NE(slot, nextSlot);
+    ASSERT_TRUE(fence != NULL);
+    // the buffer of the next slot comes with the reply if it's new
+    ASSERT_EQ((dequeueResult &
+            IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) != 0,
+            nextBuffer != NULL);
+    uint32_t width, height, transformHint, numPendingBuffers;
+    output.deflate(&width, &height, &transformHint, &numPendingBuffers);
+    EXPECT_EQ(1U, numPendingBuffers);
+
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(slot, item.mBuf);
+    ASSERT_EQ(OK, item.mGraphicBuffer->lock(GraphicBuffer::USAGE_SW_READ_OFTEN,
+            reinterpret_cast<void**>(&dataOut)));
+    ASSERT_EQ(*dataOut, 0x87654321);
+    ASSERT_EQ(OK, item.mGraphicBuffer->unlock());
 }
 
 TEST_F(BufferQueueTest, AcquireBuffer_ExceedsMaxAcquireCount_Fails) {
@@ -173,6 +213,56 @@ TEST_F(BufferQueueTest, AcquireBuffer_ExceedsMaxAcquireCount_Fails) {
     ASSERT_EQ(INVALID_OPERATION, mConsumer->acquireBuffer(&item, 0));
 }
 
+TEST_F(BufferQueueTest, QueueAndDequeueBuffer_DoesNotBlock) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput qbo;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbo));
+    ASSERT_EQ(OK, mProducer->setBufferCount(3));
+
+    int slot;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buf;
+    IGraphicBufferProducer::QueueBufferInput qbi(0, false, Rect(0, 0, 1, 1),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false, Fence::NO_FENCE);
+    BufferQueue::BufferItem item;
+
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&slot, &fence, false, 1, 1, 0,
+                GRALLOC_USAGE_SW_READ_OFTEN));
+    ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buf));
+
+    // The reply carries the newly allocated buffer of the next slot.
+    int nextSlot;
+    status_t dequeueResult;
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(slot, qbi, &qbo, false,
+            1, 1, 0, GRALLOC_USAGE_SW_READ_OFTEN, &nextSlot, &fence, &buf,
+            &dequeueResult));
+    ASSERT_LE(0, dequeueResult);
+    ASSERT_TRUE(dequeueResult &
+            IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION);
+    ASSERT_NE(slot, nextSlot);
+    ASSERT_TRUE(buf != NULL);
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(slot, item.mBuf);
+
+    slot = nextSlot;
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(slot, qbi, &qbo, false,
+            1, 1, 0, GRALLOC_USAGE_SW_READ_OFTEN, &nextSlot, &fence, &buf,
+            &dequeueResult));
+    ASSERT_LE(0, dequeueResult);
+
+    // All three buffers are now used, the dequeue fails instead of blocking
+    // but the buffer is still queued.
+    slot = nextSlot;
+    ASSERT_EQ(OK, mProducer->queueAndDequeueBuffer(slot, qbi, &qbo, false,
+            1, 1, 0, GRALLOC_USAGE_SW_READ_OFTEN, &nextSlot, &fence, &buf,
+            &dequeueResult));
+    ASSERT_EQ(WOULD_BLOCK, dequeueResult);
+}
+
 TEST_F(BufferQueueTest, SetMaxAcquiredBufferCountWithIllegalValues_ReturnsError) {
     createBufferQueue();
     sp<DummyConsumer> dc(new DummyConsumer);
@@ -27,11 +27,13 @@
 #include <gtest/gtest.h>
 #include <gui/CpuConsumer.h>
 #include <gui/Surface.h>
+#include <gui/YuvConverter.h>
 #include <ui/GraphicBuffer.h>
 #include <utils/String8.h>
 #include <utils/Thread.h>
 #include <utils/Mutex.h>
 #include <utils/Condition.h>
+#include <utils/Timers.h>
 
 #define CPU_CONSUMER_TEST_FORMAT_RAW 0
 #define CPU_CONSUMER_TEST_FORMAT_Y8 0
@@ -691,6 +693,228 @@ TEST_P(CpuConsumerTest, FromCpuLockMax) {
 
 }
 
+// Fills an NV21 image with a pseudo-random pattern, returns the planes.
+static YuvConverter::Planes makeNV21(uint8_t* buf, uint32_t w, uint32_t h,
+        uint32_t stride) {
+    uint32_t seed = w * 31 + h;
+    const size_t size = size_t(stride) * h + size_t(stride) * ((h + 1) / 2);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = uint8_t(seed >> 16);
+    }
+    YuvConverter::Planes planes;
+    planes.y = buf;
+    planes.cr = buf + size_t(stride) * h;
+    planes.cb = planes.cr + 1;
+    planes.width = w;
+    planes.height = h;
+    planes.yStride = stride;
+    planes.chromaStride = stride;
+    planes.chromaStep = 2;
+    return planes;
+}
+
+TEST(YuvConverterTest, SimdMatchesScalar) {
+    const uint32_t sizes[][2] = { { 1, 1 }, { 7, 5 }, { 33, 17 },
+            { 100, 100 }, { 641, 479 } };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const uint32_t w = sizes[i][0];
+        const uint32_t h = sizes[i][1];
+        const uint32_t stride = (w + 31) & ~31;
+        uint8_t* src = new uint8_t[stride * h * 2];
+        YuvConverter::Planes planes = makeNV21(src, w, h, stride);
+        for (uint32_t scale = 1; scale <= 4; scale *= 2) {
+            const size_t size = (w / scale) * (h / scale) * 4;
+            uint8_t* simd = new uint8_t[size + 1];
+            uint8_t* scalar = new uint8_t[size + 1];
+            ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, scale, 0,
+                    h / scale, simd, w / scale, true));
+            ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, scale, 0,
+                    h / scale, scalar, w / scale, false));
+            EXPECT_EQ(0, memcmp(simd, scalar, size)) << w << "x" << h
+                    << " at scale " << scale;
+            delete[] simd;
+            delete[] scalar;
+        }
+        delete[] src;
+    }
+}
+
+TEST(YuvConverterTest, ConvertsGreys) {
+    // 4x2 NV12 image: black, grey, white and grey again
+    uint8_t y[8] = { 16, 16, 126, 126, 16, 16, 126, 126 };
+    uint8_t c[4] = { 128, 128, 128, 128 };
+    YuvConverter::Planes planes = { y, c, c + 1, 4, 2, 4, 4, 2 };
+    uint8_t rgba[4 * 4 * 2];
+    ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, 1, 0, 2, rgba, 4));
+    EXPECT_EQ(0, rgba[0]);
+    EXPECT_EQ(0, rgba[1]);
+    EXPECT_EQ(0, rgba[2]);
+    EXPECT_EQ(255, rgba[3]);
+    EXPECT_NEAR(127, rgba[8], 1);
+    EXPECT_EQ(rgba[8], rgba[9]);
+    EXPECT_EQ(rgba[8], rgba[10]);
+
+    y[2] = y[3] = y[6] = y[7] = 235;
+    ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, 1, 0, 2, rgba, 4));
+    EXPECT_NEAR(255, rgba[8], 2);
+
+    EXPECT_EQ(BAD_VALUE, YuvConverter::toRgba(planes, 3, 0, 0, rgba, 1));
+    EXPECT_EQ(BAD_VALUE, YuvConverter::toRgba(planes, 1, 1, 2, rgba, 4));
+}
+
+// Not a correctness test: compares the SIMD kernels with the scalar loop on
+// a 1080p NV21 frame.
+TEST(YuvConverterTest, BenchmarkScalarVsSimd) {
+    const uint32_t w = 1920;
+    const uint32_t h = 1080;
+    const int iterations = 20;
+    uint8_t* src = new uint8_t[w * h * 2];
+    uint8_t* dst = new uint8_t[w * h * 4];
+    YuvConverter::Planes planes = makeNV21(src, w, h, w);
+    for (uint32_t scale = 1; scale <= 4; scale *= 2) {
+        nsecs_t times[2];
+        for (int simd = 0; simd < 2; simd++) {
+            const nsecs_t start = systemTime();
+            for (int i = 0; i < iterations; i++) {
+                YuvConverter::toRgba(planes, scale, 0, h / scale, dst,
+                        w / scale, simd);
+            }
+            times[simd] = (systemTime() - start) / iterations;
+        }
+        printf("NV21 %ux%u -> RGBA at 1/%u: scalar %.2f ms, %s %.2f ms\n",
+                w, h, scale, times[0] / 1e6,
+                YuvConverter::hasSimd() ? "SIMD" : "scalar", times[1] / 1e6);
+    }
+    delete[] src;
+    delete[] dst;
+}
+
+TEST(CpuConsumerConversionTest, LockNextConvertedBuffer) {
+    const CpuConsumerTestParams params = { 640, 480, 2,
+            HAL_PIXEL_FORMAT_YV12 };
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<CpuConsumer> cc(new CpuConsumer(consumer, params.maxLockedBuffers));
+    sp<ANativeWindow> anw(new Surface(producer));
+
+    ASSERT_NO_FATAL_FAILURE(configureANW(anw, params,
+            params.maxLockedBuffers + 1));
+    uint32_t stride;
+    for (int i = 0; i < params.maxLockedBuffers + 1; i++) {
+        ASSERT_NO_FATAL_FAILURE(produceOneFrame(anw, params, 1000 + i,
+                &stride));
+    }
+
+    // What the CpuConsumer should see of the YV12 buffers
+    const uint32_t chromaStride = ((stride / 2) + 0xf) & ~0xf;
+    const size_t ySize = size_t(stride) * params.height;
+    uint8_t* src = new uint8_t[ySize + chromaStride * params.height];
+    fillYV12Buffer(src, params.width, params.height, stride);
+    YuvConverter::Planes planes;
+    planes.y = src;
+    planes.cr = src + ySize;
+    planes.cb = planes.cr + chromaStride * params.height / 2;
+    planes.width = params.width;
+    planes.height = params.height;
+    planes.yStride = stride;
+    planes.chromaStride = chromaStride;
+    planes.chromaStep = 1;
+
+    const uint32_t scale = 2;
+    const uint32_t w = params.width / scale;
+    const uint32_t h = params.height / scale;
+    uint8_t* expected = new uint8_t[w * h * 4];
+    ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, scale, 0, h, expected,
+            w, false));
+
+    CpuConsumer::ConvertedBuffer b[2];
+    for (int i = 0; i < params.maxLockedBuffers; i++) {
+        ASSERT_EQ(OK, cc->lockNextConvertedBuffer(&b[i], scale));
+        ASSERT_TRUE(b[i].data != NULL);
+        EXPECT_EQ(w, b[i].width);
+        EXPECT_EQ(h, b[i].height);
+        EXPECT_EQ(1000 + i, b[i].timestamp);
+        for (uint32_t row = 0; row < h; row++) {
+            ASSERT_EQ(0, memcmp(expected + row * w * 4,
+                    b[i].data + row * b[i].stride * 4, w * 4))
+                    << "row " << row;
+        }
+    }
+    EXPECT_NE(b[0].data, b[1].data);
+
+    // The pool is empty until a converted buffer is returned
+    CpuConsumer::ConvertedBuffer extra;
+    EXPECT_EQ(NOT_ENOUGH_DATA, cc->lockNextConvertedBuffer(&extra, scale));
+    ASSERT_EQ(OK, cc->unlockConvertedBuffer(b[0]));
+    ASSERT_EQ(OK, cc->lockNextConvertedBuffer(&extra, scale));
+    EXPECT_EQ(b[0].data, extra.data);
+
+    // No more frames
+    EXPECT_EQ(OK, cc->unlockConvertedBuffer(b[1]));
+    EXPECT_EQ(BAD_VALUE, cc->unlockConvertedBuffer(b[1]));
+    EXPECT_EQ(BAD_VALUE, cc->lockNextConvertedBuffer(&b[1], scale));
+    EXPECT_EQ(OK, cc->unlockConvertedBuffer(extra));
+
+    delete[] src;
+    delete[] expected;
+}
+
+TEST(CpuConsumerConversionTest, ConvertsOnlyTheCrop) {
+    const CpuConsumerTestParams params = { 640, 480, 1,
+            HAL_PIXEL_FORMAT_YV12 };
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<CpuConsumer> cc(new CpuConsumer(consumer, params.maxLockedBuffers));
+    sp<ANativeWindow> anw(new Surface(producer));
+
+    ASSERT_NO_FATAL_FAILURE(configureANW(anw, params,
+            params.maxLockedBuffers + 1));
+    // the left and top edges get rounded down to even coordinates
+    android_native_rect_t crop = { 17, 31, 497, 431 };
+    ASSERT_EQ(NO_ERROR, native_window_set_crop(anw.get(), &crop));
+    uint32_t stride;
+    ASSERT_NO_FATAL_FAILURE(produceOneFrame(anw, params, 1000, &stride));
+
+    const uint32_t chromaStride = ((stride / 2) + 0xf) & ~0xf;
+    const size_t ySize = size_t(stride) * params.height;
+    uint8_t* src = new uint8_t[ySize + chromaStride * params.height];
+    fillYV12Buffer(src, params.width, params.height, stride);
+    const size_t chromaOffset = (30 / 2) * chromaStride + 16 / 2;
+    YuvConverter::Planes planes;
+    planes.y = src + 30 * stride + 16;
+    planes.cr = src + ySize + chromaOffset;
+    planes.cb = src + ySize + chromaStride * params.height / 2 +
+            chromaOffset;
+    planes.width = 497 - 16;
+    planes.height = 431 - 30;
+    planes.yStride = stride;
+    planes.chromaStride = chromaStride;
+    planes.chromaStep = 1;
+
+    const uint32_t scale = 2;
+    const uint32_t w = planes.width / scale;
+    const uint32_t h = planes.height / scale;
+    uint8_t* expected = new uint8_t[w * h * 4];
+    ASSERT_EQ(NO_ERROR, YuvConverter::toRgba(planes, scale, 0, h, expected,
+            w, false));
+
+    CpuConsumer::ConvertedBuffer b;
+    ASSERT_EQ(OK, cc->lockNextConvertedBuffer(&b, scale));
+    EXPECT_EQ(w, b.width);
+    EXPECT_EQ(h, b.height);
+    for (uint32_t row = 0; row < h; row++) {
+        ASSERT_EQ(0, memcmp(expected + row * w * 4,
+                b.data + row * b.stride * 4, w * 4)) << "row " << row;
+    }
+    EXPECT_EQ(OK, cc->unlockConvertedBuffer(b));
+
+    delete[] src;
+    delete[] expected;
+}
+
 CpuConsumerTestParams y8TestSets[] = {
     { 512,   512, 1, HAL_PIXEL_FORMAT_Y8},
     { 512,   512, 3, HAL_PIXEL_FORMAT_Y8},
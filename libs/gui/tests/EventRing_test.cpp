@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EventRing_test"
+//#define LOG_NDEBUG 0
+
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+#include <gui/BitTube.h>
+#include <gui/DisplayEventReceiver.h>
+#include <gui/EventRing.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+typedef DisplayEventReceiver::Event Event;
+
+class EventRingTest : public ::testing::Test {
+
+protected:
+    EventRingTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~EventRingTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    virtual void SetUp() {
+        mProducer = new EventRing(sizeof(Event), 4, new BitTube());
+        ASSERT_EQ(NO_ERROR, mProducer->initCheck());
+        Parcel parcel;
+        ASSERT_EQ(NO_ERROR, mProducer->writeToParcel(&parcel));
+        parcel.setDataPosition(0);
+        mConsumer = new EventRing(parcel);
+        ASSERT_EQ(NO_ERROR, mConsumer->initCheck());
+    }
+
+    bool isReadable() {
+        struct pollfd fd = { mConsumer->getFd(), POLLIN, 0 };
+        return poll(&fd, 1, 0) == 1 && (fd.revents & POLLIN);
+    }
+
+    static Event makeEvent(uint32_t count) {
+        Event event;
+        memset(&event, 0, sizeof(event));
+        event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+        event.header.timestamp = count * 1000;
+        event.vsync.count = count;
+        return event;
+    }
+
+    sp<EventRing> mProducer;
+    sp<EventRing> mConsumer;
+};
+
+TEST_F(EventRingTest, EventsAreReceivedInOrderAcrossWrapAround) {
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    for (int i = 0; i < 10; i++) {
+        Event events[3] = { makeEvent(sent), makeEvent(sent + 1),
+                makeEvent(sent + 2) };
+        ASSERT_EQ(3, DisplayEventReceiver::sendEvents(mProducer, events, 3));
+        sent += 3;
+
+        Event out[4];
+        ssize_t n;
+        while ((n = DisplayEventReceiver::getEvents(mConsumer, out, 2)) > 0) {
+            for (ssize_t j = 0; j < n; j++) {
+                EXPECT_EQ(received, out[j].vsync.count);
+                EXPECT_EQ(nsecs_t(received) * 1000, out[j].header.timestamp);
+                received++;
+            }
+        }
+        ASSERT_EQ(0, n);
+    }
+    EXPECT_EQ(sent, received);
+}
+
+TEST_F(EventRingTest, FullRingRejectsEvents) {
+    Event events[5] = { makeEvent(0), makeEvent(1), makeEvent(2),
+            makeEvent(3), makeEvent(4) };
+    EXPECT_EQ(-EAGAIN, DisplayEventReceiver::sendEvents(mProducer, events, 5));
+    EXPECT_EQ(4, DisplayEventReceiver::sendEvents(mProducer, events, 4));
+    EXPECT_EQ(-EAGAIN, DisplayEventReceiver::sendEvents(mProducer,
+            events + 4, 1));
+
+    Event out;
+    EXPECT_EQ(1, DisplayEventReceiver::getEvents(mConsumer, &out, 1));
+    EXPECT_EQ(1, DisplayEventReceiver::sendEvents(mProducer, events + 4, 1));
+}
+
+TEST_F(EventRingTest, FdIsReadableWhileEventsArePending) {
+    EXPECT_FALSE(isReadable());
+
+    Event events[2] = { makeEvent(0), makeEvent(1) };
+    ASSERT_EQ(2, DisplayEventReceiver::sendEvents(mProducer, events, 2));
+    EXPECT_TRUE(isReadable());
+
+    // a partial read leaves the fd readable
+    Event out[2];
+    ASSERT_EQ(1, DisplayEventReceiver::getEvents(mConsumer, out, 1));
+    EXPECT_TRUE(isReadable());
+
+    ASSERT_EQ(1, DisplayEventReceiver::getEvents(mConsumer, out, 2));
+    EXPECT_FALSE(isReadable());
+    EXPECT_EQ(0, DisplayEventReceiver::getEvents(mConsumer, out, 2));
+
+    // and the next event wakes up the consumer again
+    ASSERT_EQ(1, DisplayEventReceiver::sendEvents(mProducer, events, 1));
+    EXPECT_TRUE(isReadable());
+}
+
+TEST_F(EventRingTest, FdHangsUpWhenProducerIsGone) {
+    mProducer.clear();
+    struct pollfd fd = { mConsumer->getFd(), POLLIN, 0 };
+    ASSERT_EQ(1, poll(&fd, 1, 0));
+    EXPECT_TRUE(fd.revents & POLLHUP);
+}
+
+TEST_F(EventRingTest, CorruptedTailIsDetected) {
+    // a consumer that claims to have read events that were never sent
+    sp<EventRing> producer(new EventRing(sizeof(Event), 4, new BitTube()));
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, producer->writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    int memFd = parcel.readFileDescriptor();
+    void* base = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED,
+            memFd, 0);
+    ASSERT_NE(MAP_FAILED, base);
+    // tail is the first word of the second cache line
+    static_cast<volatile int32_t*>(base)[16] = 1000;
+    munmap(base, getpagesize());
+
+    Event event = makeEvent(0);
+    EXPECT_EQ(-EPIPE, DisplayEventReceiver::sendEvents(producer, &event, 1));
+}
+
+} // namespace android
@@ -155,4 +155,40 @@ TEST_F(SurfaceTest, QueryConsumerUsage) {
     ASSERT_EQ(TEST_USAGE_FLAGS, flags);
 }
 
+TEST_F(SurfaceTest, QueueAndDequeueThroughPerform) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<BufferItemConsumer> c = new BufferItemConsumer(consumer,
+            GRALLOC_USAGE_SW_READ_OFTEN, 1);
+    sp<Surface> s = new Surface(producer);
+    sp<ANativeWindow> anw(s);
+
+    ASSERT_EQ(NO_ERROR, native_window_api_connect(anw.get(),
+            NATIVE_WINDOW_API_CPU));
+    ASSERT_EQ(NO_ERROR, native_window_set_queue_and_dequeue(anw.get(), 1));
+    ASSERT_EQ(NO_ERROR, native_window_set_usage(anw.get(),
+            GRALLOC_USAGE_SW_WRITE_OFTEN));
+
+    // Each queueBuffer also dequeues the buffer of the next frame
+    for (int64_t i = 1; i <= 3; i++) {
+        ANativeWindowBuffer* buf;
+        ASSERT_EQ(NO_ERROR, native_window_dequeue_buffer_and_wait(anw.get(),
+                &buf));
+        ASSERT_EQ(NO_ERROR, native_window_set_buffers_timestamp(anw.get(),
+                i));
+        ASSERT_EQ(NO_ERROR, anw->queueBuffer(anw.get(), buf, -1));
+
+        BufferItemConsumer::BufferItem item;
+        ASSERT_EQ(NO_ERROR, c->acquireBuffer(&item, 0));
+        EXPECT_EQ(i, item.mTimestamp);
+        ASSERT_EQ(NO_ERROR, c->releaseBuffer(item));
+    }
+
+    // Disabling it gives the prefetched buffer back
+    ASSERT_EQ(NO_ERROR, native_window_set_queue_and_dequeue(anw.get(), 0));
+    ASSERT_EQ(NO_ERROR, native_window_api_disconnect(anw.get(),
+            NATIVE_WINDOW_API_CPU));
+}
+
 }
@@ -0,0 +1,18 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	BufferQueuePingPongBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+LOCAL_MODULE:= test-bq-pingpong
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
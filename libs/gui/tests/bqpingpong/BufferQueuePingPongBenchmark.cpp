@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Passes a buffer back and forth between the producer and the consumer of
+ * an in-process BufferQueue: dequeue, queue, acquire, release, with no GPU
+ * or CPU work on the buffer. Reports the time spent in each call, for a
+ * range of buffer counts, to show how the bookkeeping of the slots scales.
+ *
+ * usage: test-bq-pingpong [buffers [iterations]]
+ *
+ * Without arguments, 3, 8, 32 and 64 buffers are tried with 100000
+ * iterations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <binder/ProcessState.h>
+
+#include <gui/BufferQueue.h>
+#include <gui/IProducerListener.h>
+
+#include <ui/GraphicBuffer.h>
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+using namespace android;
+
+struct DummyConsumer : public BnConsumerListener {
+    virtual void onFrameAvailable(const BufferItem& /* item */) {}
+    virtual void onBuffersReleased() {}
+    virtual void onSidebandStreamChanged() {}
+};
+
+// ---------------------------------------------------------------------------
+
+class PingPong {
+public:
+    PingPong() : mDequeueTime(0), mQueueTime(0), mAcquireTime(0),
+            mReleaseTime(0) {}
+
+    status_t init(int bufferCount) {
+        BufferQueue::createBufferQueue(&mProducer, &mConsumer);
+        status_t err = mConsumer->consumerConnect(new DummyConsumer, false);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        IGraphicBufferProducer::QueueBufferOutput output;
+        err = mProducer->connect(new DummyProducerListener,
+                NATIVE_WINDOW_API_CPU, false, &output);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        return mProducer->setBufferCount(bufferCount);
+    }
+
+    // Runs one round trip, and adds the time of each call to the totals if
+    // timed is set.
+    status_t step(bool timed) {
+        int slot;
+        sp<Fence> fence;
+        const nsecs_t start = systemTime();
+        status_t result = mProducer->dequeueBuffer(&slot, &fence, false,
+                0, 0, 0, GRALLOC_USAGE_SW_WRITE_OFTEN);
+        const nsecs_t dequeued = systemTime();
+        if (result < 0) {
+            return result;
+        }
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            result = mProducer->requestBuffer(slot, &buffer);
+            if (result != NO_ERROR) {
+                return result;
+            }
+        }
+
+        IGraphicBufferProducer::QueueBufferInput input(0, false,
+                Rect(0, 0, 1, 1), NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false,
+                Fence::NO_FENCE);
+        IGraphicBufferProducer::QueueBufferOutput output;
+        const nsecs_t queueStart = systemTime();
+        result = mProducer->queueBuffer(slot, input, &output);
+        const nsecs_t queued = systemTime();
+        if (result != NO_ERROR) {
+            return result;
+        }
+
+        IGraphicBufferConsumer::BufferItem item;
+        result = mConsumer->acquireBuffer(&item, 0);
+        const nsecs_t acquired = systemTime();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        result = mConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+        const nsecs_t released = systemTime();
+        if (result != NO_ERROR) {
+            return result;
+        }
+
+        if (timed) {
+            mDequeueTime += dequeued - start;
+            mQueueTime += queued - queueStart;
+            mAcquireTime += acquired - queued;
+            mReleaseTime += released - acquired;
+        }
+        return NO_ERROR;
+    }
+
+    void report(int bufferCount, size_t iterations) const {
+        printf("%2d buffers: dequeue %6.3f us, queue %6.3f us, "
+                "acquire %6.3f us, release %6.3f us\n", bufferCount,
+                mDequeueTime / 1000.0 / iterations,
+                mQueueTime / 1000.0 / iterations,
+                mAcquireTime / 1000.0 / iterations,
+                mReleaseTime / 1000.0 / iterations);
+    }
+
+private:
+    sp<IGraphicBufferProducer> mProducer;
+    sp<IGraphicBufferConsumer> mConsumer;
+    nsecs_t mDequeueTime;
+    nsecs_t mQueueTime;
+    nsecs_t mAcquireTime;
+    nsecs_t mReleaseTime;
+};
+
+static bool run(int bufferCount, size_t iterations) {
+    PingPong pingPong;
+    status_t err = pingPong.init(bufferCount);
+    if (err != NO_ERROR) {
+        fprintf(stderr, "%d buffers: can't set up the BufferQueue (%d)\n",
+                bufferCount, err);
+        return false;
+    }
+
+    // The oldest free buffer is dequeued every time, so this cycles through
+    // all the slots and allocates their buffers before the timed run.
+    for (int i = 0; i < bufferCount; i++) {
+        if ((err = pingPong.step(false)) != NO_ERROR) {
+            fprintf(stderr, "%d buffers: warm-up failed (%d)\n",
+                    bufferCount, err);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        if ((err = pingPong.step(true)) != NO_ERROR) {
+            fprintf(stderr, "%d buffers: iteration %zu failed (%d)\n",
+                    bufferCount, i, err);
+            return false;
+        }
+    }
+    pingPong.report(bufferCount, iterations);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 100000;
+    Vector<int> bufferCounts;
+    if (argc > 1) {
+        bufferCounts.add(atoi(argv[1]));
+        if (argc > 2) {
+            iterations = atoi(argv[2]);
+        }
+    } else {
+        bufferCounts.add(3);
+        bufferCounts.add(8);
+        bufferCounts.add(32);
+        bufferCounts.add(BufferQueue::NUM_BUFFER_SLOTS);
+    }
+    if (iterations == 0) {
+        fprintf(stderr, "usage: %s [buffers [iterations]]\n", argv[0]);
+        return 1;
+    }
+
+    ProcessState::self()->startThreadPool();
+
+    bool ok = true;
+    for (size_t i = 0; i < bufferCounts.size(); i++) {
+        ok = run(bufferCounts[i], iterations) && ok;
+    }
+    return ok ? 0 : 1;
+}
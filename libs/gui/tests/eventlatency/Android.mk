@@ -0,0 +1,17 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	EventLatencyBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libutils \
+
+LOCAL_MODULE:= test-event-latency
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fans display events out to a number of receivers, the way EventThread
+ * does on vsync, once through BitTubes and once through EventRings. Each
+ * receiver runs on its own thread and polls its fd like a Looper. Reports
+ * the distribution of the latency from the start of the fan-out to the
+ * reception of each event, and the time the sender spends per event.
+ *
+ * usage: test-event-latency [receivers [events]]
+ *
+ * Without arguments, 1, 4 and 16 receivers are tried with 1000 events,
+ * sent every millisecond.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <gui/BitTube.h>
+#include <gui/DisplayEventReceiver.h>
+#include <gui/EventRing.h>
+
+using namespace android;
+
+typedef DisplayEventReceiver::Event Event;
+
+static const nsecs_t kEventPeriod = 1000000;    // 1 ms
+
+// ---------------------------------------------------------------------------
+
+// Wraps either transport, so that senders and receivers don't care.
+struct Channel : public RefBase {
+    explicit Channel(bool useRing) {
+        if (useRing) {
+            ring = new EventRing(sizeof(Event), 128, new BitTube());
+            Parcel parcel;
+            ring->writeToParcel(&parcel);
+            parcel.setDataPosition(0);
+            receiveRing = new EventRing(parcel);
+        } else {
+            tube = new BitTube();
+        }
+    }
+
+    ssize_t send(const Event& event) {
+        return ring != NULL ? DisplayEventReceiver::sendEvents(ring, &event, 1)
+                : DisplayEventReceiver::sendEvents(tube, &event, 1);
+    }
+
+    ssize_t receive(Event* events, size_t count) {
+        return ring != NULL ?
+                DisplayEventReceiver::getEvents(receiveRing, events, count) :
+                DisplayEventReceiver::getEvents(tube, events, count);
+    }
+
+    int getFd() const {
+        return ring != NULL ? receiveRing->getFd() : tube->getFd();
+    }
+
+    sp<BitTube> tube;
+    sp<EventRing> ring;
+    sp<EventRing> receiveRing;
+};
+
+class Receiver : public Thread {
+public:
+    Receiver(const sp<Channel>& channel, size_t numEvents)
+        : Thread(false), mChannel(channel), mNumEvents(numEvents) {
+        mLatencies.setCapacity(numEvents);
+    }
+
+    const Vector<nsecs_t>& getLatencies() const { return mLatencies; }
+
+private:
+    virtual bool threadLoop() {
+        struct pollfd fd = { mChannel->getFd(), POLLIN, 0 };
+        while (mLatencies.size() < mNumEvents) {
+            if (poll(&fd, 1, 1000) <= 0) {
+                fprintf(stderr, "receiver timed out\n");
+                break;
+            }
+            Event events[16];
+            ssize_t n;
+            while ((n = mChannel->receive(events, 16)) > 0) {
+                const nsecs_t now = systemTime();
+                for (ssize_t i = 0; i < n; i++) {
+                    mLatencies.add(now - events[i].header.timestamp);
+                }
+            }
+        }
+        return false;
+    }
+
+    sp<Channel> mChannel;
+    size_t mNumEvents;
+    Vector<nsecs_t> mLatencies;
+};
+
+// ---------------------------------------------------------------------------
+
+static int compareLatencies(const void* a, const void* b) {
+    nsecs_t la = *static_cast<const nsecs_t*>(a);
+    nsecs_t lb = *static_cast<const nsecs_t*>(b);
+    return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static double percentileUs(const Vector<nsecs_t>& sorted, int percentile) {
+    size_t idx = (sorted.size() - 1) * percentile / 100;
+    return sorted[idx] / 1000.0;
+}
+
+static void run(bool useRing, size_t numReceivers, size_t numEvents) {
+    Vector< sp<Channel> > channels;
+    Vector< sp<Receiver> > receivers;
+    for (size_t i = 0; i < numReceivers; i++) {
+        sp<Channel> channel(new Channel(useRing));
+        sp<Receiver> receiver(new Receiver(channel, numEvents));
+        channels.add(channel);
+        receivers.add(receiver);
+        receiver->run("receiver");
+    }
+    // let the receivers block in poll()
+    usleep(10000);
+
+    nsecs_t sendTime = 0;
+    size_t numDropped = 0;
+    for (size_t e = 0; e < numEvents; e++) {
+        Event event;
+        event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+        event.header.id = 0;
+        event.header.timestamp = systemTime();
+        event.vsync.count = e;
+        for (size_t i = 0; i < numReceivers; i++) {
+            if (channels[i]->send(event) < 0) {
+                numDropped++;
+            }
+        }
+        const nsecs_t sent = systemTime();
+        sendTime += sent - event.header.timestamp;
+        const nsecs_t next = event.header.timestamp + kEventPeriod;
+        if (next > sent) {
+            usleep(ns2us(next - sent));
+        }
+    }
+
+    Vector<nsecs_t> latencies;
+    for (size_t i = 0; i < numReceivers; i++) {
+        receivers[i]->join();
+        latencies.appendVector(receivers[i]->getLatencies());
+    }
+    if (latencies.isEmpty()) {
+        printf("%-9s %3zu receivers: no events received\n",
+                useRing ? "EventRing" : "BitTube", numReceivers);
+        return;
+    }
+    qsort(latencies.editArray(), latencies.size(), sizeof(nsecs_t),
+            compareLatencies);
+    printf("%-9s %3zu receivers: latency p50 %6.1f us, p90 %6.1f us, "
+            "p99 %6.1f us, max %7.1f us; send %5.2f us/event, %zu dropped\n",
+            useRing ? "EventRing" : "BitTube", numReceivers,
+            percentileUs(latencies, 50), percentileUs(latencies, 90),
+            percentileUs(latencies, 99), latencies.top() / 1000.0,
+            sendTime / 1000.0 / (numEvents * numReceivers), numDropped);
+}
+
+int main(int argc, char** argv)
+{
+    size_t numEvents = 1000;
+    Vector<size_t> receiverCounts;
+    if (argc > 1) {
+        receiverCounts.add(atoi(argv[1]));
+        if (argc > 2) {
+            numEvents = atoi(argv[2]);
+        }
+    } else {
+        receiverCounts.add(1);
+        receiverCounts.add(4);
+        receiverCounts.add(16);
+    }
+    if (numEvents == 0) {
+        fprintf(stderr, "usage: %s [receivers [events]]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < receiverCounts.size(); i++) {
+        if (receiverCounts[i] == 0) {
+            continue;
+        }
+        run(false, receiverCounts[i], numEvents);
+        run(true, receiverCounts[i], numEvents);
+    }
+    return 0;
+}
@@ -24,6 +24,7 @@ LOCAL_SRC_FILES:= \
 	GraphicBufferMapper.cpp \
 	PixelFormat.cpp \
 	Rect.cpp \
+	RectSweep.cpp \
 	Region.cpp \
 	UiConfig.cpp
 
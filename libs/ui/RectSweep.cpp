@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RectSweep"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include <ui/Rect.h>
+#include <ui/RectSweep.h>
+#include <ui/Region.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// grows 'array' to hold 'count' items, leaves it untouched on failure
+template <typename T>
+static bool growArray(T*& array, size_t count) {
+    T* grown = static_cast<T*>(realloc(array, count * sizeof(T)));
+    if (grown == NULL) {
+        return false;
+    }
+    array = grown;
+    return true;
+}
+
+static inline int64_t max(int64_t a, int64_t b) {
+    return (a > b) ? a : b;
+}
+
+// ---------------------------------------------------------------------------
+
+RectSweep::RectSweep()
+    : mRects(NULL), mCount(0), mCapacity(0),
+      mEvents(NULL), mCoords(NULL), mNodes(NULL)
+{
+}
+
+RectSweep::~RectSweep()
+{
+    free(mRects);
+    free(mEvents);
+    free(mCoords);
+    free(mNodes);
+}
+
+void RectSweep::clear()
+{
+    mCount = 0;
+}
+
+status_t RectSweep::reserve(size_t count)
+{
+    if (count <= mCapacity) {
+        return NO_ERROR;
+    }
+    // each rectangle has two events and two y coordinates, there are at
+    // most 2*count-1 elementary y intervals, and the segment tree over them
+    // needs less than 4 nodes per interval.
+    if (!growArray(mRects, count) ||
+            !growArray(mEvents, count * 2) ||
+            !growArray(mCoords, count * 2) ||
+            !growArray(mNodes, count * 8)) {
+        ALOGE("can't make room for %zu rectangles", count);
+        return NO_MEMORY;
+    }
+    mCapacity = count;
+    return NO_ERROR;
+}
+
+status_t RectSweep::add(const Rect& rect)
+{
+    if (rect.isEmpty()) {
+        return NO_ERROR;
+    }
+    if (mCount == mCapacity) {
+        status_t err = reserve(mCapacity ? mCapacity * 2 : 16);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    mRects[mCount++] = rect;
+    return NO_ERROR;
+}
+
+status_t RectSweep::add(const Region& region)
+{
+    size_t count;
+    const Rect* rects = region.getArray(&count);
+    if (count > mCapacity - mCount) {
+        const size_t needed = mCount + count;
+        status_t err = reserve(needed > mCapacity * 2 ? needed : mCapacity * 2);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    for (size_t i=0 ; i<count ; i++) {
+        if (!rects[i].isEmpty()) {
+            mRects[mCount++] = rects[i];
+        }
+    }
+    return NO_ERROR;
+}
+
+// ---------------------------------------------------------------------------
+
+int RectSweep::compareEvents(const void* lhs, const void* rhs)
+{
+    const Event& l(*static_cast<const Event*>(lhs));
+    const Event& r(*static_cast<const Event*>(rhs));
+    if (l.x != r.x) {
+        return (l.x < r.x) ? -1 : 1;
+    }
+    // rectangles that end at x must be removed before the ones starting
+    // at x are added, so that sharing an edge doesn't count as overlapping.
+    return l.delta - r.delta;
+}
+
+int RectSweep::compareCoords(const void* lhs, const void* rhs)
+{
+    const int32_t l = *static_cast<const int32_t*>(lhs);
+    const int32_t r = *static_cast<const int32_t*>(rhs);
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+size_t RectSweep::prepare()
+{
+    // collect and dedup the y coordinates
+    for (size_t i=0 ; i<mCount ; i++) {
+        mCoords[i*2] = mRects[i].top;
+        mCoords[i*2 + 1] = mRects[i].bottom;
+    }
+    qsort(mCoords, mCount * 2, sizeof(int32_t), compareCoords);
+    size_t numCoords = 1;
+    for (size_t i=1 ; i<mCount*2 ; i++) {
+        if (mCoords[i] != mCoords[numCoords - 1]) {
+            mCoords[numCoords++] = mCoords[i];
+        }
+    }
+
+    for (size_t i=0 ; i<mCount ; i++) {
+        const Rect& r(mRects[i]);
+        const int32_t* top = static_cast<const int32_t*>(bsearch(&r.top,
+                mCoords, numCoords, sizeof(int32_t), compareCoords));
+        const int32_t* bottom = static_cast<const int32_t*>(bsearch(&r.bottom,
+                mCoords, numCoords, sizeof(int32_t), compareCoords));
+        Event& start(mEvents[i*2]);
+        start.x = r.left;
+        start.delta = 1;
+        start.top = int32_t(top - mCoords);
+        start.bottom = int32_t(bottom - mCoords);
+        Event& end(mEvents[i*2 + 1]);
+        end = start;
+        end.x = r.right;
+        end.delta = -1;
+    }
+    qsort(mEvents, mCount * 2, sizeof(Event), compareEvents);
+
+    const size_t numIntervals = numCoords - 1;
+    memset(mNodes, 0, numIntervals * 4 * sizeof(Node));
+    return numIntervals;
+}
+
+// The segment tree is stored in mNodes with the root at index 1 and the
+// children of node n at 2n and 2n+1. Node n spans the elementary intervals
+// [lo, hi), interval i being [mCoords[i], mCoords[i+1]).
+
+int64_t RectSweep::queryMax(size_t node, size_t lo, size_t hi,
+        size_t top, size_t bottom) const
+{
+    if (bottom <= lo || hi <= top) {
+        return 0;
+    }
+    const Node& n(mNodes[node]);
+    if (top <= lo && hi <= bottom) {
+        return n.count + n.value;
+    }
+    const size_t mid = (lo + hi) / 2;
+    return n.count + max(queryMax(node*2, lo, mid, top, bottom),
+            queryMax(node*2 + 1, mid, hi, top, bottom));
+}
+
+void RectSweep::addMax(size_t node, size_t lo, size_t hi,
+        size_t top, size_t bottom, int32_t delta)
+{
+    if (bottom <= lo || hi <= top) {
+        return;
+    }
+    Node& n(mNodes[node]);
+    if (top <= lo && hi <= bottom) {
+        n.count += delta;
+        return;
+    }
+    const size_t mid = (lo + hi) / 2;
+    addMax(node*2, lo, mid, top, bottom, delta);
+    addMax(node*2 + 1, mid, hi, top, bottom, delta);
+    const Node& l(mNodes[node*2]);
+    const Node& r(mNodes[node*2 + 1]);
+    n.value = max(l.count + l.value, r.count + r.value);
+}
+
+void RectSweep::addLength(size_t node, size_t lo, size_t hi,
+        size_t top, size_t bottom, int32_t delta)
+{
+    if (bottom <= lo || hi <= top) {
+        return;
+    }
+    Node& n(mNodes[node]);
+    const size_t mid = (lo + hi) / 2;
+    if (top <= lo && hi <= bottom) {
+        n.count += delta;
+    } else {
+        addLength(node*2, lo, mid, top, bottom, delta);
+        addLength(node*2 + 1, mid, hi, top, bottom, delta);
+    }
+    if (n.count > 0) {
+        n.value = int64_t(mCoords[hi]) - mCoords[lo];
+    } else if (hi - lo == 1) {
+        n.value = 0;
+    } else {
+        n.value = mNodes[node*2].value + mNodes[node*2 + 1].value;
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+bool RectSweep::hasOverlap()
+{
+    if (mCount < 2) {
+        return false;
+    }
+    const size_t numIntervals = prepare();
+    for (size_t i=0 ; i<mCount*2 ; i++) {
+        const Event& e(mEvents[i]);
+        if (e.delta > 0 &&
+                queryMax(1, 0, numIntervals, e.top, e.bottom) > 0) {
+            return true;
+        }
+        addMax(1, 0, numIntervals, e.top, e.bottom, e.delta);
+    }
+    return false;
+}
+
+int64_t RectSweep::unionArea()
+{
+    if (mCount == 0) {
+        return 0;
+    }
+    const size_t numIntervals = prepare();
+    int64_t area = 0;
+    int32_t x = mEvents[0].x;
+    for (size_t i=0 ; i<mCount*2 ; i++) {
+        const Event& e(mEvents[i]);
+        area += mNodes[1].value * (int64_t(e.x) - x);
+        x = e.x;
+        addLength(1, 0, numIntervals, e.top, e.bottom, e.delta);
+    }
+    return area;
+}
+
+int64_t RectSweep::clippedAreaSum(const Rect& clip) const
+{
+    int64_t area = 0;
+    for (size_t i=0 ; i<mCount ; i++) {
+        Rect r;
+        if (mRects[i].intersect(clip, &r)) {
+            area += int64_t(r.getWidth()) * r.getHeight();
+        }
+    }
+    return area;
+}
+
+Rect RectSweep::getBounds() const
+{
+    if (mCount == 0) {
+        return Rect();
+    }
+    Rect bounds(mRects[0]);
+    for (size_t i=1 ; i<mCount ; i++) {
+        const Rect& r(mRects[i]);
+        if (r.left < bounds.left) bounds.left = r.left;
+        if (r.top < bounds.top) bounds.top = r.top;
+        if (r.right > bounds.right) bounds.right = r.right;
+        if (r.bottom > bounds.bottom) bounds.bottom = r.bottom;
+    }
+    return bounds;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -23,6 +23,7 @@
 #include <limits.h>
 
 #include <utils/Log.h>
+#include <utils/SharedBuffer.h>
 #include <utils/String8.h>
 #include <utils/CallStack.h>
 
@@ -58,20 +59,64 @@ enum {
 
 // ----------------------------------------------------------------------------
 
-Region::Region() {
-    mStorage.add(Rect(0,0));
+template<typename T>
+static inline T min(T rhs, T lhs) { return rhs < lhs ? rhs : lhs; }
+template<typename T>
+static inline T max(T rhs, T lhs) { return rhs > lhs ? rhs : lhs; }
+
+static inline bool rect_contains(const Rect& outer, const Rect& inner) {
+    return outer.left <= inner.left && outer.top <= inner.top &&
+            outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
+// returns the index of the first rect whose band ends below y
+static size_t first_band_ending_after(Rect const* rects, size_t count, int y) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (rects[mid].bottom > y) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// returns the index of the first rect whose band starts at or below y
+static size_t first_band_starting_at(Rect const* rects, size_t count, int y) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (rects[mid].top >= y) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// ----------------------------------------------------------------------------
+
+Region::Region()
+    : mInlineRect(0,0)
+{
 }
 
 Region::Region(const Region& rhs)
-    : mStorage(rhs.mStorage)
+    : mStorage(rhs.mStorage), mInlineRect(rhs.mInlineRect)
 {
 #if VALIDATE_REGIONS
     validate(rhs, "rhs copy-ctor");
 #endif
 }
 
-Region::Region(const Rect& rhs) {
-    mStorage.add(rhs);
+Region::Region(const Rect& rhs)
+    : mInlineRect(rhs)
+{
 }
 
 Region::~Region()
@@ -212,6 +257,7 @@ Region& Region::operator = (const Region& rhs)
     validate(rhs, "rhs.operator=");
 #endif
     mStorage = rhs.mStorage;
+    mInlineRect = rhs.mInlineRect;
     return *this;
 }
 
@@ -220,7 +266,7 @@ Region& Region::makeBoundsSelf()
     if (mStorage.size() >= 2) {
         const Rect bounds(getBounds());
         mStorage.clear();
-        mStorage.add(bounds);
+        mInlineRect = bounds;
     }
     return *this;
 }
@@ -244,22 +290,26 @@ bool Region::contains(int x, int y) const {
 void Region::clear()
 {
     mStorage.clear();
-    mStorage.add(Rect(0,0));
+    mInlineRect = Rect(0,0);
 }
 
 void Region::set(const Rect& r)
 {
     mStorage.clear();
-    mStorage.add(r);
+    mInlineRect = r;
 }
 
 void Region::set(uint32_t w, uint32_t h)
 {
     mStorage.clear();
-    mStorage.add(Rect(w,h));
+    mInlineRect = Rect(w,h);
 }
 
 bool Region::isTriviallyEqual(const Region& region) const {
+    if (mStorage.isEmpty() && region.mStorage.isEmpty()) {
+        // single rects are stored inline, comparing them is as cheap
+        return mInlineRect == region.mInlineRect;
+    }
     return begin() == region.begin();
 }
 
@@ -268,6 +318,9 @@ bool Region::isTriviallyEqual(const Region& region) const {
 void Region::addRectUnchecked(int l, int t, int r, int b)
 {
     Rect rect(l,t,r,b);
+    if (mStorage.isEmpty()) {
+        mStorage.add(mInlineRect);
+    }
     size_t where = mStorage.size() - 1;
     mStorage.insertAt(rect, where, 1);
 }
@@ -410,6 +463,7 @@ const Region Region::operation(const Region& rhs, int dx, int dy, int op) const
 class Region::rasterizer : public region_operator<Rect>::region_rasterizer 
 {
     Rect bounds;
+    Region& region;
     Vector<Rect>& storage;
     Rect* head;
     Rect* tail;
@@ -417,7 +471,8 @@ class Region::rasterizer : public region_operator<Rect>::region_rasterizer
     Rect* cur;
 public:
     rasterizer(Region& reg) 
-        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), cur() {
+        : bounds(INT_MAX, 0, INT_MIN, 0), region(reg), storage(reg.mStorage),
+          head(), tail(), cur() {
         storage.clear();
     }
 
@@ -428,14 +483,26 @@ public:
         if (storage.size()) {
             bounds.top = storage.itemAt(0).top;
             bounds.bottom = storage.top().bottom;
-            if (storage.size() == 1) {
-                storage.clear();
-            }
         } else {
             bounds.left  = 0;
             bounds.right = 0;
         }
-        storage.add(bounds);
+        if (storage.size() <= 1) {
+            storage.clear();
+            region.mInlineRect = bounds;
+        } else {
+            storage.add(bounds);
+        }
+    }
+
+    // copies rects that don't need to be merged with anything, i.e.: whole
+    // bands of one of the operands.
+    void copy(Rect const* rects, size_t count, int dx, int dy) {
+        for (size_t i = 0; i < count; i++) {
+            Rect rect(rects[i]);
+            rect.offsetBy(dx, dy);
+            (*this)(rect);
+        }
     }
     
     virtual void operator()(const Rect& rect) {
@@ -569,18 +636,8 @@ void Region::boolean_operation(int op, Region& dst,
     validate(dst, "boolean_operation (before): dst");
 #endif
 
-    size_t lhs_count;
-    Rect const * const lhs_rects = lhs.getArray(&lhs_count);
-
-    size_t rhs_count;
-    Rect const * const rhs_rects = rhs.getArray(&rhs_count);
-
-    region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
-    region_operator<Rect>::region rhs_region(rhs_rects, rhs_count, dx, dy);
-    region_operator<Rect> operation(op, lhs_region, rhs_region);
-    { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
-        operation(r);
+    if (!boolean_operation_trivial(op, dst, lhs, rhs, dx, dy)) {
+        boolean_operation_banded(op, dst, lhs, rhs, dx, dy);
     }
 
 #if VALIDATE_REGIONS
@@ -590,6 +647,12 @@ void Region::boolean_operation(int op, Region& dst,
 #endif
 
 #if VALIDATE_WITH_CORECG
+    size_t lhs_count;
+    Rect const * const lhs_rects = lhs.getArray(&lhs_count);
+
+    size_t rhs_count;
+    Rect const * const rhs_rects = rhs.getArray(&rhs_count);
+
     SkRegion sk_lhs;
     SkRegion sk_rhs;
     SkRegion sk_dst;
@@ -679,21 +742,148 @@ void Region::boolean_operation(int op, Region& dst,
         return;
     }
 
-#if VALIDATE_WITH_CORECG || VALIDATE_REGIONS
+    // single rect regions don't allocate any memory
     boolean_operation(op, dst, lhs, Region(rhs), dx, dy);
-#else
+}
+
+// Handles the cases where the result is one of the operands, a single Rect
+// or empty, without running the span merge.
+bool Region::boolean_operation_trivial(int op, Region& dst,
+        const Region& lhs, const Region& rhs, int dx, int dy)
+{
+    const Rect lhs_bounds(lhs.getBounds());
+    Rect rhs_bounds(rhs.getBounds());
+    rhs_bounds.offsetBy(dx, dy);
+
+    const bool lhs_empty = lhs_bounds.isEmpty();
+    const bool rhs_empty = rhs_bounds.isEmpty();
+    Rect overlap;
+    const bool disjoint = lhs_empty || rhs_empty ||
+            !lhs_bounds.intersect(rhs_bounds, &overlap);
+
+    switch (op) {
+        case op_and:
+            if (disjoint) {
+                dst.clear();
+                return true;
+            }
+            if (rhs.isRect() && rect_contains(rhs_bounds, lhs_bounds)) {
+                dst = lhs;
+                return true;
+            }
+            if (lhs.isRect()) {
+                if (rect_contains(lhs_bounds, rhs_bounds)) {
+                    translate(dst, rhs, dx, dy);
+                } else if (rhs.isRect()) {
+                    dst.set(overlap);
+                } else {
+                    return false;
+                }
+                return true;
+            }
+            break;
+        case op_nand:
+            if (lhs_empty) {
+                dst.clear();
+                return true;
+            }
+            if (disjoint) {
+                dst = lhs;
+                return true;
+            }
+            if (rhs.isRect() && rect_contains(rhs_bounds, lhs_bounds)) {
+                dst.clear();
+                return true;
+            }
+            break;
+        case op_or:
+        case op_xor:
+            if (rhs_empty) {
+                if (lhs_empty) {
+                    dst.clear();
+                } else {
+                    dst = lhs;
+                }
+                return true;
+            }
+            if (lhs_empty) {
+                translate(dst, rhs, dx, dy);
+                return true;
+            }
+            if (op == op_or) {
+                if (rhs.isRect() && rect_contains(rhs_bounds, lhs_bounds)) {
+                    dst.set(rhs_bounds);
+                    return true;
+                }
+                if (lhs.isRect() && rect_contains(lhs_bounds, rhs_bounds)) {
+                    dst = lhs;
+                    return true;
+                }
+            }
+            break;
+    }
+    return false;
+}
+
+// Only the bands where lhs and rhs overlap vertically need to be merged.
+// Above and below that range, only one of the operands has bands, which are
+// either copied as-is or dropped depending on op. The range is found with a
+// binary search since the tops and bottoms of the bands are both sorted.
+void Region::boolean_operation_banded(int op, Region& dst,
+        const Region& lhs, const Region& rhs, int dx, int dy)
+{
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
-    region_operator<Rect>::region lhs_region(lhs_rects, lhs_count);
-    region_operator<Rect>::region rhs_region(&rhs, 1, dx, dy);
-    region_operator<Rect> operation(op, lhs_region, rhs_region);
-    { // scope for rasterizer (dtor has side effects)
-        rasterizer r(dst);
+    size_t rhs_count;
+    Rect const * const rhs_rects = rhs.getArray(&rhs_count);
+
+    const Rect lhs_bounds(lhs.getBounds());
+    Rect rhs_bounds(rhs.getBounds());
+    rhs_bounds.offsetBy(dx, dy);
+
+    // see region_operator: bit 0 of op keeps what is only covered by lhs,
+    // and bit 1 what is only covered by rhs.
+    const bool keep_lhs = op & 0x1;
+    const bool keep_rhs = op & 0x2;
+
+    const int top = max(lhs_bounds.top, rhs_bounds.top);
+    const int bottom = min(lhs_bounds.bottom, rhs_bounds.bottom);
+
+    rasterizer r(dst);
+    if (top >= bottom) {
+        // the operands don't overlap vertically
+        if (lhs_bounds.top < rhs_bounds.top) {
+            if (keep_lhs) r.copy(lhs_rects, lhs_count, 0, 0);
+            if (keep_rhs) r.copy(rhs_rects, rhs_count, dx, dy);
+        } else {
+            if (keep_rhs) r.copy(rhs_rects, rhs_count, dx, dy);
+            if (keep_lhs) r.copy(lhs_rects, lhs_count, 0, 0);
+        }
+        return;
+    }
+
+    const size_t lhs_first = first_band_ending_after(lhs_rects, lhs_count, top);
+    const size_t lhs_last = first_band_starting_at(lhs_rects, lhs_count, bottom);
+    const size_t rhs_first = first_band_ending_after(rhs_rects, rhs_count, top - dy);
+    const size_t rhs_last = first_band_starting_at(rhs_rects, rhs_count, bottom - dy);
+
+    // at most one of the operands has bands above the overlap
+    if (keep_lhs) r.copy(lhs_rects, lhs_first, 0, 0);
+    if (keep_rhs) r.copy(rhs_rects, rhs_first, dx, dy);
+
+    if (lhs_first < lhs_last || rhs_first < rhs_last) {
+        region_operator<Rect>::region lhs_region(lhs_rects + lhs_first,
+                lhs_last - lhs_first);
+        region_operator<Rect>::region rhs_region(rhs_rects + rhs_first,
+                rhs_last - rhs_first, dx, dy);
+        region_operator<Rect> operation(op, lhs_region, rhs_region);
         operation(r);
     }
 
-#endif
+    // and at most one has bands below it
+    if (keep_lhs) r.copy(lhs_rects + lhs_last, lhs_count - lhs_last, 0, 0);
+    if (keep_rhs) r.copy(rhs_rects + rhs_last, rhs_count - rhs_last, dx, dy);
 }
 
 void Region::boolean_operation(int op, Region& dst,
@@ -714,12 +904,16 @@ void Region::translate(Region& reg, int dx, int dy)
 #if VALIDATE_REGIONS
         validate(reg, "translate (before)");
 #endif
-        size_t count = reg.mStorage.size();
-        Rect* rects = reg.mStorage.editArray();
-        while (count) {
-            rects->offsetBy(dx, dy);
-            rects++;
-            count--;
+        if (reg.mStorage.isEmpty()) {
+            reg.mInlineRect.offsetBy(dx, dy);
+        } else {
+            size_t count = reg.mStorage.size();
+            Rect* rects = reg.mStorage.editArray();
+            while (count) {
+                rects->offsetBy(dx, dy);
+                rects++;
+                count--;
+            }
         }
 #if VALIDATE_REGIONS
         validate(reg, "translate (after)");
@@ -736,18 +930,18 @@ void Region::translate(Region& dst, const Region& reg, int dx, int dy)
 // ----------------------------------------------------------------------------
 
 size_t Region::getFlattenedSize() const {
-    return mStorage.size() * sizeof(Rect);
+    return (mStorage.isEmpty() ? 1 : mStorage.size()) * sizeof(Rect);
 }
 
 status_t Region::flatten(void* buffer, size_t size) const {
 #if VALIDATE_REGIONS
     validate(*this, "Region::flatten");
 #endif
-    if (size < mStorage.size() * sizeof(Rect)) {
+    if (size < getFlattenedSize()) {
         return NO_MEMORY;
     }
     Rect* rects = reinterpret_cast<Rect*>(buffer);
-    memcpy(rects, mStorage.array(), mStorage.size() * sizeof(Rect));
+    memcpy(rects, begin(), getFlattenedSize());
     return NO_ERROR;
 }
 
@@ -773,19 +967,24 @@ status_t Region::unflatten(void const* buffer, size_t size) {
         ALOGE("Region::unflatten() failed, invalid region");
         return BAD_VALUE;
     }
+    if (result.mStorage.size() == 1) {
+        result.mInlineRect = result.mStorage[0];
+        result.mStorage.clear();
+    }
     mStorage = result.mStorage;
+    mInlineRect = result.mInlineRect;
     return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
 
 Region::const_iterator Region::begin() const {
-    return mStorage.array();
+    return mStorage.isEmpty() ? &mInlineRect : mStorage.array();
 }
 
 Region::const_iterator Region::end() const {
     size_t numRects = isRect() ? 1 : mStorage.size() - 1;
-    return mStorage.array() + numRects;
+    return begin() + numRects;
 }
 
 Rect const* Region::getArray(size_t* count) const {
@@ -796,6 +995,18 @@ Rect const* Region::getArray(size_t* count) const {
 }
 
 SharedBuffer const* Region::getSharedBuffer(size_t* count) const {
+    if (mStorage.isEmpty()) {
+        // single rects are stored inline, hand out a copy
+        SharedBuffer* sb = SharedBuffer::alloc(sizeof(Rect));
+        if (sb != NULL) {
+            memcpy(sb->data(), &mInlineRect, sizeof(Rect));
+        }
+        if (count) {
+            count[0] = 1;
+        }
+        return sb;
+    }
+
     // We can get to the SharedBuffer of a Vector<Rect> because Rect has
     // a trivial destructor.
     SharedBuffer const* sb = SharedBuffer::bufferFromData(mStorage.array());
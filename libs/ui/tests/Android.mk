@@ -5,6 +5,7 @@ include $(CLEAR_VARS)
 # Build the unit tests.
 test_src_files := \
     Region_test.cpp \
+    RectSweep_test.cpp \
     vec_test.cpp \
     mat_test.cpp
 
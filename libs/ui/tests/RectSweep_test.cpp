@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RectSweepTest"
+
+#include <stdlib.h>
+#include <ui/Rect.h>
+#include <ui/RectSweep.h>
+#include <ui/Region.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+class RectSweepTest : public testing::Test {
+protected:
+    static int64_t regionArea(const Region& region) {
+        int64_t area = 0;
+        for (Region::const_iterator r = region.begin(); r != region.end(); r++) {
+            area += int64_t(r->getWidth()) * r->getHeight();
+        }
+        return area;
+    }
+
+    static Rect randomRect() {
+        int32_t l = rand() % 64;
+        int32_t t = rand() % 64;
+        return Rect(l, t, l + rand() % 32, t + rand() % 32);
+    }
+};
+
+TEST_F(RectSweepTest, Empty) {
+    RectSweep sweep;
+    EXPECT_TRUE(sweep.isEmpty());
+    EXPECT_FALSE(sweep.hasOverlap());
+    EXPECT_EQ(0, sweep.unionArea());
+    EXPECT_TRUE(sweep.getBounds().isEmpty());
+
+    // empty rectangles are ignored
+    sweep.add(Rect(10, 10, 10, 20));
+    sweep.add(Rect(10, 10, 20, 10));
+    EXPECT_TRUE(sweep.isEmpty());
+}
+
+TEST_F(RectSweepTest, SharedEdgesDontOverlap) {
+    RectSweep sweep;
+    sweep.add(Rect(0, 0, 10, 10));
+    sweep.add(Rect(10, 0, 20, 10));
+    sweep.add(Rect(0, 10, 20, 20));
+    EXPECT_FALSE(sweep.hasOverlap());
+    EXPECT_EQ(400, sweep.unionArea());
+    EXPECT_EQ(Rect(0, 0, 20, 20), sweep.getBounds());
+
+    sweep.add(Rect(19, 19, 21, 21));
+    EXPECT_TRUE(sweep.hasOverlap());
+    EXPECT_EQ(403, sweep.unionArea());
+}
+
+TEST_F(RectSweepTest, ClippedAreaSum) {
+    RectSweep sweep;
+    sweep.add(Rect(0, 0, 10, 10));
+    sweep.add(Rect(5, 5, 15, 15));
+    // the overlapping area is counted twice
+    EXPECT_EQ(200, sweep.clippedAreaSum(Rect(0, 0, 20, 20)));
+    EXPECT_EQ(25 + 25, sweep.clippedAreaSum(Rect(5, 5, 10, 10)));
+    EXPECT_EQ(0, sweep.clippedAreaSum(Rect(20, 20, 30, 30)));
+}
+
+TEST_F(RectSweepTest, FromRegion) {
+    Region region;
+    region.orSelf(Rect(0, 0, 100, 100));
+    region.orSelf(Rect(50, 50, 150, 150));
+
+    // the rectangles of a region never overlap
+    RectSweep sweep;
+    sweep.add(region);
+    EXPECT_FALSE(sweep.hasOverlap());
+    EXPECT_EQ(regionArea(region), sweep.unionArea());
+    EXPECT_EQ(region.getBounds(), sweep.getBounds());
+}
+
+TEST_F(RectSweepTest, MatchesRegion) {
+    srand(42);
+    RectSweep sweep;
+    for (int i = 0; i < 500; i++) {
+        sweep.clear();
+        Region covered;
+        bool overlap = false;
+        const int count = rand() % 12;
+        for (int j = 0; j < count; j++) {
+            const Rect r(randomRect());
+            overlap = overlap || !covered.intersect(r).isEmpty();
+            covered.orSelf(r);
+            sweep.add(r);
+        }
+        EXPECT_EQ(overlap, sweep.hasOverlap());
+        EXPECT_EQ(regionArea(covered), sweep.unionArea());
+        // the queries can be repeated
+        EXPECT_EQ(overlap, sweep.hasOverlap());
+    }
+}
+
+}; // namespace android
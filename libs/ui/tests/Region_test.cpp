@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <ui/Region.h>
 #include <ui/Rect.h>
+#include <utils/SharedBuffer.h>
 #include <gtest/gtest.h>
 
 namespace android {
@@ -152,5 +153,145 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+static Region randomRegion(int maxX, int maxY) {
+    Region r;
+    const int count = random() % 6;
+    for (int i = 0; i < count; i++) {
+        const int l = random() % maxX;
+        const int t = random() % maxY;
+        const int w = 1 + random() % (maxX - l);
+        const int h = 1 + random() % (maxY - t);
+        if (random() % 4) {
+            r.orSelf(Rect(l, t, l + w, t + h));
+        } else {
+            r.subtractSelf(Rect(l, t, l + w, t + h));
+        }
+    }
+    return r;
+}
+
+static void checkOperation(const Region& lhs, const Region& rhs,
+        int dx, int dy) {
+    const Region rOr = lhs.merge(rhs, dx, dy);
+    const Region rXor = lhs.mergeExclusive(rhs, dx, dy);
+    const Region rAnd = lhs.intersect(rhs, dx, dy);
+    const Region rNand = lhs.subtract(rhs, dx, dy);
+
+
+    for (int y = -2; y < Y_MAX + 4; y++) {
+        for (int x = -2; x < X_MAX + 4; x++) {
+            const bool a = lhs.contains(x, y);
+            const bool b = rhs.contains(x - dx, y - dy);
+            ASSERT_EQ(a || b, rOr.contains(x, y));
+            ASSERT_EQ(a != b, rXor.contains(x, y));
+            ASSERT_EQ(a && b, rAnd.contains(x, y));
+            ASSERT_EQ(a && !b, rNand.contains(x, y));
+        }
+    }
+}
+
+TEST_F(RegionTest, Random_BooleanOperations) {
+    srandom(54321);
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        const Region lhs(randomRegion(X_MAX, Y_MAX));
+        const Region rhs(randomRegion(X_MAX, Y_MAX));
+        checkOperation(lhs, rhs, 0, 0);
+        checkOperation(lhs, rhs, random() % 5 - 2, random() % 5 - 2);
+        checkOperation(lhs, lhs, 0, 0);
+    }
+}
+
+TEST_F(RegionTest, BooleanOperations_Bands) {
+    // rhs only overlaps the middle bands of lhs
+    Region lhs;
+    lhs.orSelf(Rect(0, 0, 2, 2));
+    lhs.orSelf(Rect(4, 2, 6, 4));
+    lhs.orSelf(Rect(0, 4, 2, 6));
+    lhs.orSelf(Rect(4, 6, 6, 8));
+    const Region rhs(Rect(1, 3, 5, 5));
+    checkOperation(lhs, rhs, 0, 0);
+    checkOperation(rhs, lhs, 0, 0);
+
+    // bands of the result must be coalesced across the overlap
+    Region r(Rect(0, 0, 4, 4));
+    r.orSelf(Rect(0, 4, 4, 8));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(0, 0, 4, 8), r.getBounds());
+
+    // operands that don't overlap vertically
+    Region upper(Rect(0, 0, 2, 2));
+    upper.orSelf(Rect(3, 0, 5, 2));
+    const Region lower(Rect(0, 4, 5, 6));
+    checkOperation(upper, lower, 0, 0);
+    checkOperation(lower, upper, 0, 0);
+}
+
+TEST_F(RegionTest, SingleRect) {
+    Region r(Rect(1, 2, 3, 4));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(1, 2, 3, 4), r.getBounds());
+    EXPECT_EQ(1, r.end() - r.begin());
+    EXPECT_EQ(Rect(1, 2, 3, 4), *r.begin());
+
+    size_t count;
+    Rect const* rects = r.getArray(&count);
+    EXPECT_EQ(1U, count);
+    EXPECT_EQ(Rect(1, 2, 3, 4), rects[0]);
+
+    SharedBuffer const* sb = r.getSharedBuffer(&count);
+    ASSERT_TRUE(sb != NULL);
+    EXPECT_EQ(1U, count);
+    EXPECT_EQ(Rect(1, 2, 3, 4), *static_cast<Rect const*>(sb->data()));
+    sb->release();
+
+    // a copy of a single rect region is trivially equal to it
+    const Region copy(r);
+    EXPECT_TRUE(copy.isTriviallyEqual(r));
+    EXPECT_TRUE(Region(Rect(1, 2, 3, 4)).isTriviallyEqual(r));
+    EXPECT_FALSE(Region(Rect(1, 2, 3, 5)).isTriviallyEqual(r));
+
+    r.orSelf(Rect(3, 2, 5, 4));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(1, 2, 5, 4), r.getBounds());
+
+    r.orSelf(Rect(0, 5, 1, 6));
+    EXPECT_FALSE(r.isRect());
+    EXPECT_EQ(Rect(0, 2, 5, 6), r.getBounds());
+    EXPECT_FALSE(copy.isTriviallyEqual(r));
+
+    r.subtractSelf(Rect(0, 5, 1, 6));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(1, 2, 5, 4), r.getBounds());
+
+    r.translateSelf(1, 1);
+    EXPECT_EQ(Rect(2, 3, 6, 5), r.getBounds());
+
+    r.clear();
+    EXPECT_TRUE(r.isEmpty());
+    EXPECT_TRUE(r.isRect());
+}
+
+TEST_F(RegionTest, Flatten) {
+    Region single(Rect(1, 2, 3, 4));
+    Region complex(single);
+    complex.orSelf(Rect(5, 6, 7, 8));
+
+    const Region* regions[] = { &single, &complex };
+    for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+        const Region& r(*regions[i]);
+        const size_t size = r.getFlattenedSize();
+        uint8_t* buffer = new uint8_t[size];
+        ASSERT_EQ(NO_ERROR, r.flatten(buffer, size));
+
+        Region result;
+        ASSERT_EQ(NO_ERROR, result.unflatten(buffer, size));
+        EXPECT_EQ(r.isRect(), result.isRect());
+        EXPECT_TRUE((r ^ result).isEmpty());
+        EXPECT_EQ(r.getBounds(), result.getBounds());
+        delete [] buffer;
+    }
+}
+
 }; // namespace android
 
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the boolean operations SurfaceFlinger does on layer regions, once
+ * with a full span merge of both operands (what Region did before the
+ * fast paths were added) and once through the Region API, checks that both
+ * produce the same rects and reports the time spent per operation.
+ *
+ * usage: test-region-benchmark [iterations]
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <private/ui/RegionHelper.h>
+
+using namespace android;
+
+typedef region_operator<Rect> operation_t;
+
+// ---------------------------------------------------------------------------
+
+// Same output as Region::rasterizer, always into a Vector<Rect> followed by
+// the bounds.
+class LegacyRasterizer : public operation_t::region_rasterizer {
+public:
+    LegacyRasterizer(Vector<Rect>& storage)
+        : mBounds(INT_MAX, 0, INT_MIN, 0), mStorage(storage),
+          mHead(0), mTail(0) {
+        mStorage.clear();
+    }
+
+    ~LegacyRasterizer() {
+        if (mSpan.size()) {
+            flushSpan();
+        }
+        if (mStorage.size()) {
+            mBounds.top = mStorage.itemAt(0).top;
+            mBounds.bottom = mStorage.top().bottom;
+            if (mStorage.size() == 1) {
+                mStorage.clear();
+            }
+        } else {
+            mBounds.left = 0;
+            mBounds.right = 0;
+        }
+        mStorage.add(mBounds);
+    }
+
+    virtual void operator()(const Rect& rect) {
+        if (mSpan.size()) {
+            Rect& cur(mSpan.editTop());
+            if (cur.top != rect.top) {
+                flushSpan();
+            } else if (cur.right == rect.left) {
+                cur.right = rect.right;
+                return;
+            }
+        }
+        mSpan.add(rect);
+    }
+
+private:
+    void flushSpan() {
+        bool merge = false;
+        if (mTail - mHead == mSpan.size()) {
+            merge = mSpan[0].top == mStorage[mHead].bottom;
+            for (size_t i = 0; merge && i < mSpan.size(); i++) {
+                const Rect& q(mStorage[mHead + i]);
+                merge = mSpan[i].left == q.left && mSpan[i].right == q.right;
+            }
+        }
+        if (merge) {
+            const int bottom = mSpan[0].bottom;
+            for (size_t i = mHead; i < mTail; i++) {
+                mStorage.editItemAt(i).bottom = bottom;
+            }
+        } else {
+            if (mSpan[0].left < mBounds.left) mBounds.left = mSpan[0].left;
+            if (mSpan.top().right > mBounds.right) mBounds.right = mSpan.top().right;
+            mStorage.appendVector(mSpan);
+            mTail = mStorage.size();
+            mHead = mTail - mSpan.size();
+        }
+        mSpan.clear();
+    }
+
+    Rect mBounds;
+    Vector<Rect>& mStorage;
+    size_t mHead;
+    size_t mTail;
+    Vector<Rect> mSpan;
+};
+
+static Vector<Rect> legacyOperation(int op,
+        const Region& lhs, const Region& rhs) {
+    Vector<Rect> dst;
+    size_t lhsCount;
+    Rect const* lhsRects = lhs.getArray(&lhsCount);
+    size_t rhsCount;
+    Rect const* rhsRects = rhs.getArray(&rhsCount);
+
+    operation_t::region lhsRegion(lhsRects, lhsCount);
+    operation_t::region rhsRegion(rhsRects, rhsCount);
+    operation_t operation(op, lhsRegion, rhsRegion);
+    { // scope for rasterizer (dtor has side effects)
+        LegacyRasterizer r(dst);
+        operation(r);
+    }
+    return dst;
+}
+
+static void regionOperation(int op, Region& dst,
+        const Region& lhs, const Region& rhs) {
+    switch (op) {
+        case operation_t::op_or:   dst = lhs.merge(rhs);     break;
+        case operation_t::op_xor:  dst = lhs.mergeExclusive(rhs); break;
+        case operation_t::op_and:  dst = lhs.intersect(rhs); break;
+        case operation_t::op_nand: dst = lhs.subtract(rhs);  break;
+    }
+}
+
+static bool equals(const Vector<Rect>& legacy, const Region& region) {
+    size_t count;
+    Rect const* rects = region.getArray(&count);
+    // legacy storage always ends with the bounds
+    const size_t legacyCount = legacy.size() > 1 ? legacy.size() - 1 : 1;
+    if (count != legacyCount) {
+        return false;
+    }
+    if (region.isEmpty() && legacy[0].isEmpty()) {
+        return true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (rects[i] != legacy[i]) {
+            return false;
+        }
+    }
+    return region.getBounds() == legacy.top();
+}
+
+// ---------------------------------------------------------------------------
+
+struct Case {
+    const char* name;
+    int op;
+    Region lhs;
+    Region rhs;
+};
+
+static void makeCases(Vector<Case>& cases) {
+    const int w = 1080;
+    const int h = 1920;
+
+    const Region screen(Rect(w, h));
+    const Region statusBar(Rect(0, 0, w, 75));
+    const Region navBar(Rect(0, h - 144, w, h));
+    const Region app(Rect(0, 75, w, h - 144));
+    const Region dialog(Rect(100, 600, 980, 1300));
+
+    // what's left of the wallpaper below a few overlapping windows
+    Region wallpaper(screen);
+    wallpaper.subtractSelf(Rect(0, 75, 540, 900));
+    wallpaper.subtractSelf(Rect(300, 500, 1080, 1400));
+    wallpaper.subtractSelf(Rect(100, 1300, 700, 1700));
+
+    // status bar icons
+    Region icons;
+    for (int i = 0; i < 24; i++) {
+        icons.orSelf(Rect(40 * i, 8, 40 * i + 32, 64));
+    }
+
+    // a list view's dirty rows
+    Region rows;
+    for (int i = 0; i < 16; i++) {
+        rows.orSelf(Rect(0, 200 + 100 * i, w, 260 + 100 * i));
+    }
+
+    const Case all[] = {
+        { "or disjoint rects",      operation_t::op_or,   statusBar, navBar },
+        { "or contained rect",      operation_t::op_or,   app, dialog },
+        { "and contained rect",     operation_t::op_and,  screen, dialog },
+        { "and disjoint",           operation_t::op_and,  icons, navBar },
+        { "nand covering rect",     operation_t::op_nand, dialog, screen },
+        { "nand disjoint",          operation_t::op_nand, rows, statusBar },
+        { "or icons into bar",      operation_t::op_or,   icons, statusBar },
+        { "nand dialog from rows",  operation_t::op_nand, rows, dialog },
+        { "and rows with wallpaper", operation_t::op_and, rows, wallpaper },
+        { "or wallpaper and icons", operation_t::op_or,   wallpaper, icons },
+        { "xor wallpaper and app",  operation_t::op_xor,  wallpaper, app },
+    };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        cases.add(all[i]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+    Vector<Case> cases;
+    makeCases(cases);
+
+    size_t mismatches = 0;
+    nsecs_t legacyTotal = 0;
+    nsecs_t regionTotal = 0;
+
+    printf("%-24s %12s %12s\n", "operation", "legacy (ns)", "region (ns)");
+    for (size_t i = 0; i < cases.size(); i++) {
+        const Case& c(cases[i]);
+
+        Vector<Rect> legacy;
+        nsecs_t start = systemTime();
+        for (size_t n = 0; n < iterations; n++) {
+            legacy = legacyOperation(c.op, c.lhs, c.rhs);
+        }
+        const nsecs_t legacyTime = systemTime() - start;
+
+        Region region;
+        start = systemTime();
+        for (size_t n = 0; n < iterations; n++) {
+            regionOperation(c.op, region, c.lhs, c.rhs);
+        }
+        const nsecs_t regionTime = systemTime() - start;
+
+        const bool match = equals(legacy, region);
+        if (!match) {
+            mismatches++;
+        }
+        legacyTotal += legacyTime;
+        regionTotal += regionTime;
+        printf("%-24s %12.1f %12.1f%s\n", c.name,
+                double(legacyTime) / iterations,
+                double(regionTime) / iterations,
+                match ? "" : "  MISMATCH");
+    }
+    printf("%-24s %12.1f %12.1f (%.2fx)\n", "total",
+            double(legacyTotal) / iterations,
+            double(regionTotal) / iterations,
+            regionTotal ? double(legacyTotal) / regionTotal : 0.0);
+    printf("mismatches: %zu\n", mismatches);
+
+    return mismatches ? 1 : 0;
+}
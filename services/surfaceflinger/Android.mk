@@ -6,18 +6,24 @@ LOCAL_CLANG := true
 LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
 LOCAL_SRC_FILES:= \
     Client.cpp \
+    CompositionWorker.cpp \
     DisplayDevice.cpp \
     DispSync.cpp \
     EventControlThread.cpp \
     EventThread.cpp \
     FrameTracker.cpp \
+    LatencyHistogram.cpp \
     Layer.cpp \
     LayerDim.cpp \
     MessageQueue.cpp \
     MonitoredProducer.cpp \
+    PrelatchThread.cpp \
+    ScreenshotRenderer.cpp \
     SurfaceFlinger.cpp \
     SurfaceFlingerConsumer.cpp \
     Transform.cpp \
+    VisibleRegionCache.cpp \
+    DisplayHardware/CompositionStrategy.cpp \
     DisplayHardware/FramebufferSurface.cpp \
     DisplayHardware/HWComposer.cpp \
     DisplayHardware/PowerHAL.cpp \
@@ -59,6 +65,11 @@ ifeq ($(TARGET_RUNNING_WITHOUT_SYNC_FRAMEWORK),true)
     LOCAL_CFLAGS += -DRUNNING_WITHOUT_SYNC_FRAMEWORK
 endif
 
+# For builds that run with the headless display HALs of tests/headless.
+ifeq ($(TARGET_USES_HEADLESS_DISPLAY),true)
+    LOCAL_CFLAGS += -DHEADLESS_DISPLAY
+endif
+
 # See build/target/board/generic/BoardConfig.mk for a description of this setting.
 ifneq ($(VSYNC_EVENT_PHASE_OFFSET_NS),)
     LOCAL_CFLAGS += -DVSYNC_EVENT_PHASE_OFFSET_NS=$(VSYNC_EVENT_PHASE_OFFSET_NS)
@@ -72,6 +72,18 @@ void Client::detachLayer(const Layer* layer)
         }
     }
 }
+bool Client::queuePendingState(const layer_state_t& state)
+{
+    mPendingStates.add(state);
+    return mPendingStates.size() == 1;
+}
+
+void Client::takePendingStates(Vector<layer_state_t>& states)
+{
+    states = mPendingStates;
+    mPendingStates.clear();
+}
+
 sp<Layer> Client::getLayerUser(const sp<IBinder>& handle) const
 {
     Mutex::Autolock _l(mLock);
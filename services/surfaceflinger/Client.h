@@ -23,9 +23,12 @@
 #include <utils/Errors.h>
 #include <utils/KeyedVector.h>
 #include <utils/Mutex.h>
+#include <utils/Vector.h>
 
 #include <gui/ISurfaceComposerClient.h>
 
+#include <private/gui/LayerState.h>
+
 namespace android {
 
 // ---------------------------------------------------------------------------
@@ -50,6 +53,12 @@ public:
 
     sp<Layer> getLayerUser(const sp<IBinder>& handle) const;
 
+    // protected by SurfaceFlinger::mPendingStateLock
+    // layer states posted by setTransactionState() and not applied yet.
+    // queuePendingState returns true if there were none.
+    bool queuePendingState(const layer_state_t& state);
+    void takePendingStates(Vector<layer_state_t>& states);
+
 private:
     // ISurfaceComposerClient interface
     virtual status_t createSurface(
@@ -75,6 +84,9 @@ private:
 
     // thread-safe
     mutable Mutex mLock;
+
+    // protected by SurfaceFlinger::mPendingStateLock
+    Vector<layer_state_t> mPendingStates;
 };
 
 // ---------------------------------------------------------------------------
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <pthread.h>
+
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include <cutils/log.h>
+
+#include <utils/Trace.h>
+
+#include <gui/SyncFeatures.h>
+
+#include <ui/Fence.h>
+
+#include "CompositionWorker.h"
+#include "DisplayDevice.h"
+#include "Layer.h"
+#include "SurfaceFlinger.h"
+
+#include "RenderEngine/RenderEngine.h"
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+static pthread_once_t sEngineKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t sEngineKey;
+
+static void createEngineKey() {
+    pthread_key_create(&sEngineKey, NULL);
+}
+
+RenderEngine* CompositionWorker::getCurrentEngine() {
+    pthread_once(&sEngineKeyOnce, createEngineKey);
+    return static_cast<RenderEngine*>(pthread_getspecific(sEngineKey));
+}
+
+// ---------------------------------------------------------------------------
+
+CompositionWorker::CompositionWorker(const sp<SurfaceFlinger>& flinger,
+        EGLDisplay display, int hwcFormat, EGLContext shareContext)
+    :   Thread(false),
+        mFlinger(flinger),
+        mEGLDisplay(display),
+        mHwcFormat(hwcFormat),
+        mShareContext(shareContext),
+        mRenderEngine(NULL),
+        mStarted(false),
+        mStatus(NO_INIT),
+        mBusy(false) {
+}
+
+CompositionWorker::~CompositionWorker() {
+}
+
+status_t CompositionWorker::readyToRun() {
+    // the context must be created on the thread that will use it
+    RenderEngine* engine = RenderEngine::create(mEGLDisplay, mHwcFormat,
+            mShareContext);
+
+    pthread_once(&sEngineKeyOnce, createEngineKey);
+    pthread_setspecific(sEngineKey, engine);
+
+    Mutex::Autolock _l(mLock);
+    mRenderEngine = engine;
+    mStatus = engine ? NO_ERROR : NO_INIT;
+    mStarted = true;
+    mCondition.broadcast();
+    return mStatus;
+}
+
+bool CompositionWorker::waitForReady() {
+    Mutex::Autolock _l(mLock);
+    while (!mStarted) {
+        mCondition.wait(mLock);
+    }
+    return mStatus == NO_ERROR;
+}
+
+void CompositionWorker::compose(const sp<DisplayDevice>& hw,
+        const Region& dirtyRegion) {
+    Mutex::Autolock _l(mLock);
+    Job job;
+    job.hw = hw;
+    job.dirtyRegion = dirtyRegion;
+    mJobs.add(job);
+    mCondition.broadcast();
+}
+
+void CompositionWorker::waitForIdle() {
+    ATRACE_CALL();
+    Mutex::Autolock _l(mLock);
+    while (mBusy || !mJobs.isEmpty()) {
+        mCondition.wait(mLock);
+    }
+}
+
+bool CompositionWorker::threadLoop() {
+    Job job;
+    { // scope for the lock
+        Mutex::Autolock _l(mLock);
+        while (mJobs.isEmpty()) {
+            mBusy = false;
+            mCondition.broadcast();
+            mCondition.wait(mLock);
+        }
+        job = mJobs[0];
+        mJobs.removeAt(0);
+        mBusy = true;
+    }
+
+    mFlinger->composeDisplay(job.hw, job.dirtyRegion, true);
+
+    // The layers' release fences are created in the main context and HWC
+    // knows nothing about this one, so nothing else keeps the producers
+    // from writing into buffers this context is still reading.
+    const sp<Fence> fence(createReleaseFence());
+    const Vector< sp<Layer> >& layers(job.hw->getVisibleLayersSortedByZ());
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        layers[i]->addReleaseFence(fence);
+    }
+
+    // an EGLSurface can only be current on one thread at a time, release
+    // this display's so that it can be composed on another thread next time.
+    eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+            EGL_NO_CONTEXT);
+    return true;
+}
+
+sp<Fence> CompositionWorker::createReleaseFence() {
+    if (SyncFeatures::getInstance().useNativeFenceSync()) {
+        EGLSyncKHR sync = eglCreateSyncKHR(mEGLDisplay,
+                EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+        // native fence fd will not be populated until flush() is done.
+        mRenderEngine->flush();
+        if (sync != EGL_NO_SYNC_KHR) {
+            int fenceFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+            eglDestroySyncKHR(mEGLDisplay, sync);
+            if (fenceFd != EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                return new Fence(fenceFd);
+            }
+        }
+        ALOGW("can't create a composition fence (0x%04x)", eglGetError());
+    }
+    glFinish();
+    return Fence::NO_FENCE;
+}
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
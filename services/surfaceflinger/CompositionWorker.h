@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_COMPOSITION_WORKER_H
+#define ANDROID_COMPOSITION_WORKER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <EGL/egl.h>
+
+#include <ui/Region.h>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+class DisplayDevice;
+class Fence;
+class RenderEngine;
+class SurfaceFlinger;
+
+// CompositionWorker composes displays on its own thread, with its own
+// RenderEngine whose EGLContext shares textures with the main one.
+//
+// SurfaceFlinger only hands it displays that don't share any layer with
+// the other displays, and waits for it to be idle before calling
+// postFramebuffer(). The worker adds a fence of its own context to the
+// release fence of the layers it composed.
+class CompositionWorker : public Thread {
+public:
+    CompositionWorker(const sp<SurfaceFlinger>& flinger, EGLDisplay display,
+            int hwcFormat, EGLContext shareContext);
+    virtual ~CompositionWorker();
+
+    // waitForReady blocks until the worker has set up its EGLContext.
+    // Returns false if the worker can't be used.
+    bool waitForReady();
+
+    // compose queues the composition of a display.
+    void compose(const sp<DisplayDevice>& hw, const Region& dirtyRegion);
+
+    // waitForIdle blocks until all the queued compositions are done.
+    void waitForIdle();
+
+    // getCurrentEngine returns the RenderEngine of the calling thread if it
+    // is a CompositionWorker, or NULL otherwise.
+    static RenderEngine* getCurrentEngine();
+
+private:
+    struct Job {
+        sp<DisplayDevice> hw;
+        Region dirtyRegion;
+    };
+
+    virtual status_t readyToRun();
+    virtual bool threadLoop();
+
+    // returns a fence that signals when this context is done with the
+    // commands issued so far, or NO_FENCE after waiting for them.
+    sp<Fence> createReleaseFence();
+
+    sp<SurfaceFlinger> mFlinger;
+    EGLDisplay mEGLDisplay;
+    int mHwcFormat;
+    EGLContext mShareContext;
+
+    // only used on the worker thread
+    RenderEngine* mRenderEngine;
+
+    mutable Mutex mLock;
+    Condition mCondition;
+    bool mStarted;
+    status_t mStatus;
+    bool mBusy;
+    Vector<Job> mJobs;
+};
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_COMPOSITION_WORKER_H
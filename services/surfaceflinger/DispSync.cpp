@@ -20,6 +20,7 @@
 #define __STDC_LIMIT_MACROS
 
 #include <math.h>
+#include <string.h>
 
 #include <cutils/log.h>
 
@@ -49,6 +50,27 @@ static const nsecs_t kErrorThreshold = 160000000000;    // 400 usec squared
 // vsync event.
 static const int64_t kPresentTimeOffset = PRESENT_TIME_OFFSET_FROM_VSYNC_NS;
 
+// These are the bounds used to weigh the resync samples when fitting the
+// model.  Samples within a few times the spread of the residuals (but at
+// least kMinResidualScale) have full weight, samples beyond
+// kMinOutlierResidual and several times that spread are rejected, and the
+// ones in between are down-weighted.  A vsync interrupt handled late must
+// not skew the model.
+static const double kMinResidualScale = 100000;         // 100 usec
+static const double kMinOutlierResidual = 500000;       // 500 usec
+static const int kNumFitIterations = 3;
+
+// The model is confident when the error it is expected to have after
+// kConfidenceHorizon refreshes, given the residuals of its inliers and the
+// uncertainty on its period, is below kMaxConfidentError.
+static const double kConfidenceHorizon = 60;
+static const nsecs_t kMaxConfidentError = 200000;       // 200 usec
+
+// Resync samples are kept across resyncs for that long, the model is fitted
+// over all of them: the longer the span of the samples, the more precise the
+// period, and the fewer samples each resync needs.
+static const nsecs_t kMaxResyncSampleAge = 5000000000;  // 5 sec
+
 class DispSyncThread: public Thread {
 public:
 
@@ -144,7 +166,8 @@ public:
         return false;
     }
 
-    status_t addEventListener(nsecs_t phase, const sp<DispSync::Callback>& callback) {
+    status_t addEventListener(nsecs_t phase, const sp<DispSync::Callback>& callback,
+            uint32_t divisor) {
         Mutex::Autolock lock(mMutex);
 
         for (size_t i = 0; i < mEventListeners.size(); i++) {
@@ -155,6 +178,7 @@ public:
 
         EventListener listener;
         listener.mPhase = phase;
+        listener.mDivisor = divisor;
         listener.mCallback = callback;
 
         // We want to allow the firstmost future event to fire without
@@ -185,6 +209,21 @@ public:
         return BAD_VALUE;
     }
 
+    status_t setEventListenerDivisor(const sp<DispSync::Callback>& callback,
+            uint32_t divisor) {
+        Mutex::Autolock lock(mMutex);
+
+        for (size_t i = 0; i < mEventListeners.size(); i++) {
+            if (mEventListeners[i].mCallback == callback) {
+                mEventListeners.editItemAt(i).mDivisor = divisor;
+                mCond.signal();
+                return NO_ERROR;
+            }
+        }
+
+        return BAD_VALUE;
+    }
+
     // This method is only here to handle the kIgnorePresentFences case.
     bool hasAnyEventListeners() {
         Mutex::Autolock lock(mMutex);
@@ -195,6 +234,7 @@ private:
 
     struct EventListener {
         nsecs_t mPhase;
+        uint32_t mDivisor;
         nsecs_t mLastEventTime;
         sp<DispSync::Callback> mCallback;
     };
@@ -253,6 +293,15 @@ private:
             t += mPeriod;
         }
 
+        if (listener.mDivisor > 1) {
+            // Skip to the next event whose index is a multiple of the
+            // divisor, so that the listeners with the same divisor fire on
+            // the same refreshes.
+            nsecs_t index = (t - phase) / mPeriod;
+            t += ((listener.mDivisor - index % listener.mDivisor) %
+                    listener.mDivisor) * mPeriod;
+        }
+
         return t;
     }
 
@@ -288,6 +337,9 @@ private:
 };
 
 DispSync::DispSync() :
+        mPeriod(0),
+        mPhase(0),
+        mReferencePeriod(0),
         mRefreshSkipCount(0),
         mThread(new DispSyncThread()) {
 
@@ -303,7 +355,7 @@ DispSync::DispSync() :
         // not needed because any time there is an event registered we will
         // turn on the HW vsync events.
         if (!kIgnorePresentFences) {
-            addEventListener(0, new ZeroPhaseTracer());
+            addEventListener(0, new ZeroPhaseTracer(), 1);
         }
     }
 }
@@ -315,15 +367,25 @@ void DispSync::reset() {
 
     mNumResyncSamples = 0;
     mFirstResyncSample = 0;
+    mNumNewResyncSamples = 0;
     mNumResyncSamplesSincePresent = 0;
+    resetModelStatsLocked();
     resetErrorLocked();
 }
 
 bool DispSync::addPresentFence(const sp<Fence>& fence) {
     Mutex::Autolock lock(mMutex);
+    return addPresentSampleLocked(fence, 0);
+}
+
+bool DispSync::addPresentTime(nsecs_t timestamp) {
+    Mutex::Autolock lock(mMutex);
+    return addPresentSampleLocked(NULL, timestamp + kPresentTimeOffset);
+}
 
+bool DispSync::addPresentSampleLocked(const sp<Fence>& fence, nsecs_t time) {
     mPresentFences[mPresentSampleOffset] = fence;
-    mPresentTimes[mPresentSampleOffset] = 0;
+    mPresentTimes[mPresentSampleOffset] = time;
     mPresentSampleOffset = (mPresentSampleOffset + 1) % NUM_PRESENT_SAMPLES;
     mNumResyncSamplesSincePresent = 0;
 
@@ -340,13 +402,15 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
 
     updateErrorLocked();
 
-    return mPeriod == 0 || mError > kErrorThreshold;
+    return needsResyncLocked();
 }
 
 void DispSync::beginResync() {
     Mutex::Autolock lock(mMutex);
 
-    mNumResyncSamples = 0;
+    // the samples of the previous resyncs are kept, see kMaxResyncSampleAge
+    mNumNewResyncSamples = 0;
+    resetModelStatsLocked();
 }
 
 bool DispSync::addResyncSample(nsecs_t timestamp) {
@@ -360,10 +424,28 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
     } else {
         mFirstResyncSample = (mFirstResyncSample + 1) % MAX_RESYNC_SAMPLES;
     }
+    mNumNewResyncSamples++;
+
+    // forget the samples of the previous resyncs that are too old
+    while (mNumResyncSamples > mNumNewResyncSamples &&
+            timestamp - mResyncSamples[mFirstResyncSample] >
+                    kMaxResyncSampleAge) {
+        mFirstResyncSample = (mFirstResyncSample + 1) % MAX_RESYNC_SAMPLES;
+        mNumResyncSamples--;
+    }
 
     updateModelLocked();
+    // judge the present fences against the new model right away, so that
+    // hardware vsync can be turned off as soon as the model explains them
+    updateErrorLocked();
 
-    if (mNumResyncSamplesSincePresent++ > MAX_RESYNC_SAMPLES_WITHOUT_PRESENT) {
+    // Without present fences (e.g. when nothing is drawn) there is no way to
+    // validate the model, so the error is eventually dropped.  A confident
+    // model doesn't need to wait as long.
+    const int maxSamplesWithoutPresent = mModelConfident ?
+            int(MIN_RESYNC_SAMPLES_FOR_CONFIDENCE) :
+            int(MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
+    if (mNumResyncSamplesSincePresent++ > maxSamplesWithoutPresent) {
         resetErrorLocked();
     }
 
@@ -376,17 +458,23 @@ bool DispSync::addResyncSample(nsecs_t timestamp) {
         return mThread->hasAnyEventListeners();
     }
 
-    return mPeriod == 0 || mError > kErrorThreshold;
+    return needsResyncLocked();
 }
 
 void DispSync::endResync() {
 }
 
 status_t DispSync::addEventListener(nsecs_t phase,
-        const sp<Callback>& callback) {
+        const sp<Callback>& callback, uint32_t divisor) {
+
+    Mutex::Autolock lock(mMutex);
+    return mThread->addEventListener(phase, callback, divisor ? divisor : 1);
+}
 
+status_t DispSync::setEventListenerDivisor(const sp<Callback>& callback,
+        uint32_t divisor) {
     Mutex::Autolock lock(mMutex);
-    return mThread->addEventListener(phase, callback);
+    return mThread->setEventListenerDivisor(callback, divisor ? divisor : 1);
 }
 
 void DispSync::setRefreshSkipCount(int count) {
@@ -405,6 +493,32 @@ void DispSync::setPeriod(nsecs_t period) {
     Mutex::Autolock lock(mMutex);
     mPeriod = period;
     mPhase = 0;
+    mReferencePeriod = period;
+    mThread->updateModel(mPeriod, mPhase);
+}
+
+void DispSync::changeRefreshPeriod(nsecs_t period, nsecs_t when) {
+    Mutex::Autolock lock(mMutex);
+
+    // the model period includes the skipped refreshes, see updateModelLocked
+    const nsecs_t modelPeriod = period + period * mRefreshSkipCount;
+    if (mPeriod > 0 && when > mPhase) {
+        // the last modeled vsync before 'when' stays a vsync
+        nsecs_t lastVsync = when - (when - mPhase) % mPeriod;
+        mPhase = lastVsync % modelPeriod;
+    } else {
+        mPhase = 0;
+    }
+    mReferencePeriod = period;
+    mPeriod = modelPeriod;
+
+    mNumResyncSamples = 0;
+    mFirstResyncSample = 0;
+    mNumNewResyncSamples = 0;
+    mNumResyncSamplesSincePresent = 0;
+    resetModelStatsLocked();
+    resetErrorLocked();
+
     mThread->updateModel(mPeriod, mPhase);
 }
 
@@ -414,40 +528,176 @@ nsecs_t DispSync::getPeriod() {
     return mPeriod;
 }
 
-void DispSync::updateModelLocked() {
-    if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
-        nsecs_t durationSum = 0;
-        for (size_t i = 1; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
-            durationSum += mResyncSamples[idx] - mResyncSamples[prev];
+nsecs_t DispSync::getPhase() {
+    Mutex::Autolock lock(mMutex);
+    return mPhase;
+}
+
+// the most samples fitModel can fit at once
+static const size_t kMaxFitSamples = 32;
+
+// ModelFit is the result of fitting the vsync model t = offset + k * period
+// over a set of resync samples, where k is the index of the refresh.
+struct ModelFit {
+    double period;
+    double offset;
+    double residualRms;
+    // the standard error of the period
+    double periodError;
+    size_t numInliers;
+};
+
+static double median(double* values, size_t count) {
+    // insertion sort, there are at most MAX_RESYNC_SAMPLES values
+    for (size_t i = 1; i < count; i++) {
+        double v = values[i];
+        size_t j = i;
+        for (; j > 0 && values[j - 1] > v; j--) {
+            values[j] = values[j - 1];
         }
+        values[j] = v;
+    }
+    return (count & 1) ? values[count / 2] :
+            (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// fitModel fits the model over 'samples' with iteratively reweighted least
+// squares.  The refresh index of each sample is its distance to the first
+// one in units of referencePeriod, so samples may be missing.
+static bool fitModel(const nsecs_t* samples, size_t count,
+        double referencePeriod, ModelFit* fit) {
+    double x[kMaxFitSamples];
+    double y[kMaxFitSamples];
+    double w[kMaxFitSamples];
+    double r[kMaxFitSamples];
+
+    if (referencePeriod <= 0 || count > kMaxFitSamples) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // times are relative to the first sample to keep the precision
+        y[i] = double(samples[i] - samples[0]);
+        x[i] = floor(y[i] / referencePeriod + 0.5);
+        w[i] = 1.0;
+    }
+
+    double a = 0;
+    double b = 0;
+    for (int iter = 0; iter < kNumFitIterations; iter++) {
+        double sw = 0, swx = 0, swy = 0, swxx = 0, swxy = 0;
+        for (size_t i = 0; i < count; i++) {
+            sw += w[i];
+            swx += w[i] * x[i];
+            swy += w[i] * y[i];
+            swxx += w[i] * x[i] * x[i];
+            swxy += w[i] * x[i] * y[i];
+        }
+        double det = sw * swxx - swx * swx;
+        if (sw <= 0 || det <= 0) {
+            return false;
+        }
+        b = (sw * swxy - swx * swy) / det;
+        a = (swy - b * swx) / sw;
+
+        // the spread of the residuals, from their median absolute deviation
+        for (size_t i = 0; i < count; i++) {
+            r[i] = fabs(y[i] - (a + b * x[i]));
+        }
+        double sorted[kMaxFitSamples];
+        memcpy(sorted, r, count * sizeof(double));
+        double spread = 1.4826 * median(sorted, count);
+        double fullWeight = fmax(2.0 * spread, kMinResidualScale);
+        double rejected = fmax(4.0 * spread, kMinOutlierResidual);
+        for (size_t i = 0; i < count; i++) {
+            if (r[i] <= fullWeight) {
+                w[i] = 1.0;
+            } else if (r[i] <= rejected) {
+                w[i] = fullWeight / r[i];
+            } else {
+                w[i] = 0.0;
+            }
+        }
+    }
+
+    if (b <= 0) {
+        return false;
+    }
 
-        mPeriod = durationSum / (mNumResyncSamples - 1);
+    double sw = 0, swx = 0, swxx = 0, swrr = 0;
+    size_t numInliers = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (w[i] > 0) {
+            double residual = y[i] - (a + b * x[i]);
+            sw += w[i];
+            swx += w[i] * x[i];
+            swxx += w[i] * x[i] * x[i];
+            swrr += w[i] * residual * residual;
+            numInliers++;
+        }
+    }
+    double sxx = sw > 0 ? swxx - swx * swx / sw : 0;
+    fit->period = b;
+    fit->offset = a;
+    fit->residualRms = sw > 0 ? sqrt(swrr / sw) : 0;
+    fit->periodError = sxx > 0 ? fit->residualRms / sqrt(sxx) : INFINITY;
+    fit->numInliers = numInliers;
+    return true;
+}
 
-        double sampleAvgX = 0;
-        double sampleAvgY = 0;
-        double scale = 2.0 * M_PI / double(mPeriod);
+void DispSync::updateModelLocked() {
+    static_assert(size_t(MAX_RESYNC_SAMPLES) <= kMaxFitSamples,
+            "fitModel can't fit all the resync samples");
+    if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
+        nsecs_t samples[MAX_RESYNC_SAMPLES];
         for (size_t i = 0; i < mNumResyncSamples; i++) {
             size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            nsecs_t sample = mResyncSamples[idx];
-            double samplePhase = double(sample % mPeriod) * scale;
-            sampleAvgX += cos(samplePhase);
-            sampleAvgY += sin(samplePhase);
+            samples[i] = mResyncSamples[idx];
         }
 
-        sampleAvgX /= double(mNumResyncSamples);
-        sampleAvgY /= double(mNumResyncSamples);
-
-        mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
+        ModelFit fit;
+        bool fitted = fitModel(samples, mNumResyncSamples,
+                double(mReferencePeriod), &fit);
+        if (!fitted || fit.numInliers * 2 < mNumResyncSamples) {
+            // The refresh rate doesn't match the reference period (e.g. it
+            // was never set), start over from the spacing of the samples.
+            double intervals[MAX_RESYNC_SAMPLES];
+            for (size_t i = 1; i < mNumResyncSamples; i++) {
+                intervals[i - 1] = double(samples[i] - samples[i - 1]);
+            }
+            ModelFit fallback;
+            if (fitModel(samples, mNumResyncSamples,
+                    median(intervals, mNumResyncSamples - 1), &fallback) &&
+                    (!fitted || fallback.numInliers > fit.numInliers)) {
+                fit = fallback;
+                fitted = true;
+            }
+        }
+        if (!fitted) {
+            return;
+        }
 
+        mPeriod = nsecs_t(fit.period + 0.5);
+        mPhase = (samples[0] + nsecs_t(floor(fit.offset + 0.5))) % mPeriod;
         if (mPhase < 0) {
             mPhase += mPeriod;
         }
+        mReferencePeriod = mPeriod;
+
+        mResidualRms = nsecs_t(fit.residualRms);
+        mExpectedError = nsecs_t(fmin(
+                fit.residualRms / sqrt(double(fit.numInliers)) +
+                fit.periodError * kConfidenceHorizon, double(INT64_MAX)));
+        mNumInliers = fit.numInliers;
+        mNumOutliers = mNumResyncSamples - fit.numInliers;
+        mModelConfident = mNumInliers >= MIN_RESYNC_SAMPLES_FOR_CONFIDENCE &&
+                mExpectedError < kMaxConfidentError;
 
         if (kTraceDetailedInfo) {
             ATRACE_INT64("DispSync:Period", mPeriod);
             ATRACE_INT64("DispSync:Phase", mPhase);
+            ATRACE_INT64("DispSync:Residual", mResidualRms);
+            ATRACE_INT64("DispSync:ExpectedError", mExpectedError);
+            ATRACE_INT64("DispSync:Outliers", mNumOutliers);
         }
 
         // Artificially inflate the period if requested.
@@ -468,6 +718,7 @@ void DispSync::updateErrorLocked() {
 
     int numErrSamples = 0;
     nsecs_t sqErrSum = 0;
+    nsecs_t sqErrMax = 0;
 
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         nsecs_t sample = mPresentTimes[i];
@@ -476,11 +727,22 @@ void DispSync::updateErrorLocked() {
             if (sampleErr > period / 2) {
                 sampleErr -= period;
             }
-            sqErrSum += sampleErr * sampleErr;
+            nsecs_t sqErr = sampleErr * sampleErr;
+            sqErrSum += sqErr;
+            if (sqErr > sqErrMax) {
+                sqErrMax = sqErr;
+            }
             numErrSamples++;
         }
     }
 
+    // A single late present fence shouldn't trigger a resync: the largest
+    // error is ignored when there are enough samples to tell it apart.
+    if (numErrSamples >= MIN_PRESENT_SAMPLES_FOR_OUTLIER) {
+        sqErrSum -= sqErrMax;
+        numErrSamples--;
+    }
+
     if (numErrSamples > 0) {
         mError = sqErrSum / numErrSamples;
     } else {
@@ -501,6 +763,26 @@ void DispSync::resetErrorLocked() {
     }
 }
 
+bool DispSync::needsResyncLocked() const {
+    // Once started, a resync goes on until the model is confident: a model
+    // fitted over a few jittery samples drifts away quickly and costs
+    // another resync soon after.
+    bool needsMoreSamples =
+            mNumNewResyncSamples < MIN_RESYNC_SAMPLES_FOR_UPDATE ||
+            (!mModelConfident &&
+                    mNumNewResyncSamples < MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
+
+    return mPeriod == 0 || mError > kErrorThreshold || needsMoreSamples;
+}
+
+void DispSync::resetModelStatsLocked() {
+    mResidualRms = 0;
+    mExpectedError = 0;
+    mNumInliers = 0;
+    mNumOutliers = 0;
+    mModelConfident = false;
+}
+
 nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
     Mutex::Autolock lock(mMutex);
     nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
@@ -516,6 +798,10 @@ void DispSync::dump(String8& result) const {
     result.appendFormat("mPhase: %" PRId64 " ns\n", mPhase);
     result.appendFormat("mError: %" PRId64 " ns (sqrt=%.1f)\n",
             mError, sqrt(mError));
+    result.appendFormat("model: residual rms %.1f us, expected error "
+            "%.1f us, %zu inliers, %zu outliers, %s\n",
+            mResidualRms / 1000.0, mExpectedError / 1000.0, mNumInliers,
+            mNumOutliers, mModelConfident ? "confident" : "not confident");
     result.appendFormat("mNumResyncSamplesSincePresent: %d (limit %d)\n",
             mNumResyncSamplesSincePresent, MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
     result.appendFormat("mNumResyncSamples: %zd (max %d)\n",
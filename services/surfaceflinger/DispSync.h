@@ -42,7 +42,10 @@ class DispSyncThread;
 // display and uses that model to execute period callbacks at specific phase
 // offsets from the hardware vsync events.  The model is constructed by
 // feeding consecutive hardware event timestamps to the DispSync object via
-// the addResyncSample method.
+// the addResyncSample method.  The model is a weighted least-squares fit
+// of the recent samples, including those of the previous resyncs, which
+// rejects the samples that are far off (e.g. a vsync interrupt handled
+// late).
 //
 // The model is validated using timestamps from Fence objects that are passed
 // to the DispSync object via the addPresentFence method.  These fence
@@ -78,6 +81,10 @@ public:
     // set call that affects the display.
     bool addPresentFence(const sp<Fence>& fence);
 
+    // addPresentTime is addPresentFence for a fence that signaled at
+    // 'timestamp'. It is used to replay recorded present times.
+    bool addPresentTime(nsecs_t timestamp);
+
     // The beginResync, addResyncSample, and endResync methods are used to re-
     // synchronize the DispSync's model to the hardware vsync events.  The re-
     // synchronization process involves first calling beginResync, then
@@ -98,9 +105,20 @@ public:
     // turned on.  It should NOT be used after that.
     void setPeriod(nsecs_t period);
 
+    // changeRefreshPeriod moves the model to a new refresh period, e.g. when
+    // the active config of the display changes.  Unlike reset followed by
+    // setPeriod, it keeps the modeled vsync events aligned on the last one
+    // before 'when', so that the callbacks keep firing on time while a
+    // resync refines the model.  The resync samples and present fences,
+    // which describe the old refresh rate, are dropped.
+    void changeRefreshPeriod(nsecs_t period, nsecs_t when);
+
     // The getPeriod method returns the current vsync period.
     nsecs_t getPeriod();
 
+    // The getPhase method returns the current vsync phase.
+    nsecs_t getPhase();
+
     // setRefreshSkipCount specifies an additional number of refresh
     // cycles to skip.  For example, on a 60Hz display, a skip count of 1
     // will result in events happening at 30Hz.  Default is zero.  The idea
@@ -110,8 +128,17 @@ public:
     // addEventListener registers a callback to be called repeatedly at the
     // given phase offset from the hardware vsync events.  The callback is
     // called from a separate thread and it should return reasonably quickly
-    // (i.e. within a few hundred microseconds).
-    status_t addEventListener(nsecs_t phase, const sp<Callback>& callback);
+    // (i.e. within a few hundred microseconds).  With a divisor greater than
+    // one, the callback is only called on one vsync event out of 'divisor':
+    // those whose index since time 0 is a multiple of it, so that the
+    // listeners with the same divisor are called on the same events.
+    status_t addEventListener(nsecs_t phase, const sp<Callback>& callback,
+            uint32_t divisor = 1);
+
+    // setEventListenerDivisor changes the divisor of an already-registered
+    // event callback.
+    status_t setEventListenerDivisor(const sp<Callback>& callback,
+            uint32_t divisor);
 
     // removeEventListener removes an already-registered event callback.  Once
     // this method returns that callback will no longer be called by the
@@ -129,13 +156,18 @@ public:
 
 private:
 
+    bool addPresentSampleLocked(const sp<Fence>& fence, nsecs_t time);
     void updateModelLocked();
     void updateErrorLocked();
     void resetErrorLocked();
+    void resetModelStatsLocked();
+    bool needsResyncLocked() const;
 
     enum { MAX_RESYNC_SAMPLES = 32 };
     enum { MIN_RESYNC_SAMPLES_FOR_UPDATE = 3 };
+    enum { MIN_RESYNC_SAMPLES_FOR_CONFIDENCE = 6 };
     enum { NUM_PRESENT_SAMPLES = 8 };
+    enum { MIN_PRESENT_SAMPLES_FOR_OUTLIER = 4 };
     enum { MAX_RESYNC_SAMPLES_WITHOUT_PRESENT = 12 };
 
     // mPeriod is the computed period of the modeled vsync events in
@@ -146,6 +178,22 @@ private:
     // number of nanoseconds from time 0 to the first vsync event.
     nsecs_t mPhase;
 
+    // mReferencePeriod is the refresh period of the display, before
+    // mRefreshSkipCount is applied.  It's used to tell how many refreshes
+    // separate two resync samples when fitting the model.
+    nsecs_t mReferencePeriod;
+
+    // These member variables describe how well the model fits the resync
+    // samples: the RMS of the residuals of the samples that weren't rejected
+    // as outliers, the error the model is expected to have a second from
+    // now, and how many samples were rejected.  The model is confident when
+    // enough samples fit it closely.
+    nsecs_t mResidualRms;
+    nsecs_t mExpectedError;
+    size_t mNumInliers;
+    size_t mNumOutliers;
+    bool mModelConfident;
+
     // mError is the computed model error.  It is based on the difference
     // between the estimated vsync event times and those observed in the
     // mPresentTimes array.
@@ -157,6 +205,9 @@ private:
     nsecs_t mResyncSamples[MAX_RESYNC_SAMPLES];
     size_t mFirstResyncSample;
     size_t mNumResyncSamples;
+    // the number of samples added since beginResync, the others are from
+    // previous resyncs
+    size_t mNumNewResyncSamples;
     int mNumResyncSamplesSincePresent;
 
     // These member variables store information about the present fences used
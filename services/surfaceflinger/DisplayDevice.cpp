@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,6 +25,7 @@
 
 #include <utils/RefBase.h>
 #include <utils/Log.h>
+#include <utils/Trace.h>
 
 #include <ui/DisplayInfo.h>
 #include <ui/PixelFormat.h>
@@ -44,6 +47,20 @@
 using namespace android;
 // ----------------------------------------------------------------------------
 
+static bool hasEglExtension(EGLDisplay dpy, const char* name) {
+    const char* exts = eglQueryString(dpy, EGL_EXTENSIONS);
+    if (exts == NULL) {
+        return false;
+    }
+    const size_t len = strlen(name);
+    for (const char* p = strstr(exts, name); p; p = strstr(p + len, name)) {
+        if ((p == exts || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Initialize the display to the specified values.
  *
@@ -74,7 +91,19 @@ DisplayDevice::DisplayDevice(
       mLayerStack(NO_LAYER_STACK),
       mOrientation(),
       mPowerMode(HWC_POWER_MODE_OFF),
-      mActiveConfig(0)
+      mActiveConfig(0),
+      mLastCompositionTime(0),
+      mMaxCompositionTime(0),
+      mTotalCompositionTime(0),
+      mCompositionCount(0),
+      mParallelCompositionCount(0),
+      mHasBufferAge(false),
+      mDamageHistoryHead(0),
+      mDamageHistoryCount(0),
+      mRepaintCount(0),
+      mPartialRepaintCount(0),
+      mLastSavedBytes(0),
+      mTotalSavedBytes(0)
 {
     mNativeWindow = new Surface(producer, false);
     ANativeWindow* const window = mNativeWindow.get();
@@ -107,6 +136,7 @@ DisplayDevice::DisplayDevice(
     mDisplay = display;
     mSurface = surface;
     mFormat  = format;
+    mHasBufferAge = hasEglExtension(display, "EGL_EXT_buffer_age");
     mPageFlipCount = 0;
     mViewport.makeInvalid();
     mFrame.makeInvalid();
@@ -197,6 +227,76 @@ uint32_t DisplayDevice::getPageFlipCount() const {
     return mPageFlipCount;
 }
 
+void DisplayDevice::recordCompositionTime(nsecs_t duration, bool parallel) {
+    mLastCompositionTime = duration;
+    if (duration > mMaxCompositionTime) {
+        mMaxCompositionTime = duration;
+    }
+    mTotalCompositionTime += duration;
+    mCompositionCount++;
+    if (parallel) {
+        mParallelCompositionCount++;
+    }
+}
+
+void DisplayDevice::addDamage(const Region& damage) const {
+    mPendingDamage.orSelf(damage);
+}
+
+int DisplayDevice::getBufferAge() const {
+    EGLint age = 0;
+    if (!mHasBufferAge ||
+            !eglQuerySurface(mDisplay, mSurface, EGL_BUFFER_AGE_EXT, &age)) {
+        return 0;
+    }
+    return age;
+}
+
+bool DisplayDevice::getRepaintRegion(int age, Region* outRegion) const {
+    // the buffer must have been drawn since the history was invalidated,
+    // and we need the damage of the (age - 1) frames swapped since then.
+    if (age <= 0 || size_t(age) > mDamageHistoryCount) {
+        return false;
+    }
+    Region repaint(mPendingDamage);
+    for (int i = 0; i < age - 1; i++) {
+        const size_t index = (mDamageHistoryHead + MAX_DAMAGE_HISTORY - i) %
+                MAX_DAMAGE_HISTORY;
+        repaint.orSelf(mDamageHistory[index]);
+    }
+    *outRegion = repaint.intersect(getBounds());
+    return true;
+}
+
+void DisplayDevice::setCompositionTypes(const Vector<int32_t>& types) const {
+    if (types.size() != mCompositionTypes.size() ||
+            memcmp(types.array(), mCompositionTypes.array(),
+                    types.size() * sizeof(int32_t))) {
+        mCompositionTypes = types;
+        invalidateDamageHistory();
+    }
+}
+
+void DisplayDevice::invalidateDamageHistory() const {
+    mDamageHistoryCount = 0;
+}
+
+void DisplayDevice::recordRepaint(const Rect& repaint) const {
+    const size_t total = size_t(mDisplayWidth) * mDisplayHeight;
+    const size_t redrawn = size_t(repaint.getWidth()) * repaint.getHeight();
+    const ssize_t bpp = bytesPerPixel(mFormat);
+    mLastSavedBytes = (redrawn < total && bpp > 0) ?
+            (total - redrawn) * bpp : 0;
+    mTotalSavedBytes += mLastSavedBytes;
+    mRepaintCount++;
+    if (redrawn < total) {
+        mPartialRepaintCount++;
+    }
+    if (mType == DISPLAY_PRIMARY) {
+        ATRACE_INT("PartialUpdateSavedKB", int32_t(mLastSavedBytes / 1024));
+    }
+}
+
 status_t DisplayDevice::compositionComplete() const {
     return mDisplaySurface->compositionComplete();
 }
@@ -245,6 +345,21 @@ status_t DisplayDevice::prepareFrame(const HWComposer& hwc) const {
     return mDisplaySurface->prepareFrame(compositionType);
 }
 
+bool DisplayDevice::passthroughFrame(const sp<GraphicBuffer>& buffer,
+        const sp<Fence>& fence,
+        const sp<DisplaySurface::BufferReleaser>& releaser) const {
+    if (!mDisplaySurface->passthroughFrame(buffer, fence, releaser)) {
+        return false;
+    }
+    // GLES didn't draw this frame, its buffers are now all out of date
+    invalidateDamageHistory();
+    return true;
+}
+
+void DisplayDevice::reclaimPassthroughBuffers() const {
+    mDisplaySurface->reclaimPassthroughBuffers();
+}
+
 void DisplayDevice::swapBuffers(HWComposer& hwc) const {
     // We need to call eglSwapBuffers() if:
     //  (1) we don't have a hardware composer, or
@@ -256,7 +371,15 @@ void DisplayDevice::swapBuffers(HWComposer& hwc) const {
             (hwc.hasGlesComposition(mHwcDisplayId) &&
              (hwc.supportsFramebufferTarget() || mType >= DISPLAY_VIRTUAL))) {
         EGLBoolean success = eglSwapBuffers(mDisplay, mSurface);
-        if (!success) {
+        if (success) {
+            mDamageHistoryHead = (mDamageHistoryHead + 1) % MAX_DAMAGE_HISTORY;
+            mDamageHistory[mDamageHistoryHead] = mPendingDamage;
+            if (mDamageHistoryCount < MAX_DAMAGE_HISTORY) {
+                mDamageHistoryCount++;
+            }
+            mPendingDamage.clear();
+        } else {
+            invalidateDamageHistory();
             EGLint error = eglGetError();
             if (error == EGL_CONTEXT_LOST ||
                     mType == DisplayDevice::DISPLAY_PRIMARY) {
@@ -424,6 +547,7 @@ status_t DisplayDevice::orientationToTransfrom(
 
 void DisplayDevice::setDisplaySize(const int newWidth, const int newHeight) {
     dirtyRegion.set(getBounds());
+    invalidateDamageHistory();
 
     if (mSurface != EGL_NO_SURFACE) {
         eglDestroySurface(mDisplay, mSurface);
@@ -532,6 +656,24 @@ void DisplayDevice::dump(String8& result) const {
         tr[0][1], tr[1][1], tr[2][1],
         tr[0][2], tr[1][2], tr[2][2]);
 
+    result.appendFormat(
+        "   composition: last=%.1fus, avg=%.1fus, max=%.1fus, "
+        "count=%u (parallel=%u)\n",
+        mLastCompositionTime / 1000.0,
+        mCompositionCount ?
+                mTotalCompositionTime / (1000.0 * mCompositionCount) : 0.0,
+        mMaxCompositionTime / 1000.0,
+        mCompositionCount, mParallelCompositionCount);
+
+    if (mRepaintCount) {
+        result.appendFormat(
+            "   partial updates: %u of %u frames (buffer age %s), "
+            "saved %.1f KB last frame, %.1f MB total\n",
+            mPartialRepaintCount, mRepaintCount,
+            mHasBufferAge ? "from EGL" : "unknown",
+            mLastSavedBytes / 1024.0, mTotalSavedBytes / (1024.0 * 1024.0));
+    }
+
     String8 surfaceDump;
     mDisplaySurface->dump(surfaceDump);
     result.append(surfaceDump);
@@ -28,17 +28,20 @@
 #include <utils/Mutex.h>
 #include <utils/String8.h>
 #include <utils/Timers.h>
+#include <utils/Vector.h>
 
 #include <hardware/hwcomposer_defs.h>
 
 #include "Transform.h"
+#include "DisplayHardware/DisplaySurface.h"
 
 struct ANativeWindow;
 
 namespace android {
 
 struct DisplayInfo;
-class DisplaySurface;
+class Fence;
+class GraphicBuffer;
 class IGraphicBufferProducer;
 class Layer;
 class SurfaceFlinger;
@@ -135,6 +138,15 @@ public:
     status_t beginFrame(bool mustRecompose) const;
     status_t prepareFrame(const HWComposer& hwc) const;
 
+    // hands a buffer holding the whole content of this frame to the display
+    // surface, returns false if the frame must be composed as usual. The
+    // buffer goes back to releaser once the display is done with it.
+    bool passthroughFrame(const sp<GraphicBuffer>& buffer,
+            const sp<Fence>& fence,
+            const sp<DisplaySurface::BufferReleaser>& releaser) const;
+    // gives back the passed through buffers the display is done with
+    void reclaimPassthroughBuffers() const;
+
     void swapBuffers(HWComposer& hwc) const;
     status_t compositionComplete() const;
 
@@ -174,6 +186,31 @@ public:
     uint32_t getPageFlipCount() const;
     void dump(String8& result) const;
 
+    // called after each composition of this display, parallel is true if
+    // it was done on a CompositionWorker.
+    void recordCompositionTime(nsecs_t duration, bool parallel);
+
+    /* ------------------------------------------------------------------------
+     * Partial updates. When the age of the buffer GLES is about to draw into
+     * is known, only what changed since that buffer was last drawn needs to
+     * be redrawn.
+     */
+    // addDamage records what changed on this display, in screen space.
+    void addDamage(const Region& damage) const;
+    // getBufferAge returns the age of the buffer GLES will draw the next
+    // frame into, or 0 if unknown, which is always the case without
+    // EGL_EXT_buffer_age. The display must be current.
+    int getBufferAge() const;
+    // getRepaintRegion computes what must be redrawn in a buffer of the
+    // given age. Returns false if the whole display must be redrawn.
+    bool getRepaintRegion(int age, Region* outRegion) const;
+    // setCompositionTypes forgets the damage history when the h/w composer
+    // composition types of the layers changed, since what's in the buffers
+    // outside of the damage doesn't match anymore.
+    void setCompositionTypes(const Vector<int32_t>& types) const;
+    // called after each GLES composition using partial updates
+    void recordRepaint(const Rect& repaint) const;
+
 #ifdef QCOM_BSP
     /* To set egl atribute, EGL_SWAP_BEHAVIOR value
      * (EGL_BUFFER_PRESERVED/EGL_BUFFER_DESTROYED)
@@ -238,6 +275,38 @@ private:
     int mActiveConfig;
     // Panel is inverse mounted
     int mPanelInverseMounted;
+
+    // composition statistics, for dumpsys
+    nsecs_t mLastCompositionTime;
+    nsecs_t mMaxCompositionTime;
+    nsecs_t mTotalCompositionTime;
+    uint32_t mCompositionCount;
+    uint32_t mParallelCompositionCount;
+
+    /*
+     * Partial updates, only accessed by the thread composing this display.
+     */
+    void invalidateDamageHistory() const;
+
+    enum { MAX_DAMAGE_HISTORY = 4 };
+
+    // whether EGL_EXT_buffer_age is supported
+    bool mHasBufferAge;
+    // damage since the last eglSwapBuffers()
+    mutable Region mPendingDamage;
+    // damage of the last swapped frames, mDamageHistory[mDamageHistoryHead]
+    // is the most recent one.
+    mutable Region mDamageHistory[MAX_DAMAGE_HISTORY];
+    mutable size_t mDamageHistoryHead;
+    // number of frames swapped since the history was last invalidated,
+    // capped to MAX_DAMAGE_HISTORY
+    mutable size_t mDamageHistoryCount;
+    mutable Vector<int32_t> mCompositionTypes;
+    // statistics, for dumpsys
+    mutable uint32_t mRepaintCount;
+    mutable uint32_t mPartialRepaintCount;
+    mutable size_t mLastSavedBytes;
+    mutable uint64_t mTotalSavedBytes;
 };
 
 }; // namespace android
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <utils/String8.h>
+
+#include <hardware/hwcomposer.h>
+
+#include "CompositionStrategy.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+CompositionStrategy::LayerInfo::LayerInfo()
+    :   pixels(0),
+        blended(false),
+        scaled(false),
+        skipped(false),
+        hwcCompositionType(-1),
+        forceGles(false),
+        compositionType(HWC_FRAMEBUFFER) {
+}
+
+CompositionStrategy* CompositionStrategy::create(const char* name) {
+    if (!strcmp(name, "cost")) {
+        return new CostModelStrategy();
+    }
+    return NULL;
+}
+
+CompositionStrategy::CompositionStrategy() {
+}
+
+CompositionStrategy::~CompositionStrategy() {
+}
+
+static size_t getNumLayers(const hwc_display_contents_1_t* list) {
+    size_t numLayers = list->numHwLayers;
+    if (numLayers && list->hwLayers[numLayers - 1].compositionType ==
+            HWC_FRAMEBUFFER_TARGET) {
+        numLayers--;
+    }
+    return numLayers;
+}
+
+static bool isScaled(const hwc_layer_1_t& l, bool floatCrop) {
+    int srcWidth, srcHeight;
+    if (floatCrop) {
+        srcWidth = int(floorf(l.sourceCropf.right)) -
+                int(ceilf(l.sourceCropf.left));
+        srcHeight = int(floorf(l.sourceCropf.bottom)) -
+                int(ceilf(l.sourceCropf.top));
+    } else {
+        srcWidth = l.sourceCrop.right - l.sourceCrop.left;
+        srcHeight = l.sourceCrop.bottom - l.sourceCrop.top;
+    }
+    if (l.transform & HWC_TRANSFORM_ROT_90) {
+        int tmp = srcWidth;
+        srcWidth = srcHeight;
+        srcHeight = tmp;
+    }
+    return srcWidth != l.displayFrame.right - l.displayFrame.left ||
+            srcHeight != l.displayFrame.bottom - l.displayFrame.top;
+}
+
+void CompositionStrategy::prepareLayers(int32_t id,
+        hwc_display_contents_1_t* list, bool floatCrop) {
+    const size_t numLayers = getNumLayers(list);
+    ssize_t index = mDisplays.indexOfKey(id);
+    if (index < 0) {
+        index = mDisplays.add(id, Frame());
+    }
+    Frame& frame(mDisplays.editValueAt(index));
+
+    // SurfaceFlinger only sets HWC_SKIP_LAYER when it sets up the geometry,
+    // afterwards the flag is ours.
+    if ((list->flags & HWC_GEOMETRY_CHANGED) || frame.size() != numLayers) {
+        frame.clear();
+        frame.insertAt(LayerInfo(), 0, numLayers);
+        for (size_t i=0 ; i<numLayers ; i++) {
+            frame.editItemAt(i).skipped =
+                    list->hwLayers[i].flags & HWC_SKIP_LAYER;
+        }
+    }
+
+    for (size_t i=0 ; i<numLayers ; i++) {
+        const hwc_layer_1_t& l(list->hwLayers[i]);
+        LayerInfo& layer(frame.editItemAt(i));
+        layer.pixels = uint32_t(l.displayFrame.right - l.displayFrame.left) *
+                uint32_t(l.displayFrame.bottom - l.displayFrame.top);
+        layer.blended = l.blending != HWC_BLENDING_NONE;
+        layer.scaled = isScaled(l, floatCrop);
+    }
+
+    choose(id, frame);
+
+    bool changed = false;
+    for (size_t i=0 ; i<numLayers ; i++) {
+        const LayerInfo& layer(frame[i]);
+        if (layer.skipped) {
+            continue;
+        }
+        hwc_layer_1_t& l(list->hwLayers[i]);
+        const bool wasForced = l.flags & HWC_SKIP_LAYER;
+        if (layer.forceGles != wasForced) {
+            changed = true;
+        }
+        if (layer.forceGles) {
+            l.flags |= HWC_SKIP_LAYER;
+        } else {
+            l.flags &= ~HWC_SKIP_LAYER;
+        }
+    }
+
+    // HWCs may only look at HWC_SKIP_LAYER on geometry changes, and may
+    // keep using their previous decisions otherwise.
+    if (changed) {
+        list->flags |= HWC_GEOMETRY_CHANGED;
+    }
+}
+
+const CompositionStrategy::Frame& CompositionStrategy::layersPrepared(
+        int32_t id, const hwc_display_contents_1_t* list) {
+    ssize_t index = mDisplays.indexOfKey(id);
+    if (index < 0) {
+        index = mDisplays.add(id, Frame());
+    }
+    Frame& frame(mDisplays.editValueAt(index));
+    const size_t numLayers = getNumLayers(list);
+    for (size_t i=0 ; i<frame.size() && i<numLayers ; i++) {
+        LayerInfo& layer(frame.editItemAt(i));
+        layer.compositionType = list->hwLayers[i].compositionType;
+        if (!layer.skipped && !layer.forceGles) {
+            layer.hwcCompositionType = layer.compositionType;
+        }
+    }
+    return frame;
+}
+
+void CompositionStrategy::removeDisplay(int32_t id) {
+    mDisplays.removeItem(id);
+}
+
+// ---------------------------------------------------------------------------
+
+// initial diagonal of the inverse correlation matrix, large since nothing
+// is known about the weights yet
+static const double kInitialP = 1e6;
+// forgetting factor, so that the model follows e.g. GPU frequency changes
+static const double kForgettingFactor = 0.995;
+// a layer is only forced to GLES once every feature involved was seen in
+// that many frames
+static const uint32_t kMinObservations = 30;
+// and if that is predicted to save at least that many microseconds
+static const double kMinSavingUs = 100;
+
+static inline double megapixels(uint32_t pixels) {
+    return pixels / 1000000.0;
+}
+
+static inline double positive(double w) {
+    return w > 0 ? w : 0;
+}
+
+CostModelStrategy::Model::Model()
+    :   numFrames(0),
+        numLayersForced(0),
+        meanError(0) {
+    for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+        weights[i] = 0;
+        observations[i] = 0;
+        for (size_t j=0 ; j<NUM_FEATURES ; j++) {
+            p[i][j] = (i == j) ? kInitialP : 0;
+        }
+    }
+}
+
+CostModelStrategy::CostModelStrategy() {
+}
+
+CostModelStrategy::Model& CostModelStrategy::editModel(int32_t id) {
+    ssize_t index = mModels.indexOfKey(id);
+    if (index < 0) {
+        index = mModels.add(id, Model());
+    }
+    return mModels.editValueAt(index);
+}
+
+void CostModelStrategy::getFeatures(const Frame& frame, double* features) {
+    for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+        features[i] = 0;
+    }
+    for (size_t i=0 ; i<frame.size() ; i++) {
+        const LayerInfo& layer(frame[i]);
+        const double mp = megapixels(layer.pixels);
+        switch (layer.compositionType) {
+            case HWC_FRAMEBUFFER:
+                features[GLES_SETUP] = 1;
+                features[layer.blended ? GLES_BLENDED : GLES_OPAQUE] += mp;
+                if (layer.scaled) {
+                    features[GLES_SCALED] += mp;
+                }
+                break;
+            case HWC_BLIT:
+                features[BLIT] += mp;
+                break;
+            case HWC_OVERLAY:
+            case HWC_CURSOR_OVERLAY:
+                features[OVERLAY] += 1;
+                break;
+        }
+    }
+    features[BASE] = 1;
+}
+
+double CostModelStrategy::layerCost(const Model& model,
+        const LayerInfo& layer, int32_t type) {
+    const double mp = megapixels(layer.pixels);
+    switch (type) {
+        case HWC_FRAMEBUFFER: {
+            const size_t feature = layer.blended ? GLES_BLENDED : GLES_OPAQUE;
+            if (model.observations[feature] < kMinObservations ||
+                    (layer.scaled &&
+                     model.observations[GLES_SCALED] < kMinObservations)) {
+                return -1;
+            }
+            double cost = positive(model.weights[feature]) * mp;
+            if (layer.scaled) {
+                cost += positive(model.weights[GLES_SCALED]) * mp;
+            }
+            return cost;
+        }
+        case HWC_BLIT:
+            if (model.observations[BLIT] < kMinObservations) {
+                return -1;
+            }
+            return positive(model.weights[BLIT]) * mp;
+        case HWC_OVERLAY:
+            if (model.observations[OVERLAY] < kMinObservations) {
+                return -1;
+            }
+            return positive(model.weights[OVERLAY]);
+    }
+    return -1;
+}
+
+void CostModelStrategy::choose(int32_t id, Frame& frame) {
+    Model& model(editModel(id));
+    const size_t count = frame.size();
+
+    // the HWC must have seen every layer since the last geometry change
+    bool hasGles = false;
+    for (size_t i=0 ; i<count ; i++) {
+        const LayerInfo& layer(frame[i]);
+        if (layer.skipped || layer.hwcCompositionType == HWC_FRAMEBUFFER) {
+            hasGles = true;
+        } else if (layer.hwcCompositionType < 0) {
+            for (size_t j=0 ; j<count ; j++) {
+                frame.editItemAt(j).forceGles = false;
+            }
+            return;
+        }
+    }
+
+    // Force the layers that are cheaper with GLES. Layers that were forced
+    // stay so as long as it is predicted to save anything, to not go back
+    // and forth on noise.
+    double saving = 0;
+    bool wasForced = false;
+    size_t numForced = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        LayerInfo& layer(frame.editItemAt(i));
+        const bool forced = layer.forceGles;
+        wasForced = wasForced || forced;
+        layer.forceGles = false;
+        if (layer.skipped || layer.hwcCompositionType == HWC_FRAMEBUFFER) {
+            continue;
+        }
+        const double hwcCost = layerCost(model, layer,
+                layer.hwcCompositionType);
+        const double glesCost = layerCost(model, layer, HWC_FRAMEBUFFER);
+        if (hwcCost < 0 || glesCost < 0) {
+            continue;
+        }
+        const double layerSaving = hwcCost - glesCost;
+        if (layerSaving > (forced ? 0 : kMinSavingUs)) {
+            layer.forceGles = true;
+            saving += layerSaving;
+            numForced++;
+        }
+    }
+
+    // the first GLES layer costs the GLES setup as well
+    if (numForced && !hasGles) {
+        const bool trusted =
+                model.observations[GLES_SETUP] >= kMinObservations;
+        saving -= positive(model.weights[GLES_SETUP]);
+        if (!trusted || saving <= (wasForced ? 0 : kMinSavingUs)) {
+            for (size_t i=0 ; i<count ; i++) {
+                frame.editItemAt(i).forceGles = false;
+            }
+            numForced = 0;
+        }
+    }
+    model.numLayersForced += numForced;
+}
+
+void CostModelStrategy::addFrameCost(int32_t id, const Frame& frame,
+        nsecs_t cost) {
+    Model& model(editModel(id));
+
+    double x[NUM_FEATURES];
+    getFeatures(frame, x);
+    const double y = cost / 1000.0;
+
+    // recursive least squares with exponential forgetting
+    double px[NUM_FEATURES];
+    double xpx = 0;
+    double prediction = 0;
+    for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+        px[i] = 0;
+        for (size_t j=0 ; j<NUM_FEATURES ; j++) {
+            px[i] += model.p[i][j] * x[j];
+        }
+        xpx += x[i] * px[i];
+        prediction += model.weights[i] * x[i];
+    }
+    const double error = y - prediction;
+    const double denominator = kForgettingFactor + xpx;
+    double trace = 0;
+    for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+        const double gain = px[i] / denominator;
+        model.weights[i] += gain * error;
+        for (size_t j=0 ; j<NUM_FEATURES ; j++) {
+            model.p[i][j] -= gain * px[j];
+        }
+        trace += model.p[i][i];
+    }
+    // Don't forget along the directions that aren't excited (e.g.: there
+    // are no blit layers), or P would grow without bounds.
+    if (trace < NUM_FEATURES * kInitialP) {
+        for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+            for (size_t j=0 ; j<NUM_FEATURES ; j++) {
+                model.p[i][j] /= kForgettingFactor;
+            }
+        }
+    }
+
+    for (size_t i=0 ; i<NUM_FEATURES ; i++) {
+        if (x[i] != 0) {
+            model.observations[i]++;
+        }
+    }
+    model.numFrames++;
+    model.meanError += (fabs(error) - model.meanError) /
+            (model.numFrames < 16 ? model.numFrames : 16);
+}
+
+void CostModelStrategy::dump(String8& result) const {
+    result.appendFormat("  composition strategy: cost model\n");
+    for (size_t i=0 ; i<mModels.size() ; i++) {
+        const Model& model(mModels.valueAt(i));
+        const double* w = model.weights;
+        result.appendFormat("    display %d: %" PRIu64 " frames, %" PRIu64
+                " layers forced to GLES, mean error %.0f us\n",
+                mModels.keyAt(i), model.numFrames, model.numLayersForced,
+                model.meanError);
+        result.appendFormat("      base=%.0f us, GLES setup=%.0f us, "
+                "opaque=%.0f blended=%.0f scaled=+%.0f blit=%.0f us/MP, "
+                "overlay=%.0f us\n",
+                w[BASE], w[GLES_SETUP], w[GLES_OPAQUE], w[GLES_BLENDED],
+                w[GLES_SCALED], w[BLIT], w[OVERLAY]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_COMPOSITION_STRATEGY_H
+#define ANDROID_SF_COMPOSITION_STRATEGY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+struct hwc_display_contents_1;
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+class String8;
+
+// A CompositionStrategy decides, before each HWC prepare(), which layers
+// SurfaceFlinger composes with GLES rather than letting the HWC pick their
+// composition type. Layers are forced to GLES with HWC_SKIP_LAYER, so the
+// HWC's decisions for the other layers still stand.
+//
+// Strategies are told how long each frame took to compose once that is
+// known (see HWComposer::addFrameCostsLocked), along with the composition
+// types that were used, and learn from that.
+//
+// This only depends on the HWC headers and libutils so that strategies can
+// be tested on the host against a fake HWC.
+//
+// CompositionStrategy is *NOT* thread-safe, HWComposer calls it with
+// mDrawLock held.
+class CompositionStrategy {
+public:
+    struct LayerInfo {
+        LayerInfo();
+
+        // area of the displayFrame, in pixels
+        uint32_t pixels;
+        // the layer's blending isn't HWC_BLENDING_NONE
+        bool blended;
+        // the source crop and the displayFrame have different sizes
+        bool scaled;
+        // SurfaceFlinger set HWC_SKIP_LAYER itself, the layer is always
+        // composed with GLES
+        bool skipped;
+        // the composition type the HWC chose the last time the layer
+        // wasn't forced to GLES, -1 if it never did since the last
+        // geometry change
+        int32_t hwcCompositionType;
+        // the layer is composed with GLES because of the strategy
+        bool forceGles;
+        // the composition type used for the frame
+        int32_t compositionType;
+    };
+
+    // Frame holds the layers of a display for one frame, in the order of
+    // the HWC list
+    typedef Vector<LayerInfo> Frame;
+
+    // create returns the strategy called 'name', or NULL if there is no
+    // such strategy. "cost" is the only one for now, see CostModelStrategy.
+    static CompositionStrategy* create(const char* name);
+
+    virtual ~CompositionStrategy();
+
+    // prepareLayers must be called before the HWC's prepare(). It updates
+    // what is known about the layers of 'list', lets the strategy choose
+    // and sets HWC_SKIP_LAYER on the layers it forces to GLES, along with
+    // HWC_GEOMETRY_CHANGED if they differ from the previous frame's.
+    // floatCrop is whether the HWC uses sourceCropf (HWC 1.3 and up).
+    void prepareLayers(int32_t id, hwc_display_contents_1* list,
+            bool floatCrop);
+
+    // layersPrepared must be called after the HWC's prepare(), it returns
+    // the layers with their composition types, to be handed to
+    // addFrameCost() once the cost of the frame is known.
+    const Frame& layersPrepared(int32_t id,
+            const hwc_display_contents_1* list);
+
+    // removeDisplay forgets about display 'id'
+    void removeDisplay(int32_t id);
+
+    // addFrameCost tells how long it took to compose 'frame', from the
+    // end of prepare() to both GLES and the HWC's set() being done.
+    virtual void addFrameCost(int32_t id, const Frame& frame,
+            nsecs_t cost) = 0;
+
+    virtual void dump(String8& result) const = 0;
+
+protected:
+    CompositionStrategy();
+
+    // choose sets forceGles on the layers of 'frame' that should be
+    // composed with GLES. On input, it is set on the layers that were
+    // forced on the previous frame. Layers that are skipped or whose
+    // hwcCompositionType is unknown can't be forced.
+    virtual void choose(int32_t id, Frame& frame) = 0;
+
+private:
+    KeyedVector<int32_t, Frame> mDisplays;
+};
+
+// ---------------------------------------------------------------------------
+
+// CostModelStrategy predicts the cost of a frame with a linear model of the
+// composition types used for its layers, fitted online with recursive least
+// squares over the measured frame costs:
+//
+//   cost = base + gles setup (if any layer uses GLES)
+//        + per-megapixel GLES costs (opaque, blended, extra when scaled)
+//        + per-megapixel HWC blit cost + per-overlay cost
+//
+// Each frame, it forces the blit and overlay layers whose predicted cost
+// under GLES is lower to GLES, as long as the parts of the model involved
+// have been observed often enough to be trusted.
+class CostModelStrategy : public CompositionStrategy {
+public:
+    CostModelStrategy();
+
+    virtual void addFrameCost(int32_t id, const Frame& frame, nsecs_t cost);
+    virtual void dump(String8& result) const;
+
+protected:
+    virtual void choose(int32_t id, Frame& frame);
+
+private:
+    enum {
+        GLES_SETUP = 0,
+        GLES_OPAQUE,
+        GLES_BLENDED,
+        GLES_SCALED,
+        BLIT,
+        OVERLAY,
+        BASE,
+        NUM_FEATURES
+    };
+
+    struct Model {
+        Model();
+
+        // the weights, in microseconds per unit of each feature
+        double weights[NUM_FEATURES];
+        // the inverse correlation matrix of the recursive least squares
+        double p[NUM_FEATURES][NUM_FEATURES];
+        // number of frames in which each feature was non-zero
+        uint32_t observations[NUM_FEATURES];
+        // statistics, for dumpsys
+        uint64_t numFrames;
+        uint64_t numLayersForced;
+        double meanError;
+    };
+
+    static void getFeatures(const Frame& frame, double* features);
+
+    // layerCost returns the predicted cost of layer when composed with
+    // 'type' without the GLES setup cost, or -1 if the model can't be
+    // trusted for it yet.
+    static double layerCost(const Model& model, const LayerInfo& layer,
+            int32_t type);
+
+    Model& editModel(int32_t id);
+
+    KeyedVector<int32_t, Model> mModels;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_COMPOSITION_STRATEGY_H
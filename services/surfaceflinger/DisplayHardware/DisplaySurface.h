@@ -25,6 +25,8 @@
 namespace android {
 // ---------------------------------------------------------------------------
 
+class Fence;
+class GraphicBuffer;
 class IGraphicBufferProducer;
 class String8;
 
@@ -49,6 +51,35 @@ public:
     };
     virtual status_t prepareFrame(CompositionType compositionType) = 0;
 
+    // BufferReleaser gets back the buffers given to passthroughFrame().
+    class BufferReleaser : public virtual RefBase {
+    public:
+        // releaseBuffer is called once the consumer of the DisplaySurface
+        // is done with the buffer. The fence signals when its reads are
+        // complete.
+        virtual void releaseBuffer(const sp<GraphicBuffer>& buffer,
+                const sp<Fence>& fence) = 0;
+    protected:
+        virtual ~BufferReleaser() {}
+    };
+
+    // passthroughFrame is called instead of composing a frame when a single
+    // buffer already holds the whole content of the frame, unscaled. The
+    // DisplaySurface may send that buffer to its consumer as is, it then
+    // returns true and the frame must not be composed. The buffer can be read
+    // once the fence signals. If it returns true, the DisplaySurface keeps
+    // the buffer until its consumer releases it, and hands it back to
+    // releaser then.
+    virtual bool passthroughFrame(const sp<GraphicBuffer>& /* buffer */,
+            const sp<Fence>& /* fence */,
+            const sp<BufferReleaser>& /* releaser */) {
+        return false;
+    }
+
+    // reclaimPassthroughBuffers hands the buffers given to passthroughFrame()
+    // that the consumer released back to their releaser. It must not block.
+    virtual void reclaimPassthroughBuffers() {}
+
     // Should be called when composition rendering is complete for a frame (but
     // eglSwapBuffers hasn't necessarily been called). Required by certain
     // older drivers for synchronization.
@@ -49,6 +49,9 @@
 
 #define GPUTILERECT_DEBUG 0
 
+// frames whose GLES composition isn't done yet, per display
+#define MAX_PENDING_COSTS 8
+
 namespace android {
 
 #define MIN_HWC_HEADER_VERSION HWC_HEADER_VERSION
@@ -91,6 +94,11 @@ HWComposer::HWComposer(
       mCBContext(new cb_context),
       mEventHandler(handler),
       mDebugForceFakeVSync(false),
+      mSkipUnchangedPrepare(false),
+      mLastFrameOk(false),
+      mNumPrepares(0),
+      mNumPreparesSkipped(0),
+      mStrategy(NULL),
       mVDSEnabled(false)
 {
     for (size_t i =0 ; i<MAX_HWC_DISPLAYS ; i++) {
@@ -106,6 +114,14 @@ HWComposer::HWComposer(
     property_get("debug.sf.no_hw_vsync", value, "0");
     mDebugForceFakeVSync = atoi(value);
 
+    property_get("debug.sf.hwc_skip_prepare", value, "0");
+    mSkipUnchangedPrepare = atoi(value) ? true : false;
+
+    property_get("debug.sf.comp_strategy", value, "hwc");
+    mStrategy = CompositionStrategy::create(value);
+    ALOGW_IF(mStrategy == NULL && strcmp(value, "hwc"),
+            "unknown composition strategy '%s', using the HWC's", value);
+
     bool needVSyncThread = true;
 
     // Note: some devices may insist that the FB HAL be opened before HWC.
@@ -207,6 +223,9 @@ HWComposer::HWComposer(
     // Threshold Area to enable GPU Tiled Rect.
     property_get("debug.hwc.gpuTiledThreshold", value, "1.9");
     mDynThreshold = atof(value);
+    for (size_t i=0 ; i<MAX_HWC_DISPLAYS ; i++) {
+        mTiledDRCache[i].valid = false;
+    }
 #endif
 }
 
@@ -224,6 +243,7 @@ HWComposer::~HWComposer() {
         framebuffer_close(mFbDev);
     }
     delete mCBContext;
+    delete mStrategy;
 }
 
 // Load and prepare the hardware composer module.  Sets mHwc.
@@ -610,11 +630,27 @@ status_t HWComposer::createWorkList(int32_t id, size_t numLayers) {
             size_t size = sizeof(hwc_display_contents_1_t)
                     + numLayers * sizeof(hwc_layer_1_t);
             free(disp.list);
+            free(disp.shadowLayers);
+            free(disp.visibleRects);
             disp.list = (hwc_display_contents_1_t*)malloc(size);
-            if(disp.list == NULL)
+            disp.shadowLayers = (hwc_layer_1_t*)malloc(
+                    numLayers * sizeof(hwc_layer_1_t));
+            disp.visibleRects = (hwc_rect_t*)malloc(
+                    numLayers * sizeof(hwc_rect_t));
+            if (disp.list == NULL || disp.shadowLayers == NULL ||
+                    disp.visibleRects == NULL) {
+                free(disp.list);
+                free(disp.shadowLayers);
+                free(disp.visibleRects);
+                disp.list = NULL;
+                disp.shadowLayers = NULL;
+                disp.visibleRects = NULL;
+                disp.numShadowLayers = 0;
                 return NO_MEMORY;
+            }
             disp.capacity = numLayers;
         }
+        disp.numShadowLayers = 0;
         if (hwcHasApiVersion(mHwc, HWC_DEVICE_API_VERSION_1_1)) {
             disp.framebufferTarget = &disp.list->hwLayers[numLayers - 1];
             memset(disp.framebufferTarget, 0, sizeof(hwc_layer_1_t));
@@ -676,6 +712,7 @@ status_t HWComposer::setFramebufferTarget(int32_t id,
     disp.fbTargetHandle = buf->handle;
     disp.framebufferTarget->handle = disp.fbTargetHandle;
     disp.framebufferTarget->acquireFenceFd = acquireFenceFd;
+    disp.glesDoneFence = acquireFence;
     return NO_ERROR;
 }
 
@@ -708,11 +745,51 @@ status_t HWComposer::prepare() {
                 mLists[i]->dpy = EGL_NO_DISPLAY;
                 mLists[i]->sur = EGL_NO_SURFACE;
             }
+            if (mStrategy) {
+                addFrameCostsLocked(i, disp);
+                mStrategy->prepareLayers(i, disp.list,
+                        hwcHasApiVersion(mHwc, HWC_DEVICE_API_VERSION_1_3));
+            }
         }
     }
 
+    // Find the layers SurfaceFlinger changed since the last frame. If there
+    // are none, the HWC would make the same decisions as last time.
+    bool unchanged = mSkipUnchangedPrepare && mLastFrameOk;
+    for (size_t i=0 ; i<mNumDisplays ; i++) {
+        DisplayData& disp(mDisplayData[i]);
+        if (disp.list) {
+            const size_t touched = updateShadowLocked(disp);
+            disp.numLayersTouched = touched;
+            disp.totalLayersTouched += touched;
+            disp.totalLayers += disp.numShadowLayers;
+            if (touched || (disp.list->flags & HWC_GEOMETRY_CHANGED) ||
+                    disp.outbufHandle) {
+                unchanged = false;
+            }
+        }
+        if (disp.prepared != (disp.list != NULL)) {
+            unchanged = false;
+        }
+        disp.prepared = disp.list != NULL;
+    }
+    mNumPrepares++;
+    if (unchanged) {
+        ATRACE_NAME("prepare skipped");
+        mNumPreparesSkipped++;
+#ifdef QCOM_BSP
+        // the composition types didn't change
+        for (size_t i=0 ; i<mNumDisplays ; i++) {
+            prev_comp_map[i] = current_comp_map[i];
+        }
+#endif
+        preparedLocked();
+        return NO_ERROR;
+    }
+
     int err = mHwc->prepare(mHwc, mNumDisplays, mLists);
     ALOGE_IF(err, "HWComposer: prepare failed (%s)", strerror(-err));
+    mLastFrameOk = (err == NO_ERROR);
 
     if (err == NO_ERROR) {
         // here we're just making sure that "skip" layers are set
@@ -770,14 +847,27 @@ status_t HWComposer::prepare() {
                         current_comp_map[i].compType[j] = l.compositionType;
                     }
 #endif
+                    // the HWC's decisions are part of what we compare
+                    // against on the next frame.
+                    if (j < disp.numShadowLayers) {
+                        disp.shadowLayers[j].compositionType = l.compositionType;
+                        disp.shadowLayers[j].hints = l.hints;
+                    }
                 }
                 if (disp.list->numHwLayers == (disp.framebufferTarget ? 1 : 0)) {
                     disp.hasFbComp = true;
                 }
+#ifdef QCOM_BSP
+                if ((disp.list->flags & HWC_GEOMETRY_CHANGED) ||
+                        isCompositionMapChanged(i)) {
+                    mTiledDRCache[i].valid = false;
+                }
+#endif
             } else {
                 disp.hasFbComp = true;
             }
         }
+        preparedLocked();
     }
     return (status_t)err;
 }
@@ -838,9 +928,23 @@ status_t HWComposer::commit() {
         }
 
         err = mHwc->set(mHwc, mNumDisplays, mLists);
+        if (err != NO_ERROR) {
+            mLastFrameOk = false;
+        }
+        const nsecs_t setTime = systemTime();
 
         for (size_t i=0 ; i<mNumDisplays ; i++) {
             DisplayData& disp(mDisplayData[i]);
+            if (mStrategy && disp.list && err == NO_ERROR) {
+                PendingCost pending;
+                pending.frame = disp.preparedFrame;
+                pending.preparedTime = disp.preparedTime;
+                pending.setTime = setTime;
+                pending.glesDoneFence = disp.hasFbComp ?
+                        disp.glesDoneFence : Fence::NO_FENCE;
+                disp.pendingCosts.add(pending);
+            }
+            disp.glesDoneFence = Fence::NO_FENCE;
             disp.lastDisplayFence = disp.lastRetireFence;
             disp.lastRetireFence = Fence::NO_FENCE;
             if (disp.list) {
@@ -904,12 +1008,21 @@ void HWComposer::disconnectDisplay(int disp) {
     DisplayData& dd(mDisplayData[disp]);
     free(dd.list);
     dd.list = NULL;
+    free(dd.shadowLayers);
+    dd.shadowLayers = NULL;
+    dd.numShadowLayers = 0;
     dd.framebufferTarget = NULL;    // points into dd.list
     dd.fbTargetHandle = NULL;
     dd.outbufHandle = NULL;
     dd.lastRetireFence = Fence::NO_FENCE;
     dd.lastDisplayFence = Fence::NO_FENCE;
     dd.outbufAcquireFence = Fence::NO_FENCE;
+    dd.preparedFrame.clear();
+    dd.glesDoneFence = Fence::NO_FENCE;
+    dd.pendingCosts.clear();
+    if (mStrategy) {
+        mStrategy->removeDisplay(disp);
+    }
     // clear all the previous configs and repopulate when a new
     // device is added
     dd.configs.clear();
@@ -990,6 +1103,104 @@ status_t HWComposer::setCursorPositionAsync(int32_t id, const Rect& pos)
     }
 }
 
+// isSameLayer returns whether SurfaceFlinger set up l like shadow, ignoring
+// the visible region and the fences.
+static bool isSameLayer(const hwc_layer_1_t& l, const hwc_layer_1_t& shadow) {
+    return l.compositionType == shadow.compositionType &&
+            l.handle == shadow.handle &&
+            l.flags == shadow.flags &&
+            l.transform == shadow.transform &&
+            l.blending == shadow.blending &&
+            l.planeAlpha == shadow.planeAlpha &&
+            !memcmp(&l.sourceCropf, &shadow.sourceCropf, sizeof(l.sourceCropf)) &&
+            !memcmp(&l.displayFrame, &shadow.displayFrame, sizeof(l.displayFrame)) &&
+            !memcmp(&l.dirtyRect, &shadow.dirtyRect, sizeof(l.dirtyRect));
+}
+
+size_t HWComposer::updateShadowLocked(DisplayData& disp) {
+    const size_t numLayers = disp.list->numHwLayers -
+            (disp.framebufferTarget ? 1 : 0);
+    const bool valid = !(disp.list->flags & HWC_GEOMETRY_CHANGED) &&
+            disp.numShadowLayers == numLayers;
+
+    Vector<Rect> rects;
+    Vector<size_t> offsets;
+    rects.setCapacity(disp.shadowRects.size());
+    offsets.setCapacity(numLayers + 1);
+
+    size_t touched = 0;
+    for (size_t i=0 ; i<numLayers ; i++) {
+        const hwc_layer_1_t& l(disp.list->hwLayers[i]);
+        hwc_layer_1_t& shadow(disp.shadowLayers[i]);
+        const hwc_region_t& region(l.visibleRegionScreen);
+        const Rect* regionRects = reinterpret_cast<const Rect*>(region.rects);
+
+        offsets.add(rects.size());
+        if (region.numRects) {
+            rects.appendArray(regionRects, region.numRects);
+        }
+
+        bool unchanged = valid && isSameLayer(l, shadow);
+        if (unchanged) {
+            const size_t start = disp.shadowRectOffsets[i];
+            const size_t numRects = disp.shadowRectOffsets[i+1] - start;
+            unchanged = numRects == region.numRects && (!numRects ||
+                    !memcmp(regionRects, disp.shadowRects.array() + start,
+                            numRects * sizeof(Rect)));
+        }
+        if (!unchanged) {
+            shadow = l;
+            touched++;
+        }
+    }
+    offsets.add(rects.size());
+
+    disp.shadowRects = rects;
+    disp.shadowRectOffsets = offsets;
+    disp.numShadowLayers = numLayers;
+    return touched;
+}
+
+void HWComposer::preparedLocked() {
+    if (!mStrategy) {
+        return;
+    }
+    const nsecs_t now = systemTime();
+    for (size_t i=0 ; i<mNumDisplays ; i++) {
+        DisplayData& disp(mDisplayData[i]);
+        if (disp.list) {
+            disp.preparedFrame = mStrategy->layersPrepared(i, disp.list);
+            disp.preparedTime = now;
+        }
+    }
+}
+
+void HWComposer::addFrameCostsLocked(int32_t id, DisplayData& disp) {
+    // GLES composes the frames in order
+    while (!disp.pendingCosts.isEmpty()) {
+        const PendingCost& pending(disp.pendingCosts[0]);
+        nsecs_t doneTime = pending.setTime;
+        if (pending.glesDoneFence->isValid()) {
+            const nsecs_t glesDoneTime =
+                    pending.glesDoneFence->getSignalTime();
+            if (glesDoneTime == INT64_MAX) {
+                if (disp.pendingCosts.size() <= MAX_PENDING_COSTS) {
+                    break;
+                }
+                // don't wait for this one forever
+                disp.pendingCosts.removeAt(0);
+                continue;
+            }
+            if (glesDoneTime > doneTime) {
+                doneTime = glesDoneTime;
+            }
+        }
+        mStrategy->addFrameCost(id, pending.frame,
+                doneTime - pending.preparedTime);
+        disp.pendingCosts.removeAt(0);
+    }
+}
+
 /*
  * Helper template to implement a concrete HWCLayer
  * This holds the pointer to the concrete hwc layer type
@@ -1021,9 +1232,17 @@ private:
  */
 class HWCLayerVersion1 : public Iterable<HWCLayerVersion1, hwc_layer_1_t> {
     struct hwc_composer_device_1* mHwc;
+    // parallel to mLayerList, see DisplayData::visibleRects
+    hwc_rect_t* const mVisibleRects;
+
+    hwc_rect_t* getVisibleRect() {
+        return &mVisibleRects[getLayer() - mLayerList];
+    }
 public:
-    HWCLayerVersion1(struct hwc_composer_device_1* hwc, hwc_layer_1_t* layer)
-        : Iterable<HWCLayerVersion1, hwc_layer_1_t>(layer), mHwc(hwc) { }
+    HWCLayerVersion1(struct hwc_composer_device_1* hwc, hwc_layer_1_t* layer,
+            hwc_rect_t* visibleRects)
+        : Iterable<HWCLayerVersion1, hwc_layer_1_t>(layer), mHwc(hwc),
+          mVisibleRects(visibleRects) { }
 
     virtual int32_t getCompositionType() const {
         return getLayer()->compositionType;
@@ -1117,10 +1336,19 @@ public:
         }
     }
     virtual void setVisibleRegionScreen(const Region& reg) {
+        hwc_region_t& visibleRegion = getLayer()->visibleRegionScreen;
+        if (reg.isRect()) {
+            // Most layers are a single rect, which the Region holds inline:
+            // keep a copy next to the layer instead of allocating.
+            hwc_rect_t* rect = getVisibleRect();
+            *rect = reinterpret_cast<hwc_rect_t const&>(*reg.begin());
+            visibleRegion.numRects = 1;
+            visibleRegion.rects = rect;
+            return;
+        }
         // Region::getSharedBuffer creates a reference to the underlying
         // SharedBuffer of this Region, this reference is freed
         // in onDisplayed()
-        hwc_region_t& visibleRegion = getLayer()->visibleRegionScreen;
         SharedBuffer const* sb = reg.getSharedBuffer(&visibleRegion.numRects);
         visibleRegion.rects = reinterpret_cast<hwc_rect_t const *>(sb->data());
     }
@@ -1162,6 +1390,10 @@ public:
     }
     virtual void onDisplayed() {
         hwc_region_t& visibleRegion = getLayer()->visibleRegionScreen;
+        if (visibleRegion.rects == getVisibleRect()) {
+            visibleRegion.numRects = 0;
+            visibleRegion.rects = NULL;
+        }
         SharedBuffer const* sb = SharedBuffer::bufferFromData(visibleRegion.rects);
         if (sb) {
             sb->release();
@@ -1185,7 +1417,8 @@ HWComposer::LayerListIterator HWComposer::getLayerIterator(int32_t id, size_t in
     if (!mHwc || !disp.list || index > disp.list->numHwLayers) {
         return LayerListIterator();
     }
-    return LayerListIterator(new HWCLayerVersion1(mHwc, disp.list->hwLayers), index);
+    return LayerListIterator(new HWCLayerVersion1(mHwc, disp.list->hwLayers,
+            disp.visibleRects), index);
 }
 
 /*
@@ -1244,6 +1477,14 @@ void HWComposer::dump(String8& result) const {
     if (mHwc) {
         result.appendFormat("Hardware Composer state (version %08x):\n", hwcApiVersion(mHwc));
         result.appendFormat("  mDebugForceFakeVSync=%d\n", mDebugForceFakeVSync);
+        result.appendFormat("  prepare: %" PRIu64 " frames, %" PRIu64 " skipped (%s)\n",
+                mNumPrepares, mNumPreparesSkipped,
+                mSkipUnchangedPrepare ? "enabled" : "disabled");
+        if (mStrategy) {
+            mStrategy->dump(result);
+        } else {
+            result.appendFormat("  composition strategy: hwc\n");
+        }
         for (size_t i=0 ; i<mNumDisplays ; i++) {
             const DisplayData& disp(mDisplayData[i]);
             if (!disp.connected)
@@ -1265,6 +1506,11 @@ void HWComposer::dump(String8& result) const {
                 result.appendFormat(
                         "  numHwLayers=%zu, flags=%08x\n",
                         disp.list->numHwLayers, disp.list->flags);
+                result.appendFormat(
+                        "  layers touched: %zu/%zu last frame, %.1f%% overall\n",
+                        disp.numLayersTouched, disp.numShadowLayers,
+                        disp.totalLayers ?
+                                (100.0 * disp.totalLayersTouched) / disp.totalLayers : 0.0);
                 result.append(
 
                         "    type   |  handle  | hint | flag | tr | blnd |  format     |     source crop(l,t,r,b)       |           frame        |      dirtyRect         |  name \n"
@@ -1402,11 +1648,17 @@ HWComposer::DisplayData::DisplayData()
     framebufferTarget(NULL), fbTargetHandle(0),
     lastRetireFence(Fence::NO_FENCE), lastDisplayFence(Fence::NO_FENCE),
     outbufHandle(NULL), outbufAcquireFence(Fence::NO_FENCE),
-    events(0)
+    events(0),
+    shadowLayers(NULL), numShadowLayers(0), visibleRects(NULL),
+    prepared(false),
+    numLayersTouched(0), totalLayersTouched(0), totalLayers(0),
+    preparedTime(0), glesDoneFence(Fence::NO_FENCE)
 {}
 
 HWComposer::DisplayData::~DisplayData() {
     free(list);
+    free(shadowLayers);
+    free(visibleRects);
 }
 
 #ifdef QCOM_BSP
@@ -1417,43 +1669,36 @@ bool HWComposer::areVisibleRegionsOverlapping(int32_t id ) {
     const Vector< sp<Layer> >& currentLayers  =
             mFlinger->getLayerSortedByZForHwcDisplay(id);
     size_t count = currentLayers.size();
-    Region consolidatedVisibleRegion;
 
+    // The rects of a visible region never overlap each other, so any
+    // overlap is between the visible regions of two layers.
+    mRectSweep.clear();
     for (size_t i=0; i<count; i++) {
-        //If there are any overlapping visible regions, disable GPUTileRect
-        if(!consolidatedVisibleRegion.intersect(
-                 currentLayers[i]->visibleRegion).isEmpty()){
-            return true;
-        }
-        consolidatedVisibleRegion.orSelf(currentLayers[i]->visibleRegion);
+        mRectSweep.add(currentLayers[i]->visibleRegion);
     }
-    return false;
+    //If there are any overlapping visible regions, disable GPUTileRect
+    return mRectSweep.hasOverlap();
 }
 
 bool HWComposer::canHandleOverlapArea(int32_t id, Rect unionDr) {
     DisplayData& disp(mDisplayData[id]);
-    float layerAreaSum = 0;
-    float drArea = ((unionDr.right-unionDr.left)* (unionDr.bottom-unionDr.top));
     hwc_layer_1_t& fbLayer = disp.list->hwLayers[disp.list->numHwLayers-1];
     hwc_rect_t fbDisplayFrame  = fbLayer.displayFrame;
     float fbLayerArea = ((fbDisplayFrame.right - fbDisplayFrame.left)*
               (fbDisplayFrame.bottom - fbDisplayFrame.top));
 
     //Compute sum of the Areas of FB layers intersecting with Union Dirty Rect
+    mRectSweep.clear();
     for (size_t i=0; i<disp.list->numHwLayers-1; i++) {
         hwc_layer_1_t& layer = disp.list->hwLayers[i];
         if(layer.compositionType != HWC_FRAMEBUFFER)
            continue;
 
         hwc_rect_t displayFrame  = layer.displayFrame;
-        Rect df(displayFrame.left, displayFrame.top,
-              displayFrame.right, displayFrame.bottom);
-        Rect df_dirty;
-        df_dirty.clear();
-        if(df.intersect(unionDr, &df_dirty))
-            layerAreaSum += ((df_dirty.right - df_dirty.left)*
-                  (df_dirty.bottom - df_dirty.top));
+        mRectSweep.add(Rect(displayFrame.left, displayFrame.top,
+              displayFrame.right, displayFrame.bottom));
     }
+    float layerAreaSum = float(mRectSweep.clippedAreaSum(unionDr));
     ALOGD_IF(GPUTILERECT_DEBUG,"GPUTileRect: overlap/FB : %f",
            (layerAreaSum/fbLayerArea));
     // Return false, if the sum of layer Areas intersecting with union Dr is
@@ -1494,8 +1739,8 @@ void HWComposer::computeUnionDirtyRect(int32_t id, Rect& unionDirtyRect) {
     const Vector< sp<Layer> >& currentLayers =
             mFlinger->getLayerSortedByZForHwcDisplay(id);
     size_t count = currentLayers.size();
-    Region unionDirtyRegion;
     DisplayData& disp(mDisplayData[id]);
+    mRectSweep.clear();
 
     // Find UnionDr of all layers
     for (size_t i=0; i<count; i++) {
@@ -1518,10 +1763,11 @@ void HWComposer::computeUnionDirtyRect(int32_t id, Rect& unionDirtyRect) {
             int x_off = dst.left - src.left;
             int y_off = dst.top - src.top;
             dr = dr.offsetBy(x_off, y_off);
-            unionDirtyRegion = unionDirtyRegion.orSelf(dr);
+            mRectSweep.add(dr);
         }
     }
-    unionDirtyRect = unionDirtyRegion.getBounds();
+    // only the bounds of the union are used
+    unionDirtyRect = mRectSweep.getBounds();
 }
 bool HWComposer::isCompositionMapChanged(int32_t id) {
     if (prev_comp_map[id] == current_comp_map[id]) {
@@ -1535,6 +1781,18 @@ bool HWComposer::isGeometryChanged(int32_t id) {
     DisplayData& disp(mDisplayData[id]);
     return ( disp.list->flags & HWC_GEOMETRY_CHANGED );
 }
+const HWComposer::TiledDRCache& HWComposer::getTiledDRCache(int32_t id) {
+    // the scaling and the visible regions only change with the geometry,
+    // prepare() drops the cache when it or the composition map changes.
+    TiledDRCache& cache(mTiledDRCache[id]);
+    if (!cache.valid) {
+        cache.needsScaling = needsScaling(id);
+        cache.overlapping = areVisibleRegionsOverlapping(id);
+        cache.valid = true;
+    }
+    return cache;
+}
+
 /* Finds if we can enable DR optimization for GpuComp
  * 1. return false if geometry is changed
  * 2. if overlapping visible regions present.
@@ -1553,13 +1811,13 @@ bool HWComposer::canUseTiledDR(int32_t id, Rect& unionDr ){
     } else if ( isCompositionMapChanged(id)) {
         ALOGD_IF(GPUTILERECT_DEBUG, "GPUTileRect: comp map changed, disable");
         status = false;
-    } else if (needsScaling(id)) {
+    } else if (getTiledDRCache(id).needsScaling) {
        /* Do Not use TiledDR optimization, if layers need scaling */
        ALOGD_IF(GPUTILERECT_DEBUG, "GPUTileRect: Layers need scaling, disable");
        status = false;
     } else {
         computeUnionDirtyRect(id, unionDr);
-        if(areVisibleRegionsOverlapping(id) &&
+        if(getTiledDRCache(id).overlapping &&
               !canHandleOverlapArea(id, unionDr)){
            /* With DR optimizaton, On certain targets we are seeing slightly
             * lower FPS in use cases where visible regions overlap &
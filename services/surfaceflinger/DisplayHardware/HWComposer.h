@@ -23,6 +23,8 @@
 #include <hardware/hwcomposer_defs.h>
 
 #include <ui/Fence.h>
+#include <ui/Rect.h>
+#include <ui/RectSweep.h>
 
 #include <utils/BitSet.h>
 #include <utils/Condition.h>
@@ -32,6 +34,8 @@
 #include <utils/Timers.h>
 #include <utils/Vector.h>
 
+#include "CompositionStrategy.h"
+
 #define MAX_LAYER_COUNT 32
 
 extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
@@ -344,6 +348,16 @@ private:
     status_t setFramebufferTarget(int32_t id,
             const sp<Fence>& acquireFence, const sp<GraphicBuffer>& buf);
 
+    // a frame whose cost isn't known until GLES is done composing it
+    struct PendingCost {
+        CompositionStrategy::Frame frame;
+        // when prepare() and set() were done
+        nsecs_t preparedTime;
+        nsecs_t setTime;
+        // signals when GLES is done, NO_FENCE if it wasn't used
+        sp<Fence> glesDoneFence;
+    };
+
     struct DisplayData {
         DisplayData();
         ~DisplayData();
@@ -368,8 +382,49 @@ private:
 
         // protected by mEventControlLock
         int32_t events;
+
+        // The layers of list as they were passed to the last prepare(),
+        // with the composition types chosen by the HWC. Allocated along
+        // with list, numShadowLayers is 0 when they must not be used.
+        hwc_layer_1* shadowLayers;
+        size_t numShadowLayers;
+        // one rect per layer of list, holds the visibleRegionScreen of
+        // single-rect regions so that they don't need a SharedBuffer.
+        hwc_rect_t* visibleRects;
+        // visibleRegionScreen is freed after each frame, the visible rects
+        // of shadowLayers[i] are shadowRects[shadowRectOffsets[i]] up to
+        // shadowRects[shadowRectOffsets[i+1]].
+        Vector<Rect> shadowRects;
+        Vector<size_t> shadowRectOffsets;
+        // whether list was passed to the last prepare()
+        bool prepared;
+        // statistics, for dumpsys
+        size_t numLayersTouched;
+        uint64_t totalLayersTouched;
+        uint64_t totalLayers;
+
+        // used when there is a composition strategy: the layers as the
+        // last prepare() left them and when that was, the acquire fence
+        // of the framebuffer target and the frames whose cost will be
+        // handed to the strategy, oldest first.
+        CompositionStrategy::Frame preparedFrame;
+        nsecs_t preparedTime;
+        sp<Fence> glesDoneFence;
+        Vector<PendingCost> pendingCosts;
     };
 
+    // updateShadowLocked compares the layers of disp.list with the ones
+    // passed to the previous prepare(), and returns how many changed.
+    size_t updateShadowLocked(DisplayData& disp);
+
+    // preparedLocked records the layers each display was prepared with,
+    // for the composition strategy.
+    void preparedLocked();
+
+    // addFrameCostsLocked hands the cost of the frames of display id
+    // whose GLES composition is done to the composition strategy.
+    void addFrameCostsLocked(int32_t id, DisplayData& disp);
+
     sp<SurfaceFlinger>              mFlinger;
     framebuffer_device_t*           mFbDev;
     struct hwc_composer_device_1*   mHwc;
@@ -384,6 +439,16 @@ private:
     size_t                          mVSyncCounts[HWC_NUM_PHYSICAL_DISPLAY_TYPES];
     sp<VSyncThread>                 mVSyncThread;
     bool                            mDebugForceFakeVSync;
+    // don't call the HWC's prepare() when no layer changed since the last
+    // frame, see prepare().
+    bool                            mSkipUnchangedPrepare;
+    // the last frame was prepared and committed successfully
+    bool                            mLastFrameOk;
+    uint64_t                        mNumPrepares;
+    uint64_t                        mNumPreparesSkipped;
+    // picks the layers composed with GLES before the HWC does, NULL to
+    // leave that to the HWC. See debug.sf.comp_strategy.
+    CompositionStrategy*            mStrategy;
     BitSet32                        mAllocatedDisplayIDs;
     bool                            mVDSEnabled;
     // protected by mLock
@@ -439,6 +504,18 @@ private:
     bool needsScaling(int32_t id);
     float mDynThreshold;
     bool canHandleOverlapArea(int32_t id, Rect unionDr);
+
+    // the parts of the GPUTileRect decision that only depend on the
+    // geometry, valid while neither it nor the composition map change.
+    struct TiledDRCache {
+        bool valid;
+        bool needsScaling;
+        bool overlapping;
+    };
+    const TiledDRCache& getTiledDRCache(int32_t id);
+    TiledDRCache mTiledDRCache[MAX_HWC_DISPLAYS];
+    // reused by the GPUTileRect functions so they don't allocate
+    RectSweep mRectSweep;
 #endif
 };
 
@@ -59,7 +59,11 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc,
     mDbgLastCompositionType(COMPOSITION_UNKNOWN),
     mMustRecompose(false),
     mForceHwcCopy(false),
-    mSecure(false)
+    mSecure(false),
+    mPassthroughEnabled(false),
+    mPassthroughSlots(0),
+    mNumPassthroughFrames(0),
+    mNumComposedFrames(0)
 {
     mSource[SOURCE_SINK] = sink;
     mSource[SOURCE_SCRATCH] = bqProducer;
@@ -72,6 +76,7 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc,
 
     mSinkBufferWidth = sinkWidth;
     mSinkBufferHeight = sinkHeight;
+    mSinkUsage = sinkUsage;
 
     // Pick the buffer format to request from the sink when not rendering to it
     // with GLES. If the consumer needs CPU access, use the default format
@@ -103,6 +108,12 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc,
         mForceHwcCopy = true;
     }
 
+    // When the sink is fed by the h/w composer, the copy is there on purpose
+    // (e.g. to convert to YUV), so layer buffers are only passed through to
+    // sinks that GLES renders into.
+    property_get("debug.sf.vds_passthrough", value, "0");
+    mPassthroughEnabled = atoi(value) ? true : false;
+
     // Once the mForceHwcCopy flag is set, we can freely allocate an HWC
     // display ID.
     if (mForceHwcCopy &&  mHwc.isVDSEnabled())
@@ -126,6 +137,7 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc,
 }
 
 VirtualDisplaySurface::~VirtualDisplaySurface() {
+    releasePassthroughSlots();
 }
 
 // helper to update the output usage when the display is secure
@@ -205,6 +217,67 @@ status_t VirtualDisplaySurface::prepareFrame(CompositionType compositionType) {
     return NO_ERROR;
 }
 
+bool VirtualDisplaySurface::passthroughFrame(const sp<GraphicBuffer>& buffer,
+        const sp<Fence>& fence, const sp<BufferReleaser>& releaser) {
+    if (mDisplayId >= 0 || !mPassthroughEnabled || buffer == NULL)
+        return false;
+
+    // The buffer must be one the sink could have allocated: same size,
+    // format and at least the usage the sink asked for. Protected content
+    // never leaves the layer.
+    if (buffer->getWidth() != mSinkBufferWidth ||
+            buffer->getHeight() != mSinkBufferHeight ||
+            (buffer->getUsage() & GRALLOC_USAGE_PROTECTED) ||
+            (buffer->getUsage() & mSinkUsage) != mSinkUsage ||
+            buffer->getPixelFormat() != PixelFormat(mDefaultOutputFormat)) {
+        return false;
+    }
+
+    // attachBuffer would reuse a free slot of the sink, and the release
+    // fence of a layer buffer the sink released would be lost with it.
+    reclaimPassthroughBuffers();
+
+    int sslot;
+    status_t result = mSource[SOURCE_SINK]->attachBuffer(&sslot, buffer);
+    if (result < 0) {
+        VDS_LOGV("passthroughFrame: attachBuffer failed (%d)", result);
+        return false;
+    }
+    // The sink released this one since reclaimPassthroughBuffers().
+    const bool fenceLost = mPassthroughSlots & (1ULL << sslot);
+    VDS_LOGW_IF(fenceLost, "passthroughFrame: release fence of sslot=%d lost",
+            sslot);
+    if (fenceLost) {
+        releasePassthroughSlot(sslot, Fence::NO_FENCE);
+    }
+    mPassthroughSlots |= 1ULL << sslot;
+    mPassthroughBuffers[sslot] = buffer;
+    mPassthroughReleasers[sslot] = releaser;
+
+    QueueBufferOutput qbo;
+    result = mSource[SOURCE_SINK]->queueBuffer(sslot,
+            QueueBufferInput(
+                systemTime(), false /* isAutoTimestamp */,
+                Rect(mSinkBufferWidth, mSinkBufferHeight),
+                NATIVE_WINDOW_SCALING_MODE_FREEZE, 0 /* transform */,
+                true /* async*/,
+                fence),
+            &qbo);
+    if (result != NO_ERROR) {
+        VDS_LOGV("passthroughFrame: queueBuffer failed (%d)", result);
+        mSource[SOURCE_SINK]->detachBuffer(sslot);
+        // the caller releases the buffer when the frame isn't passed through
+        mPassthroughSlots &= ~(1ULL << sslot);
+        mPassthroughBuffers[sslot].clear();
+        mPassthroughReleasers[sslot].clear();
+        return false;
+    }
+    updateQueueBufferOutput(qbo);
+    VDS_LOGV("passthroughFrame: queued %p in sslot=%d", buffer.get(), sslot);
+    mNumPassthroughFrames++;
+    return true;
+}
+
 status_t VirtualDisplaySurface::compositionComplete() {
     return NO_ERROR;
 }
@@ -317,7 +390,12 @@ void VirtualDisplaySurface::onFrameCommitted() {
     resetPerFrameState();
 }
 
-void VirtualDisplaySurface::dump(String8& /* result */) const {
+void VirtualDisplaySurface::dump(String8& result) const {
+    if (mDisplayId < 0) {
+        result.appendFormat("   VDS: passthrough %s, %u frames passed through, "
+                "%u composed\n", mPassthroughEnabled ? "enabled" : "disabled",
+                mNumPassthroughFrames, mNumComposedFrames);
+    }
 }
 
 void VirtualDisplaySurface::resizeBuffers(const uint32_t w, const uint32_t h) {
@@ -391,10 +469,35 @@ status_t VirtualDisplaySurface::dequeueBuffer(Source source,
     return result;
 }
 
+status_t VirtualDisplaySurface::dequeueSinkBuffer(int* sslot, sp<Fence>* fence,
+        bool async, uint32_t w, uint32_t h, uint32_t format, uint32_t usage) {
+    for (;;) {
+        status_t result = mSource[SOURCE_SINK]->dequeueBuffer(sslot, fence,
+                async, w, h, format, usage);
+        if (result < 0)
+            return result;
+        const uint64_t slotBit = 1ULL << *sslot;
+        if (!(mPassthroughSlots & slotBit))
+            return result;
+
+        // This slot holds a layer buffer from a passthrough frame, the GLES
+        // driver must not draw into it. Give the buffer back to the layer,
+        // and the slot back to the sink without it, a new buffer is
+        // allocated the next time it's dequeued.
+        VDS_LOGV("dequeueSinkBuffer: detaching passthrough sslot=%d", *sslot);
+        result = mSource[SOURCE_SINK]->detachBuffer(*sslot);
+        if (result != NO_ERROR) {
+            mSource[SOURCE_SINK]->cancelBuffer(*sslot, *fence);
+            return result;
+        }
+        releasePassthroughSlot(*sslot, *fence);
+    }
+}
+
 status_t VirtualDisplaySurface::dequeueBuffer(int* pslot, sp<Fence>* fence, bool async,
         uint32_t w, uint32_t h, uint32_t format, uint32_t usage) {
     if (mDisplayId < 0)
-        return mSource[SOURCE_SINK]->dequeueBuffer(pslot, fence, async, w, h, format, usage);
+        return dequeueSinkBuffer(pslot, fence, async, w, h, format, usage);
 
     VDS_LOGW_IF(mDbgState != DBG_STATE_PREPARED,
             "Unexpected dequeueBuffer() in %s state", dbgStateStr());
@@ -476,8 +579,10 @@ status_t VirtualDisplaySurface::attachBuffer(int* /* outSlot */,
 
 status_t VirtualDisplaySurface::queueBuffer(int pslot,
         const QueueBufferInput& input, QueueBufferOutput* output) {
-    if (mDisplayId < 0)
+    if (mDisplayId < 0) {
+        mNumComposedFrames++;
         return mSource[SOURCE_SINK]->queueBuffer(pslot, input, output);
+    }
 
     VDS_LOGW_IF(mDbgState != DBG_STATE_GLES,
             "Unexpected queueBuffer(pslot=%d) in %s state", pslot,
@@ -531,6 +636,18 @@ status_t VirtualDisplaySurface::queueBuffer(int pslot,
     return NO_ERROR;
 }
 
+status_t VirtualDisplaySurface::queueAndDequeueBuffer(int pslot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        bool /* async */, uint32_t /* w */, uint32_t /* h */,
+        uint32_t /* format */, uint32_t /* usage */, int* /* outSlot */,
+        sp<Fence>* /* outFence */, sp<GraphicBuffer>* /* outBuffer */,
+        status_t* outDequeueResult) {
+    // The GLES driver dequeues in step with the composition state machine,
+    // which can't be done ahead of time.
+    *outDequeueResult = INVALID_OPERATION;
+    return queueBuffer(pslot, input, output);
+}
+
 void VirtualDisplaySurface::cancelBuffer(int pslot, const sp<Fence>& fence) {
     if (mDisplayId < 0)
         return mSource[SOURCE_SINK]->cancelBuffer(mapProducer2SourceSlot(SOURCE_SINK, pslot), fence);
@@ -572,7 +689,12 @@ status_t VirtualDisplaySurface::connect(const sp<IProducerListener>& listener,
 }
 
 status_t VirtualDisplaySurface::disconnect(int api) {
-    return mSource[SOURCE_SINK]->disconnect(api);
+    status_t result = mSource[SOURCE_SINK]->disconnect(api);
+    if (result == NO_ERROR) {
+        // the sink freed all its buffers
+        releasePassthroughSlots();
+    }
+    return result;
 }
 
 status_t VirtualDisplaySurface::setSidebandStream(const sp<NativeHandle>& /*stream*/) {
@@ -589,6 +711,48 @@ status_t VirtualDisplaySurface::setBuffersSize(int size) {
    return mSource[SOURCE_SINK]->setBuffersSize(size);
 }
 
+void VirtualDisplaySurface::reclaimPassthroughBuffers() {
+    // The sink can only hand a slot back through dequeueBuffer, which may
+    // block. Detach its free buffers instead, oldest first, until none of
+    // the layer buffers is left. The sink's own buffers that go with them
+    // are reallocated the next time GLES needs them.
+    while (mPassthroughSlots) {
+        sp<GraphicBuffer> buffer;
+        sp<Fence> fence;
+        if (mSource[SOURCE_SINK]->detachNextBuffer(&buffer, &fence) != NO_ERROR)
+            break;
+        for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+            if ((mPassthroughSlots & (1ULL << i)) &&
+                    mPassthroughBuffers[i] == buffer) {
+                VDS_LOGV("reclaimPassthroughBuffers: sslot=%d released", i);
+                releasePassthroughSlot(i, fence);
+                break;
+            }
+        }
+    }
+}
+
+void VirtualDisplaySurface::releasePassthroughSlot(int sslot,
+        const sp<Fence>& fence) {
+    mPassthroughSlots &= ~(1ULL << sslot);
+    sp<GraphicBuffer> buffer(mPassthroughBuffers[sslot]);
+    sp<BufferReleaser> releaser(mPassthroughReleasers[sslot]);
+    mPassthroughBuffers[sslot].clear();
+    mPassthroughReleasers[sslot].clear();
+    if (releaser != NULL) {
+        releaser->releaseBuffer(buffer, fence);
+    }
+}
+
+void VirtualDisplaySurface::releasePassthroughSlots() {
+    // The sink is gone, nothing tells when it is done with the buffers.
+    for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+        if (mPassthroughSlots & (1ULL << i)) {
+            releasePassthroughSlot(i, Fence::NO_FENCE);
+        }
+    }
+}
+
 void VirtualDisplaySurface::updateQueueBufferOutput(
         const QueueBufferOutput& qbo) {
     uint32_t w, h, transformHint, numPendingBuffers;
@@ -67,6 +67,15 @@ class IProducerListener;
  * buffer for HWC, and a separate buffer is dequeued from the sink and used as
  * the HWC output buffer. When HWC composition is complete, the scratch buffer
  * is released and the output buffer is queued to the sink.
+ *
+ * When the h/w composer is not used and a single opaque layer covers the
+ * whole display without scaling or transform (e.g. screen recording of a
+ * fullscreen video), nothing is composed: the layer's buffer is attached to
+ * the sink and queued with its acquire fence (see passthroughFrame). The
+ * sink slots that hold such buffers are tracked. When the sink releases one,
+ * it is detached, before the GLES driver could dequeue it and draw into a
+ * buffer owned by the layer, and the buffer goes back to the layer with the
+ * sink's release fence.
  */
 class VirtualDisplaySurface : public DisplaySurface,
                               public BnGraphicBufferProducer,
@@ -84,6 +93,9 @@ public:
     //
     virtual status_t beginFrame(bool mustRecompose);
     virtual status_t prepareFrame(CompositionType compositionType);
+    virtual bool passthroughFrame(const sp<GraphicBuffer>& buffer,
+            const sp<Fence>& fence, const sp<BufferReleaser>& releaser);
+    virtual void reclaimPassthroughBuffers();
     virtual status_t compositionComplete();
     virtual status_t advanceFrame();
     virtual void onFrameCommitted();
@@ -108,6 +120,11 @@ private:
     virtual status_t attachBuffer(int* slot, const sp<GraphicBuffer>& buffer);
     virtual status_t queueBuffer(int pslot,
             const QueueBufferInput& input, QueueBufferOutput* output);
+    virtual status_t queueAndDequeueBuffer(int pslot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            bool async, uint32_t w, uint32_t h, uint32_t format,
+            uint32_t usage, int* outSlot, sp<Fence>* outFence,
+            sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult);
     virtual void cancelBuffer(int pslot, const sp<Fence>& fence);
     virtual int query(int what, int* value);
     virtual status_t connect(const sp<IProducerListener>& listener,
@@ -124,7 +141,11 @@ private:
     static Source fbSourceForCompositionType(CompositionType type);
     status_t dequeueBuffer(Source source, uint32_t format, uint32_t usage,
             int* sslot, sp<Fence>* fence);
+    status_t dequeueSinkBuffer(int* sslot, sp<Fence>* fence, bool async,
+            uint32_t w, uint32_t h, uint32_t format, uint32_t usage);
     void updateQueueBufferOutput(const QueueBufferOutput& qbo);
+    void releasePassthroughSlot(int sslot, const sp<Fence>& fence);
+    void releasePassthroughSlots();
     void resetPerFrameState();
     status_t refreshOutputBuffer();
     void setOutputUsage();
@@ -145,6 +166,7 @@ private:
     const String8 mDisplayName;
     sp<IGraphicBufferProducer> mSource[2]; // indexed by SOURCE_*
     uint32_t mDefaultOutputFormat;
+    uint32_t mSinkUsage;
 
     // Force copy flag. Used to determine if we are forcing composition
     // through HWC.
@@ -159,6 +181,10 @@ private:
     // secure flag
     bool mSecure;
 
+    // Set if layer buffers may be passed through to the sink, see
+    // passthroughFrame().
+    bool mPassthroughEnabled;
+
     //
     // Inter-frame state
     //
@@ -188,6 +214,18 @@ private:
     // dequeued from the sink, and are used when queueing the buffer.
     uint32_t mSinkBufferWidth, mSinkBufferHeight;
 
+    // Each bit corresponds to a sink slot that holds a layer buffer attached
+    // by passthroughFrame(), rather than a buffer allocated by the sink. The
+    // buffer and where it goes back to once the sink releases it are kept in
+    // mPassthroughBuffers and mPassthroughReleasers, indexed by sink slot.
+    uint64_t mPassthroughSlots;
+    sp<GraphicBuffer> mPassthroughBuffers[BufferQueue::NUM_BUFFER_SLOTS];
+    sp<BufferReleaser> mPassthroughReleasers[BufferQueue::NUM_BUFFER_SLOTS];
+
+    // Number of frames passed through and composed, for dump().
+    uint32_t mNumPassthroughFrames;
+    uint32_t mNumComposedFrames;
+
     //
     // Intra-frame state
     //
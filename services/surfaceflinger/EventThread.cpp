@@ -16,10 +16,13 @@
 
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/types.h>
 
 #include <cutils/compiler.h>
+#include <cutils/properties.h>
 
 #include <gui/BitTube.h>
 #include <gui/IDisplayEventConnection.h>
@@ -38,6 +41,26 @@ namespace android {
 // time to wait between VSYNC requests before sending a VSYNC OFF power hint: 40msec.
 const long vsyncHintOffDelay = 40000000;
 
+// Connection phase offsets are rounded to this, so that connections with
+// close phases share a slot of the wheel and a wakeup, and those larger
+// than the vsync period are ignored. The period is assumed to be 60 Hz if
+// the vsync source doesn't know it.
+static const nsecs_t kPhaseOffsetQuantum = 500000;     // 500 usec
+static const nsecs_t kDefaultVsyncPeriod = 16666667;
+
+// The EventRing of a connection fits in a page, there are fewer events than
+// that pending unless the client is stuck.
+static const size_t kEventRingCapacity = 128;
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
 static void vsyncOffCallback(union sigval val) {
     EventThread *ev = (EventThread *)val.sival_ptr;
     ev->sendVsyncHintOff();
@@ -47,16 +70,14 @@ static void vsyncOffCallback(union sigval val) {
 EventThread::EventThread(const sp<VSyncSource>& src)
     : mVSyncSource(src),
       mUseSoftwareVSync(false),
-      mVsyncEnabled(false),
+      mUseEventRing(true),
       mDebugVsyncEnabled(false),
       mVsyncHintSent(false) {
 
-    for (int32_t i=0 ; i<DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES ; i++) {
-        mVSyncEvent[i].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
-        mVSyncEvent[i].header.id = 0;
-        mVSyncEvent[i].header.timestamp = 0;
-        mVSyncEvent[i].vsync.count =  0;
-    }
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.event_ring", value, "1");
+    mUseEventRing = atoi(value) ? true : false;
+
     struct sigevent se;
     se.sigev_notify = SIGEV_THREAD;
     se.sigev_value.sival_ptr = this;
@@ -85,6 +106,7 @@ void EventThread::sendVsyncHintOnLocked() {
 }
 
 void EventThread::onFirstRef() {
+    mPhaseGroups.add(0, new PhaseGroup(this, 0, mVSyncSource));
     run("EventThread", PRIORITY_URGENT_DISPLAY + PRIORITY_MORE_FAVORABLE);
 }
 
@@ -127,6 +149,37 @@ void EventThread::requestNextVsync(
     }
 }
 
+void EventThread::setVsyncPhaseOffset(nsecs_t offset,
+        const sp<EventThread::Connection>& connection) {
+    // server must protect against bad params
+    nsecs_t maxOffset = mVSyncSource->getPeriod();
+    if (maxOffset <= 0) {
+        maxOffset = kDefaultVsyncPeriod;
+    }
+    if (offset <= -maxOffset || offset >= maxOffset) {
+        return;
+    }
+    const nsecs_t half = offset < 0 ? -kPhaseOffsetQuantum / 2 :
+            kPhaseOffsetQuantum / 2;
+    offset = ((offset + half) / kPhaseOffsetQuantum) * kPhaseOffsetQuantum;
+
+    Mutex::Autolock _l(mLock);
+    if (connection->phaseOffset == offset) {
+        return;
+    }
+    if (mPhaseGroups.indexOfKey(offset) < 0) {
+        sp<VSyncSource> source(mVSyncSource->createSource(offset));
+        if (source == NULL) {
+            ALOGW("vsync source can't shift its events by %" PRId64 " ns",
+                    offset);
+            return;
+        }
+        mPhaseGroups.add(offset, new PhaseGroup(this, offset, source));
+    }
+    connection->phaseOffset = offset;
+    mCondition.broadcast();
+}
+
 void EventThread::onScreenReleased() {
     Mutex::Autolock _l(mLock);
     if (!mUseSoftwareVSync) {
@@ -145,12 +198,18 @@ void EventThread::onScreenAcquired() {
     }
 }
 
-void EventThread::onVSyncEvent(nsecs_t timestamp) {
+void EventThread::onVSyncEvent(const sp<PhaseGroup>& group,
+        nsecs_t timestamp) {
     Mutex::Autolock _l(mLock);
-    mVSyncEvent[0].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
-    mVSyncEvent[0].header.id = 0;
-    mVSyncEvent[0].header.timestamp = timestamp;
-    mVSyncEvent[0].vsync.count++;
+    DisplayEventReceiver::Event& event(group->event);
+    event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+    event.header.id = 0;
+    event.header.timestamp = timestamp;
+    // count the events the source skipped: the count stays a multiple of
+    // the divisor, so that the connections whose rate is a multiple of it
+    // get their events
+    event.vsync.count = (event.vsync.count / group->divisor + 1) *
+            group->divisor;
     mCondition.broadcast();
 }
 
@@ -211,16 +270,21 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
         bool eventPending = false;
         bool waitForVSync = false;
 
+        // see if a slot of the wheel has a vsync event to dispatch
+        sp<PhaseGroup> vsyncGroup;
         size_t vsyncCount = 0;
         nsecs_t timestamp = 0;
-        for (int32_t i=0 ; i<DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES ; i++) {
-            timestamp = mVSyncEvent[i].header.timestamp;
-            if (timestamp) {
-                // we have a vsync event to dispatch
-                *event = mVSyncEvent[i];
-                mVSyncEvent[i].header.timestamp = 0;
-                vsyncCount = mVSyncEvent[i].vsync.count;
-                break;
+        for (size_t i=0 ; i<mPhaseGroups.size() ; i++) {
+            const sp<PhaseGroup>& group(mPhaseGroups.valueAt(i));
+            group->numConnections = 0;
+            group->numWaiting = 0;
+            group->wantedDivisor = 0;
+            if (!timestamp && group->event.header.timestamp) {
+                timestamp = group->event.header.timestamp;
+                *event = group->event;
+                group->event.header.timestamp = 0;
+                vsyncCount = group->event.vsync.count;
+                vsyncGroup = group;
             }
         }
 
@@ -240,13 +304,19 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
             sp<Connection> connection(mDisplayEventConnections[i].promote());
             if (connection != NULL) {
                 bool added = false;
+                const sp<PhaseGroup>& group(
+                        mPhaseGroups.valueFor(connection->phaseOffset));
+                group->numConnections++;
                 if (connection->count >= 0) {
                     // we need vsync events because at least
                     // one connection is waiting for it
                     waitForVSync = true;
-                    if (timestamp) {
+                    group->numWaiting++;
+                    group->wantedDivisor = gcd(group->wantedDivisor,
+                            connection->count ? connection->count : 1);
+                    if (timestamp && group == vsyncGroup) {
                         // we consume the event only if it's time
-                        // (ie: we received a vsync event)
+                        // (ie: we received a vsync event for this phase)
                         if (connection->count == 0) {
                             // fired this time around
                             connection->count = -1;
@@ -275,19 +345,29 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
             }
         }
 
-        // Here we figure out if we need to enable or disable vsyncs
-        if (timestamp && !waitForVSync) {
-            // we received a VSYNC but we have no clients
-            // don't report it, and disable VSYNC events
-            disableVSyncLocked();
-        } else if (!timestamp && waitForVSync) {
-            // we have at least one client, so we want vsync enabled
-            // (TODO: this function is called right after we finish
-            // notifying clients of a vsync, so this call will be made
-            // at the vsync rate, e.g. 60fps.  If we can accurately
-            // track the current state we could avoid making this call
-            // so often.)
-            enableVSyncLocked();
+        // Here we figure out if we need to enable or disable vsyncs, for
+        // each phase
+        for (size_t i=0 ; i<mPhaseGroups.size() ; i++) {
+            const sp<PhaseGroup> group(mPhaseGroups.valueAt(i));
+            if (!group->numConnections && group->phaseOffset != 0) {
+                // nobody uses this phase anymore
+                disableVSyncLocked(group);
+                group->source->setCallback(NULL);
+                mPhaseGroups.removeItemsAt(i);
+                --i;
+            } else if (group == vsyncGroup && !group->numWaiting) {
+                // we received a VSYNC but we have no clients
+                // don't report it, and disable VSYNC events
+                disableVSyncLocked(group);
+            } else if (!timestamp && group->numWaiting) {
+                // we have at least one client, so we want vsync enabled
+                // (TODO: this function is called right after we finish
+                // notifying clients of a vsync, so this call will be made
+                // at the vsync rate, e.g. 60fps.  If we can accurately
+                // track the current state we could avoid making this call
+                // so often.)
+                enableVSyncLocked(group);
+            }
         }
 
         // note: !timestamp implies signalConnections.isEmpty(), because we
@@ -313,10 +393,17 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     }
                     // FIXME: how do we decide which display id the fake
                     // vsync came from ?
-                    mVSyncEvent[0].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
-                    mVSyncEvent[0].header.id = DisplayDevice::DISPLAY_PRIMARY;
-                    mVSyncEvent[0].header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
-                    mVSyncEvent[0].vsync.count++;
+                    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+                    for (size_t i=0 ; i<mPhaseGroups.size() ; i++) {
+                        const sp<PhaseGroup>& group(mPhaseGroups.valueAt(i));
+                        if (group->numWaiting) {
+                            DisplayEventReceiver::Event& e(group->event);
+                            e.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+                            e.header.id = DisplayDevice::DISPLAY_PRIMARY;
+                            e.header.timestamp = now;
+                            e.vsync.count++;
+                        }
+                    }
                 }
             } else {
                 // Nobody is interested in vsync, so we just want to sleep.
@@ -334,25 +421,34 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
     return signalConnections;
 }
 
-void EventThread::enableVSyncLocked() {
+void EventThread::enableVSyncLocked(const sp<PhaseGroup>& group) {
     if (!mUseSoftwareVSync) {
         // never enable h/w VSYNC when screen is off
-        if (!mVsyncEnabled) {
-            mVsyncEnabled = true;
-            mVSyncSource->setCallback(static_cast<VSyncSource::Callback*>(this));
-            mVSyncSource->setVSyncEnabled(true);
+        if (group->wantedDivisor != group->divisor) {
+            // don't wake up for the events none of the connections want
+            group->divisor = group->source->setRateDivisor(
+                    group->wantedDivisor) ? group->wantedDivisor : 1;
+        }
+        if (!group->enabled) {
+            group->enabled = true;
+            group->source->setCallback(group);
+            group->source->setVSyncEnabled(true);
         }
     }
     mDebugVsyncEnabled = true;
     sendVsyncHintOnLocked();
 }
 
-void EventThread::disableVSyncLocked() {
-    if (mVsyncEnabled) {
-        mVsyncEnabled = false;
-        mVSyncSource->setVSyncEnabled(false);
-        mDebugVsyncEnabled = false;
+void EventThread::disableVSyncLocked(const sp<PhaseGroup>& group) {
+    if (group->enabled) {
+        group->enabled = false;
+        group->source->setVSyncEnabled(false);
     }
+    bool anyEnabled = false;
+    for (size_t i=0 ; i<mPhaseGroups.size() ; i++) {
+        anyEnabled |= mPhaseGroups.valueAt(i)->enabled;
+    }
+    mDebugVsyncEnabled = anyEnabled;
 }
 
 void EventThread::dump(String8& result) const {
@@ -361,14 +457,28 @@ void EventThread::dump(String8& result) const {
             mDebugVsyncEnabled?"enabled":"disabled");
     result.appendFormat("  soft-vsync: %s\n",
             mUseSoftwareVSync?"enabled":"disabled");
+    result.appendFormat("  event-ring: %s\n",
+            mUseEventRing?"enabled":"disabled");
     result.appendFormat("  numListeners=%zu,\n  events-delivered: %u\n",
             mDisplayEventConnections.size(),
-            mVSyncEvent[DisplayDevice::DISPLAY_PRIMARY].vsync.count);
+            mPhaseGroups.valueFor(0)->event.vsync.count);
+    for (size_t i=0 ; i<mPhaseGroups.size() ; i++) {
+        const sp<PhaseGroup>& group(mPhaseGroups.valueAt(i));
+        result.appendFormat("  phase %+" PRId64 " us: %s, divisor=%u, "
+                "count=%u\n", ns2us(group->phaseOffset),
+                group->enabled ? "enabled" : "disabled", group->divisor,
+                group->event.vsync.count);
+    }
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
                 mDisplayEventConnections.itemAt(i).promote();
-        result.appendFormat("    %p: count=%d\n",
-                connection.get(), connection!=NULL ? connection->count : 0);
+        if (connection != NULL) {
+            result.appendFormat("    %p: count=%d, phase=%+" PRId64 " us\n",
+                    connection.get(), connection->count,
+                    ns2us(connection->phaseOffset));
+        } else {
+            result.appendFormat("    %p: count=0\n", connection.get());
+        }
     }
 }
 
@@ -376,7 +486,8 @@ void EventThread::dump(String8& result) const {
 
 EventThread::Connection::Connection(
         const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(new BitTube())
+    : count(-1), phaseOffset(0), mEventThread(eventThread),
+      mChannel(new BitTube())
 {
 }
 
@@ -394,6 +505,24 @@ sp<BitTube> EventThread::Connection::getDataChannel() const {
     return mChannel;
 }
 
+sp<EventRing> EventThread::Connection::getEventRing() const {
+    if (!mEventThread->mUseEventRing) {
+        return NULL;
+    }
+    Mutex::Autolock _l(mEventRingLock);
+    if (mEventRing == NULL) {
+        // the BitTube only carries wakeups from now on, and still tells
+        // the client when we die
+        sp<EventRing> ring(new EventRing(sizeof(DisplayEventReceiver::Event),
+                kEventRingCapacity, mChannel));
+        if (ring->initCheck() != NO_ERROR) {
+            return NULL;
+        }
+        mEventRing = ring;
+    }
+    return mEventRing;
+}
+
 void EventThread::Connection::setVsyncRate(uint32_t count) {
     mEventThread->setVsyncRate(count, this);
 }
@@ -402,12 +531,44 @@ void EventThread::Connection::requestNextVsync() {
     mEventThread->requestNextVsync(this);
 }
 
+void EventThread::Connection::setVsyncPhaseOffset(nsecs_t offset) {
+    mEventThread->setVsyncPhaseOffset(offset, this);
+}
+
 status_t EventThread::Connection::postEvent(
         const DisplayEventReceiver::Event& event) {
-    ssize_t size = DisplayEventReceiver::sendEvents(mChannel, &event, 1);
+    sp<EventRing> ring;
+    {
+        Mutex::Autolock _l(mEventRingLock);
+        ring = mEventRing;
+    }
+    ssize_t size = (ring != NULL) ?
+            DisplayEventReceiver::sendEvents(ring, &event, 1) :
+            DisplayEventReceiver::sendEvents(mChannel, &event, 1);
     return size < 0 ? status_t(size) : status_t(NO_ERROR);
 }
 
 // ---------------------------------------------------------------------------
 
+EventThread::PhaseGroup::PhaseGroup(const wp<EventThread>& eventThread,
+        nsecs_t phaseOffset, const sp<VSyncSource>& source)
+    : phaseOffset(phaseOffset), source(source), divisor(1), enabled(false),
+      numConnections(0), numWaiting(0), wantedDivisor(0),
+      mEventThread(eventThread)
+{
+    event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+    event.header.id = 0;
+    event.header.timestamp = 0;
+    event.vsync.count = 0;
+}
+
+void EventThread::PhaseGroup::onVSyncEvent(nsecs_t when) {
+    sp<EventThread> eventThread(mEventThread.promote());
+    if (eventThread != NULL) {
+        eventThread->onVSyncEvent(this, when);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
 }; // namespace android
@@ -21,9 +21,11 @@
 #include <sys/types.h>
 
 #include <gui/DisplayEventReceiver.h>
+#include <gui/EventRing.h>
 #include <gui/IDisplayEventConnection.h>
 
 #include <utils/Errors.h>
+#include <utils/KeyedVector.h>
 #include <utils/threads.h>
 #include <utils/SortedVector.h>
 
@@ -51,9 +53,24 @@ public:
     virtual ~VSyncSource() {}
     virtual void setVSyncEnabled(bool enable) = 0;
     virtual void setCallback(const sp<Callback>& callback) = 0;
+
+    // createSource returns a new source of the same vsync events, shifted by
+    // phaseOffset, or NULL if this source can't shift its events.
+    virtual sp<VSyncSource> createSource(nsecs_t /*phaseOffset*/) {
+        return NULL;
+    }
+
+    // setRateDivisor makes the source fire on one event out of 'divisor'
+    // only. It returns false if the source can't skip events, in which case
+    // it keeps firing on every event.
+    virtual bool setRateDivisor(uint32_t /*divisor*/) { return false; }
+
+    // getPeriod returns the current time between two events, or 0 if it
+    // isn't known.
+    virtual nsecs_t getPeriod() { return 0; }
 };
 
-class EventThread : public Thread, private VSyncSource::Callback {
+class EventThread : public Thread {
     class Connection : public BnDisplayEventConnection {
     public:
         Connection(const sp<EventThread>& eventThread);
@@ -64,14 +81,52 @@ class EventThread : public Thread, private VSyncSource::Callback {
         // count ==-1 : one-shot event that fired this round / disabled
         int32_t count;
 
+        // the offset of the vsync events of this connection from the
+        // default ones, it's the key of its PhaseGroup
+        nsecs_t phaseOffset;
+
     private:
         virtual ~Connection();
         virtual void onFirstRef();
         virtual sp<BitTube> getDataChannel() const;
+        virtual sp<EventRing> getEventRing() const;
         virtual void setVsyncRate(uint32_t count);
         virtual void requestNextVsync();    // asynchronous
+        virtual void setVsyncPhaseOffset(nsecs_t offset);
         sp<EventThread> const mEventThread;
         sp<BitTube> const mChannel;
+        // once the client asked for it, events go through mEventRing
+        // instead of mChannel
+        mutable Mutex mEventRingLock;
+        mutable sp<EventRing> mEventRing;
+    };
+
+    // A PhaseGroup is a slot of the timer wheel of the thread: the
+    // connections with the same phase offset share a VSyncSource, so the
+    // thread wakes up once per distinct phase. The source only fires as
+    // often as the fastest of its connections needs.
+    class PhaseGroup : public VSyncSource::Callback {
+    public:
+        PhaseGroup(const wp<EventThread>& eventThread, nsecs_t phaseOffset,
+                const sp<VSyncSource>& source);
+
+        nsecs_t const phaseOffset;
+        sp<VSyncSource> const source;
+
+        // protected by EventThread::mLock
+        DisplayEventReceiver::Event event;  // pending if timestamp != 0
+        uint32_t divisor;
+        bool enabled;
+        // computed by waitForEvent: the number of live connections, the
+        // number of them waiting for vsync, and the greatest divisor of
+        // their rates (0 if none)
+        size_t numConnections;
+        size_t numWaiting;
+        uint32_t wantedDivisor;
+
+    private:
+        virtual void onVSyncEvent(nsecs_t when);
+        wp<EventThread> const mEventThread;
     };
 
 public:
@@ -83,6 +138,8 @@ public:
 
     void setVsyncRate(uint32_t count, const sp<Connection>& connection);
     void requestNextVsync(const sp<Connection>& connection);
+    void setVsyncPhaseOffset(nsecs_t offset,
+            const sp<Connection>& connection);
 
     // called before the screen is turned off from main thread
     void onScreenReleased();
@@ -103,11 +160,11 @@ private:
     virtual bool        threadLoop();
     virtual void        onFirstRef();
 
-    virtual void onVSyncEvent(nsecs_t timestamp);
+    void onVSyncEvent(const sp<PhaseGroup>& group, nsecs_t timestamp);
 
     void removeDisplayEventConnection(const wp<Connection>& connection);
-    void enableVSyncLocked();
-    void disableVSyncLocked();
+    void enableVSyncLocked(const sp<PhaseGroup>& group);
+    void disableVSyncLocked(const sp<PhaseGroup>& group);
     void sendVsyncHintOnLocked();
 
     // constants
@@ -120,9 +177,14 @@ private:
     // protected by mLock
     SortedVector< wp<Connection> > mDisplayEventConnections;
     Vector< DisplayEventReceiver::Event > mPendingEvents;
-    DisplayEventReceiver::Event mVSyncEvent[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
+    // the timer wheel, sorted by phase offset. The group at offset 0 uses
+    // mVSyncSource, the others are created on demand and removed when they
+    // have no connections left.
+    KeyedVector< nsecs_t, sp<PhaseGroup> > mPhaseGroups;
     bool mUseSoftwareVSync;
-    bool mVsyncEnabled;
+
+    // set from debug.sf.event_ring, whether connections hand out EventRings
+    bool mUseEventRing;
 
     // for debugging
     bool mDebugVsyncEnabled;
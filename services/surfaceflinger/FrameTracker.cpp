@@ -32,12 +32,38 @@
 namespace android {
 
 FrameTracker::FrameTracker() :
+        mFrameRecords(new FrameRecord[NUM_FRAME_RECORDS]),
+        mNumFrameRecords(NUM_FRAME_RECORDS),
         mOffset(0),
         mNumFences(0),
         mDisplayPeriod(0) {
     resetFrameCountersLocked();
 }
 
+FrameTracker::~FrameTracker() {
+    delete [] mFrameRecords;
+}
+
+void FrameTracker::setNumFrameRecords(size_t numFrameRecords) {
+    // getStats and dumpStats skip the current frame, keep at least one more
+    if (numFrameRecords < 2) {
+        numFrameRecords = 2;
+    } else if (numFrameRecords > MAX_FRAME_RECORDS) {
+        numFrameRecords = MAX_FRAME_RECORDS;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    if (numFrameRecords == mNumFrameRecords) {
+        return;
+    }
+    delete [] mFrameRecords;
+    mFrameRecords = new FrameRecord[numFrameRecords];
+    mNumFrameRecords = numFrameRecords;
+    mOffset = 0;
+    mNumFences = 0;
+    clearRecordsLocked();
+}
+
 void FrameTracker::setDesiredPresentTime(nsecs_t presentTime) {
     Mutex::Autolock lock(mMutex);
     mFrameRecords[mOffset].desiredPresentTime = presentTime;
@@ -65,6 +91,12 @@ void FrameTracker::setActualPresentFence(const sp<Fence>& readyFence) {
     mNumFences++;
 }
 
+void FrameTracker::setLatchTime(nsecs_t latchTime, nsecs_t latchDuration) {
+    Mutex::Autolock lock(mMutex);
+    mFrameRecords[mOffset].latchTime = latchTime;
+    mFrameRecords[mOffset].latchDuration = latchDuration;
+}
+
 void FrameTracker::setDisplayRefreshPeriod(nsecs_t displayPeriod) {
     Mutex::Autolock lock(mMutex);
     mDisplayPeriod = displayPeriod;
@@ -75,12 +107,16 @@ void FrameTracker::advanceFrame() {
 
     // Update the statistic to include the frame we just finished.
     updateStatsLocked(mOffset);
+    updateHistogramsLocked(mOffset);
 
     // Advance to the next frame.
-    mOffset = (mOffset+1) % NUM_FRAME_RECORDS;
+    mOffset = (mOffset+1) % mNumFrameRecords;
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
+    mFrameRecords[mOffset].latchTime = INT64_MAX;
+    mFrameRecords[mOffset].latchDuration = 0;
+    mFrameRecords[mOffset].latenciesRecorded = false;
 
     if (mFrameRecords[mOffset].frameReadyFence != NULL) {
         // We're clobbering an unsignaled fence, so we need to decrement the
@@ -103,10 +139,20 @@ void FrameTracker::advanceFrame() {
 
 void FrameTracker::clearStats() {
     Mutex::Autolock lock(mMutex);
-    for (size_t i = 0; i < NUM_FRAME_RECORDS; i++) {
+    clearRecordsLocked();
+    for (int i = 0; i < NUM_LATENCY_HISTOGRAMS; i++) {
+        mLatencyHistograms[i].clear();
+    }
+}
+
+void FrameTracker::clearRecordsLocked() {
+    for (size_t i = 0; i < mNumFrameRecords; i++) {
         mFrameRecords[i].desiredPresentTime = 0;
         mFrameRecords[i].frameReadyTime = 0;
         mFrameRecords[i].actualPresentTime = 0;
+        mFrameRecords[i].latchTime = 0;
+        mFrameRecords[i].latchDuration = 0;
+        mFrameRecords[i].latenciesRecorded = false;
         mFrameRecords[i].frameReadyFence.clear();
         mFrameRecords[i].actualPresentFence.clear();
     }
@@ -114,6 +160,7 @@ void FrameTracker::clearStats() {
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
+    mFrameRecords[mOffset].latchTime = INT64_MAX;
 }
 
 void FrameTracker::getStats(FrameStats* outStats) const {
@@ -123,8 +170,8 @@ void FrameTracker::getStats(FrameStats* outStats) const {
     outStats->refreshPeriodNano = mDisplayPeriod;
 
     const size_t offset = mOffset;
-    for (size_t i = 1; i < NUM_FRAME_RECORDS; i++) {
-        const size_t index = (offset + i) % NUM_FRAME_RECORDS;
+    for (size_t i = 1; i < mNumFrameRecords; i++) {
+        const size_t index = (offset + i) % mNumFrameRecords;
 
         // Skip frame records with no data (if buffer not yet full).
         if (mFrameRecords[index].desiredPresentTime == 0) {
@@ -152,8 +199,8 @@ void FrameTracker::processFencesLocked() const {
     FrameRecord* records = const_cast<FrameRecord*>(mFrameRecords);
     int& numFences = const_cast<int&>(mNumFences);
 
-    for (int i = 1; i < NUM_FRAME_RECORDS && numFences > 0; i++) {
-        size_t idx = (mOffset+NUM_FRAME_RECORDS-i) % NUM_FRAME_RECORDS;
+    for (size_t i = 1; i < mNumFrameRecords && numFences > 0; i++) {
+        size_t idx = (mOffset+mNumFrameRecords-i) % mNumFrameRecords;
         bool updated = false;
 
         const sp<Fence>& rfence = records[idx].frameReadyFence;
@@ -178,6 +225,7 @@ void FrameTracker::processFencesLocked() const {
 
         if (updated) {
             updateStatsLocked(idx);
+            updateHistogramsLocked(idx);
         }
     }
 }
@@ -186,8 +234,8 @@ void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     int* numFrames = const_cast<int*>(mNumFrames);
 
     if (mDisplayPeriod > 0 && isFrameValidLocked(newFrameIdx)) {
-        size_t prevFrameIdx = (newFrameIdx+NUM_FRAME_RECORDS-1) %
-                NUM_FRAME_RECORDS;
+        size_t prevFrameIdx = (newFrameIdx+mNumFrameRecords-1) %
+                mNumFrameRecords;
 
         if (isFrameValidLocked(prevFrameIdx)) {
             nsecs_t newPresentTime =
@@ -213,6 +261,32 @@ void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     }
 }
 
+void FrameTracker::updateHistogramsLocked(size_t idx) const {
+    FrameRecord& record = const_cast<FrameRecord&>(mFrameRecords[idx]);
+    LatencyHistogram* histograms =
+            const_cast<LatencyHistogram*>(mLatencyHistograms);
+
+    // Frames are recorded once, when all their times are known. Layers
+    // without a desired present time (e.g. the window animation tracker)
+    // are never recorded.
+    if (record.latenciesRecorded ||
+            record.desiredPresentTime <= 0 ||
+            record.desiredPresentTime == INT64_MAX ||
+            record.frameReadyTime <= 0 ||
+            record.frameReadyTime == INT64_MAX ||
+            !isFrameValidLocked(idx)) {
+        return;
+    }
+
+    histograms[READY_LATENCY].record(
+            record.frameReadyTime - record.desiredPresentTime);
+    histograms[PRESENT_LATENCY].record(
+            record.actualPresentTime - record.frameReadyTime);
+    histograms[TOTAL_LATENCY].record(
+            record.actualPresentTime - record.desiredPresentTime);
+    record.latenciesRecorded = true;
+}
+
 void FrameTracker::resetFrameCountersLocked() {
     for (int i = 0; i < NUM_FRAME_BUCKETS; i++) {
         mNumFrames[i] = 0;
@@ -238,14 +312,31 @@ void FrameTracker::dumpStats(String8& result) const {
     processFencesLocked();
 
     const size_t o = mOffset;
-    for (size_t i = 1; i < NUM_FRAME_RECORDS; i++) {
-        const size_t index = (o+i) % NUM_FRAME_RECORDS;
-        result.appendFormat("%" PRId64 "\t%" PRId64 "\t%" PRId64 "\n",
+    for (size_t i = 1; i < mNumFrameRecords; i++) {
+        const size_t index = (o+i) % mNumFrameRecords;
+        result.appendFormat("%" PRId64 "\t%" PRId64 "\t%" PRId64
+                "\t%" PRId64 "\t%" PRId64 "\n",
             mFrameRecords[index].desiredPresentTime,
             mFrameRecords[index].actualPresentTime,
-            mFrameRecords[index].frameReadyTime);
+            mFrameRecords[index].frameReadyTime,
+            mFrameRecords[index].latchTime,
+            mFrameRecords[index].latchDuration);
     }
     result.append("\n");
 }
 
+void FrameTracker::appendLatencyHistograms(const String8& name,
+        Vector<uint8_t>& out) const {
+    Mutex::Autolock lock(mMutex);
+    processFencesLocked();
+
+    const uint32_t length = uint32_t(name.length());
+    out.appendArray(reinterpret_cast<const uint8_t*>(&length),
+            sizeof(length));
+    out.appendArray(reinterpret_cast<const uint8_t*>(name.string()), length);
+    for (int i = 0; i < NUM_LATENCY_HISTOGRAMS; i++) {
+        mLatencyHistograms[i].appendTo(out);
+    }
+}
+
 } // namespace android
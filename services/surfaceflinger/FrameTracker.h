@@ -22,6 +22,9 @@
 #include <utils/Mutex.h>
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include "LatencyHistogram.h"
 
 namespace android {
 
@@ -36,16 +39,34 @@ class Fence;
 // Some of the time values tracked may be set either as a specific timestamp
 // or a fence.  When a non-NULL fence is set for a given time value, the
 // signal time of that fence is used instead of the timestamp.
+//
+// Besides the history, FrameTracker keeps histograms of the latencies of all
+// the frames since the stats were last cleared: from the desired present
+// time to the ready time, from the ready time to the actual present time,
+// and from the desired to the actual present time.
 class FrameTracker {
 
 public:
-    // NUM_FRAME_RECORDS is the size of the circular buffer used to track the
-    // frame time history.
+    // NUM_FRAME_RECORDS is the default size of the circular buffer used to
+    // track the frame time history, and MAX_FRAME_RECORDS the largest one.
     enum { NUM_FRAME_RECORDS = 128 };
+    enum { MAX_FRAME_RECORDS = 65536 };
 
     enum { NUM_FRAME_BUCKETS = 7 };
 
+    enum {
+        READY_LATENCY,      // desired present -> frame ready
+        PRESENT_LATENCY,    // frame ready -> actual present
+        TOTAL_LATENCY,      // desired present -> actual present
+        NUM_LATENCY_HISTOGRAMS
+    };
+
     FrameTracker();
+    ~FrameTracker();
+
+    // setNumFrameRecords sets the size of the circular buffer used to track
+    // the frame time history, and clears the history.
+    void setNumFrameRecords(size_t numFrameRecords);
 
     // setDesiredPresentTime sets the time at which the current frame
     // should be presented to the user under ideal (i.e. zero latency)
@@ -70,6 +91,10 @@ public:
     // at which the current frame became visible to the user.
     void setActualPresentFence(const sp<Fence>& fence);
 
+    // setLatchTime sets the time at which the current frame was latched by
+    // SurfaceFlinger, and how long latching it took on the main thread.
+    void setLatchTime(nsecs_t latchTime, nsecs_t latchDuration);
+
     // setDisplayRefreshPeriod sets the display refresh period in nanoseconds.
     // This is used to compute frame presentation duration statistics relative
     // to this period.
@@ -91,15 +116,28 @@ public:
     // dumpStats dump appends the current frame display time history to the result string.
     void dumpStats(String8& result) const;
 
+    // appendLatencyHistograms appends the latency histograms, preceded by
+    // the name of the tracker, to a binary export:
+    //   uint32_t nameLength, followed by the name (without terminator)
+    //   NUM_LATENCY_HISTOGRAMS x LatencyHistogram::appendTo
+    void appendLatencyHistograms(const String8& name,
+            Vector<uint8_t>& out) const;
+
 private:
     struct FrameRecord {
         FrameRecord() :
             desiredPresentTime(0),
             frameReadyTime(0),
-            actualPresentTime(0) {}
+            actualPresentTime(0),
+            latchTime(0),
+            latchDuration(0),
+            latenciesRecorded(false) {}
         nsecs_t desiredPresentTime;
         nsecs_t frameReadyTime;
         nsecs_t actualPresentTime;
+        nsecs_t latchTime;
+        nsecs_t latchDuration;
+        bool latenciesRecorded;
         sp<Fence> frameReadyFence;
         sp<Fence> actualPresentFence;
     };
@@ -117,6 +155,13 @@ private:
     // about the frame times.
     void updateStatsLocked(size_t newFrameIdx) const;
 
+    // updateHistogramsLocked records the latencies of a frame in the
+    // histograms, once all its times are known.
+    void updateHistogramsLocked(size_t idx) const;
+
+    // clearRecordsLocked clears the frame records.
+    void clearRecordsLocked();
+
     // resetFrameCounteresLocked sets all elements of the mNumFrames array to
     // 0.
     void resetFrameCountersLocked();
@@ -128,9 +173,14 @@ private:
     // valid and has all arrived (i.e. there are no oustanding fences).
     bool isFrameValidLocked(size_t idx) const;
 
+    // FrameTracker is not copyable, it owns mFrameRecords
+    FrameTracker(const FrameTracker&);
+    FrameTracker& operator=(const FrameTracker&);
+
     // mFrameRecords is the circular buffer storing the tracked data for each
-    // frame.
-    FrameRecord mFrameRecords[NUM_FRAME_RECORDS];
+    // frame, it has mNumFrameRecords elements.
+    FrameRecord* mFrameRecords;
+    size_t mNumFrameRecords;
 
     // mOffset is the offset into mFrameRecords of the current frame.
     size_t mOffset;
@@ -141,7 +191,7 @@ private:
     // a fence.
     //
     // The number of fences is tracked so that the run time of processFences
-    // doesn't grow with NUM_FRAME_RECORDS.
+    // doesn't grow with mNumFrameRecords.
     int mNumFences;
 
     // mNumFrames keeps a count of the number of frames with a duration in a
@@ -151,6 +201,10 @@ private:
     // all frames with duration greater than 2^(NUM_FRAME_BUCKETS-1).
     int32_t mNumFrames[NUM_FRAME_BUCKETS];
 
+    // mLatencyHistograms are the histograms of the frame latencies, indexed
+    // by READY_LATENCY, PRESENT_LATENCY and TOTAL_LATENCY.
+    LatencyHistogram mLatencyHistograms[NUM_LATENCY_HISTOGRAMS];
+
     // mDisplayPeriod is the display refresh period of the display for which
     // this FrameTracker is gathering information.
     nsecs_t mDisplayPeriod;
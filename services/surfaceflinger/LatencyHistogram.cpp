@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// This is needed for stdint.h to define UINT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <stdint.h>
+#include <string.h>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+template <typename T>
+static void append(Vector<uint8_t>& out, T value) {
+    out.appendArray(reinterpret_cast<const uint8_t*>(&value), sizeof(value));
+}
+
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+void LatencyHistogram::clear() {
+    memset(mCounts, 0, sizeof(mCounts));
+    mCount = 0;
+    mMinUs = UINT64_MAX;
+    mMaxUs = 0;
+    mSumUs = 0;
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t us) {
+    if (us < SUB_BUCKET_COUNT) {
+        return size_t(us);
+    }
+    const int exponent = 63 - __builtin_clzll(us);
+    if (exponent > MAX_EXPONENT) {
+        return NUM_BUCKETS - 1;
+    }
+    const int shift = exponent - SUB_BUCKET_BITS;
+    return SUB_BUCKET_COUNT * (shift + 1) +
+            size_t((us >> shift) - SUB_BUCKET_COUNT);
+}
+
+uint64_t LatencyHistogram::bucketLowerBound(size_t index) {
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const int shift = int(index / SUB_BUCKET_COUNT) - 1;
+    return uint64_t(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+}
+
+void LatencyHistogram::record(nsecs_t duration) {
+    const uint64_t us = duration > 0 ? uint64_t(ns2us(duration)) : 0;
+    mCounts[bucketIndex(us)]++;
+    mCount++;
+    if (us < mMinUs) {
+        mMinUs = us;
+    }
+    if (us > mMaxUs) {
+        mMaxUs = us;
+    }
+    mSumUs += us;
+}
+
+uint64_t LatencyHistogram::getValueAtPercentile(double percentile) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    uint64_t target = uint64_t(percentile * mCount / 100.0 + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += mCounts[i];
+        if (seen >= target) {
+            return bucketLowerBound(i);
+        }
+    }
+    return bucketLowerBound(NUM_BUCKETS - 1);
+}
+
+void LatencyHistogram::appendTo(Vector<uint8_t>& out) const {
+    uint32_t numNonEmpty = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (mCounts[i]) {
+            numNonEmpty++;
+        }
+    }
+    append<uint32_t>(out, mCount);
+    append<uint32_t>(out, numNonEmpty);
+    append<uint64_t>(out, mCount ? mMinUs : 0);
+    append<uint64_t>(out, mMaxUs);
+    append<uint64_t>(out, mSumUs);
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        if (mCounts[i]) {
+            append<uint32_t>(out, uint32_t(i));
+            append<uint32_t>(out, mCounts[i]);
+        }
+    }
+}
+
+} // namespace android
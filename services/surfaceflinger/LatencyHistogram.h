@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LATENCY_HISTOGRAM_H
+#define ANDROID_LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+// LatencyHistogram is a streaming histogram of durations, in the style of
+// HdrHistogram: the values are counted in microseconds, in buckets that are
+// linear within each power of two, with SUB_BUCKET_COUNT buckets per power
+// of two.  Recording is O(1), and a value is known within 1/SUB_BUCKET_COUNT
+// of itself, up to 2^(MAX_EXPONENT+1) us (about 33 seconds).  Larger
+// values go to the last bucket, negative ones to the first.
+//
+// The histogram is *NOT* thread-safe.
+class LatencyHistogram {
+public:
+    enum { SUB_BUCKET_BITS = 4 };
+    enum { SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS };
+    enum { MAX_EXPONENT = 24 };
+    enum { NUM_BUCKETS = SUB_BUCKET_COUNT * (MAX_EXPONENT - SUB_BUCKET_BITS + 2) };
+
+    LatencyHistogram();
+
+    // record adds a duration to the histogram.
+    void record(nsecs_t duration);
+
+    // clear removes all the recorded durations.
+    void clear();
+
+    uint32_t getCount() const { return mCount; }
+    uint64_t getMaxUs() const { return mMaxUs; }
+    uint64_t getMeanUs() const { return mCount ? mSumUs / mCount : 0; }
+
+    // getValueAtPercentile returns the lower bound, in microseconds, of the
+    // bucket holding the given percentile of the recorded durations.
+    uint64_t getValueAtPercentile(double percentile) const;
+
+    // bucketIndex returns the index of the bucket of a duration in
+    // microseconds, and bucketLowerBound the smallest duration in a bucket.
+    static size_t bucketIndex(uint64_t us);
+    static uint64_t bucketLowerBound(size_t index);
+
+    // appendTo appends the histogram to a binary export, in host byte
+    // order:
+    //   uint32_t count, numNonEmptyBuckets
+    //   uint64_t minUs, maxUs, sumUs
+    //   numNonEmptyBuckets x { uint32_t bucketIndex, bucketCount }
+    void appendTo(Vector<uint8_t>& out) const;
+
+private:
+    uint32_t mCounts[NUM_BUCKETS];
+    uint32_t mCount;
+    uint64_t mMinUs;
+    uint64_t mMaxUs;
+    uint64_t mSumUs;
+};
+
+}
+
+#endif // ANDROID_LATENCY_HISTOGRAM_H
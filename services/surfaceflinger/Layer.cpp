@@ -42,6 +42,7 @@
 #include "DisplayDevice.h"
 #include "Layer.h"
 #include "MonitoredProducer.h"
+#include "ScreenshotRenderer.h"
 #include "SurfaceFlinger.h"
 
 #include "DisplayHardware/HWComposer.h"
@@ -102,6 +103,8 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         mCurrentOpacity(true),
         mRefreshPending(false),
         mFrameLatencyNeeded(false),
+        mLatchTime(0),
+        mLatchDuration(0),
         mFiltering(false),
         mNeedsFiltering(false),
         mMesh(Mesh::TRIANGLE_FAN, 4, 2, 2),
@@ -115,6 +118,8 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
     mCurrentCrop.makeInvalid();
     mFlinger->getRenderEngine().genTextures(1, &mTextureName);
     mTexture.init(Texture::TEXTURE_EXTERNAL, mTextureName);
+    // only uploaded when the geometry changes
+    mMesh.setGpuResident(true);
 
     uint32_t layerFlags = 0;
     if (flags & ISurfaceComposerClient::eHidden)
@@ -144,6 +149,7 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
     nsecs_t displayPeriod =
             flinger->getHwComposer().getRefreshPeriod(HWC_DISPLAY_PRIMARY);
     mFrameTracker.setDisplayRefreshPeriod(displayPeriod);
+    mFrameTracker.setNumFrameRecords(flinger->getFrameHistoryDepth());
 }
 
 void Layer::onFirstRef() {
@@ -197,6 +203,10 @@ void Layer::onLayerDisplayed(const sp<const DisplayDevice>& /* hw */,
     }
 }
 
+void Layer::addReleaseFence(const sp<Fence>& fence) {
+    mSurfaceFlingerConsumer->setReleaseFence(fence);
+}
+
 void Layer::onFrameAvailable(const BufferItem& item) {
     // Add this buffer from our internal queue tracker
     { // Autolock scope
@@ -206,6 +216,7 @@ void Layer::onFrameAvailable(const BufferItem& item) {
 
     android_atomic_inc(&mQueuedFrames);
     mFlinger->signalLayerUpdate();
+    mFlinger->queuePrelatch(this);
 }
 
 void Layer::onFrameReplaced(const BufferItem& item) {
@@ -681,6 +692,53 @@ void Layer::setAcquireFence(const sp<const DisplayDevice>& /* hw */,
     layer.setAcquireFenceFd(fenceFd);
 }
 
+// Unpins the layer buffers a display passed through to its consumer, once
+// the consumer is done with them.
+class PassthroughReleaser : public DisplaySurface::BufferReleaser {
+public:
+    PassthroughReleaser(const sp<SurfaceFlingerConsumer>& consumer)
+        : mConsumer(consumer) { }
+    virtual void releaseBuffer(const sp<GraphicBuffer>& buffer,
+            const sp<Fence>& fence) {
+        mConsumer->unpinBuffer(buffer, fence);
+    }
+private:
+    sp<SurfaceFlingerConsumer> mConsumer;
+};
+
+sp<GraphicBuffer> Layer::getPassthroughBuffer(
+        const sp<const DisplayDevice>& hw, sp<Fence>* outFence,
+        sp<DisplaySurface::BufferReleaser>* outReleaser) const
+{
+    const State& s(getDrawingState());
+    if (mActiveBuffer == NULL || mSidebandStream != NULL ||
+            !isOpaque(s) || s.alpha != 0xFF ||
+            isProtected() || (isSecure() && !hw->isSecure())) {
+        return NULL;
+    }
+
+    // the whole buffer must be shown, unscaled and without rotation or
+    // flip, at the position of the display
+    const Rect bufferBounds(mActiveBuffer->getBounds());
+    const Transform tr(hw->getTransform() * s.transform);
+    if (tr.getType() > Transform::TRANSLATE ||
+            computeBufferTransform(hw).getOrientation() != Transform::ROT_0 ||
+            getContentCrop() != bufferBounds ||
+            computeBounds() != Rect(s.active.w, s.active.h) ||
+            bufferBounds != Rect(s.active.w, s.active.h) ||
+            tr.transform(bufferBounds) != hw->getBounds()) {
+        return NULL;
+    }
+
+    sp<GraphicBuffer> buffer;
+    if (mSurfaceFlingerConsumer->pinCurrentBuffer(&buffer, outFence)
+            != NO_ERROR) {
+        return NULL;
+    }
+    *outReleaser = new PassthroughReleaser(mSurfaceFlingerConsumer);
+    return buffer;
+}
+
 Rect Layer::getPosition(
     const sp<const DisplayDevice>& hw)
 {
@@ -782,36 +840,7 @@ void Layer::onDraw(const sp<const DisplayDevice>& hw, const Region& clip,
 
         // Query the texture matrix given our current filtering mode.
         float textureMatrix[16];
-        mSurfaceFlingerConsumer->setFilteringEnabled(useFiltering);
-        mSurfaceFlingerConsumer->getTransformMatrix(textureMatrix);
-
-        if (mSurfaceFlingerConsumer->getTransformToDisplayInverse()) {
-
-            /*
-             * the code below applies the display's inverse transform to the texture transform
-             */
-
-            // create a 4x4 transform matrix from the display transform flags
-            const mat4 flipH(-1,0,0,0,  0,1,0,0, 0,0,1,0, 1,0,0,1);
-            const mat4 flipV( 1,0,0,0, 0,-1,0,0, 0,0,1,0, 0,1,0,1);
-            const mat4 rot90( 0,1,0,0, -1,0,0,0, 0,0,1,0, 1,0,0,1);
-
-            mat4 tr;
-            uint32_t transform = hw->getOrientationTransform();
-            if (transform & NATIVE_WINDOW_TRANSFORM_ROT_90)
-                tr = tr * rot90;
-            if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_H)
-                tr = tr * flipH;
-            if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_V)
-                tr = tr * flipV;
-
-            // calculate the inverse
-            tr = inverse(tr);
-
-            // and finally apply it to the original texture matrix
-            const mat4 texTransform(mat4(static_cast<const float*>(textureMatrix)) * tr);
-            memcpy(textureMatrix, texTransform.asArray(), sizeof(textureMatrix));
-        }
+        computeTextureMatrix(hw, useFiltering, textureMatrix);
 
         // Set things up for texturing.
         mTexture.setDimensions(mActiveBuffer->getWidth(), mActiveBuffer->getHeight());
@@ -827,6 +856,81 @@ void Layer::onDraw(const sp<const DisplayDevice>& hw, const Region& clip,
 }
 
 
+void Layer::computeTextureMatrix(const sp<const DisplayDevice>& hw,
+        bool useFiltering, float textureMatrix[16]) const
+{
+    mSurfaceFlingerConsumer->setFilteringEnabled(useFiltering);
+    mSurfaceFlingerConsumer->getTransformMatrix(textureMatrix);
+
+    if (mSurfaceFlingerConsumer->getTransformToDisplayInverse()) {
+
+        /*
+         * the code below applies the display's inverse transform to the texture transform
+         */
+
+        // create a 4x4 transform matrix from the display transform flags
+        const mat4 flipH(-1,0,0,0,  0,1,0,0, 0,0,1,0, 1,0,0,1);
+        const mat4 flipV( 1,0,0,0, 0,-1,0,0, 0,0,1,0, 0,1,0,1);
+        const mat4 rot90( 0,1,0,0, -1,0,0,0, 0,0,1,0, 1,0,0,1);
+
+        mat4 tr;
+        uint32_t transform = hw->getOrientationTransform();
+        if (transform & NATIVE_WINDOW_TRANSFORM_ROT_90)
+            tr = tr * rot90;
+        if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_H)
+            tr = tr * flipH;
+        if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_V)
+            tr = tr * flipV;
+
+        // calculate the inverse
+        tr = inverse(tr);
+
+        // and finally apply it to the original texture matrix
+        const mat4 texTransform(mat4(static_cast<const float*>(textureMatrix)) * tr);
+        memcpy(textureMatrix, texTransform.asArray(), 16 * sizeof(float));
+    }
+}
+
+bool Layer::snapshot(const sp<const DisplayDevice>& hw,
+        bool useIdentityTransform, bool filtering,
+        LayerSnapshot* outSnapshot) const
+{
+    if (CC_UNLIKELY(mActiveBuffer == 0)) {
+        // onDraw() only plugs the holes below us with black, screenshots
+        // start from a black screen anyways.
+        return false;
+    }
+
+    const State& s(getDrawingState());
+    Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
+    computeGeometry(hw, mesh, useIdentityTransform);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    for (size_t i=0 ; i<4 ; i++) {
+        outSnapshot->positions[i] = position[i];
+    }
+    computeTexCoords(hw, outSnapshot->texCoords);
+
+    if (isProtected() || (isSecure() && !hw->isSecure())) {
+        outSnapshot->type = LayerSnapshot::BLACKED_OUT;
+    } else {
+        status_t err = mSurfaceFlingerConsumer->pinCurrentBuffer(
+                &outSnapshot->buffer, &outSnapshot->acquireFence);
+        if (err != NO_ERROR) {
+            return false;
+        }
+        outSnapshot->type = LayerSnapshot::BUFFER;
+        outSnapshot->consumer = mSurfaceFlingerConsumer;
+        outSnapshot->filtering = filtering || getFiltering() ||
+                needsFiltering(hw) || isFixedSize();
+        computeTextureMatrix(hw, outSnapshot->filtering,
+                outSnapshot->textureMatrix);
+    }
+    outSnapshot->premultipliedAlpha = mPremultipliedAlpha;
+    outSnapshot->opaque = isOpaque(s);
+    outSnapshot->alpha = s.alpha;
+    return true;
+}
+
 void Layer::clearWithOpenGL(const sp<const DisplayDevice>& hw,
         const Region& /* clip */, float red, float green, float blue,
         float alpha) const
@@ -849,6 +953,31 @@ void Layer::drawWithOpenGL(const sp<const DisplayDevice>& hw,
 
     computeGeometry(hw, mMesh, useIdentityTransform);
 
+    vec2 coords[4];
+    computeTexCoords(hw, coords);
+    Mesh::VertexArray<vec2> texCoords(mMesh.getTexCoordArray<vec2>());
+    bool changed = false;
+    for (size_t i=0 ; i<4 ; i++) {
+        if (texCoords[i] != coords[i]) {
+            texCoords[i] = coords[i];
+            changed = true;
+        }
+    }
+    if (changed) {
+        mMesh.invalidate();
+    }
+
+    RenderEngine& engine(mFlinger->getRenderEngine());
+    engine.setupLayerBlending(mPremultipliedAlpha, isOpaque(s), s.alpha);
+    engine.drawMesh(mMesh);
+    engine.disableBlending();
+}
+
+void Layer::computeTexCoords(const sp<const DisplayDevice>& hw,
+        vec2 coords[4]) const
+{
+    const State& s(getDrawingState());
+
     // Compute the crops exactly in the way we are doing
     // for HWC & program texture coordinates for the clipped
     // source after transformation.
@@ -872,16 +1001,10 @@ void Layer::drawWithOpenGL(const sp<const DisplayDevice>& hw,
 
     // TODO: we probably want to generate the texture coords with the mesh
     // here we assume that we only have 4 vertices
-    Mesh::VertexArray<vec2> texCoords(mMesh.getTexCoordArray<vec2>());
-    texCoords[0] = vec2(left, 1.0f - top);
-    texCoords[1] = vec2(left, 1.0f - bottom);
-    texCoords[2] = vec2(right, 1.0f - bottom);
-    texCoords[3] = vec2(right, 1.0f - top);
-
-    RenderEngine& engine(mFlinger->getRenderEngine());
-    engine.setupLayerBlending(mPremultipliedAlpha, isOpaque(s), s.alpha);
-    engine.drawMesh(mMesh);
-    engine.disableBlending();
+    coords[0] = vec2(left, 1.0f - top);
+    coords[1] = vec2(left, 1.0f - bottom);
+    coords[2] = vec2(right, 1.0f - bottom);
+    coords[3] = vec2(right, 1.0f - top);
 }
 
 uint32_t Layer::getProducerStickyTransform() const {
@@ -964,13 +1087,27 @@ void Layer::computeGeometry(const sp<const DisplayDevice>& hw, Mesh& mesh,
     win = reduce(win, s.activeTransparentRegion);
 #endif
 
+    vec2 vertices[4] = {
+        vec2(win.left,  win.top),
+        vec2(win.left,  win.bottom),
+        vec2(win.right, win.bottom),
+        vec2(win.right, win.top),
+    };
+    tr.transform(vertices, vertices, 4);
+
+    // Only touch the mesh when the transform, crop or display projection
+    // changed, so that a GPU-resident mesh isn't uploaded again.
     Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
-    position[0] = tr.transform(win.left,  win.top);
-    position[1] = tr.transform(win.left,  win.bottom);
-    position[2] = tr.transform(win.right, win.bottom);
-    position[3] = tr.transform(win.right, win.top);
+    bool changed = false;
     for (size_t i=0 ; i<4 ; i++) {
-        position[i].y = hw_h - position[i].y;
+        vertices[i].y = hw_h - vertices[i].y;
+        if (position[i] != vertices[i]) {
+            position[i] = vertices[i];
+            changed = true;
+        }
+    }
+    if (changed) {
+        mesh.invalidate();
     }
 }
 
@@ -1252,6 +1389,8 @@ void Layer::onPostComposition() {
             mFrameTracker.setActualPresentTime(presentTime);
         }
 
+        mFrameTracker.setLatchTime(mLatchTime, mLatchDuration);
+
         mFrameTracker.advanceFrame();
         mFrameLatencyNeeded = false;
     }
@@ -1289,6 +1428,14 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
             return outDirtyRegion;
         }
 
+        // the buffer latched before the current one is still pinned (see
+        // snapshot() and getPassthroughBuffer()), acquiring another one would
+        // exceed the max acquired buffer count. Try again at the next vsync.
+        if (mSurfaceFlingerConsumer->hasPendingRelease()) {
+            mFlinger->signalLayerUpdate();
+            return outDirtyRegion;
+        }
+
         // Capture the old state of the layer for comparisons later
         const State& s(getDrawingState());
         const bool oldOpacity = isOpaque(s);
@@ -1403,8 +1550,10 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
         Reject r(mDrawingState, getCurrentState(), recomputeVisibleRegions,
                 getProducerStickyTransform() != 0);
 
+        const nsecs_t latchStart = systemTime();
         status_t updateResult = mSurfaceFlingerConsumer->updateTexImage(&r,
                 mFlinger->mPrimaryDispSync);
+        const nsecs_t latchEnd = systemTime();
         if (updateResult == BufferQueue::PRESENT_LATER) {
             // Producer doesn't want buffer to be displayed yet.  Signal a
             // layer update so we check again at the next opportunity.
@@ -1439,6 +1588,8 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
 
         mRefreshPending = true;
         mFrameLatencyNeeded = true;
+        mLatchTime = latchEnd;
+        mLatchDuration = latchEnd - latchStart;
         if (oldActiveBuffer == NULL) {
              // the first time we receive a buffer, we need to trigger a
              // geometry invalidation.
@@ -1481,6 +1632,25 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
     return outDirtyRegion;
 }
 
+void Layer::prelatch()
+{
+    ATRACE_CALL();
+
+    Vector<BufferItem> items;
+    { // Autolock scope
+        Mutex::Autolock lock(mQueueItemLock);
+        items = mQueueItems;
+    }
+
+    for (size_t i = 0; i < items.size(); i++) {
+        const BufferItem& item(items[i]);
+        if (item.mGraphicBuffer != NULL) {
+            mSurfaceFlingerConsumer->prepareImage(item.mSlot,
+                    item.mGraphicBuffer, item.mCrop, item.mFrameNumber);
+        }
+    }
+}
+
 uint32_t Layer::getEffectiveUsage(uint32_t usage) const
 {
     // TODO: should we do something special if mSecure is set?
@@ -1567,6 +1737,10 @@ void Layer::dumpFrameStats(String8& result) const {
     mFrameTracker.dumpStats(result);
 }
 
+void Layer::appendLatencyHistograms(Vector<uint8_t>& out) const {
+    mFrameTracker.appendLatencyHistograms(mName, out);
+}
+
 void Layer::clearFrameStats() {
     mFrameTracker.clearStats();
 }
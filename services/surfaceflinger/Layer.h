@@ -43,6 +43,7 @@
 #include "SurfaceFlingerConsumer.h"
 #include "Transform.h"
 
+#include "DisplayHardware/DisplaySurface.h"
 #include "DisplayHardware/HWComposer.h"
 #include "DisplayHardware/FloatRect.h"
 #include "RenderEngine/Mesh.h"
@@ -57,6 +58,7 @@ class Colorizer;
 class DisplayDevice;
 class GraphicBuffer;
 class SurfaceFlinger;
+struct LayerSnapshot;
 
 // ---------------------------------------------------------------------------
 
@@ -210,6 +212,12 @@ public:
     void onLayerDisplayed(const sp<const DisplayDevice>& hw,
             HWComposer::HWCLayerInterface* layer);
 
+    /*
+     * called after the layer was drawn outside of the main EGLContext,
+     * fence signals when that context is done reading the current buffer
+     */
+    void addReleaseFence(const sp<Fence>& fence);
+
     bool shouldPresentNow(const DispSync& dispSync) const;
 
     /*
@@ -231,6 +239,16 @@ public:
     void draw(const sp<const DisplayDevice>& hw, bool useIdentityTransform) const;
     void draw(const sp<const DisplayDevice>& hw) const;
 
+    /*
+     * snapshot - captures what draw(hw, useIdentityTransform) needs, so that
+     * the layer can be drawn as it is now outside of the main thread (see
+     * ScreenshotRenderer). The current buffer stays pinned until the
+     * snapshot is released. Returns false if there is nothing to draw.
+     */
+    virtual bool snapshot(const sp<const DisplayDevice>& hw,
+            bool useIdentityTransform, bool filtering,
+            LayerSnapshot* outSnapshot) const;
+
     /*
      * doTransaction - process the transaction. This is a good place to figure
      * out which attributes of the surface have changed.
@@ -265,6 +283,13 @@ public:
      */
     Region latchBuffer(bool& recomputeVisibleRegions);
 
+    /*
+     * prelatch - prepares the queued frames ahead of latchBuffer(), so that
+     * it doesn't have to create their EGLImages. Called from the
+     * PrelatchThread.
+     */
+    void prelatch();
+
     bool isPotentialCursor() const { return mPotentialCursor;}
 
     /*
@@ -304,6 +329,14 @@ public:
     // only for debugging
     inline const sp<GraphicBuffer>& getActiveBuffer() const { return mActiveBuffer; }
 
+    // returns the active buffer if it can be sent to hw as the whole frame,
+    // i.e. it is opaque and covers the display without scaling or transform,
+    // and its acquire fence in outFence. Returns NULL otherwise. The buffer
+    // stays pinned until it is given back to outReleaser.
+    sp<GraphicBuffer> getPassthroughBuffer(const sp<const DisplayDevice>& hw,
+            sp<Fence>* outFence,
+            sp<DisplaySurface::BufferReleaser>* outReleaser) const;
+
     inline  const State&    getDrawingState() const { return mDrawingState; }
     inline  const State&    getCurrentState() const { return mCurrentState; }
     inline  State&          getCurrentState()       { return mCurrentState; }
@@ -312,6 +345,7 @@ public:
     /* always call base class first */
     void dump(String8& result, Colorizer& colorizer) const;
     void dumpFrameStats(String8& result) const;
+    void appendLatencyHistograms(Vector<uint8_t>& out) const;
     void clearFrameStats();
     void logFrameStats();
     void getFrameStats(FrameStats* outStats) const;
@@ -363,6 +397,10 @@ private:
             float r, float g, float b, float alpha) const;
     void drawWithOpenGL(const sp<const DisplayDevice>& hw, const Region& clip,
             bool useIdentityTransform) const;
+    void computeTextureMatrix(const sp<const DisplayDevice>& hw,
+            bool useFiltering, float textureMatrix[16]) const;
+    void computeTexCoords(const sp<const DisplayDevice>& hw,
+            vec2 coords[4]) const;
 
     // Temporary - Used only for LEGACY camera mode.
     uint32_t getProducerStickyTransform() const;
@@ -398,6 +436,9 @@ private:
     bool mCurrentOpacity;
     bool mRefreshPending;
     bool mFrameLatencyNeeded;
+    // when the current buffer was latched, and how long it took
+    nsecs_t mLatchTime;
+    nsecs_t mLatchDuration;
     // Whether filtering is forced on or not
     bool mFiltering;
     // Whether filtering is needed b/c of the drawingstate
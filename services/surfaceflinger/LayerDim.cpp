@@ -26,6 +26,7 @@
 #include "LayerDim.h"
 #include "SurfaceFlinger.h"
 #include "DisplayDevice.h"
+#include "ScreenshotRenderer.h"
 #include "RenderEngine/RenderEngine.h"
 
 namespace android {
@@ -53,6 +54,25 @@ void LayerDim::onDraw(const sp<const DisplayDevice>& hw,
     }
 }
 
+bool LayerDim::snapshot(const sp<const DisplayDevice>& hw,
+        bool useIdentityTransform, bool /* filtering */,
+        LayerSnapshot* outSnapshot) const
+{
+    const State& s(getDrawingState());
+    if (s.alpha == 0) {
+        return false;
+    }
+    Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2);
+    computeGeometry(hw, mesh, useIdentityTransform);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    for (size_t i=0 ; i<4 ; i++) {
+        outSnapshot->positions[i] = position[i];
+    }
+    outSnapshot->type = LayerSnapshot::DIM;
+    outSnapshot->alpha = s.alpha;
+    return true;
+}
+
 bool LayerDim::isVisible() const {
     const Layer::State& s(getDrawingState());
     return !(s.flags & layer_state_t::eLayerHidden) && s.alpha;
@@ -36,6 +36,9 @@ public:
     virtual const char* getTypeId() const { return "LayerDim"; }
     virtual void onDraw(const sp<const DisplayDevice>& hw, const Region& clip,
             bool useIdentityTransform) const;
+    virtual bool snapshot(const sp<const DisplayDevice>& hw,
+            bool useIdentityTransform, bool filtering,
+            LayerSnapshot* outSnapshot) const;
     virtual bool isOpaque(const Layer::State&) const { return false; }
     virtual bool isSecure() const         { return false; }
     virtual bool isFixedSize() const      { return true; }
@@ -84,6 +84,15 @@ status_t MonitoredProducer::queueBuffer(int slot, const QueueBufferInput& input,
     return mProducer->queueBuffer(slot, input, output);
 }
 
+status_t MonitoredProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        bool async, uint32_t w, uint32_t h, uint32_t format, uint32_t usage,
+        int* outSlot, sp<Fence>* outFence, sp<GraphicBuffer>* outBuffer,
+        status_t* outDequeueResult) {
+    return mProducer->queueAndDequeueBuffer(slot, input, output, async, w, h,
+            format, usage, outSlot, outFence, outBuffer, outDequeueResult);
+}
+
 void MonitoredProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     mProducer->cancelBuffer(slot, fence);
 }
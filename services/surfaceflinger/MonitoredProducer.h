@@ -45,6 +45,11 @@ public:
             const sp<GraphicBuffer>& buffer);
     virtual status_t queueBuffer(int slot, const QueueBufferInput& input,
             QueueBufferOutput* output);
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            bool async, uint32_t w, uint32_t h, uint32_t format,
+            uint32_t usage, int* outSlot, sp<Fence>* outFence,
+            sp<GraphicBuffer>* outBuffer, status_t* outDequeueResult);
     virtual void cancelBuffer(int slot, const sp<Fence>& fence);
     virtual int query(int what, int* value);
     virtual status_t connect(const sp<IProducerListener>& token, int api,
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "Layer.h"
+#include "PrelatchThread.h"
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+PrelatchThread::PrelatchThread()
+    :   Thread(false),
+        mNumPrelatches(0),
+        mTotalPrelatchTime(0) {
+}
+
+PrelatchThread::~PrelatchThread() {
+}
+
+void PrelatchThread::queueLayer(const wp<Layer>& layer) {
+    Mutex::Autolock _l(mLock);
+    mPendingLayers.add(layer);
+    mCondition.signal();
+}
+
+bool PrelatchThread::threadLoop() {
+    SortedVector< wp<Layer> > layers;
+    { // scope for the lock
+        Mutex::Autolock _l(mLock);
+        while (mPendingLayers.isEmpty()) {
+            mCondition.wait(mLock);
+        }
+        layers = mPendingLayers;
+        mPendingLayers.clear();
+    }
+
+    ATRACE_INT("PrelatchLayers", layers.size());
+    const nsecs_t start = systemTime();
+    for (size_t i = 0; i < layers.size(); i++) {
+        sp<Layer> layer(layers[i].promote());
+        if (layer != NULL) {
+            layer->prelatch();
+        }
+    }
+    const nsecs_t duration = systemTime() - start;
+
+    Mutex::Autolock _l(mLock);
+    mNumPrelatches += layers.size();
+    mTotalPrelatchTime += duration;
+    return true;
+}
+
+void PrelatchThread::dump(String8& result) const {
+    Mutex::Autolock _l(mLock);
+    result.appendFormat("  pre-latch: enabled, %" PRIu64 " layers prepared, "
+            "%.2f us avg\n", mNumPrelatches,
+            mNumPrelatches ? mTotalPrelatchTime / (1000.0 * mNumPrelatches) : 0.0);
+}
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PRELATCH_THREAD_H
+#define ANDROID_PRELATCH_THREAD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/SortedVector.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+class Layer;
+class String8;
+
+// PrelatchThread prepares the frames queued to layers ahead of
+// SurfaceFlinger::handlePageFlip(): it creates the EGLImages of the queued
+// buffers, so that Layer::latchBuffer() only has to acquire the buffers and
+// swap the consumer state on the main thread.
+//
+// Buffers are still acquired on the main thread, since whether a frame is
+// latched depends on the drawing state and on the vsync being handled.
+class PrelatchThread : public Thread {
+public:
+    PrelatchThread();
+    virtual ~PrelatchThread();
+
+    // queueLayer schedules the preparation of the frames queued to layer.
+    // Never blocks, may be called from any thread.
+    void queueLayer(const wp<Layer>& layer);
+
+    void dump(String8& result) const;
+
+private:
+    virtual bool threadLoop();
+
+    mutable Mutex mLock;
+    Condition mCondition;
+    // layers with newly queued frames
+    SortedVector< wp<Layer> > mPendingLayers;
+
+    // statistics, for dumpsys
+    uint64_t mNumPrelatches;
+    nsecs_t mTotalPrelatchTime;
+};
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_PRELATCH_THREAD_H
@@ -88,5 +88,38 @@ void Description::setColorMatrix(const mat4& mtx) {
     mColorMatrixEnabled = (mtx != identity);
 }
 
+bool Description::isTextureEnabled() const {
+    return mTextureEnabled;
+}
+
+const Texture& Description::getTexture() const {
+    return mTexture;
+}
+
+bool Description::isSameAs(const Description& other) const {
+    if (mPlaneAlpha != other.mPlaneAlpha ||
+            mPremultipliedAlpha != other.mPremultipliedAlpha ||
+            mOpaque != other.mOpaque ||
+            mTextureEnabled != other.mTextureEnabled ||
+            mColorMatrixEnabled != other.mColorMatrixEnabled ||
+            memcmp(mColor, other.mColor, sizeof(mColor)) ||
+            mProjectionMatrix != other.mProjectionMatrix) {
+        return false;
+    }
+    if (mTextureEnabled) {
+        const Texture& texture(other.mTexture);
+        if (mTexture.getTextureName() != texture.getTextureName() ||
+                mTexture.getTextureTarget() != texture.getTextureTarget() ||
+                mTexture.getFiltering() != texture.getFiltering() ||
+                mTexture.getMatrix() != texture.getMatrix()) {
+            return false;
+        }
+    }
+    if (mColorMatrixEnabled && mColorMatrix != other.mColorMatrix) {
+        return false;
+    }
+    return true;
+}
+
 
 } /* namespace android */
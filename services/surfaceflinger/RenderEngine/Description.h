@@ -67,6 +67,13 @@ public:
     void setProjectionMatrix(const mat4& mtx);
     void setColorMatrix(const mat4& mtx);
 
+    bool isTextureEnabled() const;
+    const Texture& getTexture() const;
+
+    // whether drawing with this Description and 'other' uses the same
+    // program with the same uniforms.
+    bool isSameAs(const Description& other) const;
+
 private:
     bool mUniformsDirty;
 };
@@ -26,7 +26,9 @@
 
 #include <cutils/compiler.h>
 #include <gui/ISurfaceComposer.h>
+#include <inttypes.h>
 #include <math.h>
+#include <string.h>
 
 #include "GLES20RenderEngine.h"
 #include "Program.h"
@@ -39,14 +41,41 @@
 namespace android {
 // ---------------------------------------------------------------------------
 
-GLES20RenderEngine::GLES20RenderEngine() :
-        mVpWidth(0), mVpHeight(0) {
+GLES20RenderEngine::GLES20RenderEngine(bool ownProgramCache) :
+        mVpWidth(0), mVpHeight(0),
+        mProgramCache(NULL), mOwnsProgramCache(ownProgramCache),
+        mBlendEnabled(false), mBlendSrc(GL_ONE),
+        mGLBlendEnabled(false), mGLBlendSrc(GL_ONE),
+        mBatching(false), mBatchBlendEnabled(false), mBatchBlendSrc(GL_ONE),
+        mBatchVertexSize(0), mBatchTexCoordsSize(0), mBatchVertexCount(0),
+        mBatchMeshCount(0), mBatchMeshResident(false), mBatchMeshEpoch(0),
+        mBatchMeshOffset(0), mBatchMeshPrimitive(GL_TRIANGLES),
+        mBatchMeshVertexCount(0),
+        mVertexBuffer(0), mBoundVertexBuffer(0),
+        mVertexBufferHead(0), mVertexBufferEpoch(0),
+        mNumMeshes(0), mNumDrawCalls(0),
+        mLastBatchMeshes(0), mLastBatchDrawCalls(0),
+        mCurBatchMeshes(0), mCurBatchDrawCalls(0),
+        mNumVertexUploads(0), mNumBytesUploaded(0),
+        mNumResidentHits(0), mNumVertexBufferWraps(0) {
+
+    if (mOwnsProgramCache) {
+        mProgramCache = new ProgramCache();
+    } else {
+        mProgramCache = &ProgramCache::getInstance();
+    }
 
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxTextureSize);
     glGetIntegerv(GL_MAX_VIEWPORT_DIMS, mMaxViewportDims);
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glDisable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    glGenBuffers(1, &mVertexBuffer);
+    bindVertexBuffer(mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, VERTEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
 
     struct pack565 {
         inline uint16_t operator() (int r, int g, int b) const {
@@ -68,6 +97,9 @@ GLES20RenderEngine::GLES20RenderEngine() :
 }
 
 GLES20RenderEngine::~GLES20RenderEngine() {
+    if (mOwnsProgramCache) {
+        delete mProgramCache;
+    }
 }
 
 
@@ -117,6 +149,7 @@ void GLES20RenderEngine::setViewportAndProjection(
             break;
     }
 
+    flushBatch();
     glViewport(0, 0, vpw, vph);
     mState.setProjectionMatrix(m);
     mVpWidth = vpw;
@@ -131,10 +164,9 @@ void GLES20RenderEngine::setupLayerBlending(
     mState.setPlaneAlpha(alpha / 255.0f);
 
     if (alpha < 0xFF || !opaque) {
-        glEnable(GL_BLEND);
-        glBlendFunc(premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA);
     } else {
-        glDisable(GL_BLEND);
+        setBlending(false, mBlendSrc);
     }
 }
 
@@ -146,15 +178,22 @@ void GLES20RenderEngine::setupDimLayerBlending(int alpha) {
     mState.disableTexture();
 
     if (alpha == 0xFF) {
-        glDisable(GL_BLEND);
+        setBlending(false, mBlendSrc);
     } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, GL_ONE);
     }
 }
 
 void GLES20RenderEngine::setupLayerTexturing(const Texture& texture) {
     GLuint target = texture.getTextureTarget();
+    if (mBatchVertexCount && mBatchState.isTextureEnabled()) {
+        // the parameters below are part of the texture object
+        const Texture& batchTexture(mBatchState.getTexture());
+        if (batchTexture.getTextureName() == texture.getTextureName() &&
+                batchTexture.getFiltering() != texture.getFiltering()) {
+            flushBatch();
+        }
+    }
     glBindTexture(target, texture.getTextureName());
     GLenum filter = GL_NEAREST;
     if (texture.getFiltering()) {
@@ -180,17 +219,24 @@ void GLES20RenderEngine::disableTexturing() {
 }
 
 void GLES20RenderEngine::disableBlending() {
-    glDisable(GL_BLEND);
+    setBlending(false, mBlendSrc);
+}
+
+void GLES20RenderEngine::setBlending(bool enabled, GLenum src) {
+    mBlendEnabled = enabled;
+    mBlendSrc = src;
 }
 
 #ifdef QCOM_BSP
 void GLES20RenderEngine::startTileComposition(int x , int y, int width,
                                             int height, bool preserve) {
+    flushBatch();
     glStartTilingQCOM(x, y, width, height,
           (preserve ? GL_COLOR_BUFFER_BIT0_QCOM : GL_NONE));
 }
 
 void GLES20RenderEngine::endTileComposition(unsigned int preserveMask) {
+    flushBatch();
     glEndTilingQCOM(preserveMask);
 }
 #endif
@@ -198,6 +244,7 @@ void GLES20RenderEngine::endTileComposition(unsigned int preserveMask) {
 
 void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
         uint32_t* texName, uint32_t* fbName, uint32_t* status) {
+    flushBatch();
     GLuint tname, name;
     // turn our EGLImage into a texture
     glGenTextures(1, &tname);
@@ -215,6 +262,7 @@ void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
 }
 
 void GLES20RenderEngine::unbindFramebuffer(uint32_t texName, uint32_t fbName) {
+    flushBatch();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fbName);
     glDeleteTextures(1, &texName);
@@ -226,36 +274,261 @@ void GLES20RenderEngine::setupFillWithColor(float r, float g, float b, float a)
     mState.setOpaque(false);
     mState.setColor(r, g, b, a);
     mState.disableTexture();
-    glDisable(GL_BLEND);
+    setBlending(false, mBlendSrc);
 }
 
 void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
+    mNumMeshes++;
+    mCurBatchMeshes++;
+
+    if (!mBatching) {
+        size_t offset = 0;
+        bool inBuffer = mesh.isGpuResident() ?
+                prepareResidentMesh(mesh, &offset) :
+                uploadVertices(mesh.getPositions(),
+                        mesh.getVertexCount() * mesh.getByteStride(), &offset);
+        drawArrays(mState, mBlendEnabled, mBlendSrc, mesh.getPrimitive(),
+                inBuffer ? NULL : mesh.getPositions(), offset,
+                mesh.getVertexCount(), mesh.getVertexSize(),
+                mesh.getTexCoordsSize());
+        return;
+    }
+
+    if (mBatchVertexCount && !canBatch(mesh)) {
+        flushBatch();
+    }
+    if (!mBatchVertexCount) {
+        mBatchState = mState;
+        mBatchBlendEnabled = mBlendEnabled;
+        mBatchBlendSrc = mBlendSrc;
+        mBatchVertexSize = mesh.getVertexSize();
+        mBatchTexCoordsSize = mesh.getTexCoordsSize();
+        mBatchMeshCount = 0;
+        mBatchMeshResident = mesh.isGpuResident() &&
+                prepareResidentMesh(mesh, &mBatchMeshOffset);
+        mBatchMeshEpoch = mVertexBufferEpoch;
+        mBatchMeshPrimitive = mesh.getPrimitive();
+        mBatchMeshVertexCount = mesh.getVertexCount();
+    }
+    appendToBatch(mesh);
+    mBatchMeshCount++;
+    if (mBatchVertexCount >= MAX_BATCH_VERTICES) {
+        flushBatch();
+    }
+}
+
+bool GLES20RenderEngine::canBatch(const Mesh& mesh) const {
+    if (mBlendEnabled != mBatchBlendEnabled ||
+            (mBlendEnabled && mBlendSrc != mBatchBlendSrc)) {
+        return false;
+    }
+    if (mesh.getVertexSize() != mBatchVertexSize ||
+            mesh.getTexCoordsSize() != mBatchTexCoordsSize) {
+        return false;
+    }
+    return mState.isSameAs(mBatchState);
+}
+
+void GLES20RenderEngine::appendToBatch(const Mesh& mesh) {
+    const size_t count = mesh.getVertexCount();
+    const size_t stride = mesh.getStride();
+    const float* in = mesh.getPositions();
+
+    size_t numTriangles = 0;
+    switch (mesh.getPrimitive()) {
+        case Mesh::TRIANGLES:
+            numTriangles = count / 3;
+            break;
+        case Mesh::TRIANGLE_STRIP:
+        case Mesh::TRIANGLE_FAN:
+            numTriangles = count > 2 ? count - 2 : 0;
+            break;
+    }
+
+    const size_t needed = (mBatchVertexCount + numTriangles * 3) * stride;
+    if (mBatchVertices.size() < needed) {
+        mBatchVertices.insertAt(0.0f, mBatchVertices.size(),
+                needed - mBatchVertices.size());
+    }
+    float* out = mBatchVertices.editArray() + mBatchVertexCount * stride;
+
+    // triangles keep the order of the original primitive, so that
+    // overlapping blended meshes are rendered the same way.
+    for (size_t i = 0; i < numTriangles; i++) {
+        size_t v[3];
+        switch (mesh.getPrimitive()) {
+            case Mesh::TRIANGLES:
+                v[0] = i*3; v[1] = i*3 + 1; v[2] = i*3 + 2;
+                break;
+            case Mesh::TRIANGLE_STRIP:
+                v[0] = i; v[1] = i + 1; v[2] = i + 2;
+                break;
+            case Mesh::TRIANGLE_FAN:
+                v[0] = 0; v[1] = i + 1; v[2] = i + 2;
+                break;
+        }
+        for (size_t j = 0; j < 3; j++) {
+            memcpy(out, in + v[j] * stride, stride * sizeof(float));
+            out += stride;
+        }
+    }
+    mBatchVertexCount += numTriangles * 3;
+}
+
+void GLES20RenderEngine::beginBatch() {
+    mBatching = true;
+    mCurBatchMeshes = 0;
+    mCurBatchDrawCalls = 0;
+}
 
-    ProgramCache::getInstance().useProgram(mState);
+void GLES20RenderEngine::endBatch() {
+    flushBatch();
+    if (mBatching) {
+        mBatching = false;
+        mLastBatchMeshes = mCurBatchMeshes;
+        mLastBatchDrawCalls = mCurBatchDrawCalls;
+    }
+}
+
+void GLES20RenderEngine::flushBatch() {
+    if (!mBatchVertexCount) {
+        return;
+    }
+    const size_t count = mBatchVertexCount;
+    mBatchVertexCount = 0;
+
+    if (mBatchMeshCount == 1 && mBatchMeshResident &&
+            mBatchMeshEpoch == mVertexBufferEpoch) {
+        drawArrays(mBatchState, mBatchBlendEnabled, mBatchBlendSrc,
+                mBatchMeshPrimitive, NULL, mBatchMeshOffset,
+                mBatchMeshVertexCount, mBatchVertexSize, mBatchTexCoordsSize);
+        return;
+    }
+
+    const float* vertices = mBatchVertices.array();
+    size_t offset = 0;
+    if (uploadVertices(vertices, count *
+            (mBatchVertexSize + mBatchTexCoordsSize) * sizeof(float),
+            &offset)) {
+        vertices = NULL;
+    }
+    drawArrays(mBatchState, mBatchBlendEnabled, mBatchBlendSrc,
+            Mesh::TRIANGLES, vertices, offset, count,
+            mBatchVertexSize, mBatchTexCoordsSize);
+}
+
+void GLES20RenderEngine::bindVertexBuffer(GLuint buffer) {
+    if (buffer != mBoundVertexBuffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        mBoundVertexBuffer = buffer;
+    }
+}
+
+bool GLES20RenderEngine::uploadVertices(const float* vertices, size_t size,
+        size_t* offset) {
+    if (!mVertexBuffer || size > VERTEX_BUFFER_SIZE) {
+        return false;
+    }
+    bindVertexBuffer(mVertexBuffer);
+    if (mVertexBufferHead + size > VERTEX_BUFFER_SIZE) {
+        // orphan the storage, the GPU keeps the old one until it is done
+        // with it so we don't have to wait.
+        glBufferData(GL_ARRAY_BUFFER, VERTEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+        mVertexBufferHead = 0;
+        mVertexBufferEpoch++;
+        mNumVertexBufferWraps++;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, mVertexBufferHead, size, vertices);
+    *offset = mVertexBufferHead;
+    mVertexBufferHead += (size + 15) & ~size_t(15);
+    mNumVertexUploads++;
+    mNumBytesUploaded += size;
+    return true;
+}
+
+bool GLES20RenderEngine::prepareResidentMesh(const Mesh& mesh,
+        size_t* offset) {
+    Mesh::BufferSlot& slot(mesh.getBufferSlot());
+    if (slot.owner == this && slot.epoch == mVertexBufferEpoch &&
+            slot.generation == mesh.getGeneration()) {
+        mNumResidentHits++;
+        *offset = slot.offset;
+        return true;
+    }
+    if (!uploadVertices(mesh.getPositions(),
+            mesh.getVertexCount() * mesh.getByteStride(), offset)) {
+        return false;
+    }
+    slot.owner = this;
+    slot.epoch = mVertexBufferEpoch;
+    slot.generation = mesh.getGeneration();
+    slot.offset = *offset;
+    return true;
+}
+
+void GLES20RenderEngine::drawArrays(const Description& state,
+        bool blendEnabled, GLenum blendSrc, GLenum primitive,
+        const float* vertices, size_t offset, size_t vertexCount,
+        size_t vertexSize, size_t texCoordsSize) {
 
-    if (mesh.getTexCoordsSize()) {
+    mProgramCache->useProgram(state);
+
+    if (blendEnabled != mGLBlendEnabled) {
+        if (blendEnabled) {
+            glEnable(GL_BLEND);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        mGLBlendEnabled = blendEnabled;
+    }
+    if (blendEnabled && blendSrc != mGLBlendSrc) {
+        glBlendFunc(blendSrc, GL_ONE_MINUS_SRC_ALPHA);
+        mGLBlendSrc = blendSrc;
+    }
+
+    if (state.isTextureEnabled()) {
+        // the texture may have been unbound since the mesh was batched,
+        // e.g.: by GLConsumer::bindTextureImage()
+        const Texture& texture(state.getTexture());
+        glBindTexture(texture.getTextureTarget(), texture.getTextureName());
+    }
+
+    // with a buffer bound, the pointers are offsets into it
+    const float* base = vertices;
+    if (vertices) {
+        bindVertexBuffer(0);
+    } else {
+        bindVertexBuffer(mVertexBuffer);
+        base = reinterpret_cast<const float*>(offset);
+    }
+
+    const size_t byteStride = (vertexSize + texCoordsSize) * sizeof(float);
+    if (texCoordsSize) {
         glEnableVertexAttribArray(Program::texCoords);
         glVertexAttribPointer(Program::texCoords,
-                mesh.getTexCoordsSize(),
+                texCoordsSize,
                 GL_FLOAT, GL_FALSE,
-                mesh.getByteStride(),
-                mesh.getTexCoords());
+                byteStride,
+                base + vertexSize);
     }
 
     glVertexAttribPointer(Program::position,
-            mesh.getVertexSize(),
+            vertexSize,
             GL_FLOAT, GL_FALSE,
-            mesh.getByteStride(),
-            mesh.getPositions());
+            byteStride,
+            base);
 
-    glDrawArrays(mesh.getPrimitive(), 0, mesh.getVertexCount());
+    glDrawArrays(primitive, 0, vertexCount);
+    mNumDrawCalls++;
+    mCurBatchDrawCalls++;
 
-    if (mesh.getTexCoordsSize()) {
+    if (texCoordsSize) {
         glDisableVertexAttribArray(Program::texCoords);
     }
 }
 
 void GLES20RenderEngine::beginGroup(const mat4& colorTransform) {
+    flushBatch();
 
     GLuint tname, name;
     // create the texture
@@ -284,6 +557,8 @@ void GLES20RenderEngine::beginGroup(const mat4& colorTransform) {
 
 void GLES20RenderEngine::endGroup() {
 
+    flushBatch();
+
     const Group group(mGroupStack.top());
     mGroupStack.pop();
 
@@ -304,7 +579,7 @@ void GLES20RenderEngine::endGroup() {
     mState.setOpaque(false);
     mState.setTexture(texture);
     mState.setColorMatrix(group.colorTransform);
-    glDisable(GL_BLEND);
+    setBlending(false, mBlendSrc);
 
     Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
     Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
@@ -327,8 +602,26 @@ void GLES20RenderEngine::endGroup() {
     glDeleteTextures(1, &group.texture);
 }
 
+void GLES20RenderEngine::primeCache(EGLDisplay display,
+        EGLConfig surfaceConfig) {
+    mProgramCache->primeCacheAsync(display, getEGLConfig(), surfaceConfig,
+            getEGLContext());
+}
+
 void GLES20RenderEngine::dump(String8& result) {
     RenderEngine::dump(result);
+    mProgramCache->dump(result);
+    result.appendFormat("draw calls: %" PRIu64 " meshes drawn with %" PRIu64
+            " draw calls (%.2f meshes per call), last composition: %u meshes "
+            "with %u draw calls\n",
+            mNumMeshes, mNumDrawCalls,
+            mNumDrawCalls ? double(mNumMeshes) / mNumDrawCalls : 0.0,
+            mLastBatchMeshes, mLastBatchDrawCalls);
+    result.appendFormat("vertex buffer: %u KB, %" PRIu64 " uploads (%" PRIu64
+            " KB), %" PRIu64 " resident meshes drawn without upload, "
+            "%u wraps\n",
+            VERTEX_BUFFER_SIZE / 1024, mNumVertexUploads,
+            mNumBytesUploaded / 1024, mNumResidentHits, mNumVertexBufferWraps);
 }
 
 // ---------------------------------------------------------------------------
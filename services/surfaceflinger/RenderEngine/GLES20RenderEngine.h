@@ -54,16 +54,87 @@ class GLES20RenderEngine : public RenderEngine {
     Description mState;
     Vector<Group> mGroupStack;
 
+    // the process-wide ProgramCache, or our own one
+    ProgramCache* mProgramCache;
+    bool mOwnsProgramCache;
+
+    // blending requested by the setup methods, applied when drawing
+    bool mBlendEnabled;
+    GLenum mBlendSrc;
+    // blending currently set in GL
+    bool mGLBlendEnabled;
+    GLenum mGLBlendSrc;
+
+    // meshes waiting to be drawn, converted to GL_TRIANGLES and interleaved
+    // like in Mesh. They all use mBatchState and mBatch* blending.
+    enum { MAX_BATCH_VERTICES = 6 * 256 };
+    bool mBatching;
+    Description mBatchState;
+    bool mBatchBlendEnabled;
+    GLenum mBatchBlendSrc;
+    size_t mBatchVertexSize;
+    size_t mBatchTexCoordsSize;
+    size_t mBatchVertexCount;
+    Vector<float> mBatchVertices;
+    // when the batch is made of a single GPU-resident mesh, it is drawn
+    // from the copy in the vertex buffer
+    size_t mBatchMeshCount;
+    bool mBatchMeshResident;
+    uint32_t mBatchMeshEpoch;
+    size_t mBatchMeshOffset;
+    GLenum mBatchMeshPrimitive;
+    size_t mBatchMeshVertexCount;
+
+    // vertex buffer used by all the draws of this engine, as a ring:
+    // vertices are appended at mVertexBufferHead and the buffer is orphaned
+    // when full, which drops everything in it and starts a new epoch.
+    enum { VERTEX_BUFFER_SIZE = 256 * 1024 };
+    GLuint mVertexBuffer;
+    GLuint mBoundVertexBuffer;
+    size_t mVertexBufferHead;
+    uint32_t mVertexBufferEpoch;
+
+    // statistics, meshes given to drawMesh() and the glDrawArrays() calls
+    // they resulted in
+    uint64_t mNumMeshes;
+    uint64_t mNumDrawCalls;
+    uint32_t mLastBatchMeshes;
+    uint32_t mLastBatchDrawCalls;
+    uint32_t mCurBatchMeshes;
+    uint32_t mCurBatchDrawCalls;
+    uint64_t mNumVertexUploads;
+    uint64_t mNumBytesUploaded;
+    uint64_t mNumResidentHits;
+    uint32_t mNumVertexBufferWraps;
+
+    void setBlending(bool enabled, GLenum src);
+    bool canBatch(const Mesh& mesh) const;
+    void appendToBatch(const Mesh& mesh);
+    void bindVertexBuffer(GLuint buffer);
+    // copies vertices at the head of the vertex buffer, returns false if
+    // they don't fit in it
+    bool uploadVertices(const float* vertices, size_t size, size_t* offset);
+    // makes sure the vertex buffer has the current vertices of a
+    // GPU-resident mesh
+    bool prepareResidentMesh(const Mesh& mesh, size_t* offset);
+    // draws from client memory, or from the vertex buffer at 'offset' when
+    // vertices is NULL
+    void drawArrays(const Description& state, bool blendEnabled,
+            GLenum blendSrc, GLenum primitive, const float* vertices,
+            size_t offset, size_t vertexCount, size_t vertexSize,
+            size_t texCoordsSize);
+
     virtual void bindImageAsFramebuffer(EGLImageKHR image,
             uint32_t* texName, uint32_t* fbName, uint32_t* status);
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName);
 
 public:
-    GLES20RenderEngine();
+    GLES20RenderEngine(bool ownProgramCache = false);
 
 protected:
     virtual ~GLES20RenderEngine();
 
+    virtual void primeCache(EGLDisplay display, EGLConfig surfaceConfig);
     virtual void dump(String8& result);
     virtual void setViewportAndProjection(size_t vpw, size_t vph,
             Rect sourceCrop, size_t hwh, bool yswap, Transform::orientation_flags rotation);
@@ -81,6 +152,9 @@ protected:
 #endif
 
     virtual void drawMesh(const Mesh& mesh);
+    virtual void beginBatch();
+    virtual void endBatch();
+    virtual void flushBatch();
 
     virtual void beginGroup(const mat4& colorTransform);
     virtual void endGroup();
@@ -20,7 +20,7 @@ namespace android {
 
 Mesh::Mesh(Primitive primitive, size_t vertexCount, size_t vertexSize, size_t texCoordSize)
     : mVertexCount(vertexCount), mVertexSize(vertexSize), mTexCoordsSize(texCoordSize),
-      mPrimitive(primitive)
+      mPrimitive(primitive), mGpuResident(false), mGeneration(0)
 {
     mVertices = new float[(vertexSize + texCoordSize) * vertexCount];
     mStride = mVertexSize + mTexCoordsSize;
@@ -70,4 +70,24 @@ size_t Mesh::getStride() const {
     return mStride;
 }
 
+void Mesh::setGpuResident(bool resident) {
+    mGpuResident = resident;
+}
+
+bool Mesh::isGpuResident() const {
+    return mGpuResident;
+}
+
+void Mesh::invalidate() {
+    mGeneration++;
+}
+
+uint32_t Mesh::getGeneration() const {
+    return mGeneration;
+}
+
+Mesh::BufferSlot& Mesh::getBufferSlot() const {
+    return mBufferSlot;
+}
+
 } /* namespace android */
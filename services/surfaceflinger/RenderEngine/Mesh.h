@@ -79,6 +79,33 @@ public:
     // return stride in floats
     size_t getStride() const;
 
+    /*
+     * GPU-resident meshes keep a copy of their vertices in the vertex buffer
+     * of the RenderEngine drawing them, which is only updated after
+     * invalidate() is called. Other meshes are uploaded on each draw.
+     */
+    void setGpuResident(bool resident);
+    bool isGpuResident() const;
+
+    // must be called after modifying the vertices of a GPU-resident mesh
+    void invalidate();
+
+    // incremented by invalidate()
+    uint32_t getGeneration() const;
+
+    /*
+     * Location of the vertices in the vertex buffer of a RenderEngine,
+     * managed by the RenderEngine.
+     */
+    struct BufferSlot {
+        BufferSlot() : owner(0), epoch(0), generation(0), offset(0) { }
+        const void* owner;
+        uint32_t epoch;
+        uint32_t generation;
+        size_t offset;
+    };
+    BufferSlot& getBufferSlot() const;
+
 private:
     Mesh(const Mesh&);
     Mesh& operator = (const Mesh&);
@@ -92,6 +119,9 @@ private:
     size_t mTexCoordsSize;
     size_t mStride;
     Primitive mPrimitive;
+    bool mGpuResident;
+    uint32_t mGeneration;
+    mutable BufferSlot mBufferSlot;
 };
 
 
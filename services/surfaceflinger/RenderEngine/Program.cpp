@@ -16,6 +16,9 @@
 
 #include <stdint.h>
 
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
 #include <log/log.h>
 
 #include "Program.h"
@@ -35,7 +38,19 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
     glBindAttribLocation(programId, position, "position");
     glBindAttribLocation(programId, texCoords, "texCoords");
     glLinkProgram(programId);
+    init(programId, vertexId, fragmentId);
+}
+
+Program::Program(const ProgramCache::Key& /*needs*/, GLenum binaryFormat,
+        const void* binary, GLsizei length)
+        : mInitialized(false) {
+    // attribute locations are part of the binary
+    GLuint programId = glCreateProgram();
+    glProgramBinaryOES(programId, binaryFormat, binary, length);
+    init(programId, 0, 0);
+}
 
+void Program::init(GLuint programId, GLuint vertexId, GLuint fragmentId) {
     GLint status;
     glGetProgramiv(programId, GL_LINK_STATUS, &status);
     if (status != GL_TRUE) {
@@ -47,10 +62,14 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
             glGetProgramInfoLog(programId, infoLen, 0, &log[0]);
             ALOGE("%s", log);
         }
-        glDetachShader(programId, vertexId);
-        glDetachShader(programId, fragmentId);
-        glDeleteShader(vertexId);
-        glDeleteShader(fragmentId);
+        if (vertexId) {
+            glDetachShader(programId, vertexId);
+            glDeleteShader(vertexId);
+        }
+        if (fragmentId) {
+            glDetachShader(programId, fragmentId);
+            glDeleteShader(fragmentId);
+        }
         glDeleteProgram(programId);
     } else {
         mProgram = programId;
@@ -74,6 +93,35 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
 }
 
 Program::~Program() {
+    if (mInitialized) {
+        glDeleteProgram(mProgram);
+        if (mVertexShader) {
+            glDeleteShader(mVertexShader);
+        }
+        if (mFragmentShader) {
+            glDeleteShader(mFragmentShader);
+        }
+    }
+}
+
+bool Program::getBinary(GLenum* binaryFormat, Vector<uint8_t>& binary) const {
+    if (!mInitialized) {
+        return false;
+    }
+    GLint length = 0;
+    glGetProgramiv(mProgram, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return false;
+    }
+    binary.resize(length);
+    GLsizei written = 0;
+    glGetProgramBinaryOES(mProgram, length, &written, binaryFormat,
+            binary.editArray());
+    if (written <= 0) {
+        return false;
+    }
+    binary.resize(written);
+    return true;
 }
 
 bool Program::isValid() const {
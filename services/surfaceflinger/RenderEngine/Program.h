@@ -21,6 +21,8 @@
 
 #include <GLES2/gl2.h>
 
+#include <utils/Vector.h>
+
 #include "Description.h"
 #include "ProgramCache.h"
 
@@ -37,8 +39,14 @@ public:
     enum { position=0, texCoords=1 };
 
     Program(const ProgramCache::Key& needs, const char* vertex, const char* fragment);
+    // creates the program from a binary returned by getBinary()
+    Program(const ProgramCache::Key& needs, GLenum binaryFormat,
+            const void* binary, GLsizei length);
     ~Program();
 
+    /* retrieves the program binary, with GL_OES_get_program_binary */
+    bool getBinary(GLenum* binaryFormat, Vector<uint8_t>& binary) const;
+
     /* whether this object is usable */
     bool isValid() const;
 
@@ -56,6 +64,8 @@ public:
 
 
 private:
+    // checks the link status and looks up the uniforms
+    void init(GLuint programId, GLuint vertexId, GLuint fragmentId);
     GLuint buildShader(const char* source, GLenum type);
     String8& dumpShader(String8& result, GLenum type);
 
@@ -14,14 +14,23 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <cutils/log.h>
+
 #include <utils/String8.h>
+#include <utils/Vector.h>
 
 #include "ProgramCache.h"
 #include "Program.h"
 #include "Description.h"
+#include "GLExtensions.h"
 
 namespace android {
 // -----------------------------------------------------------------------------------------------
@@ -75,23 +84,355 @@ Formatter& dedent(Formatter& f) {
 
 // -----------------------------------------------------------------------------------------------
 
+/*
+ * ProgramBinaryStore keeps the binaries of the programs generated by all
+ * the ProgramCaches of the process, and persists them on disk. The file
+ * is tagged with the GL vendor, renderer and version strings, so that
+ * binaries from another driver are never handed to glProgramBinaryOES().
+ */
+class ProgramBinaryStore : public Singleton<ProgramBinaryStore> {
+    friend class Singleton<ProgramBinaryStore>;
+
+    struct Binary {
+        GLenum format;
+        Vector<uint8_t> data;
+    };
+
+    enum {
+        FILE_MAGIC   = 0x53465043, // 'SFPC'
+        FILE_VERSION = 1,
+    };
+
+    class Saver;
+
+    mutable Mutex mLock;
+    // serializes the writes of the file, which happen without mLock
+    Mutex mSaveLock;
+    bool mInitialized;
+    bool mSupported;
+    bool mDirty;
+    bool mSaveScheduled;
+    String8 mDriver;
+    KeyedVector<ProgramCache::Key, Binary> mBinaries;
+    uint32_t mNumLoaded;
+    uint32_t mNumUsed;
+    uint32_t mNumRejected;
+
+    ProgramBinaryStore();
+
+    // must be called with a current EGLContext
+    void initLocked();
+    void loadLocked();
+
+public:
+    bool get(const ProgramCache::Key& needs, GLenum* format,
+            Vector<uint8_t>& data);
+    void put(const ProgramCache::Key& needs, GLenum format,
+            const Vector<uint8_t>& data);
+    // the driver refused a binary returned by get()
+    void reject(const ProgramCache::Key& needs);
+    bool isSupported();
+    // writes the binaries to disk if they changed since the last call
+    void save();
+    // does the same from a background thread
+    void scheduleSaveLocked();
+    void dump(String8& result) const;
+};
+
+// The directory is created by init and labeled for surfaceflinger only,
+// SurfaceFlinger can't write to /data/system.
+static const char* const PROGRAM_BINARY_FILE =
+        "/data/misc/surfaceflinger/program_cache";
+
+ANDROID_SINGLETON_STATIC_INSTANCE(ProgramBinaryStore)
+
+// Saves the binaries of programs generated after priming, so that they are
+// on disk for the next boot without stalling the frame that needed them.
+class ProgramBinaryStore::Saver : public Thread {
+public:
+    Saver() : Thread(false) { }
+private:
+    virtual bool threadLoop() {
+        ProgramBinaryStore::getInstance().save();
+        return false;
+    }
+};
+
+ProgramBinaryStore::ProgramBinaryStore()
+    : mInitialized(false), mSupported(false), mDirty(false),
+      mSaveScheduled(false), mNumLoaded(0), mNumUsed(0), mNumRejected(0) {
+}
+
+void ProgramBinaryStore::initLocked() {
+    if (mInitialized) {
+        return;
+    }
+    mInitialized = true;
+
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    GLint numFormats = 0;
+    if (extensions.hasExtension("GL_OES_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &numFormats);
+    }
+    mSupported = numFormats > 0;
+    if (!mSupported) {
+        return;
+    }
+    mDriver = String8::format("%s|%s|%s", extensions.getVendor(),
+            extensions.getRenderer(), extensions.getVersion());
+    loadLocked();
+}
+
+static bool readUint32(FILE* f, uint32_t* value) {
+    return fread(value, sizeof(uint32_t), 1, f) == 1;
+}
+
+static bool writeUint32(FILE* f, uint32_t value) {
+    return fwrite(&value, sizeof(uint32_t), 1, f) == 1;
+}
+
+void ProgramBinaryStore::loadLocked() {
+    FILE* f = fopen(PROGRAM_BINARY_FILE, "rb");
+    if (f == NULL) {
+        return;
+    }
+
+    uint32_t magic, version, length, count;
+    bool valid = readUint32(f, &magic) && magic == FILE_MAGIC &&
+            readUint32(f, &version) && version == FILE_VERSION &&
+            readUint32(f, &length) && length == mDriver.length();
+    if (valid) {
+        Vector<char> driver;
+        driver.resize(length);
+        valid = fread(driver.editArray(), 1, length, f) == length &&
+                !memcmp(driver.array(), mDriver.string(), length) &&
+                readUint32(f, &count);
+    }
+    if (!valid) {
+        ALOGI("discarding program binaries of another driver");
+        fclose(f);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t key, format;
+        if (!readUint32(f, &key) || !readUint32(f, &format) ||
+                !readUint32(f, &length) || length > 1024*1024) {
+            break;
+        }
+        Binary binary;
+        binary.format = format;
+        binary.data.resize(length);
+        if (fread(binary.data.editArray(), 1, length, f) != length) {
+            break;
+        }
+        ProgramCache::Key needs;
+        needs.set(~0u, key);
+        mBinaries.add(needs, binary);
+    }
+    fclose(f);
+    mNumLoaded = mBinaries.size();
+}
+
+bool ProgramBinaryStore::get(const ProgramCache::Key& needs, GLenum* format,
+        Vector<uint8_t>& data) {
+    Mutex::Autolock _l(mLock);
+    initLocked();
+    ssize_t index = mBinaries.indexOfKey(needs);
+    if (index < 0) {
+        return false;
+    }
+    const Binary& binary(mBinaries.valueAt(index));
+    *format = binary.format;
+    data = binary.data;
+    mNumUsed++;
+    return true;
+}
+
+void ProgramBinaryStore::put(const ProgramCache::Key& needs, GLenum format,
+        const Vector<uint8_t>& data) {
+    Mutex::Autolock _l(mLock);
+    Binary binary;
+    binary.format = format;
+    binary.data = data;
+    mBinaries.add(needs, binary);
+    mDirty = true;
+    scheduleSaveLocked();
+}
+
+void ProgramBinaryStore::scheduleSaveLocked() {
+    if (mSaveScheduled) {
+        return;
+    }
+    mSaveScheduled = true;
+    sp<Saver> saver(new Saver());
+    if (saver->run("ProgramBinarySaver", PRIORITY_BACKGROUND) != NO_ERROR) {
+        mSaveScheduled = false;
+    }
+}
+
+void ProgramBinaryStore::reject(const ProgramCache::Key& needs) {
+    Mutex::Autolock _l(mLock);
+    mBinaries.removeItem(needs);
+    mNumUsed--;
+    mNumRejected++;
+    mDirty = true;
+}
+
+bool ProgramBinaryStore::isSupported() {
+    Mutex::Autolock _l(mLock);
+    initLocked();
+    return mSupported;
+}
+
+void ProgramBinaryStore::save() {
+    Mutex::Autolock _s(mSaveLock);
+    String8 driver;
+    KeyedVector<ProgramCache::Key, Binary> binaries;
+    {
+        // snapshot the binaries, their data isn't copied
+        Mutex::Autolock _l(mLock);
+        mSaveScheduled = false;
+        if (!mSupported || !mDirty) {
+            return;
+        }
+        mDirty = false;
+        driver = mDriver;
+        binaries = mBinaries;
+    }
+
+    // write a new file and rename it, so that a crash never leaves a
+    // truncated one behind
+    String8 path(PROGRAM_BINARY_FILE);
+    path.append(".tmp");
+    FILE* f = fopen(path.string(), "wb");
+    if (f == NULL) {
+        ALOGW("can't open %s (%s)", path.string(), strerror(errno));
+        return;
+    }
+    bool success = writeUint32(f, FILE_MAGIC) &&
+            writeUint32(f, FILE_VERSION) &&
+            writeUint32(f, driver.length()) &&
+            fwrite(driver.string(), 1, driver.length(), f) ==
+                    driver.length() &&
+            writeUint32(f, binaries.size());
+    for (size_t i = 0; success && i < binaries.size(); i++) {
+        const Binary& binary(binaries.valueAt(i));
+        success = writeUint32(f, binaries.keyAt(i).get()) &&
+                writeUint32(f, binary.format) &&
+                writeUint32(f, binary.data.size()) &&
+                fwrite(binary.data.array(), 1, binary.data.size(), f) ==
+                        binary.data.size();
+    }
+    if (fclose(f) != 0) {
+        success = false;
+    }
+    if (!success || rename(path.string(), PROGRAM_BINARY_FILE) != 0) {
+        ALOGW("can't write %s (%s)", PROGRAM_BINARY_FILE, strerror(errno));
+        unlink(path.string());
+    }
+}
+
+void ProgramBinaryStore::dump(String8& result) const {
+    Mutex::Autolock _l(mLock);
+    if (!mSupported) {
+        result.append("  program binaries: not supported\n");
+        return;
+    }
+    result.appendFormat("  program binaries: %zu stored, %u loaded from disk, "
+            "%u used, %u rejected by the driver\n",
+            mBinaries.size(), mNumLoaded, mNumUsed, mNumRejected);
+}
+
+// -----------------------------------------------------------------------------------------------
+
+/*
+ * Primer generates the programs of a ProgramCache with its own EGLContext,
+ * so that SurfaceFlinger doesn't wait for the shader compiler during boot.
+ */
+class ProgramCache::Primer : public Thread {
+    ProgramCache& mCache;
+    EGLDisplay mDisplay;
+    EGLConfig mContextConfig;
+    EGLConfig mSurfaceConfig;
+    EGLContext mShareContext;
+    EGLContext mContext;
+    EGLSurface mSurface;
+
+    virtual status_t readyToRun() {
+        EGLint contextAttributes[] = {
+                EGL_CONTEXT_CLIENT_VERSION, 2,
+                EGL_NONE
+        };
+        mContext = eglCreateContext(mDisplay, mContextConfig, mShareContext,
+                contextAttributes);
+        if (mContext == EGL_NO_CONTEXT) {
+            ALOGW("can't create the shader cache EGLContext (0x%04x)",
+                    eglGetError());
+            return UNKNOWN_ERROR;
+        }
+        EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        mSurface = eglCreatePbufferSurface(mDisplay, mSurfaceConfig, attribs);
+        if (mSurface == EGL_NO_SURFACE ||
+                !eglMakeCurrent(mDisplay, mSurface, mSurface, mContext)) {
+            ALOGW("can't make the shader cache EGLContext current (0x%04x)",
+                    eglGetError());
+            tearDown();
+            return UNKNOWN_ERROR;
+        }
+        return NO_ERROR;
+    }
+
+    virtual bool threadLoop() {
+        mCache.primeCache();
+        tearDown();
+        return false;
+    }
+
+    void tearDown() {
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (mSurface != EGL_NO_SURFACE) {
+            eglDestroySurface(mDisplay, mSurface);
+            mSurface = EGL_NO_SURFACE;
+        }
+        if (mContext != EGL_NO_CONTEXT) {
+            // the programs outlive the context, they belong to its share group
+            eglDestroyContext(mDisplay, mContext);
+            mContext = EGL_NO_CONTEXT;
+        }
+    }
+
+public:
+    Primer(ProgramCache& cache, EGLDisplay display, EGLConfig contextConfig,
+            EGLConfig surfaceConfig, EGLContext shareContext)
+        : Thread(false), mCache(cache), mDisplay(display),
+          mContextConfig(contextConfig), mSurfaceConfig(surfaceConfig),
+          mShareContext(shareContext), mContext(EGL_NO_CONTEXT),
+          mSurface(EGL_NO_SURFACE) {
+    }
+};
+
+// -----------------------------------------------------------------------------------------------
+
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
-    // Until surfaceflinger has a dependable blob cache on the filesystem,
-    // generate shaders on initialization so as to avoid jank.
-    primeCache();
+ProgramCache::ProgramCache()
+    : mNumPrimed(0), mPrimeTime(0), mPrimedAsync(false), mMaxStall(0) {
+    memset(mStallHistogram, 0, sizeof(mStallHistogram));
 }
 
 ProgramCache::~ProgramCache() {
+    if (mPrimer != NULL) {
+        mPrimer->requestExitAndWait();
+    }
 }
 
 void ProgramCache::primeCache() {
     uint32_t shaderCount = 0;
-    uint32_t keyMask = Key::BLEND_MASK | Key::OPACITY_MASK |
-                       Key::PLANE_ALPHA_MASK | Key::TEXTURE_MASK;
-    // Prime the cache for all combinations of the above masks,
-    // leaving off the experimental color matrix mask options.
+    const uint32_t keyMask = Key::BLEND_MASK | Key::OPACITY_MASK |
+            Key::PLANE_ALPHA_MASK | Key::TEXTURE_MASK |
+            Key::COLOR_MATRIX_MASK;
+    // Prime the cache for all combinations of the above masks.
 
     nsecs_t timeBefore = systemTime();
     for (uint32_t keyVal = 0; keyVal <= keyMask; keyVal++) {
@@ -103,18 +444,52 @@ void ProgramCache::primeCache() {
             tex != Key::TEXTURE_2D) {
             continue;
         }
-        Program* program = mCache.valueFor(shaderKey);
-        if (program == NULL) {
-            program = generateProgram(shaderKey);
-            mCache.add(shaderKey, program);
+        {
+            Mutex::Autolock _l(mLock);
+            if (mCache.indexOfKey(shaderKey) >= 0) {
+                continue;
+            }
+        }
+        Program* program = generateProgram(shaderKey);
+        // the program must be complete before another context uses it
+        glFinish();
+        if (addProgram(shaderKey, program) == program) {
             shaderCount++;
         }
     }
+    ProgramBinaryStore::getInstance().save();
     nsecs_t timeAfter = systemTime();
-    float compileTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
+
+    Mutex::Autolock _l(mLock);
+    mNumPrimed = shaderCount;
+    mPrimeTime = timeAfter - timeBefore;
+    float compileTimeMs = static_cast<float>(mPrimeTime) / 1.0E6;
     ALOGD("shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
 }
 
+void ProgramCache::primeCacheAsync(EGLDisplay display, EGLConfig contextConfig,
+        EGLConfig surfaceConfig, EGLContext shareContext) {
+    if (mPrimer != NULL) {
+        return;
+    }
+    mPrimedAsync = true;
+    mPrimer = new Primer(*this, display, contextConfig, surfaceConfig,
+            shareContext);
+    mPrimer->run("ProgramCache", PRIORITY_BACKGROUND);
+}
+
+Program* ProgramCache::addProgram(const Key& needs, Program* program) {
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mCache.indexOfKey(needs);
+    if (index >= 0) {
+        // another thread generated the same program in the meantime
+        delete program;
+        return mCache.valueAt(index);
+    }
+    mCache.add(needs, program);
+    return program;
+}
+
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
     Key needs;
     needs.set(Key::TEXTURE_MASK,
@@ -214,6 +589,20 @@ String8 ProgramCache::generateFragmentShader(const Key& needs) {
 }
 
 Program* ProgramCache::generateProgram(const Key& needs) {
+    ProgramBinaryStore& store(ProgramBinaryStore::getInstance());
+    GLenum format;
+    Vector<uint8_t> binary;
+    if (store.get(needs, &format, binary)) {
+        Program* program = new Program(needs, format,
+                binary.array(), binary.size());
+        if (program->isValid()) {
+            return program;
+        }
+        // the driver was updated without changing its version strings
+        delete program;
+        store.reject(needs);
+    }
+
     // vertex shader
     String8 vs = generateVertexShader(needs);
 
@@ -221,6 +610,10 @@ Program* ProgramCache::generateProgram(const Key& needs) {
     String8 fs = generateFragmentShader(needs);
 
     Program* program = new Program(needs, vs.string(), fs.string());
+    if (program->isValid() && store.isSupported() &&
+            program->getBinary(&format, binary)) {
+        store.put(needs, format, binary);
+    }
     return program;
 }
 
@@ -230,16 +623,28 @@ void ProgramCache::useProgram(const Description& description) {
     Key needs(computeKey(description));
 
      // look-up the program in the cache
-    Program* program = mCache.valueFor(needs);
+    Program* program;
+    {
+        Mutex::Autolock _l(mLock);
+        program = mCache.valueFor(needs);
+    }
     if (program == NULL) {
         // we didn't find our program, so generate one...
         nsecs_t time = -systemTime();
-        program = generateProgram(needs);
-        mCache.add(needs, program);
+        program = addProgram(needs, generateProgram(needs));
         time += systemTime();
 
-        //ALOGD(">>> generated new program: needs=%08X, time=%u ms (%d programs)",
-        //        needs.mNeeds, uint32_t(ns2ms(time)), mCache.size());
+        // ...and remember how long this frame was stalled
+        Mutex::Autolock _l(mLock);
+        size_t bucket = 0;
+        while (bucket < NUM_STALL_BUCKETS - 1 &&
+                ns2ms(time) >= (1 << bucket)) {
+            bucket++;
+        }
+        mStallHistogram[bucket]++;
+        if (time > mMaxStall) {
+            mMaxStall = time;
+        }
     }
 
     // here we have a suitable program for this description
@@ -249,5 +654,31 @@ void ProgramCache::useProgram(const Description& description) {
     }
 }
 
+void ProgramCache::dump(String8& result) const {
+    Mutex::Autolock _l(mLock);
+    result.appendFormat("ProgramCache: %zu programs, %u primed in %.2f ms%s\n",
+            mCache.size(), mNumPrimed, mPrimeTime / 1.0E6,
+            mPrimedAsync ? " (background)" : "");
+    uint32_t numStalls = 0;
+    for (size_t i = 0; i < NUM_STALL_BUCKETS; i++) {
+        numStalls += mStallHistogram[i];
+    }
+    result.appendFormat("  first-use stalls: %u (max %.2f ms)\n",
+            numStalls, mMaxStall / 1.0E6);
+    if (numStalls) {
+        result.append("   ");
+        for (size_t i = 0; i < NUM_STALL_BUCKETS; i++) {
+            if (i < NUM_STALL_BUCKETS - 1) {
+                result.appendFormat(" <%dms: %u", 1 << i, mStallHistogram[i]);
+            } else {
+                result.appendFormat(" >=%dms: %u", 1 << (i - 1),
+                        mStallHistogram[i]);
+            }
+        }
+        result.append("\n");
+    }
+    ProgramBinaryStore::getInstance().dump(result);
+}
+
 
 } /* namespace android */
@@ -17,10 +17,14 @@
 #ifndef SF_RENDER_ENGINE_PROGRAMCACHE_H
 #define SF_RENDER_ENGINE_PROGRAMCACHE_H
 
+#include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
 #include <utils/TypeHelpers.h>
 
 #include "Description.h"
@@ -36,6 +40,12 @@ class String8;
  * Description. It's responsible for figuring out what to
  * generate from a Description.
  * It also maintains a cache of these Programs.
+ *
+ * The cache can be primed with every valid Key on a background thread,
+ * using an EGLContext which shares its objects with the one used for
+ * composition. Programs compiled during a frame are recorded as first-use
+ * stalls. When GL_OES_get_program_binary is supported, program binaries
+ * are stored on disk so that later boots don't need to compile shaders.
  */
 class ProgramCache : public Singleton<ProgramCache> {
 public:
@@ -79,6 +89,10 @@ public:
             return *this;
         }
 
+        inline key_t get() const {
+            return mKey;
+        }
+
         inline bool isTexturing() const {
             return (mKey & TEXTURE_MASK) != TEXTURE_OFF;
         }
@@ -111,21 +125,50 @@ public:
     // if none can be found.
     void useProgram(const Description& description);
 
-private:
-    // Generate shaders to populate the cache
+    // primeCache generates the programs of all the valid Keys with the
+    // current EGLContext.
     void primeCache();
+
+    // primeCacheAsync does the same from a background thread, with a new
+    // EGLContext sharing its objects with shareContext. surfaceConfig is
+    // used for the pbuffer the thread needs to make its context current.
+    void primeCacheAsync(EGLDisplay display, EGLConfig contextConfig,
+            EGLConfig surfaceConfig, EGLContext shareContext);
+
+    void dump(String8& result) const;
+
+private:
+    class Primer;
+
+    // histogram of the time spent generating programs in useProgram
+    enum { NUM_STALL_BUCKETS = 8 };
+
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
-    // generates a program from the Key
+    // generates a program from the Key, from its binary when available
     static Program* generateProgram(const Key& needs);
     // generates the vertex shader from the Key
     static String8 generateVertexShader(const Key& needs);
     // generates the fragment shader from the Key
     static String8 generateFragmentShader(const Key& needs);
 
+    // adds a program generated outside of mLock, returns the one to use
+    Program* addProgram(const Key& needs, Program* program);
+
+    // protects mCache and the statistics below, the programs themselves
+    // are only used by the thread owning the cache
+    mutable Mutex mLock;
+
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+
+    sp<Thread> mPrimer;
+    uint32_t mNumPrimed;
+    nsecs_t mPrimeTime;
+    bool mPrimedAsync;
+    uint32_t mStallHistogram[NUM_STALL_BUCKETS];
+    nsecs_t mMaxStall;
 };
 
 
@@ -46,7 +46,8 @@ static bool findExtension(const char* exts, const char* name) {
     return false;
 }
 
-RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
+RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat,
+        EGLContext shareContext) {
     // EGL_ANDROIDX_no_config_context is an experimental extension with no
     // written specification. It will be replaced by something more formal.
     // SurfaceFlinger is using it to allow a single EGLContext to render to
@@ -89,7 +90,14 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
 #endif
             EGL_NONE, EGL_NONE
     };
-    EGLContext ctxt = eglCreateContext(display, config, NULL, contextAttributes);
+    EGLContext ctxt = eglCreateContext(display, config, shareContext,
+            contextAttributes);
+
+    // a shared context is optional, let the caller deal with it
+    if (ctxt == EGL_NO_CONTEXT && shareContext != EGL_NO_CONTEXT) {
+        ALOGE("shared EGLContext creation failed (0x%04x)", eglGetError());
+        return NULL;
+    }
 
     // if can't create a GL context, we can only abort.
     LOG_ALWAYS_FATAL_IF(ctxt==EGL_NO_CONTEXT, "EGLContext creation failed");
@@ -102,18 +110,35 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
     if (dummyConfig == EGL_NO_CONFIG) {
         dummyConfig = chooseEglConfig(display, hwcFormat);
     }
-    EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE, EGL_NONE };
-    EGLSurface dummy = eglCreatePbufferSurface(display, dummyConfig, attribs);
-    LOG_ALWAYS_FATAL_IF(dummy==EGL_NO_SURFACE, "can't create dummy pbuffer");
+    EGLSurface dummy = EGL_NO_SURFACE;
+#ifdef HEADLESS_DISPLAY
+    // some headless EGL implementations have no pbuffers, with
+    // EGL_KHR_surfaceless_context the context is made current without a
+    // surface instead.
+    const bool surfaceless = findExtension(
+            eglQueryStringImplementationANDROID(display, EGL_EXTENSIONS),
+            "EGL_KHR_surfaceless_context");
+#else
+    const bool surfaceless = false;
+#endif
+    if (!surfaceless) {
+        EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE, EGL_NONE };
+        dummy = eglCreatePbufferSurface(display, dummyConfig, attribs);
+        LOG_ALWAYS_FATAL_IF(dummy==EGL_NO_SURFACE, "can't create dummy pbuffer");
+    }
     EGLBoolean success = eglMakeCurrent(display, dummy, dummy, ctxt);
-    LOG_ALWAYS_FATAL_IF(!success, "can't make dummy pbuffer current");
+    LOG_ALWAYS_FATAL_IF(!success, "can't make dummy surface current");
 
+    // shared contexts are created from other threads once the strings
+    // of the main context are known, don't modify them under their feet.
     GLExtensions& extensions(GLExtensions::getInstance());
-    extensions.initWithGLStrings(
-            glGetString(GL_VENDOR),
-            glGetString(GL_RENDERER),
-            glGetString(GL_VERSION),
-            glGetString(GL_EXTENSIONS));
+    if (shareContext == EGL_NO_CONTEXT) {
+        extensions.initWithGLStrings(
+                glGetString(GL_VENDOR),
+                glGetString(GL_RENDERER),
+                glGetString(GL_VERSION),
+                glGetString(GL_EXTENSIONS));
+    }
 
     GlesVersion version = parseGlesVersion( extensions.getVersion() );
 
@@ -129,11 +154,20 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
         break;
     case GLES_VERSION_2_0:
     case GLES_VERSION_3_0:
-        engine = new GLES20RenderEngine();
+        // uniforms are part of the program objects, which are shared with
+        // shareContext: give each context its own programs.
+        engine = new GLES20RenderEngine(shareContext != EGL_NO_CONTEXT);
         break;
     }
     engine->setEGLHandles(config, ctxt);
 
+    // The main context compiles its shaders in the background. Shared
+    // contexts are created while a composition worker starts or a screenshot
+    // is taken, they generate their programs on demand instead.
+    if (shareContext == EGL_NO_CONTEXT) {
+        engine->primeCache(display, dummyConfig);
+    }
+
     ALOGI("OpenGL ES informations:");
     ALOGI("vendor    : %s", extensions.getVendor());
     ALOGI("renderer  : %s", extensions.getRenderer());
@@ -143,7 +177,9 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
     ALOGI("GL_MAX_VIEWPORT_DIMS = %zu", engine->getMaxViewportDims());
 
     eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    eglDestroySurface(display, dummy);
+    if (dummy != EGL_NO_SURFACE) {
+        eglDestroySurface(display, dummy);
+    }
 
     return engine;
 }
@@ -159,6 +195,19 @@ void RenderEngine::setEGLHandles(EGLConfig config, EGLContext ctxt) {
     mEGLContext = ctxt;
 }
 
+void RenderEngine::primeCache(EGLDisplay /*display*/,
+        EGLConfig /*surfaceConfig*/) {
+}
+
+void RenderEngine::beginBatch() {
+}
+
+void RenderEngine::endBatch() {
+}
+
+void RenderEngine::flushBatch() {
+}
+
 EGLContext RenderEngine::getEGLConfig() const {
     return mEGLConfig;
 }
@@ -220,21 +269,25 @@ void RenderEngine::fillRegionWithColor(const Region& region, uint32_t height,
 }
 
 void RenderEngine::flush() {
+    flushBatch();
     glFlush();
 }
 
 void RenderEngine::clearWithColor(float red, float green, float blue, float alpha) {
+    flushBatch();
     glClearColor(red, green, blue, alpha);
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void RenderEngine::setScissor(
         uint32_t left, uint32_t bottom, uint32_t right, uint32_t top) {
+    flushBatch();
     glScissor(left, bottom, right, top);
     glEnable(GL_SCISSOR_TEST);
 }
 
 void RenderEngine::disableScissor() {
+    flushBatch();
     glDisable(GL_SCISSOR_TEST);
 }
 
@@ -243,10 +296,12 @@ void RenderEngine::genTextures(size_t count, uint32_t* names) {
 }
 
 void RenderEngine::deleteTextures(size_t count, uint32_t const* names) {
+    flushBatch();
     glDeleteTextures(count, names);
 }
 
 void RenderEngine::readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels) {
+    flushBatch();
     glReadPixels(l, b, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
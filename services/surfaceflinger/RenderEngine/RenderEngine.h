@@ -58,11 +58,24 @@ protected:
     RenderEngine();
     virtual ~RenderEngine() = 0;
 
+    // draws the meshes batched so far. must be called before any GL call
+    // that can change how they are rendered.
+    virtual void flushBatch();
+
 public:
-    static RenderEngine* create(EGLDisplay display, int hwcFormat);
+    // creates a RenderEngine and its EGLContext. If shareContext is not
+    // EGL_NO_CONTEXT, the new context shares its textures with it and NULL
+    // is returned if it can't be created.
+    static RenderEngine* create(EGLDisplay display, int hwcFormat,
+            EGLContext shareContext = EGL_NO_CONTEXT);
 
     static EGLConfig chooseEglConfig(EGLDisplay display, int format);
 
+    // generates the programs needed by this engine ahead of time, from a
+    // background thread. surfaceConfig is a pbuffer config compatible with
+    // our EGLContext.
+    virtual void primeCache(EGLDisplay display, EGLConfig surfaceConfig);
+
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
 
@@ -111,6 +124,12 @@ public:
     // drawing
     virtual void drawMesh(const Mesh& mesh) = 0;
 
+    // batching
+    // between beginBatch() and endBatch(), consecutive meshes drawn with the
+    // same state may be merged and drawn with a single draw call.
+    virtual void beginBatch();
+    virtual void endBatch();
+
     // grouping
     // creates a color-transform group, everything drawn in the group will be
     // transformed by the given color transform when endGroup() is called.
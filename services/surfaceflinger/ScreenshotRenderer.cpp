@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <string.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <cutils/log.h>
+
+#include <private/gui/SyncFeatures.h>
+
+#include <utils/Trace.h>
+
+#include "ScreenshotRenderer.h"
+#include "SurfaceFlingerConsumer.h"
+
+#include "RenderEngine/Mesh.h"
+#include "RenderEngine/RenderEngine.h"
+#include "RenderEngine/Texture.h"
+
+namespace android {
+
+// The layers' buffers are pinned while we render, and a layer can't latch
+// a new buffer until they're unpinned: don't wait for their producers for
+// longer than this.
+static const unsigned int ACQUIRE_FENCE_TIMEOUT_MS = 500;
+
+// ---------------------------------------------------------------------------
+
+LayerSnapshot::LayerSnapshot()
+    :   type(BUFFER),
+        filtering(false),
+        premultipliedAlpha(false),
+        opaque(false),
+        alpha(0xFF) {
+    memset(textureMatrix, 0, sizeof(textureMatrix));
+}
+
+// ---------------------------------------------------------------------------
+
+ScreenSnapshot::ScreenSnapshot()
+    :   reqWidth(0),
+        reqHeight(0),
+        hwHeight(0),
+        rotation(Transform::ROT_0) {
+}
+
+ScreenSnapshot::~ScreenSnapshot() {
+    // the rendering failed before anything was submitted, or the caller
+    // already did this.
+    unpinBuffers(Fence::NO_FENCE);
+}
+
+void ScreenSnapshot::unpinBuffers(const sp<Fence>& fence) {
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        LayerSnapshot& layer(layers.editItemAt(i));
+        if (layer.consumer != NULL) {
+            layer.consumer->unpinBuffer(layer.buffer, fence);
+            layer.consumer.clear();
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+ScreenshotRenderer* ScreenshotRenderer::create(EGLDisplay display,
+        int hwcFormat, EGLContext shareContext) {
+    EGLConfig config = RenderEngine::chooseEglConfig(display, hwcFormat);
+    EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, attribs);
+    if (surface == EGL_NO_SURFACE) {
+        ALOGE("can't create screenshot pbuffer (0x%04x)", eglGetError());
+        return NULL;
+    }
+
+    RenderEngine* engine = RenderEngine::create(display, hwcFormat,
+            shareContext);
+    if (engine == NULL) {
+        eglDestroySurface(display, surface);
+        return NULL;
+    }
+    return new ScreenshotRenderer(display, surface, engine);
+}
+
+ScreenshotRenderer::ScreenshotRenderer(EGLDisplay display, EGLSurface surface,
+        RenderEngine* engine)
+    :   mEGLDisplay(display),
+        mEGLSurface(surface),
+        mEngine(engine) {
+}
+
+status_t ScreenshotRenderer::render(const ScreenSnapshot& snapshot,
+        ANativeWindowBuffer* buffer, sp<Fence>* outFence) {
+    ATRACE_CALL();
+    *outFence = Fence::NO_FENCE;
+
+    if (!eglMakeCurrent(mEGLDisplay, mEGLSurface, mEGLSurface,
+            mEngine->getEGLContext())) {
+        ALOGE("can't make the screenshot context current (0x%04x)",
+                eglGetError());
+        return INVALID_OPERATION;
+    }
+
+    // create an EGLImage from the buffer so we can later
+    // turn it into a texture
+    EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
+    if (image == EGL_NO_IMAGE_KHR) {
+        eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                EGL_NO_CONTEXT);
+        return BAD_VALUE;
+    }
+
+    const size_t count = snapshot.layers.size();
+    Vector<uint32_t> texNames;
+    texNames.resize(count);
+    if (count) {
+        mEngine->genTextures(count, texNames.editArray());
+    }
+    Vector<EGLImageKHR> layerImages;
+
+    status_t result = NO_ERROR;
+    { // scope for imageBond
+        // this binds the given EGLImage as a framebuffer for the
+        // duration of this scope.
+        RenderEngine::BindImageAsFramebuffer imageBond(*mEngine, image);
+        if (imageBond.getStatus() == NO_ERROR) {
+            mEngine->checkErrors();
+            mEngine->setViewportAndProjection(snapshot.reqWidth,
+                    snapshot.reqHeight, snapshot.sourceCrop,
+                    snapshot.hwHeight, true, snapshot.rotation);
+            mEngine->disableTexturing();
+
+            // redraw the screen entirely...
+            mEngine->clearWithColor(0, 0, 0, 1);
+
+            for (size_t i=0 ; i<count ; i++) {
+                const LayerSnapshot& layer(snapshot.layers[i]);
+                if (layer.type == LayerSnapshot::BUFFER) {
+                    // we're on the caller's thread, it can wait
+                    if (layer.acquireFence != NULL &&
+                            layer.acquireFence->wait(ACQUIRE_FENCE_TIMEOUT_MS)
+                            != NO_ERROR) {
+                        ALOGE("layer %zu not ready after %u ms, giving up "
+                                "on the screenshot", i,
+                                ACQUIRE_FENCE_TIMEOUT_MS);
+                        result = TIMED_OUT;
+                        break;
+                    }
+                    EGLint attrs[] = {
+                        EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE,
+                    };
+                    EGLImageKHR layerImage = eglCreateImageKHR(mEGLDisplay,
+                            EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID,
+                            layer.buffer->getNativeBuffer(), attrs);
+                    if (layerImage == EGL_NO_IMAGE_KHR) {
+                        ALOGW("can't create an EGLImage for layer %zu "
+                                "(0x%04x)", i, eglGetError());
+                        continue;
+                    }
+                    layerImages.add(layerImage);
+                    glBindTexture(GL_TEXTURE_EXTERNAL_OES, texNames[i]);
+                    glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES,
+                            static_cast<GLeglImageOES>(layerImage));
+                }
+                drawLayer(layer, texNames[i]);
+            }
+
+            // the caller queues the buffer with this fence rather than
+            // waiting for the GPU to be done.
+            if (SyncFeatures::getInstance().useNativeFenceSync()) {
+                EGLSyncKHR sync = eglCreateSyncKHR(mEGLDisplay,
+                        EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+                // native fence fd will not be populated until flush() is done.
+                mEngine->flush();
+                if (sync != EGL_NO_SYNC_KHR) {
+                    int fenceFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+                    eglDestroySyncKHR(mEGLDisplay, sync);
+                    if (fenceFd != EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                        *outFence = new Fence(fenceFd);
+                    }
+                }
+            }
+            if (!(*outFence)->isValid()) {
+                ALOGW_IF(SyncFeatures::getInstance().useNativeFenceSync(),
+                        "can't create a screenshot fence (0x%04x)",
+                        eglGetError());
+                glFinish();
+            }
+        } else {
+            ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
+            result = INVALID_OPERATION;
+        }
+    }
+
+    // these are only destroyed once the GPU is done with them
+    if (count) {
+        mEngine->deleteTextures(count, texNames.array());
+    }
+    for (size_t i=0 ; i<layerImages.size() ; i++) {
+        eglDestroyImageKHR(mEGLDisplay, layerImages[i]);
+    }
+    eglDestroyImageKHR(mEGLDisplay, image);
+
+    eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+            EGL_NO_CONTEXT);
+    return result;
+}
+
+void ScreenshotRenderer::drawLayer(const LayerSnapshot& layer,
+        uint32_t texName) {
+    if (layer.type == LayerSnapshot::DIM) {
+        Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2);
+        Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+        for (size_t i=0 ; i<4 ; i++) {
+            position[i] = layer.positions[i];
+        }
+        mEngine->setupDimLayerBlending(layer.alpha);
+        mEngine->drawMesh(mesh);
+        mEngine->disableBlending();
+        return;
+    }
+
+    Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    Mesh::VertexArray<vec2> texCoords(mesh.getTexCoordArray<vec2>());
+    for (size_t i=0 ; i<4 ; i++) {
+        position[i] = layer.positions[i];
+        texCoords[i] = layer.texCoords[i];
+    }
+
+    if (layer.type == LayerSnapshot::BUFFER) {
+        Texture texture(Texture::TEXTURE_EXTERNAL, texName);
+        texture.setDimensions(layer.buffer->getWidth(),
+                layer.buffer->getHeight());
+        texture.setFiltering(layer.filtering);
+        texture.setMatrix(layer.textureMatrix);
+        mEngine->setupLayerTexturing(texture);
+    } else {
+        mEngine->setupLayerBlackedOut();
+    }
+    mEngine->setupLayerBlending(layer.premultipliedAlpha, layer.opaque,
+            layer.alpha);
+    mEngine->drawMesh(mesh);
+    mEngine->disableBlending();
+    mEngine->disableTexturing();
+}
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
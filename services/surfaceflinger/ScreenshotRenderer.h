@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SCREENSHOT_RENDERER_H
+#define ANDROID_SCREENSHOT_RENDERER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <ui/Fence.h>
+#include <ui/GraphicBuffer.h>
+#include <ui/Rect.h>
+#include <ui/vec2.h>
+
+#include <utils/StrongPointer.h>
+#include <utils/Vector.h>
+
+#include "Transform.h"
+
+struct ANativeWindowBuffer;
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+class RenderEngine;
+class SurfaceFlingerConsumer;
+
+// LayerSnapshot holds what's needed to draw a layer as it was when the
+// snapshot was taken, see Layer::snapshot().
+struct LayerSnapshot {
+    enum Type {
+        // the layer's buffer
+        BUFFER,
+        // a secure or protected layer, drawn in black
+        BLACKED_OUT,
+        // a LayerDim
+        DIM,
+    };
+
+    LayerSnapshot();
+
+    Type type;
+    // see Layer::computeGeometry()
+    vec2 positions[4];
+    vec2 texCoords[4];
+    float textureMatrix[16];
+    bool filtering;
+    bool premultipliedAlpha;
+    bool opaque;
+    int alpha;
+
+    // for BUFFER snapshots, the buffer stays pinned in consumer until
+    // ScreenSnapshot::unpinBuffers() is called.
+    sp<GraphicBuffer> buffer;
+    sp<Fence> acquireFence;
+    sp<SurfaceFlingerConsumer> consumer;
+};
+
+// ScreenSnapshot is what SurfaceFlinger::captureScreen() needs to render a
+// display, taken on the main thread.
+struct ScreenSnapshot {
+    ScreenSnapshot();
+    ~ScreenSnapshot();
+
+    // unpinBuffers lets the layers release the buffers of the snapshot once
+    // fence signals. Must be called once the rendering was submitted.
+    void unpinBuffers(const sp<Fence>& fence);
+
+    Rect sourceCrop;
+    uint32_t reqWidth;
+    uint32_t reqHeight;
+    uint32_t hwHeight;
+    Transform::orientation_flags rotation;
+    Vector<LayerSnapshot> layers;
+
+private:
+    ScreenSnapshot(const ScreenSnapshot&);
+    ScreenSnapshot& operator = (const ScreenSnapshot&);
+};
+
+// ScreenshotRenderer renders screen snapshots with its own EGLContext,
+// which shares textures with the main one. It can be used from any thread,
+// but only by one thread at a time. Like the RenderEngines of the
+// CompositionWorkers, renderers live as long as SurfaceFlinger.
+class ScreenshotRenderer {
+public:
+    // returns NULL if the EGLContext can't be created
+    static ScreenshotRenderer* create(EGLDisplay display, int hwcFormat,
+            EGLContext shareContext);
+
+    // render draws snapshot into buffer. outFence signals when the
+    // rendering is done, it is Fence::NO_FENCE if it already is. Gives up
+    // with TIMED_OUT if a layer's buffer isn't ready within half a second.
+    status_t render(const ScreenSnapshot& snapshot,
+            ANativeWindowBuffer* buffer, sp<Fence>* outFence);
+
+private:
+    ScreenshotRenderer(EGLDisplay display, EGLSurface surface,
+            RenderEngine* engine);
+
+    void drawLayer(const LayerSnapshot& layer, uint32_t texName);
+
+    EGLDisplay mEGLDisplay;
+    // a 1x1 pbuffer to make our context current with, we only render
+    // into FBOs.
+    EGLSurface mEGLSurface;
+    RenderEngine* mEngine;
+};
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_SCREENSHOT_RENDERER_H
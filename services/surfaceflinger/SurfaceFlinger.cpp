@@ -67,6 +67,8 @@
 #include "EventThread.h"
 #include "Layer.h"
 #include "LayerDim.h"
+#include "PrelatchThread.h"
+#include "ScreenshotRenderer.h"
 #include "SurfaceFlinger.h"
 
 #include "DisplayHardware/FramebufferSurface.h"
@@ -141,6 +143,12 @@ SurfaceFlinger::SurfaceFlinger()
         mTransactionPending(false),
         mAnimTransactionPending(false),
         mLayersRemoved(false),
+        mQueueClientStates(false),
+        mNumQueuedTransactions(0),
+        mNumLockedTransactions(0),
+        mNumContendedTransactions(0),
+        mTotalStateLockWait(0),
+        mMaxStateLockWait(0),
         mRepaintEverything(0),
         mRenderEngine(NULL),
         mBootTime(systemTime()),
@@ -157,6 +165,17 @@ SurfaceFlinger::SurfaceFlinger()
         mLastTransactionTime(0),
         mBootFinished(false),
         mGpuTileRenderEnable(false),
+        mIncrementalVisibleRegions(false),
+        mNumCompositionWorkers(0),
+        mBatchDraws(false),
+        mPartialUpdates(false),
+        mPrelatch(false),
+        mFrameHistoryDepth(FrameTracker::NUM_FRAME_RECORDS),
+        mAsyncScreenshots(false),
+        mNumScreenshotRenderers(0),
+        mScreenshotRendererFailed(false),
+        mNumAsyncScreenshots(0),
+        mTotalScreenshotSnapshotTime(0),
         mPrimaryHWVsyncEnabled(false),
         mHWVsyncAvailable(false),
         mDaltonize(false),
@@ -173,6 +192,33 @@ SurfaceFlinger::SurfaceFlinger()
     property_get("debug.sf.showupdates", value, "0");
     mDebugRegion = atoi(value);
 
+    property_get("debug.sf.incremental_vr", value, "0");
+    mIncrementalVisibleRegions = atoi(value) ? true : false;
+
+    property_get("debug.sf.queue_client_state", value, "1");
+    mQueueClientStates = atoi(value) ? true : false;
+
+    property_get("debug.sf.parallel_composition", value, "0");
+    mNumCompositionWorkers = atoi(value);
+
+    property_get("debug.sf.batch_draws", value, "1");
+    mBatchDraws = atoi(value) ? true : false;
+
+    property_get("debug.sf.partial_updates", value, "1");
+    mPartialUpdates = atoi(value) ? true : false;
+
+    property_get("debug.sf.prelatch", value, "1");
+    mPrelatch = atoi(value) ? true : false;
+
+    property_get("debug.sf.frame_history", value, "128");
+    if (atoi(value) > 0) {
+        mFrameHistoryDepth = atoi(value);
+    }
+    mAnimFrameTracker.setNumFrameRecords(mFrameHistoryDepth);
+
+    property_get("debug.sf.async_screenshots", value, "1");
+    mAsyncScreenshots = atoi(value) ? true : false;
+
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
     if (mDebugDDMS) {
@@ -194,6 +240,13 @@ SurfaceFlinger::SurfaceFlinger()
 #endif
 
     ALOGI_IF(mDebugRegion, "showupdates enabled");
+    ALOGI_IF(mIncrementalVisibleRegions, "incremental visible regions enabled");
+    ALOGI_IF(mNumCompositionWorkers > 0, "parallel composition enabled (%d workers)",
+            mNumCompositionWorkers);
+    ALOGI_IF(!mBatchDraws, "draw batching disabled");
+    ALOGI_IF(!mPartialUpdates, "partial updates disabled");
+    ALOGI_IF(!mPrelatch, "pre-latching disabled");
+    ALOGI_IF(!mAsyncScreenshots, "asynchronous screenshots disabled");
     ALOGI_IF(mDebugDDMS, "DDMS debugging enabled");
 }
 
@@ -344,7 +397,9 @@ public:
         const char* label) :
             mValue(0),
             mPhaseOffset(phaseOffset),
+            mDivisor(1),
             mTraceVsync(traceVsync),
+            mLabel(label),
             mVsyncOnLabel(String8::format("VsyncOn-%s", label)),
             mVsyncEventLabel(String8::format("VSYNC-%s", label)),
             mDispSync(dispSync) {}
@@ -356,7 +411,7 @@ public:
         // with locking it in the onDispSyncEvent callback.
         if (enable) {
             status_t err = mDispSync->addEventListener(mPhaseOffset,
-                    static_cast<DispSync::Callback*>(this));
+                    static_cast<DispSync::Callback*>(this), mDivisor);
             if (err != NO_ERROR) {
                 ALOGE("error registering vsync callback: %s (%d)",
                         strerror(-err), err);
@@ -378,6 +433,29 @@ public:
         mCallback = callback;
     }
 
+    virtual sp<VSyncSource> createSource(nsecs_t phaseOffset) {
+        String8 label(String8::format("%s%+" PRId64 "us", mLabel.string(),
+                ns2us(phaseOffset)));
+        return new DispSyncSource(mDispSync, mPhaseOffset + phaseOffset,
+                mTraceVsync, label.string());
+    }
+
+    virtual nsecs_t getPeriod() {
+        return mDispSync->getPeriod();
+    }
+
+    virtual bool setRateDivisor(uint32_t divisor) {
+        // like setVSyncEnabled, this is only called from the EventThread
+        if (divisor != mDivisor) {
+            mDivisor = divisor;
+            // this fails harmlessly if the listener isn't registered, it
+            // will get the new divisor when it is
+            mDispSync->setEventListenerDivisor(
+                    static_cast<DispSync::Callback*>(this), divisor);
+        }
+        return true;
+    }
+
 private:
     virtual void onDispSyncEvent(nsecs_t when) {
         sp<VSyncSource::Callback> callback;
@@ -399,7 +477,9 @@ private:
     int mValue;
 
     const nsecs_t mPhaseOffset;
+    uint32_t mDivisor;
     const bool mTraceVsync;
+    const String8 mLabel;
     const String8 mVsyncOnLabel;
     const String8 mVsyncEventLabel;
 
@@ -488,6 +568,13 @@ void SurfaceFlinger::init() {
     mEventControlThread = new EventControlThread(this);
     mEventControlThread->run("EventControl", PRIORITY_URGENT_DISPLAY);
 
+    if (mPrelatch) {
+        mPrelatchThread = new PrelatchThread();
+        mPrelatchThread->run("Prelatch", PRIORITY_URGENT_DISPLAY);
+    }
+
+    startCompositionWorkers();
+
     // set a fake vsync period if there is no HWComposer
     if (mHwc->initCheck() != NO_ERROR) {
         mPrimaryDispSync.setPeriod(16666667);
@@ -674,6 +761,14 @@ void SurfaceFlinger::setActiveConfigInternal(const sp<DisplayDevice>& hw, int mo
     status_t status = getHwComposer().setActiveConfig(type, mode);
     if (status == NO_ERROR) {
         hw->setActiveConfig(mode);
+        if (type == DisplayDevice::DISPLAY_PRIMARY) {
+            // move the vsync model to the new refresh rate right away, and
+            // let hardware vsync refine it
+            mPrimaryDispSync.changeRefreshPeriod(
+                    getHwComposer().getRefreshPeriod(type),
+                    systemTime(SYSTEM_TIME_MONOTONIC));
+            enableHardwareVsync();
+        }
     }
 }
 
@@ -747,6 +842,12 @@ void SurfaceFlinger::signalRefresh() {
     mEventQueue.refresh();
 }
 
+void SurfaceFlinger::queuePrelatch(const wp<Layer>& layer) {
+    if (mPrelatchThread != NULL) {
+        mPrelatchThread->queueLayer(layer);
+    }
+}
+
 status_t SurfaceFlinger::postMessageAsync(const sp<MessageBase>& msg,
         nsecs_t reltime, uint32_t /* flags */) {
     return mEventQueue.postMessage(msg, reltime);
@@ -897,8 +998,7 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
 bool SurfaceFlinger::handleMessageTransaction() {
     uint32_t transactionFlags = peekTransactionFlags(eTransactionMask);
     if (transactionFlags) {
-        handleTransaction(transactionFlags);
-        return true;
+        return handleTransaction(transactionFlags);
     }
     return false;
 }
@@ -920,6 +1020,7 @@ void SurfaceFlinger::setUpTiledDr() {
 #endif
 void SurfaceFlinger::handleMessageRefresh() {
     ATRACE_CALL();
+    const nsecs_t start = systemTime();
     preComposition();
     rebuildLayerStacks();
     setUpHWComposer();
@@ -929,6 +1030,9 @@ void SurfaceFlinger::handleMessageRefresh() {
     doDebugFlashRegions();
     doComposition();
     postComposition();
+
+    Mutex::Autolock _l(mRefreshStatsLock);
+    mRefreshHistogram.record(systemTime() - start);
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1052,6 +1156,29 @@ void SurfaceFlinger::postComposition()
     }
 }
 
+// Displays showing the same layer stack share a VisibleRegionCache, unless
+// they compute different regions: with QCOM_BSP, computeVisibleRegions
+// skips different layers on the primary display and on the other ones.
+static uint64_t getVisibleRegionCacheKey(const sp<const DisplayDevice>& hw) {
+#ifdef QCOM_BSP
+    return (uint64_t(hw->getLayerStack()) << 1) |
+            (hw->getHwcDisplayId() != 0 ? 1 : 0);
+#else
+    return hw->getLayerStack();
+#endif
+}
+
+static String8 getVisibleRegionCacheName(uint64_t key) {
+    String8 name;
+#ifdef QCOM_BSP
+    name.appendFormat("layerStack %u%s", uint32_t(key >> 1),
+            (key & 1) ? " (secondary displays)" : " (primary display)");
+#else
+    name.appendFormat("layerStack %u", uint32_t(key));
+#endif
+    return name;
+}
+
 void SurfaceFlinger::rebuildLayerStacks() {
 #ifdef QCOM_BSP
     char prop[PROPERTY_VALUE_MAX];
@@ -1074,8 +1201,18 @@ void SurfaceFlinger::rebuildLayerStacks() {
             const Rect bounds(hw->getBounds());
             int dpyId = hw->getHwcDisplayId();
             if (hw->isDisplayOn()) {
+                VisibleRegionCache* cache = NULL;
+                if (mIncrementalVisibleRegions) {
+                    const uint64_t key = getVisibleRegionCacheKey(hw);
+                    ssize_t index = mVisibleRegionCaches.indexOfKey(key);
+                    if (index < 0) {
+                        index = mVisibleRegionCaches.add(key,
+                                VisibleRegionCache());
+                    }
+                    cache = &mVisibleRegionCaches.editValueAt(index);
+                }
                 SurfaceFlinger::computeVisibleRegions(dpyId, layers,
-                        hw->getLayerStack(), dirtyRegion, opaqueRegion);
+                        hw->getLayerStack(), dirtyRegion, opaqueRegion, cache);
 
                 const size_t count = layers.size();
                 for (size_t i=0 ; i<count ; i++) {
@@ -1094,6 +1231,20 @@ void SurfaceFlinger::rebuildLayerStacks() {
             hw->undefinedRegion.subtractSelf(tr.transform(opaqueRegion));
             hw->dirtyRegion.orSelf(dirtyRegion);
         }
+
+        // drop the caches no display uses anymore
+        for (size_t i = mVisibleRegionCaches.size(); i-- > 0; ) {
+            const uint64_t key = mVisibleRegionCaches.keyAt(i);
+            bool used = false;
+            for (size_t dpy=0 ; dpy<mDisplays.size() && !used ; dpy++) {
+                const sp<DisplayDevice>& hw(mDisplays[dpy]);
+                used = hw->isDisplayOn() &&
+                        getVisibleRegionCacheKey(hw) == key;
+            }
+            if (!used) {
+                mVisibleRegionCaches.removeItemsAt(i);
+            }
+        }
     }
 }
 
@@ -1251,23 +1402,150 @@ void SurfaceFlinger::setUpHWComposer() {
 void SurfaceFlinger::doComposition() {
     ATRACE_CALL();
     const bool repaintEverything = android_atomic_and(0, &mRepaintEverything);
+
+    // hand the displays that can be composed in parallel to the workers
+    // first, so that they run while we compose the other ones.
+    Vector< sp<DisplayDevice> > mainThreadDisplays;
+    Vector< sp<CompositionWorker> > busyWorkers;
+    DefaultKeyedVector<const Layer*, size_t> layerDisplays(0);
+    if (!mCompositionWorkers.isEmpty()) {
+        for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+            const Vector< sp<Layer> >& layers(
+                    mDisplays[dpy]->getVisibleLayersSortedByZ());
+            for (size_t i=0 ; i<layers.size() ; i++) {
+                const Layer* layer = layers[i].get();
+                layerDisplays.replaceValueFor(layer,
+                        layerDisplays.valueFor(layer) + 1);
+            }
+        }
+    }
+    size_t nextWorker = 0;
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
         const sp<DisplayDevice>& hw(mDisplays[dpy]);
+        CompositionWorker* worker = NULL;
+        if (hw->isDisplayOn()) {
+            worker = getCompositionWorker(hw, layerDisplays, nextWorker);
+        }
+        if (worker == NULL) {
+            mainThreadDisplays.add(hw);
+            continue;
+        }
+        if (busyWorkers.isEmpty()) {
+            // make sure the workers' contexts see everything the main
+            // context did so far (e.g.: buffers bound while latching)
+            mRenderEngine->flush();
+        }
+        // transform the dirty region into this screen's coordinate space
+        worker->compose(hw, hw->getDirtyRegion(repaintEverything));
+        busyWorkers.add(worker);
+    }
+
+    for (size_t i=0 ; i<mainThreadDisplays.size() ; i++) {
+        const sp<DisplayDevice>& hw(mainThreadDisplays[i]);
         if (hw->isDisplayOn()) {
             // transform the dirty region into this screen's coordinate space
             const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+            composeDisplay(hw, dirtyRegion, false);
+        } else {
+            // inform the h/w that we're done compositing
+            hw->compositionComplete();
+        }
+    }
+
+    for (size_t i=0 ; i<busyWorkers.size() ; i++) {
+        busyWorkers[i]->waitForIdle();
+    }
+    postFramebuffer();
+}
+
+void SurfaceFlinger::composeDisplay(const sp<DisplayDevice>& hw,
+        const Region& dirtyRegion, bool parallel) {
+    const nsecs_t start = systemTime();
+
+    // repaint the framebuffer (if needed)
+    if (!passthroughDisplayFrame(hw, dirtyRegion)) {
+        doDisplayComposition(hw, dirtyRegion);
+    }
+
+    hw->dirtyRegion.clear();
+    hw->flip(hw->swapRegion);
+    hw->swapRegion.clear();
+
+    // inform the h/w that we're done compositing
+    hw->compositionComplete();
+
+    hw->recordCompositionTime(systemTime() - start, parallel);
+}
+
+bool SurfaceFlinger::passthroughDisplayFrame(const sp<const DisplayDevice>& hw,
+        const Region& dirtyRegion) const {
+    // Only virtual displays that GLES would render into directly, when the
+    // frame changed (see doDisplayComposition) and nothing is drawn on top
+    // of the layers.
+    if (hw->getDisplayType() < DisplayDevice::DISPLAY_VIRTUAL ||
+            hw->getHwcDisplayId() >= 0 || dirtyRegion.isEmpty() ||
+            mDebugRegion || mDaltonize || mHasColorMatrix) {
+        return false;
+    }
+
+    const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
+    if (layers.size() != 1) {
+        return false;
+    }
 
-            // repaint the framebuffer (if needed)
-            doDisplayComposition(hw, dirtyRegion);
+    sp<Fence> fence;
+    sp<DisplaySurface::BufferReleaser> releaser;
+    sp<GraphicBuffer> buffer(layers[0]->getPassthroughBuffer(hw, &fence,
+            &releaser));
+    if (buffer == NULL) {
+        return false;
+    }
+    if (!hw->passthroughFrame(buffer, fence, releaser)) {
+        releaser->releaseBuffer(buffer, Fence::NO_FENCE);
+        return false;
+    }
+    return true;
+}
 
-            hw->dirtyRegion.clear();
-            hw->flip(hw->swapRegion);
-            hw->swapRegion.clear();
+CompositionWorker* SurfaceFlinger::getCompositionWorker(
+        const sp<DisplayDevice>& hw,
+        const DefaultKeyedVector<const Layer*, size_t>& layerDisplays,
+        size_t& nextWorker) const {
+    // the primary display is always composed on the main thread
+    if (mCompositionWorkers.isEmpty() ||
+            hw->getDisplayType() == DisplayDevice::DISPLAY_PRIMARY) {
+        return NULL;
+    }
+    // Layers can't be drawn by two threads at the same time, so none of the
+    // display's layers may be visible on another display. Comparing layer
+    // stacks isn't enough: with QCOM_BSP, ext_only, secure and extended
+    // mode layers are shown on displays of other layer stacks.
+    const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        if (layerDisplays.valueFor(layers[i].get()) > 1) {
+            return NULL;
         }
-        // inform the h/w that we're done compositing
-        hw->compositionComplete();
     }
-    postFramebuffer();
+    if (nextWorker >= mCompositionWorkers.size()) {
+        return NULL;
+    }
+    return mCompositionWorkers[nextWorker++].get();
+}
+
+void SurfaceFlinger::startCompositionWorkers() {
+    for (int i=0 ; i<mNumCompositionWorkers ; i++) {
+        sp<CompositionWorker> worker = new CompositionWorker(this,
+                mEGLDisplay, mHwc->getVisualID(), mEGLContext);
+        String8 name;
+        name.appendFormat("Composition%d", i);
+        worker->run(name.string(), PRIORITY_URGENT_DISPLAY);
+        if (!worker->waitForReady()) {
+            ALOGE("can't start composition worker %d, parallel composition "
+                    "limited to %d workers", i, i);
+            break;
+        }
+        mCompositionWorkers.add(worker);
+    }
 }
 
 void SurfaceFlinger::postFramebuffer()
@@ -1322,7 +1600,7 @@ void SurfaceFlinger::postFramebuffer()
     }
 }
 
-void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
+bool SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
 {
     ATRACE_CALL();
 
@@ -1343,12 +1621,22 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
     // until the transaction is committed.
 
     transactionFlags = getTransactionFlags(eTransactionMask);
+    if (transactionFlags & eClientStateNeeded) {
+        transactionFlags &= ~eClientStateNeeded;
+        transactionFlags |= applyPendingClientStatesLocked();
+        if (!transactionFlags) {
+            // the queued states didn't change anything
+            mDebugInTransaction = 0;
+            return false;
+        }
+    }
     handleTransactionLocked(transactionFlags);
 
     mLastTransactionTime = systemTime() - now;
     mDebugInTransaction = 0;
     invalidateHwcGeometry();
     // here the transaction has been committed
+    return true;
 }
 
 void SurfaceFlinger::setVirtualDisplayData(
@@ -1796,7 +2084,8 @@ void SurfaceFlinger::commitTransaction()
 
 void SurfaceFlinger::computeVisibleRegions(size_t dpy,
         const LayerVector& currentLayers, uint32_t layerStack,
-        Region& outDirtyRegion, Region& outOpaqueRegion)
+        Region& outDirtyRegion, Region& outOpaqueRegion,
+        VisibleRegionCache* cache)
 {
     ATRACE_CALL();
 
@@ -1830,6 +2119,12 @@ void SurfaceFlinger::computeVisibleRegions(size_t dpy,
     }
     i = currentLayers.size();
 #endif
+    if (cache != NULL) {
+        computeVisibleRegionsCached(dpy, currentLayers, layerStack,
+                bIgnoreLayers, indexLOI, outDirtyRegion, outOpaqueRegion,
+                *cache);
+        return;
+    }
     while (i--) {
         const sp<Layer>& layer = currentLayers[i];
 
@@ -1983,6 +2278,76 @@ void SurfaceFlinger::computeVisibleRegions(size_t dpy,
     outOpaqueRegion = aboveOpaqueLayers;
 }
 
+void SurfaceFlinger::computeVisibleRegionsCached(size_t dpy,
+        const LayerVector& currentLayers, uint32_t layerStack,
+        bool bIgnoreLayers, int indexLOI,
+        Region& outDirtyRegion, Region& outOpaqueRegion,
+        VisibleRegionCache& cache)
+{
+    // gather what the visible region computation needs to know about each
+    // layer, from the top-most to the bottom-most one. This is much cheaper
+    // than the region arithmetic, which VisibleRegionCache only redoes from
+    // the top-most layer that changed.
+    const size_t count = currentLayers.size();
+    Vector<VisibleRegionCache::LayerInput> inputs;
+    inputs.setCapacity(count);
+    for (size_t i = count; i-- > 0; ) {
+        const sp<Layer>& layer = currentLayers[i];
+        const Layer::State& s(layer->getDrawingState());
+
+        VisibleRegionCache::LayerInput input;
+        input.sequence = layer->sequence;
+        input.stateSequence = s.sequence;
+#ifdef QCOM_BSP
+        // see computeVisibleRegions()
+        if(((bIgnoreLayers && indexLOI != (int)i) ||
+           (!dpy && layer->isExtOnly()) ||
+                     (!dpy && isExtendedMode() && layer->isYuvLayer()))||
+                     (dpy && layer->isIntOnly())) {
+            input.skip = true;
+        }
+#else
+        (void)dpy;
+        (void)indexLOI;
+#endif
+        if (s.layerStack != layerStack && !bIgnoreLayers) {
+            input.skip = true;
+        }
+        if (!input.skip) {
+            input.visible = layer->isVisible();
+            if (CC_LIKELY(input.visible)) {
+                input.translucent = !layer->isOpaque(s);
+                input.bounds = s.transform.transform(layer->computeBounds());
+                const int32_t layerOrientation = s.transform.getOrientation();
+                input.opaque = s.alpha==255 && !input.translucent &&
+                        ((layerOrientation & Transform::ROT_INVALID) == false);
+                input.transform = s.transform;
+                input.transparentRegion = s.activeTransparentRegion;
+            }
+            input.contentDirty = layer->contentDirty;
+            input.oldVisibleRegion = layer->visibleRegion;
+            input.oldCoveredRegion = layer->coveredRegion;
+        }
+        inputs.add(input);
+    }
+
+    cache.compute(inputs, outDirtyRegion, outOpaqueRegion);
+
+    // publish the results, the cached ones are shared with the layers so
+    // this doesn't copy any region.
+    for (size_t j = 0; j < count; j++) {
+        const sp<Layer>& layer = currentLayers[count - 1 - j];
+        const VisibleRegionCache::LayerOutput& output(cache.getOutput(j));
+        if (!inputs[j].skip) {
+            layer->setVisibleRegion(output.visibleRegion);
+            layer->setCoveredRegion(output.coveredRegion);
+            layer->contentDirty = false;
+        }
+        layer->setVisibleNonTransparentRegion(
+                output.visibleNonTransparentRegion);
+    }
+}
+
 void SurfaceFlinger::invalidateLayerStack(uint32_t layerStack,
         const Region& dirty) {
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
@@ -2001,6 +2366,12 @@ bool SurfaceFlinger::handlePageFlip()
     const LayerVector& layers(mDrawingState.layersSortedByZ);
     bool frameQueued = false;
 
+    // Layers can't latch a new buffer while the one before the current one
+    // is still pinned, get back those the virtual displays are done with.
+    for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+        mDisplays[dpy]->reclaimPassthroughBuffers();
+    }
+
     // Store the set of layers that need updates. This set must not change as
     // buffers are being latched, as this could result in a deadlock.
     // Example: Two producers share the same command stream and:
@@ -2060,6 +2431,21 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
 
     Region dirtyRegion(inDirtyRegion);
 
+    const bool partialUpdates = usePartialUpdates(hw);
+    if (partialUpdates) {
+        hw->addDamage(inDirtyRegion);
+        if (isHwcDisplay) {
+            HWComposer& hwc(getHwComposer());
+            Vector<int32_t> compositionTypes;
+            HWComposer::LayerListIterator cur = hwc.begin(hw->getHwcDisplayId());
+            const HWComposer::LayerListIterator end = hwc.end(hw->getHwcDisplayId());
+            for ( ; cur != end ; ++cur) {
+                compositionTypes.add(cur->getCompositionType());
+            }
+            hw->setCompositionTypes(compositionTypes);
+        }
+    }
+
     // compute the invalid region
     hw->swapRegion.orSelf(dirtyRegion);
 
@@ -2077,9 +2463,23 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
             // rectangle instead of a region (see DisplayDevice::flip())
             dirtyRegion.set(hw->swapRegion.bounds());
         } else {
-            // we need to redraw everything (the whole screen)
-            dirtyRegion.set(hw->bounds());
+            // we need to redraw everything (the whole screen), unless we
+            // know what's already in the buffer we're about to draw into
+            Region repaint;
+            if (partialUpdates &&
+                    getHwComposer().hasGlesComposition(hw->getHwcDisplayId()) &&
+                    hw->makeCurrent(mEGLDisplay, getRenderEngine().getEGLContext()) &&
+                    hw->getRepaintRegion(hw->getBufferAge(), &repaint)) {
+                // only redraw a rectangle, so that it can be scissored
+                // (see doComposeSurfaces)
+                dirtyRegion.set(repaint.bounds());
+            } else {
+                dirtyRegion.set(hw->bounds());
+            }
             hw->swapRegion = dirtyRegion;
+            if (partialUpdates) {
+                hw->recordRepaint(dirtyRegion.bounds());
+            }
         }
     }
 
@@ -2133,16 +2533,30 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     bool hasGlesComposition = hwc.hasGlesComposition(id);
     const bool hasHwcComposition = hwc.hasHwcComposition(id);
     if (hasGlesComposition) {
-        if (!hw->makeCurrent(mEGLDisplay, mEGLContext)) {
+        if (!hw->makeCurrent(mEGLDisplay, engine.getEGLContext())) {
             ALOGW("DisplayDevice::makeCurrent failed. Aborting surface composition for display %s",
                   hw->getDisplayName().string());
             eglMakeCurrent(mEGLDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-            if(!getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext)) {
+            // the default display can only be made current on the main thread
+            if (CompositionWorker::getCurrentEngine() == NULL &&
+                    !getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext)) {
               ALOGE("DisplayDevice::makeCurrent on default display failed. Aborting.");
             }
             return false;
         }
 
+        // with partial updates, everything outside of the dirty region is
+        // still valid in the buffer we're drawing into, so nothing (including
+        // the clear below) must be drawn outside of it.
+        const Rect& dirtyBounds(dirty.getBounds());
+        const bool partialUpdate = usePartialUpdates(hw) &&
+                dirtyBounds != hw->getBounds();
+        if (partialUpdate) {
+            engine.setScissor(dirtyBounds.left,
+                    hw->getHeight() - dirtyBounds.bottom,
+                    dirtyBounds.getWidth(), dirtyBounds.getHeight());
+        }
+
         // Never touch the framebuffer if we don't have any framebuffer layers
         if (hasHwcComposition) {
             // when using overlays, we assume a fully transparent framebuffer
@@ -2200,11 +2614,14 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             // scissor on the main display. It should never be needed
             // anyways (though in theory it could since the API allows it).
             const Rect& bounds(hw->getBounds());
-            const Rect& scissor(hw->getScissor());
+            Rect scissor(hw->getScissor());
             if (scissor != bounds) {
                 // scissor doesn't match the screen's dimensions, so we
                 // need to clear everything outside of it and enable
                 // the GL scissor so we don't draw anything where we shouldn't
+                if (partialUpdate && !scissor.intersect(dirtyBounds, &scissor)) {
+                    scissor.clear();
+                }
 
                 // enable scissor for this frame
                 const uint32_t height = hw->getHeight();
@@ -2221,6 +2638,9 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
     const size_t count = layers.size();
     const Transform& tr = hw->getTransform();
+    if (mBatchDraws) {
+        engine.beginBatch();
+    }
     if (cur != end) {
         // we're using h/w composer
 #ifdef QCOM_BSP
@@ -2320,11 +2740,30 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
         }
     }
 
+    // draw what's left before the scissor goes away
+    engine.endBatch();
+
     // disable scissor at the end of the frame
     engine.disableScissor();
     return true;
 }
 
+bool SurfaceFlinger::usePartialUpdates(const sp<const DisplayDevice>& hw) const {
+    // Virtual displays are excluded since h/w composer may write into the
+    // buffers GLES draws into. Everything that draws outside of the dirty
+    // region (showupdates, color transforms, which go through an offscreen
+    // buffer) or manages buffer preservation itself (swap rectangle,
+    // partial updates and tiled rendering) is excluded as well.
+    const int32_t type = hw->getDisplayType();
+    return mPartialUpdates &&
+            type >= DisplayDevice::DISPLAY_PRIMARY &&
+            type < DisplayDevice::DISPLAY_VIRTUAL &&
+            !(hw->getFlags() & (DisplayDevice::SWAP_RECTANGLE |
+                    DisplayDevice::PARTIAL_UPDATES)) &&
+            !mDebugRegion && !mDaltonize && !mHasColorMatrix &&
+            !mGpuTileRenderEnable;
+}
+
 void SurfaceFlinger::drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const {
     const int32_t height = hw->getHeight();
     RenderEngine& engine(getRenderEngine());
@@ -2402,8 +2841,41 @@ void SurfaceFlinger::setTransactionState(
         }
     }
 #endif
-    Mutex::Autolock _l(mStateLock);
-    uint32_t transactionFlags = 0;
+
+    if (mQueueClientStates && count == 0 &&
+            !(flags & (eSynchronous | eAnimation))) {
+        // Nothing to wait for: queue the layer states for the main thread
+        // instead of applying them with mStateLock held.
+        bool queued = false;
+        { // scope for the lock
+            Mutex::Autolock _l(mPendingStateLock);
+            for (size_t i=0 ; i<state.size() ; i++) {
+                const ComposerState& s(state[i]);
+                // see below for why we check the interface
+                if (s.client != NULL) {
+                    sp<IBinder> binder = s.client->asBinder();
+                    if (binder != NULL) {
+                        String16 desc(binder->getInterfaceDescriptor());
+                        if (desc == ISurfaceComposerClient::descriptor) {
+                            sp<Client> client( static_cast<Client *>(s.client.get()) );
+                            queueClientStateLocked(client, s.state);
+                            queued = true;
+                        }
+                    }
+                }
+            }
+        }
+        if (queued) {
+            android_atomic_inc(&mNumQueuedTransactions);
+            setTransactionFlags(eClientStateNeeded);
+        }
+        return;
+    }
+
+    lockStateForTransaction();
+
+    // states queued earlier must be applied first
+    uint32_t transactionFlags = applyPendingClientStatesLocked();
 
     if (flags & eAnimation) {
         // For window updates that are part of an animation we must wait for
@@ -2471,6 +2943,60 @@ void SurfaceFlinger::setTransactionState(
             }
         }
     }
+
+    mStateLock.unlock();
+}
+
+void SurfaceFlinger::lockStateForTransaction()
+{
+    nsecs_t wait = 0;
+    if (mStateLock.tryLock() != NO_ERROR) {
+        const nsecs_t start = systemTime();
+        mStateLock.lock();
+        wait = systemTime() - start;
+        mNumContendedTransactions++;
+    }
+    mNumLockedTransactions++;
+    mTotalStateLockWait += wait;
+    if (wait > mMaxStateLockWait) {
+        mMaxStateLockWait = wait;
+    }
+}
+
+void SurfaceFlinger::queueClientStateLocked(const sp<Client>& client,
+        const layer_state_t& s)
+{
+    if (client->queuePendingState(s)) {
+        mClientsWithPendingStates.add(client);
+    }
+}
+
+uint32_t SurfaceFlinger::applyPendingClientStatesLocked()
+{
+    ATRACE_CALL();
+    Vector< sp<Client> > clients;
+    Vector< Vector<layer_state_t> > states;
+    { // scope for the lock
+        Mutex::Autolock _l(mPendingStateLock);
+        if (mClientsWithPendingStates.isEmpty()) {
+            return 0;
+        }
+        clients = mClientsWithPendingStates;
+        mClientsWithPendingStates.clear();
+        states.resize(clients.size());
+        for (size_t i=0 ; i<clients.size() ; i++) {
+            clients[i]->takePendingStates(states.editItemAt(i));
+        }
+    }
+
+    uint32_t flags = 0;
+    for (size_t i=0 ; i<clients.size() ; i++) {
+        const Vector<layer_state_t>& clientStates(states[i]);
+        for (size_t j=0 ; j<clientStates.size() ; j++) {
+            flags |= setClientStateLocked(clients[i], clientStates[j]);
+        }
+    }
+    return flags;
 }
 
 uint32_t SurfaceFlinger::setDisplayStateLocked(const DisplayState& s)
@@ -2807,6 +3333,8 @@ void SurfaceFlinger::setPowerMode(const sp<IBinder>& display, int mode) {
 status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
 {
     String8 result;
+    // binary output, written instead of result when it's not empty
+    Vector<uint8_t> binaryResult;
 
     IPCThreadState* ipc = IPCThreadState::self();
     const int pid = ipc->getCallingPid();
@@ -2855,6 +3383,27 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--latency-histogram"))) {
+                index++;
+                dumpLatencyHistogramsLocked(args, index, binaryResult);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--refresh-stats"))) {
+                index++;
+                dumpRefreshStats(result);
+                dumpAll = false;
+            }
+
+            if ((index < numArgs) &&
+                    (args[index] == String16("--refresh-stats-clear"))) {
+                index++;
+                clearRefreshStats();
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--dispsync"))) {
                 index++;
@@ -2871,7 +3420,11 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
             mStateLock.unlock();
         }
     }
-    write(fd, result.string(), result.size());
+    if (!binaryResult.isEmpty()) {
+        write(fd, binaryResult.array(), binaryResult.size());
+    } else {
+        write(fd, result.string(), result.size());
+    }
     return NO_ERROR;
 }
 
@@ -2934,6 +3487,68 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+void SurfaceFlinger::dumpRefreshStats(String8& result) const
+{
+    // one line, see tests/headless/RefreshBenchmark.cpp
+    Mutex::Autolock _l(mRefreshStatsLock);
+    const LatencyHistogram& h(mRefreshHistogram);
+    result.appendFormat("refresh: count=%u mean=%" PRIu64 " p50=%" PRIu64
+            " p90=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 " (us)\n",
+            h.getCount(), h.getMeanUs(), h.getValueAtPercentile(50),
+            h.getValueAtPercentile(90), h.getValueAtPercentile(99),
+            h.getMaxUs());
+}
+
+void SurfaceFlinger::clearRefreshStats()
+{
+    Mutex::Autolock _l(mRefreshStatsLock);
+    mRefreshHistogram.clear();
+}
+
+void SurfaceFlinger::dumpLatencyHistogramsLocked(const Vector<String16>& args,
+        size_t& index, Vector<uint8_t>& out) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    // The histograms are exported as is, the formatting is left to the
+    // reader. The header is, in host byte order:
+    //   uint32_t magic ('SFLH'), version, subBucketBits, numBuckets
+    //   int64_t  refresh period in ns
+    //   uint32_t number of layers
+    // and is followed by FrameTracker::appendLatencyHistograms for each layer.
+    // <win-anim> has no desired present times, it isn't exported.
+    Vector< sp<Layer> > layers;
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<Layer>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            layers.add(layer);
+        }
+    }
+
+    const uint32_t header[] = {
+        0x53464c48, // 'SFLH'
+        1,
+        LatencyHistogram::SUB_BUCKET_BITS,
+        LatencyHistogram::NUM_BUCKETS,
+    };
+    const int64_t period =
+            getHwComposer().getRefreshPeriod(HWC_DISPLAY_PRIMARY);
+    const uint32_t numLayers = uint32_t(layers.size());
+    out.appendArray(reinterpret_cast<const uint8_t*>(header), sizeof(header));
+    out.appendArray(reinterpret_cast<const uint8_t*>(&period), sizeof(period));
+    out.appendArray(reinterpret_cast<const uint8_t*>(&numLayers),
+            sizeof(numLayers));
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        layers[i]->appendLatencyHistograms(out);
+    }
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -2959,6 +3574,9 @@ void SurfaceFlinger::logFrameStats() {
 #endif
 #ifdef TARGET_DISABLE_TRIPLE_BUFFERING
             " TARGET_DISABLE_TRIPLE_BUFFERING"
+#endif
+#ifdef HEADLESS_DISPLAY
+            " HEADLESS_DISPLAY"
 #endif
             "]";
     result.append(config);
@@ -3081,6 +3699,53 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     result.appendFormat("  transaction time: %f us\n",
             inTransactionDuration/1000.0);
 
+    result.appendFormat("  transactions: %d queued, %u locked, "
+            "%u waited for mStateLock (avg %.1f us, max %.1f us)\n",
+            android_atomic_acquire_load(&mNumQueuedTransactions),
+            mNumLockedTransactions, mNumContendedTransactions,
+            mNumContendedTransactions ?
+                    mTotalStateLockWait / (1000.0 * mNumContendedTransactions) : 0.0,
+            mMaxStateLockWait / 1000.0);
+
+    if (mCompositionWorkers.isEmpty()) {
+        result.append("  parallel composition: disabled\n");
+    } else {
+        result.appendFormat("  parallel composition: %zu workers\n",
+                mCompositionWorkers.size());
+    }
+    result.appendFormat("  draw batching: %s\n",
+            mBatchDraws ? "enabled" : "disabled");
+    result.appendFormat("  partial updates: %s\n",
+            mPartialUpdates ? "enabled" : "disabled");
+    if (mPrelatchThread != NULL) {
+        mPrelatchThread->dump(result);
+    } else {
+        result.append("  pre-latch: disabled\n");
+    }
+    if (mAsyncScreenshots) {
+        size_t numRenderers;
+        {
+            Mutex::Autolock _l(mScreenshotLock);
+            numRenderers = mNumScreenshotRenderers;
+        }
+        result.appendFormat("  async screenshots: enabled (%zu renderers), "
+                "%u captures, %.2f us avg on main thread\n",
+                numRenderers, mNumAsyncScreenshots,
+                mNumAsyncScreenshots ?
+                        mTotalScreenshotSnapshotTime /
+                                (1000.0 * mNumAsyncScreenshots) : 0.0);
+    } else {
+        result.append("  async screenshots: disabled\n");
+    }
+
+    result.appendFormat("  incremental visible regions: %s\n",
+            mIncrementalVisibleRegions ? "enabled" : "disabled");
+    for (size_t i=0 ; i<mVisibleRegionCaches.size() ; i++) {
+        const String8 name(getVisibleRegionCacheName(
+                mVisibleRegionCaches.keyAt(i)));
+        mVisibleRegionCaches.valueAt(i).dump(result, name.string());
+    }
+
     /*
      * VSYNC state
      */
@@ -3456,6 +4121,16 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
             break;
     }
 
+    if (mAsyncScreenshots && !DEBUG_SCREENSHOTS) {
+        status_t res = captureScreenAsync(display, producer,
+                sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                useIdentityTransform, rotationFlags);
+        if (res != NO_INIT) {
+            return res;
+        }
+        // no renderer available, render on the main thread instead
+    }
+
     class MessageCaptureScreen : public MessageBase {
         SurfaceFlinger* flinger;
         sp<IBinder> display;
@@ -3536,6 +4211,42 @@ void SurfaceFlinger::renderScreenImplLocked(
     const uint32_t hw_h = hw->getHeight();
     const bool filtering = reqWidth != hw_w || reqWidth != hw_h;
 
+    adjustCaptureGeometry(hw, sourceCrop, rotation);
+
+    // make sure to clear all GL error flags
+    engine.checkErrors();
+
+    // set-up our viewport
+    engine.setViewportAndProjection(
+        reqWidth, reqHeight, sourceCrop, hw_h, yswap, rotation);
+    engine.disableTexturing();
+
+    // redraw the screen entirely...
+    engine.clearWithColor(0, 0, 0, 1);
+
+    const LayerVector& layers( mDrawingState.layersSortedByZ );
+    const size_t count = layers.size();
+    for (size_t i=0 ; i<count ; ++i) {
+        const sp<Layer>& layer(layers[i]);
+        if (isLayerCaptured(hw, layer, minLayerZ, maxLayerZ)) {
+            if (filtering) layer->setFiltering(true);
+            if(!layer->isProtected())
+                   layer->draw(hw, useIdentityTransform);
+            if (filtering) layer->setFiltering(false);
+        }
+    }
+
+    // compositionComplete is needed for older driver
+    hw->compositionComplete();
+    hw->setViewportAndProjection();
+}
+
+void SurfaceFlinger::adjustCaptureGeometry(const sp<const DisplayDevice>& hw,
+        Rect& sourceCrop, Transform::orientation_flags& rotation) const
+{
+    const uint32_t hw_w = hw->getWidth();
+    const uint32_t hw_h = hw->getHeight();
+
     // if a default or invalid sourceCrop is passed in, set reasonable values
     if (sourceCrop.width() == 0 || sourceCrop.height() == 0 ||
             !sourceCrop.isValid()) {
@@ -3557,59 +4268,36 @@ void SurfaceFlinger::renderScreenImplLocked(
         ALOGE("Invalid crop rect: b = %d (> %d)", sourceCrop.bottom, hw_h);
     }
 
-    // make sure to clear all GL error flags
-    engine.checkErrors();
-
     if (DisplayDevice::DISPLAY_PRIMARY == hw->getDisplayType() &&
                 hw->isPanelInverseMounted()) {
         rotation = (Transform::orientation_flags)
                 (rotation ^ Transform::ROT_180);
     }
+}
 
-    // set-up our viewport
-    engine.setViewportAndProjection(
-        reqWidth, reqHeight, sourceCrop, hw_h, yswap, rotation);
-    engine.disableTexturing();
-
-    // redraw the screen entirely...
-    engine.clearWithColor(0, 0, 0, 1);
-
-    const LayerVector& layers( mDrawingState.layersSortedByZ );
-    const size_t count = layers.size();
-    for (size_t i=0 ; i<count ; ++i) {
-        const sp<Layer>& layer(layers[i]);
-        const Layer::State& state(layer->getDrawingState());
-        if (state.layerStack == hw->getLayerStack()) {
-            if (state.z >= minLayerZ && state.z <= maxLayerZ) {
-#ifdef QCOM_BSP
-                // dont render the secure Display Layer
-                if(layer->isSecureDisplay()) {
-                    continue;
-                }
-#endif
+bool SurfaceFlinger::isLayerCaptured(const sp<const DisplayDevice>& hw,
+        const sp<Layer>& layer, uint32_t minLayerZ, uint32_t maxLayerZ) const
+{
+    const Layer::State& state(layer->getDrawingState());
+    if (state.layerStack != hw->getLayerStack() ||
+            state.z < minLayerZ || state.z > maxLayerZ) {
+        return false;
+    }
 #ifdef QCOM_BSP
-                int dispType = hw->getDisplayType();
-                // Dont let ext_only and extended_mode to be captured
-                // If not, we would see incorrect image during rotatoin
-                // on primary
-                if (layer->isVisible() &&
-                    not (!dispType && (layer->isExtOnly() ||
-                         (isExtendedMode() && layer->isYuvLayer())))) {
+    // dont render the secure Display Layer
+    if(layer->isSecureDisplay()) {
+        return false;
+    }
+    int dispType = hw->getDisplayType();
+    // Dont let ext_only and extended_mode to be captured
+    // If not, we would see incorrect image during rotatoin
+    // on primary
+    return layer->isVisible() &&
+        not (!dispType && (layer->isExtOnly() ||
+             (isExtendedMode() && layer->isYuvLayer())));
 #else
-                if (layer->isVisible()) {
+    return layer->isVisible();
 #endif
-                    if (filtering) layer->setFiltering(true);
-                    if(!layer->isProtected())
-                           layer->draw(hw, useIdentityTransform);
-                    if (filtering) layer->setFiltering(false);
-                }
-            }
-        }
-    }
-
-    // compositionComplete is needed for older driver
-    hw->compositionComplete();
-    hw->setViewportAndProjection();
 }
 
 
@@ -3730,6 +4418,239 @@ status_t SurfaceFlinger::captureScreenImplLocked(
     return result;
 }
 
+status_t SurfaceFlinger::captureScreenAsync(const sp<IBinder>& display,
+        const sp<IGraphicBufferProducer>& producer,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation)
+{
+    ATRACE_CALL();
+
+    class MessageSnapshotScreen : public MessageBase {
+        SurfaceFlinger* flinger;
+        sp<IBinder> display;
+        Rect sourceCrop;
+        uint32_t reqWidth, reqHeight;
+        uint32_t minLayerZ,maxLayerZ;
+        bool useIdentityTransform;
+        Transform::orientation_flags rotation;
+        ScreenSnapshot* snapshot;
+        status_t result;
+    public:
+        MessageSnapshotScreen(SurfaceFlinger* flinger,
+                const sp<IBinder>& display,
+                Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+                uint32_t minLayerZ, uint32_t maxLayerZ,
+                bool useIdentityTransform, Transform::orientation_flags rotation,
+                ScreenSnapshot* snapshot)
+            : flinger(flinger), display(display),
+              sourceCrop(sourceCrop), reqWidth(reqWidth), reqHeight(reqHeight),
+              minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              useIdentityTransform(useIdentityTransform),
+              rotation(rotation), snapshot(snapshot),
+              result(PERMISSION_DENIED)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+            sp<const DisplayDevice> hw(flinger->getDisplayDevice(display));
+            result = flinger->snapshotScreenLocked(hw,
+                    sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                    useIdentityTransform, rotation, snapshot);
+            return true;
+        }
+    };
+
+    // get a renderer and the destination buffer first, so that the layers'
+    // buffers are only pinned while we render: a layer can't latch a new
+    // buffer while the one before its current one is pinned.
+    ScreenshotRenderer* renderer = acquireScreenshotRenderer();
+    if (renderer == NULL) {
+        return NO_INIT;
+    }
+
+    // snapshotScreenLocked() picks the same size
+    uint32_t width = reqWidth;
+    uint32_t height = reqHeight;
+    if (!width || !height) {
+        Mutex::Autolock _l(mStateLock);
+        sp<const DisplayDevice> hw(getDisplayDevice(display));
+        if (hw == NULL) {
+            releaseScreenshotRenderer(renderer);
+            return BAD_VALUE;
+        }
+        width = width ? width : hw->getWidth();
+        height = height ? height : hw->getHeight();
+    }
+
+    // create a surface (because we're a producer, and we need to
+    // dequeue/queue a buffer)
+    sp<Surface> sur = new Surface(producer, false);
+    ANativeWindow* window = sur.get();
+
+    status_t result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
+    if (result != NO_ERROR) {
+        releaseScreenshotRenderer(renderer);
+        return result;
+    }
+
+    uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
+                    GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+
+    int err = 0;
+    err = native_window_set_buffers_dimensions(window, width, height);
+    err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
+    err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+    err |= native_window_set_usage(window, usage);
+
+    ANativeWindowBuffer* buffer = NULL;
+    if (err == NO_ERROR) {
+        result = native_window_dequeue_buffer_and_wait(window, &buffer);
+    } else {
+        result = BAD_VALUE;
+    }
+
+    if (result == NO_ERROR) {
+        // see captureScreen()
+        mEventQueue.invalidateTransactionNow();
+
+        // only the snapshot is taken on the main thread, which doesn't wait
+        // for the rendering nor for the producer.
+        ScreenSnapshot snapshot;
+        sp<MessageSnapshotScreen> msg = new MessageSnapshotScreen(this,
+                display, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                useIdentityTransform, rotation, &snapshot);
+        result = postMessageSync(msg);
+        if (result == NO_ERROR) {
+            result = msg->getResult();
+        }
+        if (result == NO_ERROR && (snapshot.reqWidth != width ||
+                snapshot.reqHeight != height)) {
+            // the display was resized meanwhile, render on the main thread
+            result = NO_INIT;
+        }
+
+        if (result == NO_ERROR) {
+            sp<Fence> fence;
+            result = renderer->render(snapshot, buffer, &fence);
+            // the layers' buffers and ours can be reused as soon as
+            // the GPU is done with them.
+            snapshot.unpinBuffers(fence);
+            if (result == NO_ERROR) {
+                window->queueBuffer(window, buffer, fence->dup());
+            } else {
+                window->cancelBuffer(window, buffer, fence->dup());
+            }
+        } else {
+            window->cancelBuffer(window, buffer, -1);
+        }
+    }
+    native_window_api_disconnect(window, NATIVE_WINDOW_API_EGL);
+
+    releaseScreenshotRenderer(renderer);
+    return result;
+}
+
+status_t SurfaceFlinger::snapshotScreenLocked(
+        const sp<const DisplayDevice>& hw,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        ScreenSnapshot* outSnapshot)
+{
+    ATRACE_CALL();
+
+    if (hw == NULL) {
+        return BAD_VALUE;
+    }
+
+    const nsecs_t start = systemTime();
+
+    // get screen geometry
+    const uint32_t hw_w = hw->getWidth();
+    const uint32_t hw_h = hw->getHeight();
+
+    if ((reqWidth > hw_w) || (reqHeight > hw_h)) {
+        ALOGE("size mismatch (%d, %d) > (%d, %d)",
+                reqWidth, reqHeight, hw_w, hw_h);
+        return BAD_VALUE;
+    }
+
+    reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
+    reqHeight = (!reqHeight) ? hw_h : reqHeight;
+    const bool filtering = reqWidth != hw_w || reqHeight != hw_h;
+
+    adjustCaptureGeometry(hw, sourceCrop, rotation);
+
+    outSnapshot->sourceCrop = sourceCrop;
+    outSnapshot->reqWidth = reqWidth;
+    outSnapshot->reqHeight = reqHeight;
+    outSnapshot->hwHeight = hw_h;
+    outSnapshot->rotation = rotation;
+
+    const LayerVector& layers( mDrawingState.layersSortedByZ );
+    const size_t count = layers.size();
+    for (size_t i=0 ; i<count ; ++i) {
+        const sp<Layer>& layer(layers[i]);
+        if (isLayerCaptured(hw, layer, minLayerZ, maxLayerZ) &&
+                !layer->isProtected()) {
+            LayerSnapshot layerSnapshot;
+            if (layer->snapshot(hw, useIdentityTransform, filtering,
+                    &layerSnapshot)) {
+                outSnapshot->layers.add(layerSnapshot);
+            }
+        }
+    }
+
+    mNumAsyncScreenshots++;
+    mTotalScreenshotSnapshotTime += systemTime() - start;
+    return NO_ERROR;
+}
+
+ScreenshotRenderer* SurfaceFlinger::acquireScreenshotRenderer()
+{
+    {
+        Mutex::Autolock _l(mScreenshotLock);
+        while (mIdleScreenshotRenderers.isEmpty() && !mScreenshotRendererFailed &&
+                mNumScreenshotRenderers >= MAX_SCREENSHOT_RENDERERS) {
+            mScreenshotCondition.wait(mScreenshotLock);
+        }
+        if (!mIdleScreenshotRenderers.isEmpty()) {
+            ScreenshotRenderer* renderer = mIdleScreenshotRenderers.top();
+            mIdleScreenshotRenderers.pop();
+            return renderer;
+        }
+        if (mScreenshotRendererFailed) {
+            return NULL;
+        }
+        mNumScreenshotRenderers++;
+    }
+
+    // creating the context and compiling its programs takes a while, don't
+    // hold the lock.
+    ScreenshotRenderer* renderer = ScreenshotRenderer::create(mEGLDisplay,
+            mHwc->getVisualID(), mEGLContext);
+    if (renderer == NULL) {
+        ALOGE("can't create a ScreenshotRenderer, "
+                "screenshots will be taken on the main thread");
+        Mutex::Autolock _l(mScreenshotLock);
+        mNumScreenshotRenderers--;
+        mScreenshotRendererFailed = true;
+        mScreenshotCondition.broadcast();
+    }
+    return renderer;
+}
+
+void SurfaceFlinger::releaseScreenshotRenderer(ScreenshotRenderer* renderer)
+{
+    Mutex::Autolock _l(mScreenshotLock);
+    mIdleScreenshotRenderers.push(renderer);
+    mScreenshotCondition.signal();
+}
+
 void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
         const sp<const DisplayDevice>& hw, uint32_t minLayerZ, uint32_t maxLayerZ) {
     if (DEBUG_SCREENSHOTS) {
@@ -49,10 +49,13 @@
 #include <private/gui/LayerState.h>
 
 #include "Barrier.h"
+#include "CompositionWorker.h"
 #include "DisplayDevice.h"
 #include "DispSync.h"
 #include "FrameTracker.h"
+#include "LatencyHistogram.h"
 #include "MessageQueue.h"
+#include "VisibleRegionCache.h"
 
 #include "DisplayHardware/HWComposer.h"
 #include "Effects/Daltonizer.h"
@@ -69,7 +72,10 @@ class Layer;
 class LayerDim;
 class Surface;
 class RenderEngine;
+class ScreenshotRenderer;
+struct ScreenSnapshot;
 class EventControlThread;
+class PrelatchThread;
 
 // ---------------------------------------------------------------------------
 
@@ -77,7 +83,8 @@ enum {
     eTransactionNeeded        = 0x01,
     eTraversalNeeded          = 0x02,
     eDisplayTransactionNeeded = 0x04,
-    eTransactionMask          = 0x07
+    eClientStateNeeded        = 0x08,
+    eTransactionMask          = 0x0f
 };
 
 class SurfaceFlinger : public BnSurfaceComposer,
@@ -132,8 +139,11 @@ public:
     // TODO: this should be made accessible only to HWComposer
     const Vector< sp<Layer> >& getLayerSortedByZForHwcDisplay(int id);
 
+    // returns the RenderEngine of the calling CompositionWorker, or the
+    // main one
     RenderEngine& getRenderEngine() const {
-        return *mRenderEngine;
+        RenderEngine* engine = CompositionWorker::getCurrentEngine();
+        return engine ? *engine : *mRenderEngine;
     }
 #ifdef QCOM_BSP
     // Extended Mode - No video on primary and it will be shown full
@@ -143,6 +153,7 @@ public:
 #endif
 private:
     friend class Client;
+    friend class CompositionWorker;
     friend class DisplayEventConnection;
     friend class Layer;
     friend class MonitoredProducer;
@@ -246,6 +257,9 @@ private:
     void signalTransaction();
     void signalLayerUpdate();
     void signalRefresh();
+    // schedules the preparation of the frames queued to a layer, see
+    // PrelatchThread.
+    void queuePrelatch(const wp<Layer>& layer);
 
     // called on the main thread in response to initializeDisplays()
     void onInitializeDisplays();
@@ -262,7 +276,8 @@ private:
 
     void handleMessageRefresh();
 
-    void handleTransaction(uint32_t transactionFlags);
+    // Returns false if the transaction turned out not to change anything
+    bool handleTransaction(uint32_t transactionFlags);
     void handleTransactionLocked(uint32_t transactionFlags);
 
     void updateCursorAsync();
@@ -294,6 +309,12 @@ private:
     uint32_t setTransactionFlags(uint32_t flags);
     void commitTransaction();
     uint32_t setClientStateLocked(const sp<Client>& client, const layer_state_t& s);
+    // queues s, to be applied by applyPendingClientStatesLocked(). Must be
+    // called with mPendingStateLock held.
+    void queueClientStateLocked(const sp<Client>& client, const layer_state_t& s);
+    uint32_t applyPendingClientStatesLocked();
+    // locks mStateLock and records how long it took, for dumpsys
+    void lockStateForTransaction();
     uint32_t setDisplayStateLocked(const DisplayState& s);
 
     /* ------------------------------------------------------------------------
@@ -349,6 +370,31 @@ private:
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, Transform::orientation_flags rotation);
 
+    // defaults and checks sourceCrop, and applies the panel orientation
+    void adjustCaptureGeometry(const sp<const DisplayDevice>& hw,
+            Rect& sourceCrop, Transform::orientation_flags& rotation) const;
+    bool isLayerCaptured(const sp<const DisplayDevice>& hw,
+            const sp<Layer>& layer, uint32_t minLayerZ, uint32_t maxLayerZ) const;
+
+    // Asynchronous screen capture: only snapshotScreenLocked() runs on the
+    // main thread, the snapshot is rendered on the calling binder thread
+    // by a pooled ScreenshotRenderer. Returns NO_INIT if no renderer can
+    // be created.
+    status_t captureScreenAsync(const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation);
+    status_t snapshotScreenLocked(const sp<const DisplayDevice>& hw,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation,
+            ScreenSnapshot* outSnapshot);
+    // blocks until a renderer is available, returns NULL if none can be
+    // created.
+    ScreenshotRenderer* acquireScreenshotRenderer();
+    void releaseScreenshotRenderer(ScreenshotRenderer* renderer);
+
     /* ------------------------------------------------------------------------
      * EGL
      */
@@ -388,13 +434,24 @@ private:
 
     HWComposer& getHwComposer() const { return *mHwc; }
 
+    // number of frames kept in the FrameTracker of each layer
+    size_t getFrameHistoryDepth() const { return mFrameHistoryDepth; }
+
     /* ------------------------------------------------------------------------
      * Compositing
      */
     void invalidateHwcGeometry();
+    // when cache is not NULL, only the layers below the top-most changed
+    // layer are recomputed (see VisibleRegionCache)
     static void computeVisibleRegions(size_t dpy,
             const LayerVector& currentLayers, uint32_t layerStack,
-            Region& dirtyRegion, Region& opaqueRegion);
+            Region& dirtyRegion, Region& opaqueRegion,
+            VisibleRegionCache* cache = NULL);
+    static void computeVisibleRegionsCached(size_t dpy,
+            const LayerVector& currentLayers, uint32_t layerStack,
+            bool bIgnoreLayers, int indexLOI,
+            Region& dirtyRegion, Region& opaqueRegion,
+            VisibleRegionCache& cache);
 
     void preComposition();
     void postComposition();
@@ -403,11 +460,29 @@ private:
     void doComposition();
     void doDebugFlashRegions();
     void doDisplayComposition(const sp<const DisplayDevice>& hw, const Region& dirtyRegion);
+    // composes and flips hw, on the main thread or on a CompositionWorker
+    void composeDisplay(const sp<DisplayDevice>& hw, const Region& dirtyRegion,
+            bool parallel);
+    // sends the buffer of the only layer of a virtual display to its sink
+    // instead of composing it, returns false if the frame must be composed
+    bool passthroughDisplayFrame(const sp<const DisplayDevice>& hw,
+            const Region& dirtyRegion) const;
+    // returns the CompositionWorker that should compose hw this frame, or
+    // NULL if it must be composed on the main thread. layerDisplays counts
+    // the displays each layer is visible on.
+    CompositionWorker* getCompositionWorker(const sp<DisplayDevice>& hw,
+            const DefaultKeyedVector<const Layer*, size_t>& layerDisplays,
+            size_t& nextWorker) const;
+    void startCompositionWorkers();
 
     // compose surfaces for display hw. this fails if using GL and the surface
     // has been destroyed and is no longer valid.
     bool doComposeSurfaces(const sp<const DisplayDevice>& hw, const Region& dirty);
 
+    // whether only what changed since the buffer GLES draws into was last
+    // shown may be redrawn on hw
+    bool usePartialUpdates(const sp<const DisplayDevice>& hw) const;
+
     void postFramebuffer();
     void drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const;
 
@@ -428,6 +503,10 @@ private:
     void listLayersLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void dumpStatsLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void clearStatsLocked(const Vector<String16>& args, size_t& index, String8& result);
+    void dumpRefreshStats(String8& result) const;
+    void clearRefreshStats();
+    void dumpLatencyHistogramsLocked(const Vector<String16>& args, size_t& index,
+            Vector<uint8_t>& out) const;
     void dumpAllLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     bool startDdmConnection();
     static void appendSfConfigString(String8& result);
@@ -454,6 +533,22 @@ private:
     // protected by mStateLock (but we could use another lock)
     bool mLayersRemoved;
 
+    // Layer states of asynchronous transactions are queued per Client and
+    // applied by the main thread in handleTransaction(), so that clients
+    // don't have to wait for mStateLock. Whole transactions are queued with
+    // mPendingStateLock held, so they are still applied atomically.
+    bool mQueueClientStates;
+    Mutex mPendingStateLock;
+    Vector< sp<Client> > mClientsWithPendingStates;
+
+    // transaction statistics, for dumpsys
+    volatile int32_t mNumQueuedTransactions;
+    // protected by mStateLock
+    uint32_t mNumLockedTransactions;
+    uint32_t mNumContendedTransactions;
+    nsecs_t mTotalStateLockWait;
+    nsecs_t mMaxStateLockWait;
+
     // access must be protected by mInvalidateLock
     volatile int32_t mRepaintEverything;
 
@@ -465,6 +560,8 @@ private:
     sp<EventThread> mEventThread;
     sp<EventThread> mSFEventThread;
     sp<EventControlThread> mEventControlThread;
+    // NULL if pre-latching is disabled
+    sp<PrelatchThread> mPrelatchThread;
     EGLContext mEGLContext;
     EGLDisplay mEGLDisplay;
     sp<IBinder> mBuiltinDisplays[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
@@ -496,6 +593,51 @@ private:
     bool mCanUseGpuTileRender;
     Rect mUnionDirtyRect;
 
+    // Set if visible regions are only recomputed below the top-most changed
+    // layer. Can only be accessed from the main thread.
+    bool mIncrementalVisibleRegions;
+    // keyed by layer stack, and whether the display is the primary one with
+    // QCOM_BSP (see rebuildLayerStacks)
+    KeyedVector<uint64_t, VisibleRegionCache> mVisibleRegionCaches;
+
+    // Number of threads composing displays which don't share layers with
+    // the primary display in parallel with it, 0 if disabled.
+    int mNumCompositionWorkers;
+
+    // Set if the RenderEngine may merge consecutive layers drawn with the
+    // same state into a single draw call.
+    bool mBatchDraws;
+    Vector< sp<CompositionWorker> > mCompositionWorkers;
+
+    // Set if only the damage since the buffer GLES draws into was last
+    // shown is redrawn on physical displays. This relies on
+    // EGL_EXT_buffer_age, displays without it are always fully redrawn.
+    bool mPartialUpdates;
+
+    // Set if the EGLImages of queued frames are created by a PrelatchThread.
+    bool mPrelatch;
+
+    // Number of frames kept by the FrameTrackers, for dumpsys --latency.
+    size_t mFrameHistoryDepth;
+
+    // Set if captureScreen() renders on the calling thread rather than on
+    // the main thread.
+    bool mAsyncScreenshots;
+    enum { MAX_SCREENSHOT_RENDERERS = 2 };
+    // protects the ScreenshotRenderer pool
+    Mutex mScreenshotLock;
+    Condition mScreenshotCondition;
+    Vector<ScreenshotRenderer*> mIdleScreenshotRenderers;
+    size_t mNumScreenshotRenderers;
+    bool mScreenshotRendererFailed;
+    // asynchronous screenshot statistics, protected by mStateLock
+    uint32_t mNumAsyncScreenshots;
+    nsecs_t mTotalScreenshotSnapshotTime;
+
+    // durations of handleMessageRefresh(), for dumpsys --refresh-stats
+    mutable Mutex mRefreshStatsLock;
+    LatencyHistogram mRefreshHistogram;
+
 #ifdef QCOM_BSP
     // Set up the DirtyRect/flags for GPU Comp optimization if required.
     void setUpTiledDr();
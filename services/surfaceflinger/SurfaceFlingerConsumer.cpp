@@ -110,6 +110,88 @@ status_t SurfaceFlingerConsumer::acquireBufferLocked(
     return result;
 }
 
+status_t SurfaceFlingerConsumer::releaseBufferLocked(int slot,
+        const sp<GraphicBuffer> graphicBuffer,
+        EGLDisplay display, EGLSyncKHR eglFence) {
+    ssize_t index = mPins.indexOfKey(graphicBuffer.get());
+    if (index >= 0) {
+        Pin& pin(mPins.editValueAt(index));
+        pin.slot = slot;
+        pin.releasePending = true;
+        pin.display = display;
+        pin.eglFence = eglFence;
+        return NO_ERROR;
+    }
+    return GLConsumer::releaseBufferLocked(slot, graphicBuffer, display,
+            eglFence);
+}
+
+status_t SurfaceFlingerConsumer::pinCurrentBuffer(sp<GraphicBuffer>* outBuffer,
+        sp<Fence>* outFence) {
+    // these take mMutex, but the current buffer can only change on this
+    // thread.
+    sp<GraphicBuffer> buffer(getCurrentBuffer());
+    sp<Fence> fence(getCurrentFence());
+
+    Mutex::Autolock lock(mMutex);
+    if (mAbandoned || buffer == NULL) {
+        return NO_INIT;
+    }
+
+    ssize_t index = mPins.indexOfKey(buffer.get());
+    if (index < 0) {
+        Pin pin;
+        for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+            if (mSlots[i].mGraphicBuffer == buffer) {
+                pin.slot = i;
+                break;
+            }
+        }
+        index = mPins.add(buffer.get(), pin);
+    }
+    mPins.editValueAt(index).count++;
+
+    *outBuffer = buffer;
+    *outFence = fence;
+    return NO_ERROR;
+}
+
+void SurfaceFlingerConsumer::unpinBuffer(const sp<GraphicBuffer>& buffer,
+        const sp<Fence>& fence) {
+    Mutex::Autolock lock(mMutex);
+    ssize_t index = mPins.indexOfKey(buffer.get());
+    if (index < 0) {
+        return;
+    }
+
+    Pin& pin(mPins.editValueAt(index));
+    if (fence != NULL && fence->isValid() &&
+            pin.slot != BufferQueue::INVALID_BUFFER_SLOT) {
+        // this does nothing if the slot was reallocated in the meantime
+        addReleaseFenceLocked(pin.slot, buffer, fence);
+    }
+    if (--pin.count > 0) {
+        return;
+    }
+
+    const Pin released(pin);
+    mPins.removeItemsAt(index);
+    if (released.releasePending) {
+        GLConsumer::releaseBufferLocked(released.slot, buffer,
+                released.display, released.eglFence);
+    }
+}
+
+bool SurfaceFlingerConsumer::hasPendingRelease() const {
+    Mutex::Autolock lock(mMutex);
+    for (size_t i = 0; i < mPins.size(); i++) {
+        if (mPins.valueAt(i).releasePending) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool SurfaceFlingerConsumer::getTransformToDisplayInverse() const {
     return mTransformToDisplayInverse;
 }
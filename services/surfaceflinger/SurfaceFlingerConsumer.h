@@ -19,6 +19,7 @@
 
 #include "DispSync.h"
 #include <gui/GLConsumer.h>
+#include <utils/KeyedVector.h>
 
 namespace android {
 // ----------------------------------------------------------------------------
@@ -49,6 +50,13 @@ public:
 
     virtual status_t acquireBufferLocked(BufferQueue::BufferItem *item, nsecs_t presentWhen);
 
+    // releaseBufferLocked defers the release of pinned buffers until they
+    // are unpinned.
+    using GLConsumer::releaseBufferLocked;
+    virtual status_t releaseBufferLocked(int slot,
+            const sp<GraphicBuffer> graphicBuffer,
+            EGLDisplay display, EGLSyncKHR eglFence);
+
     // This version of updateTexImage() takes a functor that may be used to
     // reject the newly acquired buffer.  Unlike the GLConsumer version,
     // this does not guarantee that the buffer has been bound to the GL
@@ -69,9 +77,40 @@ public:
 
     nsecs_t computeExpectedPresent(const DispSync& dispSync);
 
+    // pinCurrentBuffer returns the current buffer and its acquire fence, and
+    // keeps the buffer from being released to the producer until
+    // unpinBuffer() is called, so that it can be read from another thread
+    // after a new buffer was latched. Must be called from SF main thread.
+    status_t pinCurrentBuffer(sp<GraphicBuffer>* outBuffer,
+            sp<Fence>* outFence);
+
+    // unpinBuffer undoes pinCurrentBuffer(). fence signals when the reads
+    // of the buffer are done, the buffer is released if it was released
+    // while pinned. May be called from any thread.
+    void unpinBuffer(const sp<GraphicBuffer>& buffer, const sp<Fence>& fence);
+
+    // hasPendingRelease returns true if a buffer that was released while
+    // pinned is still pinned. It still counts as acquired, so no new buffer
+    // may be acquired until it is unpinned.
+    bool hasPendingRelease() const;
+
 private:
     virtual void onSidebandStreamChanged();
 
+    struct Pin {
+        Pin() : count(0), slot(BufferQueue::INVALID_BUFFER_SLOT),
+                releasePending(false), display(EGL_NO_DISPLAY),
+                eglFence(EGL_NO_SYNC_KHR) { }
+        int count;
+        int slot;
+        // releaseBufferLocked() was called for the buffer while pinned
+        bool releasePending;
+        EGLDisplay display;
+        EGLSyncKHR eglFence;
+    };
+    // pinned buffers, protected by mMutex
+    KeyedVector<GraphicBuffer*, Pin> mPins;
+
     wp<ContentsChangedListener> mContentsChangedListener;
 
     // Indicates this buffer must be transformed by the inverse transform of the screen
@@ -16,6 +16,12 @@
 
 #include <math.h>
 
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <cutils/compiler.h>
 #include <utils/String8.h>
 #include <ui/Region.h>
@@ -201,6 +207,13 @@ Rect Transform::makeBounds(int w, int h) const
 }
 
 Rect Transform::transform(const Rect& bounds) const
+{
+    Rect r;
+    transform(&r, &bounds, 1);
+    return r;
+}
+
+Rect Transform::transformCorners(const Rect& bounds) const
 {
     Rect r;
     vec2 lt( bounds.left,  bounds.top    );
@@ -221,16 +234,227 @@ Rect Transform::transform(const Rect& bounds) const
     return r;
 }
 
+// ---------------------------------------------------------------------------
+// Batched kernels.
+//
+// A transform that preserves rects maps (left, top, right, bottom) to
+// (x * sx + tx, y * sy + ty) for both corners, after swapping x and y for 90
+// degrees rotations, so a Rect is transformed as one vector of 4 floats.
+// Products and sums are done in the same order as transform(vec2) and are
+// rounded the same way, so the results are identical to the scalar path.
+
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+
+typedef float32x4_t float4;
+
+static inline float4 set4(float a, float b, float c, float d) {
+    const float v[4] = { a, b, c, d };
+    return vld1q_f32(v);
+}
+static inline float4 load4(const float* p) { return vld1q_f32(p); }
+static inline void store4(float* p, float4 v) { vst1q_f32(p, v); }
+static inline float4 loadRect(const Rect& r) {
+    return vcvtq_f32_s32(vld1q_s32(&r.left));
+}
+static inline float4 mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+static inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+static inline float4 min4(float4 a, float4 b) { return vminq_f32(a, b); }
+static inline float4 max4(float4 a, float4 b) { return vmaxq_f32(a, b); }
+// (a, b, c, d) -> (b, a, d, c)
+static inline float4 swapPairs(float4 v) { return vrev64q_f32(v); }
+// (a, b, c, d) -> (c, d, a, b)
+static inline float4 swapHalves(float4 v) {
+    return vcombine_f32(vget_high_f32(v), vget_low_f32(v));
+}
+// (lo0, lo1, hi2, hi3)
+static inline float4 lowHigh(float4 lo, float4 hi) {
+    return vcombine_f32(vget_low_f32(lo), vget_high_f32(hi));
+}
+// (a, b, c, d) -> (a, a, c, c) and (b, b, d, d)
+static inline float4 evens(float4 v) { return vtrnq_f32(v, v).val[0]; }
+static inline float4 odds(float4 v) { return vtrnq_f32(v, v).val[1]; }
+// floorf(v + 0.5f)
+static inline void storeRect(Rect& r, float4 v) {
+    v = vaddq_f32(v, vdupq_n_f32(0.5f));
+    int32x4_t i = vcvtq_s32_f32(v);
+    uint32x4_t roundedUp = vcgtq_f32(vcvtq_f32_s32(i), v);
+    vst1q_s32(&r.left, vaddq_s32(i, vreinterpretq_s32_u32(roundedUp)));
+}
+#define TRANSFORM_SIMD 1
+
+#elif defined(__SSE2__)
+
+typedef __m128 float4;
+
+static inline float4 set4(float a, float b, float c, float d) {
+    return _mm_setr_ps(a, b, c, d);
+}
+static inline float4 load4(const float* p) { return _mm_loadu_ps(p); }
+static inline void store4(float* p, float4 v) { _mm_storeu_ps(p, v); }
+static inline float4 loadRect(const Rect& r) {
+    return _mm_cvtepi32_ps(_mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(&r.left)));
+}
+static inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+static inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+static inline float4 min4(float4 a, float4 b) { return _mm_min_ps(a, b); }
+static inline float4 max4(float4 a, float4 b) { return _mm_max_ps(a, b); }
+static inline float4 swapPairs(float4 v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+static inline float4 swapHalves(float4 v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+static inline float4 lowHigh(float4 lo, float4 hi) {
+    return _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 2, 1, 0));
+}
+static inline float4 evens(float4 v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 0, 0));
+}
+static inline float4 odds(float4 v) {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 1, 1));
+}
+static inline void storeRect(Rect& r, float4 v) {
+    v = _mm_add_ps(v, _mm_set1_ps(0.5f));
+    __m128i i = _mm_cvttps_epi32(v);
+    __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(i), v);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&r.left),
+            _mm_add_epi32(i, _mm_castps_si128(roundedUp)));
+}
+#define TRANSFORM_SIMD 1
+
+#endif
+
+#ifdef TRANSFORM_SIMD
+
+static void transformRects(Rect* out, const Rect* in, size_t count,
+        float sx, float sy, float tx, float ty, bool swapXY) {
+    const float4 scale = set4(sx, sy, sx, sy);
+    const float4 offset = set4(tx, ty, tx, ty);
+    for (size_t i=0 ; i<count ; i++) {
+        float4 v = loadRect(in[i]);
+        if (swapXY) {
+            v = swapPairs(v);
+        }
+        v = add4(mul4(v, scale), offset);
+        const float4 other = swapHalves(v);
+        storeRect(out[i], lowHigh(min4(v, other), max4(v, other)));
+    }
+}
+
+static void transformPoints(vec2* out, const vec2* in, size_t count,
+        float a, float b, float c, float d, float tx, float ty) {
+    // two points per vector: x' = a*x + b*y + tx, y' = c*x + d*y + ty
+    const float4 m0 = set4(a, c, a, c);
+    const float4 m1 = set4(b, d, b, d);
+    const float4 offset = set4(tx, ty, tx, ty);
+    size_t i = 0;
+    for ( ; i+2<=count ; i+=2) {
+        const float4 v = load4(&in[i].x);
+        const float4 r = add4(add4(mul4(evens(v), m0), mul4(odds(v), m1)),
+                offset);
+        store4(&out[i].x, r);
+    }
+    for ( ; i<count ; i++) {
+        const float x = in[i].x;
+        const float y = in[i].y;
+        out[i].x = a*x + b*y + tx;
+        out[i].y = c*x + d*y + ty;
+    }
+}
+
+#else
+
+static void transformRects(Rect* out, const Rect* in, size_t count,
+        float sx, float sy, float tx, float ty, bool swapXY) {
+    for (size_t i=0 ; i<count ; i++) {
+        const Rect& r(in[i]);
+        float x0 = r.left, y0 = r.top, x1 = r.right, y1 = r.bottom;
+        if (swapXY) {
+            swap(x0, y0);
+            swap(x1, y1);
+        }
+        x0 = x0*sx + tx;    y0 = y0*sy + ty;
+        x1 = x1*sx + tx;    y1 = y1*sy + ty;
+        out[i].left   = floorf(min(x0, x1) + 0.5f);
+        out[i].top    = floorf(min(y0, y1) + 0.5f);
+        out[i].right  = floorf(max(x0, x1) + 0.5f);
+        out[i].bottom = floorf(max(y0, y1) + 0.5f);
+    }
+}
+
+static void transformPoints(vec2* out, const vec2* in, size_t count,
+        float a, float b, float c, float d, float tx, float ty) {
+    for (size_t i=0 ; i<count ; i++) {
+        const float x = in[i].x;
+        const float y = in[i].y;
+        out[i].x = a*x + b*y + tx;
+        out[i].y = c*x + d*y + ty;
+    }
+}
+
+#endif
+
+void Transform::transform(vec2* out, const vec2* in, size_t count) const
+{
+    const mat33& M(mMatrix);
+    if (type() == IDENTITY) {
+        if (out != in) {
+            for (size_t i=0 ; i<count ; i++) {
+                out[i] = in[i];
+            }
+        }
+        return;
+    }
+    transformPoints(out, in, count,
+            M[0][0], M[1][0], M[0][1], M[1][1], M[2][0], M[2][1]);
+}
+
+void Transform::transform(Rect* out, const Rect* in, size_t count) const
+{
+    const mat33& M(mMatrix);
+    const uint32_t orientation = getOrientation();
+    if (orientation & ROT_INVALID) {
+        for (size_t i=0 ; i<count ; i++) {
+            out[i] = transformCorners(in[i]);
+        }
+    } else if (orientation & ROT_90) {
+        // x' = b*y + tx, y' = c*x + ty
+        transformRects(out, in, count,
+                M[1][0], M[0][1], M[2][0], M[2][1], true);
+    } else {
+        // identity, translate, flips and scales: x' = a*x + tx, y' = d*y + ty
+        transformRects(out, in, count,
+                M[0][0], M[1][1], M[2][0], M[2][1], false);
+    }
+}
+
+// Returns the union of disjoint rects. The halves are merged recursively so
+// that each rect takes part in O(log n) merges of banded regions, rather
+// than the whole region being rebuilt for each rect.
+static Region unionOf(const Rect* rects, size_t count)
+{
+    if (count <= 4) {
+        Region r;
+        for (size_t i=0 ; i<count ; i++) {
+            r.orSelf(rects[i]);
+        }
+        return r;
+    }
+    const size_t half = count / 2;
+    return unionOf(rects, half).merge(unionOf(rects + half, count - half));
+}
+
 Region Transform::transform(const Region& reg) const
 {
     Region out;
     if (CC_UNLIKELY(transformed())) {
         if (CC_LIKELY(preserveRects())) {
-            Region::const_iterator it = reg.begin();
-            Region::const_iterator const end = reg.end();
-            while (it != end) {
-                out.orSelf(transform(*it++));
-            }
+            const size_t count = reg.end() - reg.begin();
+            Vector<Rect> rects;
+            rects.resize(count);
+            transform(rects.editArray(), reg.begin(), count);
+            out = unionOf(rects.array(), count);
         } else {
             out.set(transform(reg.bounds()));
         }
@@ -80,6 +80,12 @@ public:
             vec2    transform(int x, int y) const;
             Region  transform(const Region& reg) const;
             Rect    transform(const Rect& bounds) const;
+
+            // batched versions of transform(x, y) and transform(Rect), the
+            // kernel is chosen once for the whole array based on the type
+            // of the transform. out may be the same array as in.
+            void    transform(vec2* out, const vec2* in, size_t count) const;
+            void    transform(Rect* out, const Rect* in, size_t count) const;
             Transform operator * (const Transform& rhs) const;
 
             Transform inverse() const;
@@ -99,6 +105,7 @@ private:
     // assumes the last row is < 0 , 0 , 1 >
     vec2 transform(const vec2& v) const;
     vec3 transform(const vec3& v) const;
+    Rect transformCorners(const Rect& bounds) const;
     uint32_t type() const;
     static bool absIsOne(float f);
     static bool isZero(float f);
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+
+#include <cutils/compiler.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "VisibleRegionCache.h"
+
+namespace android {
+
+// ---------------------------------------------------------------------------
+
+VisibleRegionCache::LayerInput::LayerInput()
+    :   sequence(0),
+        stateSequence(0),
+        skip(false),
+        visible(false),
+        opaque(false),
+        translucent(false),
+        contentDirty(false) {
+}
+
+VisibleRegionCache::VisibleRegionCache()
+    :   mSteadyDirtyCount(0),
+        mNumComputes(0),
+        mNumLayersComputed(0),
+        mNumLayersReused(0) {
+}
+
+void VisibleRegionCache::invalidate() {
+    mEntries.clear();
+    mSteadyDirtyCount = 0;
+}
+
+bool VisibleRegionCache::isUnchanged(const Entry& entry,
+        const LayerInput& layer) {
+    const LayerInput& old(entry.input);
+    if (old.sequence != layer.sequence || old.skip != layer.skip) {
+        return false;
+    }
+    if (layer.skip) {
+        // layers outside of this layer stack only have their visible
+        // non-transparent region cleared.
+        return true;
+    }
+    // The exposed region of a layer depends on the regions it had after
+    // the previous call, so these must not have been changed behind our
+    // back (e.g.: by another layer stack).
+    return !layer.contentDirty &&
+            old.stateSequence == layer.stateSequence &&
+            old.visible == layer.visible &&
+            old.opaque == layer.opaque &&
+            old.translucent == layer.translucent &&
+            old.bounds == layer.bounds &&
+            old.transparentRegion.isTriviallyEqual(layer.transparentRegion) &&
+            entry.output.visibleRegion.isTriviallyEqual(layer.oldVisibleRegion) &&
+            entry.output.coveredRegion.isTriviallyEqual(layer.oldCoveredRegion);
+}
+
+void VisibleRegionCache::updateSteadyDirty(size_t count) {
+    // When a layer and everything above it is unchanged, its new visible
+    // and covered regions are the same as the old ones, and its dirty
+    // region reduces to (visibleRegion & coveredRegion).
+    for (size_t i = mSteadyDirtyCount; i < count; i++) {
+        Entry& entry(mEntries.editItemAt(i));
+        if (i > 0) {
+            entry.steadyDirty = mEntries[i - 1].steadyDirty;
+        } else {
+            entry.steadyDirty.clear();
+        }
+        if (!entry.input.skip) {
+            entry.steadyDirty.orSelf(entry.output.visibleRegion.intersect(
+                    entry.output.coveredRegion));
+        }
+    }
+    if (count > mSteadyDirtyCount) {
+        mSteadyDirtyCount = count;
+    }
+}
+
+size_t VisibleRegionCache::compute(const Vector<LayerInput>& layers,
+        Region& outDirtyRegion, Region& outOpaqueRegion) {
+    ATRACE_CALL();
+
+    const size_t count = layers.size();
+
+    // find the top-most layer that changed since the last call
+    size_t first = 0;
+    while (first < count && first < mEntries.size() &&
+            isUnchanged(mEntries[first], layers[first])) {
+        first++;
+    }
+
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+    Region dirty;
+
+    outDirtyRegion.clear();
+    if (first > 0) {
+        updateSteadyDirty(first);
+        const Entry& entry(mEntries[first - 1]);
+        aboveOpaqueLayers = entry.aboveOpaqueLayers;
+        aboveCoveredLayers = entry.aboveCoveredLayers;
+        outDirtyRegion = entry.steadyDirty;
+    }
+
+    if (first < mEntries.size()) {
+        mEntries.removeItemsAt(first, mEntries.size() - first);
+    }
+    if (first < mSteadyDirtyCount) {
+        mSteadyDirtyCount = first;
+    }
+
+    for (size_t i = first; i < count; i++) {
+        const LayerInput& layer(layers[i]);
+
+        Entry entry;
+        entry.input = layer;
+        entry.input.contentDirty = false;
+
+        if (layer.skip) {
+            entry.aboveOpaqueLayers = aboveOpaqueLayers;
+            entry.aboveCoveredLayers = aboveCoveredLayers;
+            mEntries.add(entry);
+            continue;
+        }
+
+        // see SurfaceFlinger::computeVisibleRegions for the meaning of
+        // these regions.
+        Region opaqueRegion;
+        Region visibleRegion;
+        Region coveredRegion;
+        Region transparentRegion;
+
+        // handle hidden surfaces by setting the visible region to empty
+        if (CC_LIKELY(layer.visible)) {
+            visibleRegion.set(layer.bounds);
+            if (!visibleRegion.isEmpty()) {
+                // Remove the transparent area from the visible region
+                if (layer.translucent) {
+                    const Transform& tr(layer.transform);
+                    if (tr.transformed()) {
+                        if (tr.preserveRects()) {
+                            // transform the transparent region
+                            transparentRegion = tr.transform(
+                                    layer.transparentRegion);
+                        }
+                    } else {
+                        transparentRegion = layer.transparentRegion;
+                    }
+                }
+
+                // compute the opaque region
+                if (layer.opaque) {
+                    // the opaque region is the layer's footprint
+                    opaqueRegion = visibleRegion;
+                }
+            }
+        }
+
+        // Clip the covered region to the visible region
+        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+
+        // Update aboveCoveredLayers for next (lower) layer
+        aboveCoveredLayers.orSelf(visibleRegion);
+
+        // subtract the opaque region covered by the layers above us
+        visibleRegion.subtractSelf(aboveOpaqueLayers);
+
+        // compute this layer's dirty region
+        if (layer.contentDirty) {
+            // we need to invalidate the whole region
+            dirty = visibleRegion;
+            // as well, as the old visible region
+            dirty.orSelf(layer.oldVisibleRegion);
+        } else {
+            const Region newExposed = visibleRegion - coveredRegion;
+            const Region oldExposed = layer.oldVisibleRegion -
+                    layer.oldCoveredRegion;
+            dirty = (visibleRegion & layer.oldCoveredRegion) |
+                    (newExposed - oldExposed);
+        }
+        dirty.subtractSelf(aboveOpaqueLayers);
+
+        // accumulate to the screen dirty region
+        outDirtyRegion.orSelf(dirty);
+
+        // Update aboveOpaqueLayers for next (lower) layer
+        aboveOpaqueLayers.orSelf(opaqueRegion);
+
+        entry.output.visibleRegion = visibleRegion;
+        entry.output.coveredRegion = coveredRegion;
+        entry.output.visibleNonTransparentRegion =
+                visibleRegion.subtract(transparentRegion);
+        entry.aboveOpaqueLayers = aboveOpaqueLayers;
+        entry.aboveCoveredLayers = aboveCoveredLayers;
+        mEntries.add(entry);
+    }
+
+    outOpaqueRegion = aboveOpaqueLayers;
+
+    mNumComputes++;
+    mNumLayersComputed += count - first;
+    mNumLayersReused += first;
+    return first;
+}
+
+void VisibleRegionCache::dump(String8& result, const char* name) const {
+    const uint64_t total = mNumLayersComputed + mNumLayersReused;
+    result.appendFormat("  %s: %zu layers cached, %" PRIu64 " computes, "
+            "%" PRIu64 " layers computed, %" PRIu64 " reused (%.1f%%)\n",
+            name, mEntries.size(), mNumComputes,
+            mNumLayersComputed, mNumLayersReused,
+            total ? (100.0 * mNumLayersReused) / total : 0.0);
+}
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VISIBLE_REGION_CACHE_H
+#define ANDROID_VISIBLE_REGION_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <utils/Vector.h>
+
+#include "Transform.h"
+
+namespace android {
+
+class String8;
+
+// ---------------------------------------------------------------------------
+
+// VisibleRegionCache implements the visible region computation done by
+// SurfaceFlinger::computeVisibleRegions for one layer stack, and remembers
+// the per-layer results along with the opaque/covered regions accumulated
+// above each layer.
+//
+// Layers are walked from the top-most to the bottom-most one. On each call,
+// the leading run of layers whose inputs did not change since the previous
+// call is not recomputed: their outputs and the accumulated regions below
+// them are reused, and the computation restarts from the top-most changed
+// layer. The results are identical to a full recomputation.
+//
+// VisibleRegionCache is *NOT* thread-safe, it must only be used from the
+// SurfaceFlinger main thread.
+class VisibleRegionCache {
+public:
+    // Everything computeVisibleRegions needs to know about a layer. This is
+    // cheap to gather, and is compared against the previous call to find
+    // the top-most layer that needs to be recomputed.
+    struct LayerInput {
+        LayerInput();
+
+        // Layer::sequence, identifies the layer
+        int32_t sequence;
+        // Layer::State::sequence, changes when visible regions can change
+        int32_t stateSequence;
+        // the layer is not part of this layer stack
+        bool skip;
+        // Layer::isVisible()
+        bool visible;
+        // the whole footprint of the layer is opaque
+        bool opaque;
+        // !Layer::isOpaque()
+        bool translucent;
+        // Layer::contentDirty
+        bool contentDirty;
+        // footprint of the layer in layer-stack space
+        Rect bounds;
+        // Layer::State::transform
+        Transform transform;
+        // Layer::State::activeTransparentRegion, in layer space
+        Region transparentRegion;
+        // the regions computed for this layer by the previous call
+        Region oldVisibleRegion;
+        Region oldCoveredRegion;
+    };
+
+    struct LayerOutput {
+        Region visibleRegion;
+        Region coveredRegion;
+        Region visibleNonTransparentRegion;
+    };
+
+    VisibleRegionCache();
+
+    // compute computes the visible regions of 'layers', which must be sorted
+    // from the top-most to the bottom-most layer. The per-layer results
+    // are available through getOutput() until the next call. Returns the
+    // index of the top-most recomputed layer, or layers.size() if all the
+    // results were reused.
+    size_t compute(const Vector<LayerInput>& layers,
+            Region& outDirtyRegion, Region& outOpaqueRegion);
+
+    // getOutput returns the result for the i-th layer passed to compute().
+    const LayerOutput& getOutput(size_t i) const {
+        return mEntries[i].output;
+    }
+
+    // invalidate forces the next call to compute() to recompute everything.
+    void invalidate();
+
+    void dump(String8& result, const char* name) const;
+
+private:
+    struct Entry {
+        LayerInput input;
+        LayerOutput output;
+        // opaque and covered regions accumulated from the top-most layer
+        // down to and including this one
+        Region aboveOpaqueLayers;
+        Region aboveCoveredLayers;
+        // dirty region accumulated from the top-most layer down to and
+        // including this one, for layers that didn't change since the
+        // previous call. Only valid for entries below mSteadyDirtyCount.
+        Region steadyDirty;
+    };
+
+    static bool isUnchanged(const Entry& entry, const LayerInput& layer);
+
+    // updateSteadyDirty computes the steadyDirty region of the first
+    // 'count' entries.
+    void updateSteadyDirty(size_t count);
+
+    Vector<Entry> mEntries;
+    size_t mSteadyDirtyCount;
+
+    // statistics, for dumpsys
+    uint64_t mNumComputes;
+    uint64_t mNumLayersComputed;
+    uint64_t mNumLayersReused;
+};
+
+// ---------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_VISIBLE_REGION_CACHE_H
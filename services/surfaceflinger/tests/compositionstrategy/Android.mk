@@ -0,0 +1,21 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	CompositionStrategy_test.cpp \
+	FakeHwc.cpp \
+	../../DisplayHardware/CompositionStrategy.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+	libutils \
+	libcutils \
+	liblog \
+
+LOCAL_MODULE:= CompositionStrategy_test
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../..
+
+# Runs on the host, against FakeHwc
+include $(BUILD_HOST_NATIVE_TEST)
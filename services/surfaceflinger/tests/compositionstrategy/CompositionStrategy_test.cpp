@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CompositionStrategyTest"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <utils/Vector.h>
+
+#include "FakeHwc.h"
+#include "DisplayHardware/CompositionStrategy.h"
+
+namespace android {
+
+// The layers of the test scene, from the bottom-most one
+enum {
+    // full screen, opaque: goes to an overlay
+    WALLPAPER = 0,
+    // scaled and resized every frame: blitted by the HWC
+    APP,
+    VIDEO,
+    // skipped by SurfaceFlinger: always composed with GLES, so that the
+    // model sees GLES frames of various sizes
+    STATUS_BAR,
+    DIALOG,
+    NUM_LAYERS
+};
+
+static const int kWidth = 1080;
+static const int kHeight = 1920;
+
+class CompositionStrategyTest : public testing::Test {
+protected:
+    struct Result {
+        Result() : averageCost(0) { }
+        // average cost of the last kMeasuredFrames frames
+        nsecs_t averageCost;
+        // for each frame, the mask of the layers forced to GLES
+        Vector<uint32_t> forced;
+        // for each frame, whether the HWC saw a geometry change
+        Vector<bool> geometryChanged;
+    };
+
+    enum { kMeasuredFrames = 100 };
+    // how many frames it takes for the cost of a frame to be known
+    enum { kCostLatency = 2 };
+
+    CompositionStrategyTest() : mList(NULL) { }
+
+    virtual void SetUp() {
+        const size_t size = sizeof(hwc_display_contents_1_t) +
+                (NUM_LAYERS + 1) * sizeof(hwc_layer_1_t);
+        mList = static_cast<hwc_display_contents_1_t*>(malloc(size));
+        memset(mList, 0, size);
+        mList->numHwLayers = NUM_LAYERS + 1;
+        mList->retireFenceFd = -1;
+    }
+
+    virtual void TearDown() {
+        free(mList);
+    }
+
+    static void setLayer(hwc_layer_1_t& l, int height, bool scaled,
+            bool blended) {
+        l.displayFrame.left = 0;
+        l.displayFrame.top = kHeight - height;
+        l.displayFrame.right = kWidth;
+        l.displayFrame.bottom = kHeight;
+        l.sourceCropf.left = 0;
+        l.sourceCropf.top = 0;
+        l.sourceCropf.right = scaled ? kWidth / 2 : kWidth;
+        l.sourceCropf.bottom = scaled ? height / 2 : height;
+        l.blending = blended ? HWC_BLENDING_PREMULT : HWC_BLENDING_NONE;
+    }
+
+    // setGeometry sets up the list like SurfaceFlinger does when the
+    // geometry changes
+    void setGeometry() {
+        mList->flags = HWC_GEOMETRY_CHANGED;
+        for (size_t i=0 ; i<NUM_LAYERS ; i++) {
+            hwc_layer_1_t& l(mList->hwLayers[i]);
+            l.compositionType = HWC_FRAMEBUFFER;
+            l.flags = (i == STATUS_BAR || i == DIALOG) ? HWC_SKIP_LAYER : 0;
+            l.acquireFenceFd = -1;
+            l.releaseFenceFd = -1;
+            l.planeAlpha = 0xFF;
+        }
+        hwc_layer_1_t& target(mList->hwLayers[NUM_LAYERS]);
+        target.compositionType = HWC_FRAMEBUFFER_TARGET;
+        setLayer(target, kHeight, false, true);
+    }
+
+    // setFrame sets the per-frame data of frame n
+    void setFrame(size_t n) {
+        setLayer(mList->hwLayers[WALLPAPER], kHeight, false, false);
+        setLayer(mList->hwLayers[APP], 400 + (n * 37) % 1400, true, false);
+        setLayer(mList->hwLayers[VIDEO], 300 + (n * 53) % 1200, true, false);
+        setLayer(mList->hwLayers[STATUS_BAR], 50 + (n * 71) % 900,
+                false, true);
+        setLayer(mList->hwLayers[DIALOG], 100 + (n * 29) % 1600,
+                (n % 3) == 0, false);
+    }
+
+    // runFrames composes numFrames frames with hwc, letting strategy pick
+    // the layers to compose with GLES if it isn't NULL.
+    Result runFrames(CompositionStrategy* strategy, FakeHwc& hwc,
+            size_t numFrames, size_t geometryChangeAt = 0) {
+        Result result;
+        Vector<CompositionStrategy::Frame> pendingFrames;
+        Vector<nsecs_t> pendingCosts;
+        nsecs_t totalCost = 0;
+        uint32_t noise = 1;
+
+        for (size_t n=0 ; n<numFrames ; n++) {
+            if (n == 0 || n == geometryChangeAt) {
+                setGeometry();
+            }
+            setFrame(n);
+
+            if (strategy) {
+                strategy->prepareLayers(0, mList, true);
+            }
+            result.geometryChanged.add(mList->flags & HWC_GEOMETRY_CHANGED);
+            hwc.getDevice()->prepare(hwc.getDevice(), 1, &mList);
+            hwc.getDevice()->set(hwc.getDevice(), 1, &mList);
+            mList->flags &= ~HWC_GEOMETRY_CHANGED;
+
+            // +/- 1% of deterministic noise
+            noise = noise * 1103515245 + 12345;
+            nsecs_t cost = hwc.frameCost(mList);
+            cost += cost * (int32_t((noise >> 16) % 201) - 100) / 10000;
+
+            uint32_t forced = 0;
+            for (size_t i=0 ; i<NUM_LAYERS ; i++) {
+                if (mList->hwLayers[i].flags & HWC_SKIP_LAYER) {
+                    forced |= 1 << i;
+                }
+            }
+            result.forced.add(forced);
+            if (n >= numFrames - kMeasuredFrames) {
+                totalCost += cost;
+            }
+
+            if (strategy) {
+                pendingFrames.add(strategy->layersPrepared(0, mList));
+                pendingCosts.add(cost);
+                if (pendingFrames.size() > kCostLatency) {
+                    strategy->addFrameCost(0, pendingFrames[0],
+                            pendingCosts[0]);
+                    pendingFrames.removeAt(0);
+                    pendingCosts.removeAt(0);
+                }
+            }
+        }
+        result.averageCost = totalCost / kMeasuredFrames;
+        return result;
+    }
+
+    static uint32_t skipMask() {
+        return (1 << STATUS_BAR) | (1 << DIALOG);
+    }
+
+    hwc_display_contents_1_t* mList;
+};
+
+TEST_F(CompositionStrategyTest, UnknownStrategy) {
+    EXPECT_TRUE(CompositionStrategy::create("unknown") == NULL);
+    CompositionStrategy* strategy = CompositionStrategy::create("cost");
+    EXPECT_TRUE(strategy != NULL);
+    delete strategy;
+}
+
+TEST_F(CompositionStrategyTest, ForcesExpensiveBlitsToGles) {
+    FakeHwc::Costs costs;
+    costs.blitPerMp = 8000000;
+
+    FakeHwc baselineHwc(2, true, costs);
+    Result baseline(runFrames(NULL, baselineHwc, 600));
+
+    FakeHwc hwc(2, true, costs);
+    CompositionStrategy* strategy = CompositionStrategy::create("cost");
+    Result result(runFrames(strategy, hwc, 600));
+    delete strategy;
+
+    // the blitted layers end up composed with GLES, the overlay stays
+    EXPECT_EQ(skipMask() | (1 << APP) | (1 << VIDEO), result.forced.top());
+    EXPECT_LT(result.averageCost, baseline.averageCost * 9 / 10);
+}
+
+TEST_F(CompositionStrategyTest, KeepsCheapBlits) {
+    FakeHwc::Costs costs;
+    costs.blitPerMp = 500000;
+
+    FakeHwc baselineHwc(2, true, costs);
+    Result baseline(runFrames(NULL, baselineHwc, 600));
+
+    FakeHwc hwc(2, true, costs);
+    CompositionStrategy* strategy = CompositionStrategy::create("cost");
+    Result result(runFrames(strategy, hwc, 600));
+    delete strategy;
+
+    for (size_t n=0 ; n<result.forced.size() ; n++) {
+        EXPECT_EQ(skipMask(), result.forced[n]) << "frame " << n;
+    }
+    EXPECT_EQ(baseline.averageCost, result.averageCost);
+}
+
+TEST_F(CompositionStrategyTest, GeometryChangeResetsChoices) {
+    FakeHwc::Costs costs;
+    costs.blitPerMp = 8000000;
+
+    FakeHwc hwc(2, true, costs);
+    CompositionStrategy* strategy = CompositionStrategy::create("cost");
+    Result result(runFrames(strategy, hwc, 600, 500));
+    delete strategy;
+
+    const uint32_t allForced = skipMask() | (1 << APP) | (1 << VIDEO);
+    EXPECT_EQ(allForced, result.forced[499]);
+    // the HWC picks freely after a geometry change, and SurfaceFlinger's
+    // own skipped layers are left alone
+    EXPECT_EQ(skipMask(), result.forced[500]);
+    EXPECT_EQ(allForced, result.forced[501]);
+}
+
+TEST_F(CompositionStrategyTest, ForcedLayerChangesAreGeometryChanges) {
+    FakeHwc::Costs costs;
+    costs.blitPerMp = 8000000;
+
+    FakeHwc hwc(2, true, costs);
+    CompositionStrategy* strategy = CompositionStrategy::create("cost");
+    Result result(runFrames(strategy, hwc, 600, 500));
+    delete strategy;
+
+    size_t numChanges = 0;
+    for (size_t n=1 ; n<result.forced.size() ; n++) {
+        if (n == 500) {
+            continue;
+        }
+        const bool changed = result.forced[n] != result.forced[n - 1];
+        EXPECT_EQ(changed, result.geometryChanged[n]) << "frame " << n;
+        if (changed) {
+            numChanges++;
+        }
+    }
+    EXPECT_GT(numChanges, 0u);
+}
+
+TEST_F(CompositionStrategyTest, IsDeterministic) {
+    FakeHwc::Costs costs;
+    costs.blitPerMp = 3500000;
+
+    FakeHwc hwc1(2, true, costs);
+    CompositionStrategy* strategy1 = CompositionStrategy::create("cost");
+    Result result1(runFrames(strategy1, hwc1, 400));
+    delete strategy1;
+
+    FakeHwc hwc2(2, true, costs);
+    CompositionStrategy* strategy2 = CompositionStrategy::create("cost");
+    Result result2(runFrames(strategy2, hwc2, 400));
+    delete strategy2;
+
+    ASSERT_EQ(result1.forced.size(), result2.forced.size());
+    for (size_t n=0 ; n<result1.forced.size() ; n++) {
+        EXPECT_EQ(result1.forced[n], result2.forced[n]) << "frame " << n;
+    }
+    EXPECT_EQ(result1.averageCost, result2.averageCost);
+}
+
+}; // namespace android
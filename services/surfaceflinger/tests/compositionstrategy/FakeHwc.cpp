@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "FakeHwc.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+FakeHwc::Costs::Costs()
+    :   base(500000),
+        overlay(100000),
+        blitPerMp(4000000),
+        glesSetup(1000000),
+        glesOpaquePerMp(2000000),
+        glesBlendedPerMp(3000000),
+        glesScaledPerMp(1000000) {
+}
+
+FakeHwc::FakeHwc(size_t numPipes, bool hasBlit, const Costs& costs)
+    :   mNumPipes(numPipes),
+        mHasBlit(hasBlit),
+        mCosts(costs),
+        mNumPrepares(0) {
+    memset(&mDevice, 0, sizeof(mDevice));
+    mDevice.device.common.tag = HARDWARE_DEVICE_TAG;
+    mDevice.device.common.version = HWC_DEVICE_API_VERSION_1_3;
+    mDevice.device.prepare = hook_prepare;
+    mDevice.device.set = hook_set;
+    mDevice.hwc = this;
+}
+
+int FakeHwc::hook_prepare(hwc_composer_device_1_t* dev,
+        size_t numDisplays, hwc_display_contents_1_t** displays) {
+    FakeHwc* hwc = reinterpret_cast<Device*>(dev)->hwc;
+    for (size_t i=0 ; i<numDisplays ; i++) {
+        if (displays[i]) {
+            hwc->prepare(displays[i]);
+        }
+    }
+    hwc->mNumPrepares++;
+    return 0;
+}
+
+int FakeHwc::hook_set(hwc_composer_device_1_t* /*dev*/,
+        size_t numDisplays, hwc_display_contents_1_t** displays) {
+    for (size_t i=0 ; i<numDisplays ; i++) {
+        hwc_display_contents_1_t* list = displays[i];
+        if (list == NULL) {
+            continue;
+        }
+        list->retireFenceFd = -1;
+        for (size_t j=0 ; j<list->numHwLayers ; j++) {
+            list->hwLayers[j].releaseFenceFd = -1;
+        }
+    }
+    return 0;
+}
+
+static bool isScaled(const hwc_layer_1_t& l) {
+    const hwc_frect_t& src(l.sourceCropf);
+    const hwc_rect_t& dst(l.displayFrame);
+    return int(src.right - src.left) != dst.right - dst.left ||
+            int(src.bottom - src.top) != dst.bottom - dst.top;
+}
+
+static double megapixels(const hwc_layer_1_t& l) {
+    const hwc_rect_t& dst(l.displayFrame);
+    return (dst.right - dst.left) * (dst.bottom - dst.top) / 1000000.0;
+}
+
+void FakeHwc::prepare(hwc_display_contents_1_t* list) {
+    size_t freePipes = mNumPipes;
+    for (size_t i=0 ; i<list->numHwLayers ; i++) {
+        hwc_layer_1_t& l(list->hwLayers[i]);
+        if (l.compositionType == HWC_FRAMEBUFFER_TARGET) {
+            continue;
+        }
+        if (l.flags & HWC_SKIP_LAYER) {
+            l.compositionType = HWC_FRAMEBUFFER;
+        } else if (freePipes && !isScaled(l)) {
+            l.compositionType = HWC_OVERLAY;
+            freePipes--;
+        } else if (mHasBlit) {
+            l.compositionType = HWC_BLIT;
+        } else {
+            l.compositionType = HWC_FRAMEBUFFER;
+        }
+    }
+}
+
+nsecs_t FakeHwc::frameCost(const hwc_display_contents_1_t* list) const {
+    double cost = mCosts.base;
+    bool hasGles = false;
+    for (size_t i=0 ; i<list->numHwLayers ; i++) {
+        const hwc_layer_1_t& l(list->hwLayers[i]);
+        const double mp = megapixels(l);
+        switch (l.compositionType) {
+            case HWC_FRAMEBUFFER:
+                hasGles = true;
+                cost += mp * (l.blending == HWC_BLENDING_NONE ?
+                        mCosts.glesOpaquePerMp : mCosts.glesBlendedPerMp);
+                if (isScaled(l)) {
+                    cost += mp * mCosts.glesScaledPerMp;
+                }
+                break;
+            case HWC_BLIT:
+                cost += mp * mCosts.blitPerMp;
+                break;
+            case HWC_OVERLAY:
+                cost += mCosts.overlay;
+                break;
+        }
+    }
+    if (hasGles) {
+        cost += mCosts.glesSetup;
+    }
+    return nsecs_t(cost);
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
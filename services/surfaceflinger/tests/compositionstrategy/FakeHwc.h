@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_FAKE_HWC_H
+#define ANDROID_SF_FAKE_HWC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Timers.h>
+
+#include <hardware/hwcomposer.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// FakeHwc is a deterministic HWC 1.3 device for host tests: its prepare()
+// always makes the same decisions for the same layers, and frameCost()
+// tells how long a composition of the prepared layers takes.
+//
+// Layers are handed to overlay pipes from the bottom-most one, as long as
+// they're neither skipped nor scaled. The other ones are blitted when the
+// blitter is enabled, and composed with GLES otherwise.
+class FakeHwc {
+public:
+    // the simulated costs, in nanoseconds
+    struct Costs {
+        Costs();
+        // the fixed cost of a frame
+        nsecs_t base;
+        // the cost of each overlay
+        nsecs_t overlay;
+        // the cost of a megapixel through the blitter
+        nsecs_t blitPerMp;
+        // the fixed cost of GLES composition
+        nsecs_t glesSetup;
+        // the cost of a megapixel composed with GLES
+        nsecs_t glesOpaquePerMp;
+        nsecs_t glesBlendedPerMp;
+        // the additional cost of a scaled megapixel
+        nsecs_t glesScaledPerMp;
+    };
+
+    FakeHwc(size_t numPipes, bool hasBlit, const Costs& costs);
+
+    hwc_composer_device_1_t* getDevice() { return &mDevice.device; }
+
+    // frameCost returns how long the composition of a list prepared by
+    // this device takes.
+    nsecs_t frameCost(const hwc_display_contents_1_t* list) const;
+
+    size_t getNumPrepares() const { return mNumPrepares; }
+
+private:
+    struct Device {
+        hwc_composer_device_1_t device;
+        FakeHwc* hwc;
+    };
+
+    static int hook_prepare(hwc_composer_device_1_t* dev,
+            size_t numDisplays, hwc_display_contents_1_t** displays);
+    static int hook_set(hwc_composer_device_1_t* dev,
+            size_t numDisplays, hwc_display_contents_1_t** displays);
+
+    void prepare(hwc_display_contents_1_t* list);
+
+    Device mDevice;
+    size_t mNumPipes;
+    bool mHasBlit;
+    Costs mCosts;
+    size_t mNumPrepares;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_FAKE_HWC_H
@@ -0,0 +1,21 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	DispSyncReplay.cpp \
+	../../DispSync.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils \
+	libui \
+
+LOCAL_MODULE:= test-dispsync-replay
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_CFLAGS := -DPRESENT_TIME_OFFSET_FROM_VSYNC_NS=0
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../..
+
+include $(BUILD_EXECUTABLE)
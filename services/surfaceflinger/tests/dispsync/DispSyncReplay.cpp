@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays recorded hardware vsync and present fence timestamps through
+ * DispSync the way SurfaceFlinger drives it: hardware vsync events only
+ * reach the model while they are enabled, and are enabled or disabled
+ * depending on what addResyncSample and addPresentTime return. Reports the
+ * distribution of the error between each hardware vsync and the model's
+ * prediction, and how long hardware vsync stayed enabled.
+ *
+ * usage: test-dispsync-replay [trace-file]
+ *
+ * The trace must list *every* hardware vsync, e.g. recorded with hardware
+ * vsync forced on, so that the predictions can be checked even while the
+ * model runs on its own. Without a trace file, a synthetic trace of a 60Hz
+ * display with jitter, late vsync and present timestamps, and a switch to
+ * 50Hz is used. A trace file has one event per line, in time order:
+ *
+ *   vsync <timestamp>
+ *   present <timestamp>
+ *   period <refresh period>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "../../DispSync.h"
+
+using namespace android;
+
+struct Event {
+    enum Type { VSYNC, PRESENT, PERIOD };
+    Event() : type(VSYNC), value(0) { }
+    Event(Type type, nsecs_t value) : type(type), value(value) { }
+    Type type;
+    nsecs_t value;
+};
+
+// ---------------------------------------------------------------------------
+
+static bool loadTrace(const char* path, Vector<Event>& events) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char type[16];
+        long long value;
+        if (sscanf(line, "%15s %lld", type, &value) != 2) {
+            continue;
+        }
+        if (!strcmp(type, "vsync")) {
+            events.add(Event(Event::VSYNC, value));
+        } else if (!strcmp(type, "present")) {
+            events.add(Event(Event::PRESENT, value));
+        } else if (!strcmp(type, "period")) {
+            events.add(Event(Event::PERIOD, value));
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static void makeSyntheticTrace(Vector<Event>& events) {
+    uint32_t noise = 1;
+    // the actual refresh rates are a bit off their nominal values
+    nsecs_t period = 16672000;
+    nsecs_t vsync = 1004321987;
+
+    events.add(Event(Event::PERIOD, 16666667));
+    for (size_t n = 0; n < 1800; n++) {
+        if (n == 1200) {
+            period = 20006400;
+            events.add(Event(Event::PERIOD, 20000000));
+        }
+        vsync += period;
+
+        // +/- 40us of jitter, and an interrupt handled late now and then
+        noise = noise * 1103515245 + 12345;
+        nsecs_t reported = vsync + int32_t((noise >> 8) % 80001) - 40000;
+        if (n % 97 == 42) {
+            reported += 1500000 + (noise >> 16) % 1500000;
+        }
+        events.add(Event(Event::VSYNC, reported));
+
+        // animations run for a second, every three seconds; a few present
+        // fences are signaled late
+        if ((n / 60) % 3 == 0) {
+            nsecs_t present = vsync;
+            if (n % 53 == 7) {
+                present += 2000000;
+            }
+            events.add(Event(Event::PRESENT, present));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static int compareErrors(const void* a, const void* b) {
+    nsecs_t ea = *static_cast<const nsecs_t*>(a);
+    nsecs_t eb = *static_cast<const nsecs_t*>(b);
+    return ea < eb ? -1 : (ea > eb ? 1 : 0);
+}
+
+static double percentileUs(const Vector<nsecs_t>& sorted, int percentile) {
+    size_t idx = (sorted.size() - 1) * percentile / 100;
+    return sorted[idx] / 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+    Vector<Event> events;
+    if (argc > 1) {
+        if (!loadTrace(argv[1], events)) {
+            return 1;
+        }
+    } else {
+        makeSyntheticTrace(events);
+    }
+
+    DispSync dispSync;
+    bool hwVsyncEnabled = false;
+    bool started = false;
+    nsecs_t lastTimestamp = 0;
+    size_t numVsyncs = 0;
+    size_t numHwVsyncs = 0;
+    size_t numResyncs = 0;
+    Vector<nsecs_t> errors;
+
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event& event(events[i]);
+        if (!started && event.type != Event::PERIOD) {
+            // like resyncToHardwareVsync() when the display is turned on
+            dispSync.reset();
+            dispSync.setPeriod(16666667);
+            started = true;
+        }
+
+        switch (event.type) {
+            case Event::PERIOD:
+                if (!started) {
+                    dispSync.reset();
+                    dispSync.setPeriod(event.value);
+                    started = true;
+                } else {
+                    dispSync.changeRefreshPeriod(event.value, lastTimestamp);
+                }
+                if (!hwVsyncEnabled) {
+                    dispSync.beginResync();
+                    hwVsyncEnabled = true;
+                    numResyncs++;
+                }
+                break;
+
+            case Event::VSYNC: {
+                lastTimestamp = event.value;
+                numVsyncs++;
+                const nsecs_t period = dispSync.getPeriod();
+                if (period > 0) {
+                    const nsecs_t phase = dispSync.getPhase();
+                    nsecs_t error = (event.value - phase) % period;
+                    if (error > period / 2) {
+                        error -= period;
+                    } else if (error < -period / 2) {
+                        error += period;
+                    }
+                    errors.add(error < 0 ? -error : error);
+                }
+                if (hwVsyncEnabled) {
+                    numHwVsyncs++;
+                    if (!dispSync.addResyncSample(event.value)) {
+                        dispSync.endResync();
+                        hwVsyncEnabled = false;
+                    }
+                }
+                break;
+            }
+
+            case Event::PRESENT:
+                lastTimestamp = event.value;
+                if (dispSync.addPresentTime(event.value)) {
+                    if (!hwVsyncEnabled) {
+                        dispSync.beginResync();
+                        hwVsyncEnabled = true;
+                        numResyncs++;
+                    }
+                } else if (hwVsyncEnabled) {
+                    dispSync.endResync();
+                    hwVsyncEnabled = false;
+                }
+                break;
+        }
+    }
+
+    if (errors.isEmpty()) {
+        fprintf(stderr, "no vsync events to replay\n");
+        return 1;
+    }
+    qsort(errors.editArray(), errors.size(), sizeof(nsecs_t), compareErrors);
+    double sum = 0;
+    for (size_t i = 0; i < errors.size(); i++) {
+        sum += errors[i];
+    }
+
+    printf("%zu vsync events, hardware vsync enabled for %zu (%.1f%%), "
+            "%zu resyncs\n", numVsyncs, numHwVsyncs,
+            100.0 * numHwVsyncs / numVsyncs, numResyncs);
+    printf("phase error: mean %.1f us, p50 %.1f us, p90 %.1f us, "
+            "p99 %.1f us, max %.1f us\n", sum / errors.size() / 1000.0,
+            percentileUs(errors, 50), percentileUs(errors, 90),
+            percentileUs(errors, 99), errors.top() / 1000.0);
+
+    String8 result;
+    dispSync.dump(result);
+    printf("%s", result.string());
+    return 0;
+}
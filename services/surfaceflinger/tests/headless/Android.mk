@@ -0,0 +1,54 @@
+# Headless stand-ins for the display HALs, see HeadlessHwc.cpp, and a
+# handleMessageRefresh benchmark to run on them
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	HeadlessHwc.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+	libsync \
+	libutils \
+
+LOCAL_MODULE:= hwcomposer.headless
+LOCAL_MODULE_RELATIVE_PATH := hw
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	HeadlessGralloc.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog \
+
+LOCAL_MODULE:= gralloc.headless
+LOCAL_MODULE_RELATIVE_PATH := hw
+
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	RefreshBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+LOCAL_MODULE:= sf_refresh_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
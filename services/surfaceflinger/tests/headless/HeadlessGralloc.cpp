@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// gralloc.headless: a gralloc module without any graphics hardware, for
+// running SurfaceFlinger in containers. See HeadlessHwc.cpp for how to use
+// it. There is no framebuffer device, the headless HWC stands in for the
+// display.
+
+#define LOG_TAG "HeadlessGralloc"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+
+#include <hardware/gralloc.h>
+#include <hardware/hardware.h>
+
+#include "HeadlessGralloc.h"
+
+using namespace android;
+
+// ---------------------------------------------------------------------------
+
+static inline int align(int value, int alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// getLayout computes the stride, in pixels, and the size of a buffer. All
+// the YUV formats use the layouts the framework expects from their public
+// definitions: YV12 with 16-pixel aligned strides, and NV21 for the
+// flexible format.
+static int getLayout(int w, int h, int format, int* stride, size_t* size) {
+    if (w <= 0 || h <= 0) {
+        return -EINVAL;
+    }
+    const int alignedW = align(w, 16);
+    size_t bpp = 0;
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+        case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED:
+            bpp = 4;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            bpp = 3;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_RAW_SENSOR:
+        case HAL_PIXEL_FORMAT_Y16:
+            bpp = 2;
+            break;
+        case HAL_PIXEL_FORMAT_Y8:
+            bpp = 1;
+            break;
+        case HAL_PIXEL_FORMAT_BLOB:
+            // w is a size in bytes
+            *stride = w;
+            *size = size_t(w) * h;
+            return 0;
+        case HAL_PIXEL_FORMAT_YV12: {
+            const size_t cStride = align(alignedW / 2, 16);
+            *stride = alignedW;
+            *size = size_t(alignedW) * h + 2 * cStride * ((h + 1) / 2);
+            return 0;
+        }
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+            *stride = alignedW;
+            *size = size_t(alignedW) * h + size_t(alignedW) * ((h + 1) / 2);
+            return 0;
+        default:
+            return -EINVAL;
+    }
+    *stride = alignedW;
+    *size = size_t(alignedW) * h * bpp;
+    return 0;
+}
+
+static int mapBuffer(headless_handle_t* h) {
+    void* base = mmap(NULL, h->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            h->fd, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("can't map buffer (%s)", strerror(errno));
+        h->base = 0;
+        return -errno;
+    }
+    h->base = uintptr_t(base);
+    return 0;
+}
+
+static void unmapBuffer(headless_handle_t* h) {
+    if (h->base) {
+        munmap(reinterpret_cast<void*>(uintptr_t(h->base)), h->size);
+        h->base = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// gralloc_module_t
+
+static int headless_register_buffer(gralloc_module_t const* /*module*/,
+        buffer_handle_t handle) {
+    headless_handle_t* h = const_cast<headless_handle_t*>(
+            headless_handle_t::validate(handle));
+    if (h == NULL) {
+        return -EINVAL;
+    }
+    // the base came from the process which created the handle
+    h->base = 0;
+    return mapBuffer(h);
+}
+
+static int headless_unregister_buffer(gralloc_module_t const* /*module*/,
+        buffer_handle_t handle) {
+    headless_handle_t* h = const_cast<headless_handle_t*>(
+            headless_handle_t::validate(handle));
+    if (h == NULL) {
+        return -EINVAL;
+    }
+    unmapBuffer(h);
+    return 0;
+}
+
+static int headless_lock(gralloc_module_t const* /*module*/,
+        buffer_handle_t handle, int /*usage*/, int /*l*/, int /*t*/,
+        int /*w*/, int /*h*/, void** vaddr) {
+    const headless_handle_t* h = headless_handle_t::validate(handle);
+    if (h == NULL || h->base == 0) {
+        return -EINVAL;
+    }
+    *vaddr = reinterpret_cast<void*>(uintptr_t(h->base));
+    return 0;
+}
+
+static int headless_unlock(gralloc_module_t const* /*module*/,
+        buffer_handle_t handle) {
+    // the mappings are coherent, there is nothing to flush
+    return headless_handle_t::validate(handle) ? 0 : -EINVAL;
+}
+
+static int headless_lock_ycbcr(gralloc_module_t const* /*module*/,
+        buffer_handle_t handle, int /*usage*/, int /*l*/, int /*t*/,
+        int /*w*/, int /*h*/, android_ycbcr* ycbcr) {
+    const headless_handle_t* h = headless_handle_t::validate(handle);
+    if (h == NULL || h->base == 0) {
+        return -EINVAL;
+    }
+    uint8_t* base = reinterpret_cast<uint8_t*>(uintptr_t(h->base));
+    const size_t ySize = size_t(h->stride) * h->height;
+    memset(ycbcr->reserved, 0, sizeof(ycbcr->reserved));
+    switch (h->format) {
+        case HAL_PIXEL_FORMAT_YV12: {
+            const size_t cStride = align(h->stride / 2, 16);
+            const size_t cSize = cStride * ((h->height + 1) / 2);
+            ycbcr->y = base;
+            ycbcr->cr = base + ySize;
+            ycbcr->cb = base + ySize + cSize;
+            ycbcr->ystride = h->stride;
+            ycbcr->cstride = cStride;
+            ycbcr->chroma_step = 1;
+            return 0;
+        }
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+            ycbcr->y = base;
+            ycbcr->cr = base + ySize;
+            ycbcr->cb = base + ySize + 1;
+            ycbcr->ystride = h->stride;
+            ycbcr->cstride = h->stride;
+            ycbcr->chroma_step = 2;
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// alloc_device_t
+
+static volatile int32_t sNumBuffers = 0;
+
+static int headless_alloc(alloc_device_t* /*dev*/, int w, int h, int format,
+        int usage, buffer_handle_t* handle, int* stride) {
+    int bufferStride = 0;
+    size_t size = 0;
+    int err = getLayout(w, h, format, &bufferStride, &size);
+    if (err) {
+        ALOGE("unsupported buffer %dx%d, format %#x", w, h, format);
+        return err;
+    }
+    size = align(size, getpagesize());
+
+    int fd = ashmem_create_region("headless-gralloc-buffer", size);
+    if (fd < 0) {
+        ALOGE("can't create a %zu bytes region (%s)", size, strerror(errno));
+        return -ENOMEM;
+    }
+
+    headless_handle_t* hnd = static_cast<headless_handle_t*>(
+            native_handle_create(headless_handle_t::sNumFds,
+                    headless_handle_t::numInts()));
+    if (hnd == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+    hnd->fd = fd;
+    hnd->magic = headless_handle_t::MAGIC;
+    hnd->size = size;
+    hnd->width = w;
+    hnd->height = h;
+    hnd->format = format;
+    hnd->stride = bufferStride;
+    hnd->usage = usage;
+    hnd->base = 0;
+
+    // the allocating process may lock its buffers without registering them
+    err = mapBuffer(hnd);
+    if (err) {
+        native_handle_close(hnd);
+        native_handle_delete(hnd);
+        return err;
+    }
+
+    android_atomic_inc(&sNumBuffers);
+    *handle = hnd;
+    *stride = bufferStride;
+    return 0;
+}
+
+static int headless_free(alloc_device_t* /*dev*/, buffer_handle_t handle) {
+    headless_handle_t* h = const_cast<headless_handle_t*>(
+            headless_handle_t::validate(handle));
+    if (h == NULL) {
+        return -EINVAL;
+    }
+    unmapBuffer(h);
+    native_handle_close(h);
+    native_handle_delete(h);
+    android_atomic_dec(&sNumBuffers);
+    return 0;
+}
+
+static void headless_dump(alloc_device_t* /*dev*/, char* buff, int buff_len) {
+    snprintf(buff, buff_len, "headless gralloc: %d buffers allocated\n",
+            android_atomic_acquire_load(&sNumBuffers));
+}
+
+static int headless_close_alloc(hw_device_t* dev) {
+    free(dev);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int headless_device_open(const hw_module_t* module, const char* name,
+        hw_device_t** device) {
+    if (strcmp(name, GRALLOC_HARDWARE_GPU0)) {
+        // there is no framebuffer device
+        return -EINVAL;
+    }
+    alloc_device_t* dev = static_cast<alloc_device_t*>(
+            calloc(1, sizeof(alloc_device_t)));
+    if (dev == NULL) {
+        return -ENOMEM;
+    }
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = 0;
+    dev->common.module = const_cast<hw_module_t*>(module);
+    dev->common.close = headless_close_alloc;
+    dev->alloc = headless_alloc;
+    dev->free = headless_free;
+    dev->dump = headless_dump;
+    *device = &dev->common;
+    return 0;
+}
+
+static struct hw_module_methods_t headless_module_methods = {
+    .open = headless_device_open,
+};
+
+struct gralloc_module_t HAL_MODULE_INFO_SYM = {
+    .common = {
+        .tag = HARDWARE_MODULE_TAG,
+        .module_api_version = GRALLOC_MODULE_API_VERSION_0_2,
+        .hal_api_version = HARDWARE_HAL_API_VERSION,
+        .id = GRALLOC_HARDWARE_MODULE_ID,
+        .name = "Headless graphics memory allocator",
+        .author = "The Android Open Source Project",
+        .methods = &headless_module_methods,
+    },
+    .registerBuffer = headless_register_buffer,
+    .unregisterBuffer = headless_unregister_buffer,
+    .lock = headless_lock,
+    .unlock = headless_unlock,
+    .lock_ycbcr = headless_lock_ycbcr,
+};
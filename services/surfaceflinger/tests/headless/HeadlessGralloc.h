@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_HEADLESS_GRALLOC_H
+#define ANDROID_SF_HEADLESS_GRALLOC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <cutils/native_handle.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// The buffers of the headless gralloc are ashmem regions, which libcutils
+// emulates with shared memory files on Linux hosts. Every buffer can be
+// mapped by the CPU regardless of its usage bits, so a software GLES
+// implementation can render into them and HWC stand-ins can read them.
+struct headless_handle_t : public native_handle {
+    enum {
+        MAGIC = 0x48444c53, // 'HDLS'
+    };
+
+    // the ashmem region, which is the only fd of the handle
+    int fd;
+
+    int magic;
+    int size;
+    int width;
+    int height;
+    int format;
+    // in pixels, or in bytes for HAL_PIXEL_FORMAT_BLOB
+    int stride;
+    int usage;
+
+    // the address of the mapping in the current process, it is reset when
+    // a handle is registered since it's meaningless in other processes
+    uint64_t base;
+
+    static const int sNumFds = 1;
+    static int numInts() {
+        return (sizeof(headless_handle_t) - sizeof(native_handle)) /
+                sizeof(int) - sNumFds;
+    }
+
+    static const headless_handle_t* validate(buffer_handle_t handle) {
+        const headless_handle_t* h =
+                static_cast<const headless_handle_t*>(handle);
+        if (h == NULL || h->version != sizeof(native_handle) ||
+                h->numFds != sNumFds || h->numInts != numInts() ||
+                h->magic != MAGIC) {
+            return NULL;
+        }
+        return h;
+    }
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_HEADLESS_GRALLOC_H
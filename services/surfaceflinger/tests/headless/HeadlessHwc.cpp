@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// hwcomposer.headless: a HWC 1.4 stand-in for running SurfaceFlinger
+// without a display, e.g. to measure handleMessageRefresh in a container
+// with sf_refresh_benchmark.
+//
+// - every layer is composed with GLES, the framebuffer target is the only
+//   thing "displayed": set() waits for it to be rendered and releases it.
+// - vsync is generated in software on a fixed grid: the timestamp of each
+//   event is a multiple of the refresh period, whatever the scheduling
+//   latency of the thread, so DispSync sees a perfect display.
+//
+// To use it, install hwcomposer.headless.so and gralloc.headless.so in
+// /system/lib/hw and set ro.hardware=headless so that libhardware picks
+// them in every process (the applications map the buffers of the headless
+// gralloc too). The only GLES driver in /system/lib/egl must be a software
+// one. Transaction_test also needs framebuffer objects for its screenshots,
+// which libGLES_android doesn't have. SurfaceFlinger is built with
+// TARGET_USES_HEADLESS_DISPLAY := true to make its contexts current without
+// a surface when the EGL has EGL_KHR_surfaceless_context.
+//
+// The primary display is configured with these properties:
+//   debug.headless.width, debug.headless.height  (1080x1920)
+//   debug.headless.dpi                           (320)
+//   debug.headless.fps                           (60)
+
+#define LOG_TAG "HeadlessHwc"
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Trace.h>
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+
+#include <sync/sync.h>
+
+using namespace android;
+
+// ---------------------------------------------------------------------------
+
+// how long set() waits for GLES to be done with the framebuffer target
+static const int kFramebufferTimeoutMs = 3000;
+
+// VSyncThread delivers the vsync events of the primary display. Event n
+// is delivered at n * period on the monotonic clock, and reports that
+// time: a late wakeup delays the callback but never shifts the timestamps.
+// Events the thread slept through entirely are dropped and counted.
+class VSyncThread : public Thread {
+public:
+    VSyncThread(nsecs_t period)
+        :   mPeriod(period), mProcs(NULL), mEnabled(false),
+            mNextVSync(0), mNumVSyncs(0), mNumMissed(0) {
+    }
+
+    void setProcs(const hwc_procs_t* procs) {
+        Mutex::Autolock _l(mLock);
+        mProcs = procs;
+    }
+
+    void setEnabled(bool enabled) {
+        Mutex::Autolock _l(mLock);
+        if (mEnabled != enabled) {
+            mEnabled = enabled;
+            if (enabled) {
+                // restart on the grid, from the next period
+                const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+                mNextVSync = (now / mPeriod + 1) * mPeriod;
+            }
+            mCondition.signal();
+        }
+    }
+
+    void dump(String8& result) {
+        Mutex::Autolock _l(mLock);
+        result.appendFormat("  vsync: %s, %llu events, %llu missed\n",
+                mEnabled ? "on" : "off",
+                (unsigned long long)mNumVSyncs,
+                (unsigned long long)mNumMissed);
+    }
+
+private:
+    virtual bool threadLoop() {
+        nsecs_t vsync;
+        {
+            Mutex::Autolock _l(mLock);
+            while (!mEnabled) {
+                mCondition.wait(mLock);
+            }
+            vsync = mNextVSync;
+            const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (now - vsync >= mPeriod) {
+                const nsecs_t missed = (now - vsync) / mPeriod;
+                mNumMissed += missed;
+                vsync += missed * mPeriod;
+            }
+            mNextVSync = vsync + mPeriod;
+        }
+
+        struct timespec spec;
+        spec.tv_sec  = vsync / 1000000000;
+        spec.tv_nsec = vsync % 1000000000;
+        int err;
+        do {
+            err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+        } while (err == EINTR);
+
+        const hwc_procs_t* procs;
+        {
+            Mutex::Autolock _l(mLock);
+            if (!mEnabled) {
+                // disabled while we were sleeping
+                return true;
+            }
+            procs = mProcs;
+            mNumVSyncs++;
+        }
+        if (procs && procs->vsync) {
+            procs->vsync(procs, HWC_DISPLAY_PRIMARY, vsync);
+        }
+        return true;
+    }
+
+    const nsecs_t mPeriod;
+    Mutex mLock;
+    Condition mCondition;
+    const hwc_procs_t* mProcs;
+    bool mEnabled;
+    nsecs_t mNextVSync;
+    uint64_t mNumVSyncs;
+    uint64_t mNumMissed;
+};
+
+struct headless_hwc_t {
+    hwc_composer_device_1_t device;
+
+    int32_t width;
+    int32_t height;
+    int32_t dpi;
+    nsecs_t period;
+    int powerMode;
+    sp<VSyncThread> vsyncThread;
+
+    // number of frames set() was called with, for each display type
+    uint64_t numFrames[HWC_NUM_DISPLAY_TYPES];
+    // number of framebuffer targets set() timed out waiting for
+    uint64_t numTimeouts;
+};
+
+static headless_hwc_t* getHwc(hwc_composer_device_1_t* dev) {
+    return reinterpret_cast<headless_hwc_t*>(dev);
+}
+
+static int32_t getIntProperty(const char* name, int32_t defaultValue) {
+    char value[PROPERTY_VALUE_MAX];
+    property_get(name, value, "");
+    int32_t result = atoi(value);
+    return result > 0 ? result : defaultValue;
+}
+
+static void closeFence(int& fd) {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static int headless_prepare(hwc_composer_device_1_t* /*dev*/,
+        size_t numDisplays, hwc_display_contents_1_t** displays) {
+    for (size_t i=0 ; i<numDisplays ; i++) {
+        hwc_display_contents_1_t* list = displays[i];
+        if (list == NULL) {
+            continue;
+        }
+        for (size_t j=0 ; j<list->numHwLayers ; j++) {
+            hwc_layer_1_t& l(list->hwLayers[j]);
+            if (l.compositionType != HWC_FRAMEBUFFER_TARGET) {
+                l.compositionType = HWC_FRAMEBUFFER;
+            }
+        }
+    }
+    return 0;
+}
+
+static int headless_set(hwc_composer_device_1_t* dev,
+        size_t numDisplays, hwc_display_contents_1_t** displays) {
+    ATRACE_CALL();
+    headless_hwc_t* hwc = getHwc(dev);
+    for (size_t i=0 ; i<numDisplays ; i++) {
+        hwc_display_contents_1_t* list = displays[i];
+        if (list == NULL) {
+            continue;
+        }
+        for (size_t j=0 ; j<list->numHwLayers ; j++) {
+            hwc_layer_1_t& l(list->hwLayers[j]);
+            if (l.compositionType == HWC_FRAMEBUFFER_TARGET &&
+                    i == HWC_DISPLAY_PRIMARY && l.acquireFenceFd >= 0) {
+                // "scan out" the frame, so that frames are timed until
+                // their composition is done
+                if (sync_wait(l.acquireFenceFd,
+                        kFramebufferTimeoutMs) < 0) {
+                    ALOGE("framebuffer target not ready after %d ms",
+                            kFramebufferTimeoutMs);
+                    hwc->numTimeouts++;
+                }
+            }
+            closeFence(l.acquireFenceFd);
+            // buffers are released as soon as set() returns
+            l.releaseFenceFd = -1;
+        }
+        if (i >= HWC_DISPLAY_VIRTUAL) {
+            closeFence(list->outbufAcquireFenceFd);
+        }
+        list->retireFenceFd = -1;
+        hwc->numFrames[i < HWC_DISPLAY_VIRTUAL ? i : HWC_DISPLAY_VIRTUAL]++;
+    }
+    return 0;
+}
+
+static int headless_event_control(hwc_composer_device_1_t* dev, int disp,
+        int event, int enabled) {
+    if (disp != HWC_DISPLAY_PRIMARY || event != HWC_EVENT_VSYNC) {
+        return -EINVAL;
+    }
+    getHwc(dev)->vsyncThread->setEnabled(enabled != 0);
+    return 0;
+}
+
+static int headless_set_power_mode(hwc_composer_device_1_t* dev, int disp,
+        int mode) {
+    if (disp != HWC_DISPLAY_PRIMARY) {
+        return -EINVAL;
+    }
+    getHwc(dev)->powerMode = mode;
+    return 0;
+}
+
+static int headless_query(hwc_composer_device_1_t* dev, int what,
+        int* value) {
+    switch (what) {
+        case HWC_BACKGROUND_LAYER_SUPPORTED:
+            *value = 0;
+            return 0;
+        case HWC_VSYNC_PERIOD:
+            *value = int(getHwc(dev)->period);
+            return 0;
+        case HWC_DISPLAY_TYPES_SUPPORTED:
+            *value = HWC_DISPLAY_PRIMARY_BIT | HWC_DISPLAY_VIRTUAL_BIT;
+            return 0;
+        default:
+            return -EINVAL;
+    }
+}
+
+static void headless_register_procs(hwc_composer_device_1_t* dev,
+        hwc_procs_t const* procs) {
+    getHwc(dev)->vsyncThread->setProcs(procs);
+}
+
+static void headless_dump(hwc_composer_device_1_t* dev, char* buff,
+        int buff_len) {
+    headless_hwc_t* hwc = getHwc(dev);
+    String8 result;
+    result.appendFormat("  headless display: %dx%d, %d dpi, "
+            "%.2f fps, power mode %d\n",
+            hwc->width, hwc->height, hwc->dpi, 1e9 / hwc->period,
+            hwc->powerMode);
+    hwc->vsyncThread->dump(result);
+    result.appendFormat("  frames: primary=%llu, virtual=%llu, "
+            "framebuffer timeouts=%llu\n",
+            (unsigned long long)hwc->numFrames[HWC_DISPLAY_PRIMARY],
+            (unsigned long long)hwc->numFrames[HWC_DISPLAY_VIRTUAL],
+            (unsigned long long)hwc->numTimeouts);
+    strlcpy(buff, result.string(), buff_len);
+}
+
+static int headless_get_display_configs(hwc_composer_device_1_t* /*dev*/,
+        int disp, uint32_t* configs, size_t* numConfigs) {
+    if (disp != HWC_DISPLAY_PRIMARY) {
+        // there is no external display
+        return -EINVAL;
+    }
+    if (*numConfigs > 0) {
+        configs[0] = 0;
+        *numConfigs = 1;
+    }
+    return 0;
+}
+
+static int headless_get_display_attributes(hwc_composer_device_1_t* dev,
+        int disp, uint32_t config, const uint32_t* attributes,
+        int32_t* values) {
+    if (disp != HWC_DISPLAY_PRIMARY || config != 0) {
+        return -EINVAL;
+    }
+    headless_hwc_t* hwc = getHwc(dev);
+    for (size_t i=0 ; attributes[i] != HWC_DISPLAY_NO_ATTRIBUTE ; i++) {
+        switch (attributes[i]) {
+            case HWC_DISPLAY_VSYNC_PERIOD:
+                values[i] = int32_t(hwc->period);
+                break;
+            case HWC_DISPLAY_WIDTH:
+                values[i] = hwc->width;
+                break;
+            case HWC_DISPLAY_HEIGHT:
+                values[i] = hwc->height;
+                break;
+            case HWC_DISPLAY_DPI_X:
+            case HWC_DISPLAY_DPI_Y:
+                values[i] = hwc->dpi * 1000;
+                break;
+            default:
+                values[i] = 0;
+                break;
+        }
+    }
+    return 0;
+}
+
+static int headless_get_active_config(hwc_composer_device_1_t* /*dev*/,
+        int disp) {
+    return disp == HWC_DISPLAY_PRIMARY ? 0 : -EINVAL;
+}
+
+static int headless_set_active_config(hwc_composer_device_1_t* /*dev*/,
+        int disp, int index) {
+    return (disp == HWC_DISPLAY_PRIMARY && index == 0) ? 0 : -EINVAL;
+}
+
+static int headless_set_cursor_position_async(
+        hwc_composer_device_1_t* /*dev*/, int /*disp*/, int /*x*/,
+        int /*y*/) {
+    // cursor layers are composed with GLES like all the others
+    return -EINVAL;
+}
+
+static int headless_close(hw_device_t* device) {
+    headless_hwc_t* hwc = reinterpret_cast<headless_hwc_t*>(device);
+    hwc->vsyncThread->setEnabled(false);
+    hwc->vsyncThread->requestExitAndWait();
+    delete hwc;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int headless_open(const hw_module_t* module, const char* name,
+        hw_device_t** device) {
+    if (strcmp(name, HWC_HARDWARE_COMPOSER)) {
+        return -EINVAL;
+    }
+
+    headless_hwc_t* hwc = new headless_hwc_t;
+    memset(&hwc->device, 0, sizeof(hwc->device));
+    hwc->width = getIntProperty("debug.headless.width", 1080);
+    hwc->height = getIntProperty("debug.headless.height", 1920);
+    hwc->dpi = getIntProperty("debug.headless.dpi", 320);
+    hwc->period = nsecs_t(1e9 / getIntProperty("debug.headless.fps", 60));
+    hwc->powerMode = HWC_POWER_MODE_NORMAL;
+    memset(hwc->numFrames, 0, sizeof(hwc->numFrames));
+    hwc->numTimeouts = 0;
+
+    // the thread is blocked until vsync is enabled, the procs are
+    // registered before that
+    hwc->vsyncThread = new VSyncThread(hwc->period);
+    hwc->vsyncThread->run("HeadlessVSync", PRIORITY_URGENT_DISPLAY);
+
+    hwc_composer_device_1_t& dev(hwc->device);
+    dev.common.tag = HARDWARE_DEVICE_TAG;
+    dev.common.version = HWC_DEVICE_API_VERSION_1_4;
+    dev.common.module = const_cast<hw_module_t*>(module);
+    dev.common.close = headless_close;
+    dev.prepare = headless_prepare;
+    dev.set = headless_set;
+    dev.eventControl = headless_event_control;
+    dev.setPowerMode = headless_set_power_mode;
+    dev.query = headless_query;
+    dev.registerProcs = headless_register_procs;
+    dev.dump = headless_dump;
+    dev.getDisplayConfigs = headless_get_display_configs;
+    dev.getDisplayAttributes = headless_get_display_attributes;
+    dev.getActiveConfig = headless_get_active_config;
+    dev.setActiveConfig = headless_set_active_config;
+    dev.setCursorPositionAsync = headless_set_cursor_position_async;
+
+    ALOGI("headless display: %dx%d, %d dpi, %" PRId64 " ns period",
+            hwc->width, hwc->height, hwc->dpi, hwc->period);
+
+    *device = &dev.common;
+    return 0;
+}
+
+static struct hw_module_methods_t headless_module_methods = {
+    .open = headless_open,
+};
+
+hwc_module_t HAL_MODULE_INFO_SYM = {
+    .common = {
+        .tag = HARDWARE_MODULE_TAG,
+        .module_api_version = HWC_MODULE_API_VERSION_0_1,
+        .hal_api_version = HARDWARE_HAL_API_VERSION,
+        .id = HWC_HARDWARE_MODULE_ID,
+        .name = "Headless hwcomposer module",
+        .author = "The Android Open Source Project",
+        .methods = &headless_module_methods,
+    },
+};
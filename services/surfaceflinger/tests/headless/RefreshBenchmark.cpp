@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// sf_refresh_benchmark: measures SurfaceFlinger::handleMessageRefresh()
+// while a stack of layers is updated on every frame, and fails if it got
+// slower than a given bound. Meant to run against the headless HALs (see
+// HeadlessHwc.cpp), whose vsync is deterministic, to catch performance
+// regressions in CI containers.
+//
+// usage: sf_refresh_benchmark [-l layers] [-f frames] [-m max_p99_us]
+//
+// The durations are the ones SurfaceFlinger records itself, see
+// dumpsys SurfaceFlinger --refresh-stats. The exit status is 1 if the
+// 99th percentile is above max_p99_us, 2 if the benchmark couldn't run.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cutils/memory.h>
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+
+#include <gui/ISurfaceComposer.h>
+#include <gui/Surface.h>
+#include <gui/SurfaceComposerClient.h>
+
+#include <ui/DisplayInfo.h>
+
+using namespace android;
+
+// frames posted before the statistics are cleared, so that the buffers
+// are allocated and the caches are warm
+static const int WARMUP_FRAMES = 30;
+
+static String8 dumpSurfaceFlinger(const char* option) {
+    String8 result;
+    sp<IBinder> sf(defaultServiceManager()->checkService(
+            String16("SurfaceFlinger")));
+    int fds[2];
+    if (sf == NULL || pipe(fds) < 0) {
+        return result;
+    }
+    Vector<String16> args;
+    args.add(String16(option));
+    sf->dump(fds[1], args);
+    close(fds[1]);
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+        result.append(buf, n);
+    }
+    close(fds[0]);
+    return result;
+}
+
+static bool postFrame(const Vector< sp<Surface> >& surfaces, int frame) {
+    for (size_t i=0 ; i<surfaces.size() ; i++) {
+        ANativeWindow_Buffer buffer;
+        if (surfaces[i]->lock(&buffer, NULL) != NO_ERROR) {
+            return false;
+        }
+        // a different color on every frame, with some translucency
+        const uint32_t color = 0x80000000 | ((frame * 0x10203 + i * 0x3050)
+                & 0xFFFFFF);
+        android_memset32((uint32_t*)buffer.bits, color,
+                buffer.stride * buffer.height * 4);
+        surfaces[i]->unlockAndPost();
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int numLayers = 8;
+    int numFrames = 600;
+    uint64_t maxP99Us = 0;
+    int c;
+    while ((c = getopt(argc, argv, "l:f:m:")) != -1) {
+        switch (c) {
+            case 'l': numLayers = atoi(optarg); break;
+            case 'f': numFrames = atoi(optarg); break;
+            case 'm': maxP99Us = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-l layers] [-f frames] "
+                        "[-m max_p99_us]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    ProcessState::self()->startThreadPool();
+
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient();
+    if (client->initCheck() != NO_ERROR) {
+        fprintf(stderr, "can't connect to SurfaceFlinger\n");
+        return 2;
+    }
+
+    sp<IBinder> display(SurfaceComposerClient::getBuiltInDisplay(
+            ISurfaceComposer::eDisplayIdMain));
+    DisplayInfo info;
+    if (SurfaceComposerClient::getDisplayInfo(display, &info) != NO_ERROR) {
+        fprintf(stderr, "can't get the main display\n");
+        return 2;
+    }
+
+    // full-width layers, each one covering half of the display and
+    // overlapping the ones below it
+    Vector< sp<SurfaceControl> > controls;
+    Vector< sp<Surface> > surfaces;
+    SurfaceComposerClient::openGlobalTransaction();
+    for (int i=0 ; i<numLayers ; i++) {
+        sp<SurfaceControl> sc = client->createSurface(
+                String8::format("RefreshBenchmark %d", i),
+                info.w, info.h / 2, PIXEL_FORMAT_RGBA_8888, 0);
+        if (sc == NULL || !sc->isValid()) {
+            SurfaceComposerClient::closeGlobalTransaction();
+            fprintf(stderr, "can't create layer %d\n", i);
+            return 2;
+        }
+        sc->setLayer(100000 + i);
+        sc->setPosition(0, (info.h / 2) * i / numLayers);
+        sc->show();
+        controls.add(sc);
+        surfaces.add(sc->getSurface());
+    }
+    SurfaceComposerClient::closeGlobalTransaction(true);
+
+    // lock() blocks once all the buffers of a layer are queued, until
+    // SurfaceFlinger latched one, which paces us at vsync.
+    int frame = 0;
+    for ( ; frame<WARMUP_FRAMES ; frame++) {
+        if (!postFrame(surfaces, frame)) {
+            fprintf(stderr, "can't post frame %d\n", frame);
+            return 2;
+        }
+    }
+    dumpSurfaceFlinger("--refresh-stats-clear");
+    for (int i=0 ; i<numFrames ; i++, frame++) {
+        if (!postFrame(surfaces, frame)) {
+            fprintf(stderr, "can't post frame %d\n", frame);
+            return 2;
+        }
+    }
+    const String8 stats(dumpSurfaceFlinger("--refresh-stats"));
+    client->dispose();
+
+    unsigned int count;
+    uint64_t mean, p50, p90, p99, max;
+    if (sscanf(stats.string(), "refresh: count=%u mean=%" SCNu64
+            " p50=%" SCNu64 " p90=%" SCNu64 " p99=%" SCNu64 " max=%" SCNu64,
+            &count, &mean, &p50, &p90, &p99, &max) != 6 || count == 0) {
+        fprintf(stderr, "no refresh statistics: %s\n", stats.string());
+        return 2;
+    }
+
+    printf("%d layers, %d frames: %u refreshes, mean=%" PRIu64 "us "
+            "p50=%" PRIu64 "us p90=%" PRIu64 "us p99=%" PRIu64 "us "
+            "max=%" PRIu64 "us\n", numLayers, numFrames, count, mean, p50,
+            p90, p99, max);
+    if (maxP99Us && p99 > maxP99Us) {
+        printf("FAIL: p99 above %" PRIu64 "us\n", maxP99Us);
+        return 1;
+    }
+    return 0;
+}
@@ -14,11 +14,89 @@
  * limitations under the License.
  */
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <utils/Errors.h>
+#include <utils/Timers.h>
+#include <ui/Region.h>
 #include "../../Transform.h"
 
 using namespace android;
 
+// transforms the 4 corners of r one by one
+static Rect transformCorners(const Transform& tr, const Rect& r)
+{
+    const vec2 c[4] = {
+        tr.transform(r.left,  r.top),
+        tr.transform(r.right, r.top),
+        tr.transform(r.left,  r.bottom),
+        tr.transform(r.right, r.bottom),
+    };
+    float l = c[0].x, t = c[0].y, rt = c[0].x, b = c[0].y;
+    for (int i=1 ; i<4 ; i++) {
+        l = fminf(l, c[i].x);   rt = fmaxf(rt, c[i].x);
+        t = fminf(t, c[i].y);   b  = fmaxf(b,  c[i].y);
+    }
+    return Rect(floorf(l + 0.5f), floorf(t + 0.5f),
+            floorf(rt + 0.5f), floorf(b + 0.5f));
+}
+
+// checks the batched transforms against the scalar ones, and times the
+// transformation of a region with many rects
+static int checkBatched(const char* name, const Transform& tr)
+{
+    enum { NUM_RECTS = 1000 };
+    Rect in[NUM_RECTS], out[NUM_RECTS];
+    vec2 points[NUM_RECTS], tpoints[NUM_RECTS];
+    Region region;
+    for (int i=0 ; i<NUM_RECTS ; i++) {
+        int l = rand() % 2000 - 1000;
+        int t = rand() % 2000 - 1000;
+        in[i] = Rect(l, t, l + rand() % 200 + 1, t + rand() % 200 + 1);
+        points[i] = vec2(l, t);
+        region.orSelf(Rect(l + 1000, t + 1000, in[i].right + 1000,
+                in[i].bottom + 1000));
+    }
+
+    int errors = 0;
+    tr.transform(out, in, NUM_RECTS);
+    tr.transform(tpoints, points, NUM_RECTS);
+    for (int i=0 ; i<NUM_RECTS ; i++) {
+        const vec2 p(tr.transform(points[i].x, points[i].y));
+        if (out[i] != transformCorners(tr, in[i]) ||
+                tpoints[i].x != p.x || tpoints[i].y != p.y) {
+            errors++;
+        }
+    }
+
+    Region expected;
+    if (tr.preserveRects()) {
+        Region::const_iterator it = region.begin();
+        Region::const_iterator const end = region.end();
+        nsecs_t start = systemTime();
+        while (it != end) {
+            expected.orSelf(transformCorners(tr, *it++));
+        }
+        nsecs_t scalar = systemTime() - start;
+        start = systemTime();
+        Region batched(tr.transform(region));
+        nsecs_t elapsed = systemTime() - start;
+        if (!batched.subtract(expected).isEmpty() ||
+                !expected.subtract(batched).isEmpty()) {
+            errors++;
+        }
+        printf("%-10s region of %zd rects: %8.1f us (%.1f us one by one)\n",
+                name, region.end() - region.begin(), elapsed / 1000.0,
+                scalar / 1000.0);
+    }
+    if (errors) {
+        printf("%-10s %d mismatches\n", name, errors);
+    }
+    return errors;
+}
+
 int main(int argc, char **argv)
 {
     Transform tr90(Transform::ROT_90);
@@ -41,5 +119,21 @@ int main(int argc, char **argv)
     (tr90*trFH).dump("tr90*trFH");
     (tr90*trFV).dump("tr90*trFV");
 
-    return 0;
+    Transform trT;
+    trT.set(10.5f, -3.25f);
+    Transform trS;
+    trS.set(1.5f, 0, 0, 0.75f);
+    Transform trR;
+    trR.set(0.6f, 0.8f, -0.8f, 0.6f);
+
+    int errors = 0;
+    errors += checkBatched("identity", Transform());
+    errors += checkBatched("translate", trT);
+    errors += checkBatched("scale", trS * trT);
+    errors += checkBatched("rot90", tr90 * trT);
+    errors += checkBatched("rot90FH", tr90FH);
+    errors += checkBatched("flipV", trFV * trT);
+    errors += checkBatched("rotate", trR);
+
+    return errors ? 1 : 0;
 }
@@ -0,0 +1,20 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	VisibleRegionsBenchmark.cpp \
+	../../Transform.cpp \
+	../../VisibleRegionCache.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils \
+	libui \
+
+LOCAL_MODULE:= test-visibleregions-benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../..
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays layer stacks through VisibleRegionCache, once recomputing every
+ * layer on each frame (what SurfaceFlinger::computeVisibleRegions does by
+ * default) and once incrementally, checks that both produce the same
+ * regions and reports the time spent per rebuildLayerStacks() call.
+ *
+ * usage: test-visibleregions-benchmark [trace-file]
+ *
+ * Without a trace file, a synthetic 40-layer stack where one application
+ * window moves every frame is used. A trace file lists the layers of each
+ * frame from the top-most to the bottom-most one:
+ *
+ *   frame
+ *   layer <seq> <stateSeq> <visible> <translucent> <opaque> <contentDirty> <l> <t> <r> <b>
+ *   ...
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include "../../VisibleRegionCache.h"
+
+using namespace android;
+
+typedef VisibleRegionCache::LayerInput LayerInput;
+typedef Vector<LayerInput> Frame;
+
+// ---------------------------------------------------------------------------
+
+static bool loadTrace(const char* path, Vector<Frame>& frames) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "frame", 5)) {
+            frames.add(Frame());
+            continue;
+        }
+        LayerInput layer;
+        int visible, translucent, opaque, contentDirty;
+        int l, t, r, b;
+        if (sscanf(line, "layer %d %d %d %d %d %d %d %d %d %d",
+                &layer.sequence, &layer.stateSequence,
+                &visible, &translucent, &opaque, &contentDirty,
+                &l, &t, &r, &b) != 10 || frames.isEmpty()) {
+            continue;
+        }
+        layer.visible = visible;
+        layer.translucent = translucent;
+        layer.opaque = opaque;
+        layer.contentDirty = contentDirty;
+        layer.bounds = Rect(l, t, r, b);
+        frames.editTop().add(layer);
+    }
+    fclose(f);
+    return true;
+}
+
+static void makeSyntheticTrace(Vector<Frame>& frames) {
+    const int w = 1080;
+    const int h = 1920;
+    const size_t numFrames = 600;
+
+    for (size_t n = 0; n < numFrames; n++) {
+        Frame frame;
+        int32_t seq = 1;
+
+        // status bar icons and notification shade, static
+        for (int i = 0; i < 24; i++, seq++) {
+            LayerInput layer;
+            layer.sequence = seq;
+            layer.visible = true;
+            layer.translucent = true;
+            layer.bounds = Rect(40 * i, 0, 40 * i + 32, 64);
+            frame.add(layer);
+        }
+        // navigation bar, static
+        LayerInput navBar;
+        navBar.sequence = seq++;
+        navBar.visible = true;
+        navBar.translucent = true;
+        navBar.bounds = Rect(0, h - 144, w, h);
+        frame.add(navBar);
+
+        // a dialog being dragged around
+        LayerInput dialog;
+        dialog.sequence = seq++;
+        dialog.stateSequence = n;
+        dialog.visible = true;
+        dialog.opaque = true;
+        dialog.bounds = Rect(100, 200 + (n % 600), 980, 800 + (n % 600));
+        frame.add(dialog);
+
+        // its dim layer
+        LayerInput dim;
+        dim.sequence = seq++;
+        dim.visible = true;
+        dim.translucent = true;
+        dim.bounds = Rect(w, h);
+        frame.add(dim);
+
+        // stacked application windows and surface views
+        for (int i = 0; i < 12; i++, seq++) {
+            LayerInput layer;
+            layer.sequence = seq;
+            layer.visible = (i % 4) != 3;
+            layer.opaque = (i % 2) == 0;
+            layer.translucent = !layer.opaque;
+            layer.contentDirty = (i == 5) && (n % 2);
+            layer.bounds = Rect(0, 64 + 20 * i, w, h - 144 - 20 * i);
+            frame.add(layer);
+        }
+
+        // wallpaper
+        LayerInput wallpaper;
+        wallpaper.sequence = seq++;
+        wallpaper.visible = true;
+        wallpaper.opaque = true;
+        wallpaper.bounds = Rect(w, h);
+        frame.add(wallpaper);
+
+        frames.add(frame);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+// The state SurfaceFlinger keeps in each Layer between two calls
+struct LayerRegions {
+    Region visibleRegion;
+    Region coveredRegion;
+};
+
+struct Pipeline {
+    Pipeline(bool incremental) : incremental(incremental), time(0) { }
+
+    void run(const Frame& layers) {
+        Frame inputs(layers);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            LayerInput& input(inputs.editItemAt(i));
+            const LayerRegions& regions(state.valueFor(input.sequence));
+            input.oldVisibleRegion = regions.visibleRegion;
+            input.oldCoveredRegion = regions.coveredRegion;
+        }
+
+        const nsecs_t start = systemTime();
+        if (!incremental) {
+            cache.invalidate();
+        }
+        cache.compute(inputs, dirtyRegion, opaqueRegion);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            LayerRegions regions;
+            regions.visibleRegion = cache.getOutput(i).visibleRegion;
+            regions.coveredRegion = cache.getOutput(i).coveredRegion;
+            state.add(inputs[i].sequence, regions);
+        }
+        time += systemTime() - start;
+    }
+
+    bool incremental;
+    nsecs_t time;
+    VisibleRegionCache cache;
+    DefaultKeyedVector<int32_t, LayerRegions> state;
+    Region dirtyRegion;
+    Region opaqueRegion;
+};
+
+static bool equals(const Region& a, const Region& b) {
+    return a.subtract(b).isEmpty() && b.subtract(a).isEmpty();
+}
+
+int main(int argc, char** argv)
+{
+    Vector<Frame> frames;
+    if (argc > 1) {
+        if (!loadTrace(argv[1], frames)) {
+            return 1;
+        }
+    } else {
+        makeSyntheticTrace(frames);
+    }
+    if (frames.isEmpty()) {
+        fprintf(stderr, "no frames to replay\n");
+        return 1;
+    }
+
+    Pipeline full(false);
+    Pipeline incremental(true);
+    size_t mismatches = 0;
+    for (size_t n = 0; n < frames.size(); n++) {
+        full.run(frames[n]);
+        incremental.run(frames[n]);
+        if (!equals(full.dirtyRegion, incremental.dirtyRegion) ||
+                !equals(full.opaqueRegion, incremental.opaqueRegion)) {
+            mismatches++;
+        }
+    }
+
+    const double fullUs = full.time / (1000.0 * frames.size());
+    const double incrementalUs = incremental.time / (1000.0 * frames.size());
+    printf("%zu frames, %zu layers in the first frame\n",
+            frames.size(), frames[0].size());
+    printf("full:        %8.2f us per rebuildLayerStacks\n", fullUs);
+    printf("incremental: %8.2f us per rebuildLayerStacks (%.2fx)\n",
+            incrementalUs, incrementalUs > 0 ? fullUs / incrementalUs : 0.0);
+    printf("mismatches:  %zu\n", mismatches);
+
+    String8 stats;
+    incremental.cache.dump(stats, "incremental");
+    printf("%s", stats.string());
+
+    return mismatches ? 1 : 0;
+}